@@ -24,6 +24,7 @@ build/obj/fp/parse.o: src/parse.asm build/gen/fp/basic.asm
 build/obj/int/parse.o: src/parse.asm build/gen/int/basic.asm
 
 $(FASTBASIC_HOST_OBJ) $(FASTBASIC_TARGET_OBJ): version.mk
+$(SYNTAX_CPP_HOST_OBJ) $(SYNTAX_CPP_TARGET_OBJ): src/compiler/parser.h src/compiler/parser-compiled.h
 
 # The compiler dependencies - auto-generated from c++ files
 FASTBASIC_HOST_DEPS=$(FASTBASIC_HOST_OBJ:.o=.d)
@@ -33,6 +33,8 @@ clean:
 	$(Q)rm -f $(XEXS) $(MAPS) $(LBLS)
 	$(Q)rm -f $(SYNTP) $(COMPILER_HOST)
 	$(Q)rm -f $(FASTBASIC_TARGET_OBJ) $(FASTBASIC_HOST_OBJ)
+	$(Q)rm -f $(SYNTAX_CPP_TARGET_OBJ) $(SYNTAX_CPP_HOST_OBJ)
+	$(Q)rm -f $(SYNTAX_CPP:%=build/gen/cpp/syntax-%.cc)
 	$(Q)rm -f $(SYNTAX_PARSER_OBJ) $(SYNTAX_PARSER_DEPS)
 	$(Q)rm -f $(FASTBASIC_HOST_DEPS) $(FASTBASIC_TARGET_DEPS)
 	$(Q)rm -f $(SAMPLE_BAS:%.bas=build/gen/%.asm)
@@ -102,7 +104,25 @@ build/obj/cxx/%.o: src/compiler/%.cc | build/obj/cxx
 	$(ECHO) "Compile $<"
 	$(Q)$(CXX) $(HOST_CXXFLAGS) $(FB_CXX) -c -o $@ $<
 
-$(FASTBASIC_HOST): $(FASTBASIC_HOST_OBJ) | build/bin
+# Host compiler build - generated parsers
+build/obj/cxx/syntax-%.o: build/gen/cpp/syntax-%.cc | build/obj/cxx
+	$(ECHO) "Compile $<"
+	$(Q)$(CXX) $(HOST_CXXFLAGS) $(FB_CXX) -c -o $@ $<
+
+# Host compiler build - CA65 and LD65 linked into the compiler
+build/obj/cc65/ca65/%.o: cc65/ca65/%.c | build/obj/cc65/ca65
+	$(ECHO) "Compile $<"
+	$(Q)$(CC) $(HOST_CFLAGS) $(CC65_CFLAGS) $(CA65_LIB_CFLAGS) -c -o $@ $<
+
+build/obj/cc65/ld65/%.o: cc65/ld65/%.c | build/obj/cc65/ld65
+	$(ECHO) "Compile $<"
+	$(Q)$(CC) $(HOST_CFLAGS) $(CC65_CFLAGS) $(LD65_LIB_CFLAGS) -c -o $@ $<
+
+build/obj/cc65/common/%.o: cc65/common/%.c | build/obj/cc65/common
+	$(ECHO) "Compile $<"
+	$(Q)$(CC) $(HOST_CFLAGS) $(CC65_CFLAGS) -c -o $@ $<
+
+$(FASTBASIC_HOST): $(FASTBASIC_HOST_OBJ) $(SYNTAX_CPP_HOST_OBJ) | build/bin
 	$(ECHO) "Linking host compiler"
 	$(Q)$(CXX) $(HOST_CXXFLAGS) $(FB_CXX) -o $@ $^
 
@@ -141,7 +161,23 @@ build/obj/cxx-tgt/%.o: src/compiler/%.cc | build/obj/cxx-tgt
 	$(ECHO) "Compile target $<"
 	$(Q)$(CROSS)$(CXX) $(TARGET_CXXFLAGS) $(FB_CXX) -c -o $@ $<
 
-$(FASTBASIC_TARGET): $(FASTBASIC_TARGET_OBJ) | build/compiler
+build/obj/cxx-tgt/syntax-%.o: build/gen/cpp/syntax-%.cc | build/obj/cxx-tgt
+	$(ECHO) "Compile target $<"
+	$(Q)$(CROSS)$(CXX) $(TARGET_CXXFLAGS) $(FB_CXX) -c -o $@ $<
+
+build/obj/tgt/cc65/ca65/%.o: cc65/ca65/%.c | build/obj/tgt/cc65/ca65
+	$(ECHO) "Compile target $<"
+	$(Q)$(CROSS)$(CC) $(TARGET_CFLAGS) $(CC65_CFLAGS) $(CA65_LIB_CFLAGS) -c -o $@ $<
+
+build/obj/tgt/cc65/ld65/%.o: cc65/ld65/%.c | build/obj/tgt/cc65/ld65
+	$(ECHO) "Compile target $<"
+	$(Q)$(CROSS)$(CC) $(TARGET_CFLAGS) $(CC65_CFLAGS) $(LD65_LIB_CFLAGS) -c -o $@ $<
+
+build/obj/tgt/cc65/common/%.o: cc65/common/%.c | build/obj/tgt/cc65/common
+	$(ECHO) "Compile target $<"
+	$(Q)$(CROSS)$(CC) $(TARGET_CFLAGS) $(CC65_CFLAGS) -c -o $@ $<
+
+$(FASTBASIC_TARGET): $(FASTBASIC_TARGET_OBJ) $(SYNTAX_CPP_TARGET_OBJ) | build/compiler
 	$(ECHO) "Linking target compiler"
 	$(Q)$(CROSS)$(CXX) $(TARGET_CXXFLAGS) $(FB_CXX) -o $@ $^
 
@@ -184,6 +220,19 @@ build/gen/int/basic.asm: $(SYNTAX_INT) $(SYNTP) | build/gen/int
 	$(ECHO) "Creating INT parsing bytecode"
 	$(Q)$(SYNTP) $(SYNTAX_INT) -o $@
 
+# Generator for syntax file - C++ version for the compiler
+build/gen/cpp/syntax-fp.cc: $(SYNTAX_CPP_FP) $(SYNTP) | build/gen/cpp
+	$(ECHO) "Creating FP C++ parser"
+	$(Q)$(SYNTP) -c atari-fp $(SYNTAX_CPP_FP) -o $@
+
+build/gen/cpp/syntax-int.cc: $(SYNTAX_CPP_INT) $(SYNTP) | build/gen/cpp
+	$(ECHO) "Creating INT C++ parser"
+	$(Q)$(SYNTP) -c atari-int $(SYNTAX_CPP_INT) -o $@
+
+build/gen/cpp/syntax-a5200.cc: $(SYNTAX_CPP_A5200) $(SYNTP) | build/gen/cpp
+	$(ECHO) "Creating A5200 C++ parser"
+	$(Q)$(SYNTP) -c a5200 $(SYNTAX_CPP_A5200) -o $@
+
 # Sets the version inside command line compiler source
 build/gen/cmdline-vers.bas: src/cmdline.bas version.mk
 	$(Q)$(SED) 's/%VERSION%/$(VERSION)/' < $< > $@
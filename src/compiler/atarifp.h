@@ -79,6 +79,7 @@ class atari_fp
     atari_fp() : num(0.0) {}
     atari_fp(double x) : num(x) {}
     bool valid() const { return num >= -1E98 && num <= 1E98; }
+    double value() const { return num; }
     std::string to_asm()
     {
         update();
@@ -86,4 +87,9 @@ class atari_fp
                hex(mant[2]) + ", " + hex(mant[3]) + ", " + hex(mant[4]);
     }
     std::string to_string();
+    std::string to_bytes()
+    {
+        update();
+        return std::string(1, char(exp)) + std::string((const char *)mant, 5);
+    }
 };
@@ -0,0 +1,313 @@
+/*
+ * FastBasic - Fast basic interpreter for the Atari 8-bit computers
+ * Copyright (C) 2017-2025 Daniel Serpell
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+// cache.cc: Cache of the compiled and assembled files
+
+#include "cache.h"
+#include "os.h"
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <iomanip>
+#include <random>
+#include <set>
+#include <sstream>
+
+static const char *cache_magic = "FastBasic cache 1";
+static const char *stats_name = "stats";
+static const char *entry_ext = ".fbc";
+
+// Returns true if the file name is of a cache entry
+static bool is_entry(const std::string &name)
+{
+    auto l = std::string(entry_ext).size();
+    return name.size() > l && name.substr(name.size() - l) == entry_ext;
+}
+
+static bool read_file(const std::string &fname, std::string &data)
+{
+    std::ifstream f(fname, std::ios::binary);
+    if(!f.is_open())
+        return false;
+    std::ostringstream s;
+    s << f.rdbuf();
+    data = s.str();
+    return true;
+}
+
+// Writes a file to a temporary name and then renames it, so concurrent
+// compilations never read a partial file.
+static bool write_file(const std::string &fname, const std::string &data)
+{
+    auto tmp_name = fname + "." + std::to_string(std::random_device()());
+    std::ofstream f(tmp_name, std::ios::binary);
+    if(!f.is_open())
+        return false;
+    f << data;
+    f.close();
+    if(!f || !os::rename_file(tmp_name, fname))
+    {
+        os::remove_file(tmp_name);
+        return false;
+    }
+    return true;
+}
+
+bool cache_key::add_file(const std::string &fname)
+{
+    std::string data;
+    if(!read_file(fname, data))
+        return false;
+    add(data);
+    return true;
+}
+
+// Returns the file name in an assembler include directive, or an empty
+// string if the line has none. Sets "bad" if the name can't be read.
+static std::string asm_include(const std::string &line, bool &bad)
+{
+    std::string l;
+    for(unsigned char c : line.substr(0, line.find(';')))
+        l += std::tolower(c);
+    for(auto dir : {".include", ".incbin"})
+    {
+        auto p = l.find(dir);
+        if(p == l.npos)
+            continue;
+        p += std::string(dir).size();
+        if(p < l.size() && (std::isalnum((unsigned char)l[p]) || l[p] == '_'))
+            continue;
+        auto q1 = line.find('"', p);
+        auto q2 = q1 == line.npos ? q1 : line.find('"', q1 + 1);
+        if(q2 == line.npos)
+            bad = true;
+        else
+            return line.substr(q1 + 1, q2 - q1 - 1);
+    }
+    return std::string();
+}
+
+static bool add_asm(cache_key &k, const std::string &fname,
+                    const std::vector<std::string> &inc_dirs, std::set<std::string> &seen,
+                    int depth)
+{
+    k.add(fname);
+    if(!seen.insert(fname).second)
+        return true;
+    std::string data;
+    if(depth > 16 || !read_file(fname, data))
+        return false;
+    k.add(data);
+
+    std::istringstream is(data);
+    std::string line;
+    while(std::getline(is, line))
+    {
+        bool bad = false;
+        auto name = asm_include(line, bad);
+        if(bad)
+            return false;
+        if(name.empty())
+            continue;
+        // Add all the possible locations of the file, so the key changes if
+        // any of them changes.
+        std::vector<std::string> paths{name};
+        if(!os::path_absolute(name))
+        {
+            paths.push_back(os::full_path(os::dir_name(fname), name));
+            for(auto &d : inc_dirs)
+                paths.push_back(os::full_path(d, name));
+        }
+        bool found = false;
+        for(auto &p : paths)
+        {
+            if(!std::ifstream(p).is_open())
+                continue;
+            found = true;
+            if(!add_asm(k, p, inc_dirs, seen, depth + 1))
+                return false;
+        }
+        if(!found)
+            return false;
+    }
+    return true;
+}
+
+bool cache_key::add_asm_file(const std::string &fname, const std::vector<std::string> &inc_dirs)
+{
+    std::set<std::string> seen;
+    return add_asm(*this, fname, inc_dirs, seen, 0);
+}
+
+std::string cache_key::str() const
+{
+    std::ostringstream s;
+    s << std::hex << std::setw(16) << std::setfill('0') << hash.get();
+    return s.str();
+}
+
+build_cache::build_cache(unsigned long long max_size) : max_size(max_size)
+{
+    if(max_size)
+        path = os::cache_dir("build");
+}
+
+std::string build_cache::entry_name(const std::string &key) const
+{
+    return os::full_path(path, key + entry_ext);
+}
+
+bool build_cache::get(const std::string &key, entry &e,
+                      const std::function<bool(const entry &)> &valid)
+{
+    if(!enabled())
+        return false;
+    auto fname = entry_name(key);
+    std::ifstream f(fname, std::ios::binary);
+    std::string magic, line;
+    size_t ndeps = 0, size = 0;
+    bool ok = f.is_open() && std::getline(f, magic) && magic == cache_magic &&
+              std::getline(f, e.kind) && (f >> ndeps).ignore();
+    e.deps.clear();
+    for(size_t i = 0; ok && i < ndeps; i++)
+    {
+        std::string dkey, dname;
+        ok = (f >> dkey).ignore() && std::getline(f, dname);
+        e.deps.emplace_back(dname, dkey);
+    }
+    for(auto d : {&e.data, &e.output})
+    {
+        ok = ok && (f >> size).ignore();
+        if(ok && size)
+        {
+            d->resize(size);
+            ok = bool(f.read(&(*d)[0], size));
+        }
+        else if(ok)
+            d->clear();
+    }
+    ok = ok && (!valid || valid(e));
+
+    std::lock_guard<std::mutex> guard(lock);
+    if(!ok)
+    {
+        current.misses++;
+        return false;
+    }
+    current.hits++;
+    os::touch_file(fname);
+    return true;
+}
+
+void build_cache::put(const std::string &key, const entry &e)
+{
+    if(!enabled())
+        return;
+    std::ostringstream s;
+    s << cache_magic << "\n" << e.kind << "\n" << e.deps.size() << "\n";
+    for(auto &d : e.deps)
+        s << d.second << " " << d.first << "\n";
+    s << e.data.size() << "\n" << e.data << e.output.size() << "\n" << e.output;
+    auto data = s.str();
+    if(!write_file(entry_name(key), data))
+        return;
+    std::lock_guard<std::mutex> guard(lock);
+    current.size += data.size();
+}
+
+// Reads the statistics file
+static build_cache::stats read_stats(const std::string &fname)
+{
+    build_cache::stats st;
+    std::ifstream f(fname);
+    std::string name;
+    unsigned long long val;
+    while(f >> name >> val)
+    {
+        if(name == "hits")
+            st.hits = val;
+        else if(name == "misses")
+            st.misses = val;
+        else if(name == "size")
+            st.size = val;
+    }
+    return st;
+}
+
+build_cache::~build_cache()
+{
+    if(!enabled() || (!current.hits && !current.misses && !current.size))
+        return;
+
+    auto stats_file = os::full_path(path, stats_name);
+    auto st = read_stats(stats_file);
+    st.hits += current.hits;
+    st.misses += current.misses;
+    st.size += current.size;
+
+    // Over the maximum size, remove the least recently used entries until
+    // the size is 3/4 of the maximum, and get the real size of the rest.
+    if(st.size > max_size)
+    {
+        auto files = os::list_dir(path);
+        std::sort(files.begin(), files.end(), [](const os::file_info &a, const os::file_info &b) {
+            return a.mtime > b.mtime;
+        });
+        st.size = 0;
+        bool full = false;
+        for(auto &f : files)
+        {
+            if(!is_entry(f.name))
+                continue;
+            full = full || st.size + f.size > max_size / 4 * 3;
+            if(full)
+                os::remove_file(os::full_path(path, f.name));
+            else
+                st.size += f.size;
+        }
+    }
+
+    std::ostringstream s;
+    s << "hits " << st.hits << "\nmisses " << st.misses << "\nsize " << st.size << "\n";
+    write_file(stats_file, s.str());
+}
+
+build_cache::stats build_cache::total() const
+{
+    stats st;
+    if(!enabled())
+        return st;
+    st = read_stats(os::full_path(path, stats_name));
+    st.hits += current.hits;
+    st.misses += current.misses;
+    st.size = 0;
+    for(auto &f : os::list_dir(path))
+        if(is_entry(f.name))
+            st.size += f.size;
+    return st;
+}
+
+void build_cache::clear()
+{
+    if(!enabled())
+        return;
+    for(auto &f : os::list_dir(path))
+        if(f.name == stats_name || is_entry(f.name))
+            os::remove_file(os::full_path(path, f.name));
+    current = stats();
+}
@@ -0,0 +1,99 @@
+/*
+ * FastBasic - Fast basic interpreter for the Atari 8-bit computers
+ * Copyright (C) 2017-2025 Daniel Serpell
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+// cache.h: Cache of the compiled and assembled files
+#pragma once
+
+#include "parser-compiled.h"
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Key of one entry in the build cache, a hash of all the inputs
+class cache_key
+{
+  private:
+    syntax::syntax_hash hash;
+
+  public:
+    void add(const std::string &data) { hash.add(data); }
+    // Adds the contents of the file, returns false if can't be read
+    bool add_file(const std::string &fname);
+    // Adds an assembly source and all the files included from it, searching
+    // in the folder of the file, the current folder and in "inc_dirs".
+    // Returns false if an included file is not found or the name is not a
+    // constant string, as then the assembler output can't be predicted.
+    bool add_asm_file(const std::string &fname, const std::vector<std::string> &inc_dirs);
+    // Returns the key as an hexadecimal string
+    std::string str() const;
+};
+
+// A cache of the files produced by the compiler and the assembler, stored in
+// the user cache folder and limited in size, removing the least recently
+// used files first.
+class build_cache
+{
+  public:
+    // One entry in the cache
+    class entry
+    {
+      public:
+        std::string kind; // Type of the stored file
+        std::vector<std::pair<std::string, std::string>> deps; // Included files and keys
+        std::string data;                                      // File contents
+        std::string output; // Messages shown when producing the file
+    };
+    // Statistics of the cache use
+    class stats
+    {
+      public:
+        unsigned long hits = 0;
+        unsigned long misses = 0;
+        unsigned long long size = 0; // Size in bytes of the stored entries
+    };
+
+  private:
+    std::string path;
+    unsigned long long max_size;
+    stats current; // Statistics of this run
+    std::mutex lock;
+    std::string entry_name(const std::string &key) const;
+
+  public:
+    // Opens the cache in the "build" folder of the user cache with the given
+    // maximum size in bytes. The cache is disabled if the folder is not
+    // available or the size is 0.
+    build_cache(unsigned long long max_size);
+    // Writes the statistics and limits the size of the cache
+    ~build_cache();
+    bool enabled() const { return !path.empty(); }
+    const std::string &folder() const { return path; }
+    unsigned long long size_limit() const { return max_size; }
+    // Gets the entry with the given key, returns false if not found or if
+    // "valid" returns false for the entry.
+    bool get(const std::string &key, entry &e,
+             const std::function<bool(const entry &)> &valid = nullptr);
+    // Stores the entry with the given key
+    void put(const std::string &key, const entry &e);
+    // Returns the statistics of all the runs, including the current one, with
+    // the real size of the files
+    stats total() const;
+    // Removes all entries and statistics
+    void clear();
+};
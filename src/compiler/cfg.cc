@@ -0,0 +1,519 @@
+/*
+ * FastBasic - Fast basic interpreter for the Atari 8-bit computers
+ * Copyright (C) 2017-2025 Daniel Serpell
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+// cfg.cc: Control flow graph and data flow analysis of the bytecode
+
+#include "cfg.h"
+#include "parser.h"
+#include "tokinfo.h"
+#include "vartype.h"
+#include <algorithm>
+#include <deque>
+#include <iostream>
+#include <unordered_map>
+
+static const size_t npos = size_t(-1);
+
+static void add_edge(std::vector<cfg::block> &blocks, size_t from, size_t to)
+{
+    auto &s = blocks[from].succ;
+    if(std::find(s.begin(), s.end(), to) != s.end())
+        return;
+    s.push_back(to);
+    blocks[to].pred.push_back(from);
+}
+
+// Returns the label in the arguments of the instruction at "pos", or an
+// empty string
+static std::string arg_label(const std::vector<codew> &code, size_t pos)
+{
+    if(pos + 1 < code.size() && code[pos + 1].is_sword())
+        return code[pos + 1].get_str();
+    return std::string();
+}
+
+cfg::cfg(const std::vector<codew> &code) : code(code), block_of(code.size(), npos)
+{
+    auto n = code.size();
+    std::string prefix = parse::label_prefix;
+
+    // Get all variables and the ones with the address taken
+    for(auto &c : code)
+    {
+        if(c.is_varn())
+        {
+            size_t v = c.get_varn();
+            if(v >= num_vars)
+            {
+                num_vars = v + 1;
+                var_names.resize(num_vars);
+            }
+            var_names[v] = c.get_varname();
+        }
+    }
+    aliased = bitvec(num_vars);
+    external = bitvec(num_vars);
+    for(size_t v = 0; v < num_vars; v++)
+        if(!var_names[v].empty() && !is_temp_var(var_names[v]))
+            external.set(v);
+
+    // Split the code into procedures and basic blocks. The last instruction
+    // of each block is stored to build the edges.
+    std::vector<size_t> last_ins;
+    bool open = false; // There is a block accepting instructions
+    auto close_block = [&](size_t pos) {
+        if(open)
+            blocks.back().last = pos;
+        open = false;
+    };
+    auto open_block = [&](size_t pos) {
+        blocks.push_back(block{pos, pos, procs.size() - 1, {}, {}});
+        last_ins.push_back(npos);
+        open = true;
+    };
+    auto close_proc = [&](size_t pos) {
+        close_block(pos);
+        procs.back().end = pos;
+        procs.back().last = blocks.size();
+    };
+    procs.push_back(proc{"", 0, 0, 0, 0});
+    for(size_t pos = 0; pos < n;)
+    {
+        auto &c = code[pos];
+        if(c.is_label())
+        {
+            auto &name = c.get_str();
+            if(name.compare(0, prefix.size(), prefix) == 0)
+            {
+                // Start of a new procedure or DATA array
+                close_proc(pos);
+                procs.push_back(proc{name, pos, pos, blocks.size(), blocks.size()});
+                if(pos + 1 < n && !code[pos + 1].is_tok() && !code[pos + 1].is_label())
+                {
+                    // A DATA array, skip up to the next label
+                    procs.back().is_data = true;
+                    for(pos++; pos < n && !code[pos].is_label(); pos++)
+                        ;
+                    procs.back().end = pos;
+                    continue;
+                }
+            }
+            // A label starts a block, unless the block is still empty
+            if(open && last_ins.back() != npos)
+                close_block(pos);
+            if(!open)
+                open_block(pos);
+            block_of[pos] = blocks.size() - 1;
+            pos++;
+            continue;
+        }
+        if(!open)
+            open_block(pos);
+        auto nxt = next(pos);
+        for(auto p = pos; p < nxt; p++)
+            block_of[p] = blocks.size() - 1;
+        if(c.is_tok())
+        {
+            last_ins.back() = pos;
+            if(tokinfo::get(c.get_tok_id()).flow != tokinfo::f_none)
+                close_block(nxt);
+        }
+        pos = nxt;
+    }
+    close_proc(n);
+
+    // Get the block of each label and the procedure of each proc label
+    std::unordered_map<std::string, size_t> label_block, label_proc;
+    for(size_t i = 0; i < procs.size(); i++)
+        if(!procs[i].is_data && procs[i].first != procs[i].last)
+            label_proc[procs[i].name] = i;
+    for(size_t pos = 0; pos < n; pos++)
+        if(code[pos].is_label() && block_of[pos] != npos)
+            label_block[code[pos].get_str()] = block_of[pos];
+
+    // Build the edges, the returns are added after knowing all the calls
+    unknown_call.resize(blocks.size());
+    std::vector<size_t> rets;
+    for(size_t b = 0; b < blocks.size(); b++)
+    {
+        auto ins = last_ins[b];
+        auto flow = ins == npos ? tokinfo::f_none : tokinfo::get(code[ins].get_tok_id()).flow;
+        bool fall = flow == tokinfo::f_none || flow == tokinfo::f_cjump ||
+                    flow == tokinfo::f_cret;
+        if(flow == tokinfo::f_jump || flow == tokinfo::f_cjump)
+        {
+            auto it = label_block.find(arg_label(code, ins));
+            if(it != label_block.end())
+                add_edge(blocks, b, it->second);
+        }
+        else if(flow == tokinfo::f_call)
+        {
+            auto it = label_proc.find(arg_label(code, ins));
+            if(it != label_proc.end())
+            {
+                add_edge(blocks, b, procs[it->second].first);
+                procs[it->second].calls.push_back(b);
+            }
+            else
+            {
+                unknown_call[b] = 1;
+                fall = true;
+            }
+        }
+        else if(flow == tokinfo::f_ret || flow == tokinfo::f_cret)
+            rets.push_back(b);
+        if(fall && b + 1 < blocks.size() && blocks[b + 1].first == blocks[b].last)
+            add_edge(blocks, b, b + 1);
+    }
+
+    // Add the edges from the returns to the code after the calls. The calls
+    // that can be active at each block are propagated from the calls to the
+    // procedure entries, along the edges, and from the returns to the code
+    // after the calls. This also handles procedures that continue into other
+    // one, falling through the end or with a jump in a tail call.
+    std::vector<size_t> calls;
+    std::vector<int> call_num(blocks.size(), -1);
+    for(auto &p : procs)
+    {
+        for(auto c : p.calls)
+        {
+            call_num[c] = calls.size();
+            calls.push_back(c);
+        }
+    }
+    std::vector<uint8_t> is_ret(blocks.size());
+    for(auto b : rets)
+        is_ret[b] = 1;
+    std::vector<std::vector<size_t>> flow_succ(blocks.size());
+    for(size_t b = 0; b < blocks.size(); b++)
+        flow_succ[b] = blocks[b].succ;
+    std::vector<bitvec> active(blocks.size(), bitvec(calls.size()));
+    auto add_active = [&](size_t b, const bitvec &a) {
+        auto x = active[b];
+        x |= a;
+        if(x == active[b])
+            return false;
+        active[b] = x;
+        return true;
+    };
+    for(bool changed = true; changed;)
+    {
+        changed = false;
+        for(size_t b = 0; b < blocks.size(); b++)
+        {
+            if(call_num[b] >= 0)
+            {
+                bitvec a(calls.size());
+                a.set(call_num[b]);
+                for(auto s : flow_succ[b])
+                    changed = add_active(s, a) || changed;
+                continue;
+            }
+            if(is_ret[b])
+            {
+                for(size_t c = 0; c < calls.size(); c++)
+                {
+                    auto ret = blocks[calls[c]].last;
+                    if(!active[b].test(c) || ret >= n || block_of[ret] == npos)
+                        continue;
+                    add_edge(blocks, b, block_of[ret]);
+                    changed = add_active(block_of[ret], active[calls[c]]) || changed;
+                }
+            }
+            for(auto s : flow_succ[b])
+                changed = add_active(s, active[b]) || changed;
+        }
+    }
+
+    // Mark the loop heads, the targets of the jumps back
+    for(size_t b = 0; b < blocks.size(); b++)
+        for(auto s : blocks[b].succ)
+            if(blocks[s].first <= blocks[b].first && blocks[s].proc == blocks[b].proc)
+                blocks[s].loop_head = true;
+
+    // Mark variables with the address taken
+    for(size_t pos = 0; pos < n; pos++)
+    {
+        if(code[pos].is_tok())
+        {
+            auto e = get_effect(pos);
+            if(e.var >= 0 && e.access == tokinfo::v_addr)
+                aliased.set(e.var);
+        }
+    }
+}
+
+size_t cfg::next(size_t pos) const
+{
+    for(pos++; pos < code.size() && !code[pos].is_tok() && !code[pos].is_label(); pos++)
+        ;
+    return pos;
+}
+
+cfg::effect cfg::get_effect(size_t pos) const
+{
+    effect e;
+    if(!code[pos].is_tok())
+        return e;
+    auto &info = tokinfo::get(code[pos].get_tok_id());
+    e.mem_read = info.mem_read;
+    e.mem_write = info.mem_write;
+    e.clobber = info.clobber;
+    if(info.flow == tokinfo::f_call)
+        e.clobber = unknown_call[block_of[pos]];
+    for(auto p = pos + 1; p < code.size() && p < next(pos); p++)
+    {
+        if(code[p].is_varn())
+        {
+            e.var = code[p].get_varn();
+            e.access = info.var;
+        }
+    }
+    return e;
+}
+
+size_t cfg::block_at(size_t pos) const { return block_of[pos]; }
+
+std::vector<size_t> cfg::instructions(size_t b) const
+{
+    std::vector<size_t> ret;
+    for(auto p = blocks[b].first; p < blocks[b].last;)
+    {
+        if(code[p].is_tok())
+        {
+            ret.push_back(p);
+            p = next(p);
+        }
+        else
+            p++;
+    }
+    return ret;
+}
+
+liveness::liveness(const cfg &g) : g(g)
+{
+    auto nb = g.blocks.size();
+    in.assign(nb, bitvec(g.num_vars));
+    out.assign(nb, bitvec(g.num_vars));
+
+    // Variables read before written (use) and written (def) in each block
+    std::vector<bitvec> use(nb, bitvec(g.num_vars)), def(nb, bitvec(g.num_vars));
+    for(size_t b = 0; b < nb; b++)
+    {
+        auto ins = g.instructions(b);
+        for(auto it = ins.rbegin(); it != ins.rend(); ++it)
+        {
+            auto e = g.get_effect(*it);
+            if(e.var >= 0 && (e.access == tokinfo::v_write || e.access == tokinfo::v_modify))
+            {
+                def[b].set(e.var);
+                use[b].reset(e.var);
+            }
+            step(*it, use[b]);
+        }
+    }
+
+    // Iterate up to the fixed point
+    std::deque<size_t> work;
+    std::vector<uint8_t> queued(nb, 1);
+    for(size_t b = nb; b > 0; b--)
+        work.push_back(b - 1);
+    while(!work.empty())
+    {
+        auto b = work.front();
+        work.pop_front();
+        queued[b] = 0;
+        // The external variables are live at the end of the program
+        bitvec o(g.num_vars);
+        if(g.blocks[b].succ.empty())
+            o = g.external;
+        for(auto s : g.blocks[b].succ)
+            o |= in[s];
+        out[b] = o;
+        o -= def[b];
+        o |= use[b];
+        if(g.blocks[b].loop_head)
+            o |= g.external;
+        if(o != in[b])
+        {
+            in[b] = o;
+            for(auto p : g.blocks[b].pred)
+            {
+                if(!queued[p])
+                {
+                    queued[p] = 1;
+                    work.push_back(p);
+                }
+            }
+        }
+    }
+}
+
+void liveness::step(size_t pos, bitvec &live) const
+{
+    auto e = g.get_effect(pos);
+    if(e.clobber)
+    {
+        live.set_all(g.num_vars);
+        return;
+    }
+    if(e.var >= 0)
+    {
+        if(e.access == tokinfo::v_write)
+            live.reset(e.var);
+        else if(e.access == tokinfo::v_read || e.access == tokinfo::v_modify)
+            live.set(e.var);
+    }
+    if(e.mem_read)
+        live |= g.aliased;
+}
+
+bitvec liveness::after(size_t pos) const
+{
+    auto b = g.block_at(pos);
+    auto live = out[b];
+    auto ins = g.instructions(b);
+    for(auto it = ins.rbegin(); it != ins.rend() && *it > pos; ++it)
+        step(*it, live);
+    return live;
+}
+
+const int reaching_consts::varying;
+const int reaching_consts::undefined;
+
+// Joins the value "b" into "a"
+static void join_value(int &a, int b)
+{
+    if(a == reaching_consts::undefined)
+        a = b;
+    else if(a != b && b != reaching_consts::undefined)
+        a = reaching_consts::varying;
+}
+
+reaching_consts::reaching_consts(const cfg &g, const std::vector<int> &stored)
+    : g(g), stored(stored)
+{
+    auto nb = g.blocks.size();
+    in.assign(nb, std::vector<int>(g.num_vars, undefined));
+    out.assign(nb, std::vector<int>(g.num_vars, undefined));
+
+    // Iterate up to the fixed point, each value can only change twice
+    std::deque<size_t> work;
+    std::vector<uint8_t> queued(nb, 1);
+    for(size_t b = 0; b < nb; b++)
+        work.push_back(b);
+    while(!work.empty())
+    {
+        auto b = work.front();
+        work.pop_front();
+        queued[b] = 0;
+        // The blocks without predecessors start with unknown values, and
+        // the external variables can have any value at the loop heads
+        auto &i = in[b];
+        for(size_t v = 0; v < g.num_vars; v++)
+        {
+            int x = g.blocks[b].pred.empty() ? varying : undefined;
+            if(g.blocks[b].loop_head && g.external.test(v))
+                x = varying;
+            for(auto p : g.blocks[b].pred)
+                join_value(x, out[p][v]);
+            i[v] = x;
+        }
+        auto o = i;
+        for(auto pos : g.instructions(b))
+            step(pos, o);
+        if(o != out[b])
+        {
+            out[b].swap(o);
+            for(auto s : g.blocks[b].succ)
+            {
+                if(!queued[s])
+                {
+                    queued[s] = 1;
+                    work.push_back(s);
+                }
+            }
+        }
+    }
+}
+
+void reaching_consts::step(size_t pos, std::vector<int> &vals) const
+{
+    auto e = g.get_effect(pos);
+    if(e.clobber)
+    {
+        vals.assign(g.num_vars, varying);
+        return;
+    }
+    if(e.mem_write)
+    {
+        for(size_t v = 0; v < g.num_vars; v++)
+            if(g.aliased.test(v))
+                vals[v] = varying;
+    }
+    if(e.var >= 0 && (e.access == tokinfo::v_write || e.access == tokinfo::v_modify))
+        vals[e.var] = stored[pos] >= 0 ? stored[pos] : varying;
+}
+
+std::vector<int> reaching_consts::before(size_t pos) const
+{
+    auto b = g.block_at(pos);
+    auto vals = in[b];
+    for(auto p : g.instructions(b))
+    {
+        if(p >= pos)
+            break;
+        step(p, vals);
+    }
+    return vals;
+}
+
+void print_cfg(const std::vector<codew> &code, std::ostream &os)
+{
+    cfg g(code);
+    liveness live(g);
+    auto var_list = [&](const bitvec &vars) {
+        std::string ret;
+        for(size_t v = 0; v < g.num_vars; v++)
+            if(vars.test(v))
+                ret += " " + g.var_names[v];
+        return ret;
+    };
+    os << "variables with address taken:" << var_list(g.aliased) << "\n";
+    for(auto &p : g.procs)
+    {
+        if(p.is_data)
+        {
+            os << "DATA " << p.name << "\n";
+            continue;
+        }
+        os << (p.name.empty() ? std::string("MAIN") : "PROC " + p.name) << "\n";
+        for(auto b = p.first; b < p.last; b++)
+        {
+            auto &blk = g.blocks[b];
+            os << "  B" << b << ": line " << code[blk.first].linenum() << ", "
+               << g.instructions(b).size() << " instructions, pred:";
+            for(auto x : blk.pred)
+                os << " B" << x;
+            os << ", succ:";
+            for(auto x : blk.succ)
+                os << " B" << x;
+            os << "\n    live in:" << var_list(live.in[b]) << "\n";
+        }
+    }
+}
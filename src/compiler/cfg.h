@@ -0,0 +1,193 @@
+/*
+ * FastBasic - Fast basic interpreter for the Atari 8-bit computers
+ * Copyright (C) 2017-2025 Daniel Serpell
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+// cfg.h: Control flow graph and data flow analysis of the bytecode
+
+#pragma once
+
+#include "codew.h"
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+// A set of small integers, used in the data flow equations
+class bitvec
+{
+  private:
+    std::vector<uint64_t> w;
+
+  public:
+    bitvec() {}
+    explicit bitvec(size_t n) : w((n + 63) / 64) {}
+    bool test(size_t i) const { return (w[i >> 6] >> (i & 63)) & 1; }
+    void set(size_t i) { w[i >> 6] |= uint64_t(1) << (i & 63); }
+    void reset(size_t i) { w[i >> 6] &= ~(uint64_t(1) << (i & 63)); }
+    // Sets all the elements from 0 to n-1
+    void set_all(size_t n)
+    {
+        for(size_t i = 0; i < n; i++)
+            set(i);
+    }
+    bool any() const
+    {
+        for(auto x : w)
+            if(x)
+                return true;
+        return false;
+    }
+    bitvec &operator|=(const bitvec &b)
+    {
+        for(size_t i = 0; i < w.size(); i++)
+            w[i] |= b.w[i];
+        return *this;
+    }
+    // Keeps only the elements also in b
+    bitvec &operator&=(const bitvec &b)
+    {
+        for(size_t i = 0; i < w.size(); i++)
+            w[i] &= b.w[i];
+        return *this;
+    }
+    // Removes all the elements of b
+    bitvec &operator-=(const bitvec &b)
+    {
+        for(size_t i = 0; i < w.size(); i++)
+            w[i] &= ~b.w[i];
+        return *this;
+    }
+    bool operator==(const bitvec &b) const { return w == b.w; }
+    bool operator!=(const bitvec &b) const { return w != b.w; }
+};
+
+// The control flow graph of the full program. Calls to procedures are
+// edges to the procedure entry and returns are edges to all the places
+// the procedure is called from, so the data flow analysis works across
+// procedures.
+//
+// The program variables are exported to the assembly modules, so code in
+// interrupts (DLI or VBI) can read or write them at any time. The analysis
+// assumes that this happens at the start of each loop and at the end of
+// the program: the external variables are live there, and can have any
+// value at the start of the loops.
+class cfg
+{
+  public:
+    // A basic block: a range of the code only entered at the start and
+    // exited at the end.
+    class block
+    {
+      public:
+        size_t first, last;            // Code positions, "last" is one past the end
+        size_t proc;                   // Procedure containing the block
+        std::vector<size_t> succ, pred; // Successor and predecessor blocks
+        bool loop_head = false;        // Entered by a jump back in the procedure
+    };
+    // A procedure, the main program or a DATA array
+    class proc
+    {
+      public:
+        std::string name;          // Label name, empty for the main program
+        size_t start, end;         // Code positions
+        size_t first, last;        // Blocks of the procedure, "last" is one past
+        bool is_data = false;      // A DATA array, without blocks
+        std::vector<size_t> calls; // Blocks that end in a CALL to this procedure
+    };
+    // Effect of one instruction on the variables
+    class effect
+    {
+      public:
+        int var = -1;           // Variable in the arguments, or -1
+        int access = 0;         // tokinfo::var_access of the variable
+        bool mem_read = false;  // Can read variables with the address taken
+        bool mem_write = false; // Can write variables with the address taken
+        bool clobber = false;   // Can read or write any variable
+    };
+
+    const std::vector<codew> &code;
+    std::vector<block> blocks;
+    std::vector<proc> procs;
+    size_t num_vars = 0;
+    std::vector<std::string> var_names;
+    bitvec aliased;  // Variables with the address taken
+    bitvec external; // Variables accessible by other code, all but the temporaries
+
+    explicit cfg(const std::vector<codew> &code);
+    // Returns the position of the instruction after the one at "pos"
+    size_t next(size_t pos) const;
+    // Returns the effect of the instruction at "pos" on the variables
+    effect get_effect(size_t pos) const;
+    // Returns the block containing the code position
+    size_t block_at(size_t pos) const;
+    // Returns the positions of the instructions in the block
+    std::vector<size_t> instructions(size_t b) const;
+
+  private:
+    std::vector<size_t> block_of; // Block of each code position
+    std::vector<uint8_t> unknown_call; // Calls to unknown procedures
+};
+
+// Variables live at the start and end of each block: their current value
+// can be read later.
+class liveness
+{
+  public:
+    const cfg &g;
+    std::vector<bitvec> in, out;
+
+    explicit liveness(const cfg &g);
+    // Returns the variables live after the instruction at "pos"
+    bitvec after(size_t pos) const;
+    // Updates "live" from after to before the instruction at "pos"
+    void step(size_t pos, bitvec &live) const;
+};
+
+// Values of the variables at the start and end of each block, from the
+// definitions (stores to variables) reaching it: a constant if all the
+// definitions store the same constant, "varying" if not, or "undefined"
+// if no definition reaches. The value at the start of the program, and the
+// stores by pointers or by unknown tokens, are varying.
+//
+// The value is the join of the values of all the reaching definitions, so
+// this is the same as computing the sets of reaching definitions, but the
+// size only depends on the number of variables and not on the number of
+// definitions.
+class reaching_consts
+{
+  public:
+    static const int varying = -1;
+    static const int undefined = -2;
+
+    const cfg &g;
+    std::vector<std::vector<int>> in, out;
+
+    // The "stored" vector gives the constant stored by the definition at
+    // each code position, or -1 if not constant.
+    reaching_consts(const cfg &g, const std::vector<int> &stored);
+    // Returns the values of the variables before the instruction at "pos"
+    std::vector<int> before(size_t pos) const;
+    // Updates "vals" from before to after the instruction at "pos"
+    void step(size_t pos, std::vector<int> &vals) const;
+
+  private:
+    const std::vector<int> &stored;
+};
+
+// Writes the graph of the code, with the variables live at the start of
+// each block, to the stream.
+void print_cfg(const std::vector<codew> &code, std::ostream &os);
@@ -19,6 +19,10 @@
 // codestat.cc: Generate code statistics
 
 #include "codestat.h"
+#include "tokinfo.h"
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <map>
 
@@ -32,39 +36,55 @@ class opstat
   public:
     opstat(const std::vector<codew> &code)
     {
-        std::string old;
+        static const int TOK_BYTE = codew::intern("TOK_BYTE");
+        static const int TOK_BYTE_POKE = codew::intern("TOK_BYTE_POKE");
+        static const int TOK_NUM = codew::intern("TOK_NUM");
+        static const int TOK_NUM_POKE = codew::intern("TOK_NUM_POKE");
+        static const int TOK_VAR_LOAD = codew::intern("TOK_VAR_LOAD");
+        static const int TOK_VAR_ADDR = codew::intern("TOK_VAR_ADDR");
+        // Count using the token IDs, converting to names at the end
+        std::map<int, int> n1;
+        std::map<std::pair<int, int>, int> n2;
+        std::map<std::pair<int, int>, int> n3;
+        int old = -1;
         for(auto &c : code)
         {
             if(c.is_tok())
             {
-                auto t = c.get_tok();
-                c1[t]++;
-                if(!old.empty())
-                    c2[{t, old}]++;
-                old = c.get_tok();
+                auto t = c.get_tok_id();
+                n1[t]++;
+                if(old >= 0)
+                    n2[{t, old}]++;
+                old = t;
             }
             else
             {
-                if(c.is_byte() && old == "TOK_BYTE")
-                    c3[{old, c.get_val()}]++;
-                else if(c.is_sbyte() && old == "TOK_BYTE")
+                if(c.is_byte() && old == TOK_BYTE)
+                    n3[{old, c.get_val()}]++;
+                else if(c.is_sbyte() && old == TOK_BYTE)
                     continue;
-                else if(c.is_sbyte() && old == "TOK_BYTE_POKE")
+                else if(c.is_sbyte() && old == TOK_BYTE_POKE)
                     continue;
-                else if(c.is_word() && old == "TOK_NUM")
-                    c3[{old, c.get_val()}]++;
-                else if(c.is_sword() && old == "TOK_NUM")
+                else if(c.is_word() && old == TOK_NUM)
+                    n3[{old, c.get_val()}]++;
+                else if(c.is_sword() && old == TOK_NUM)
                     continue;
-                else if(c.is_sword() && old == "TOK_NUM_POKE")
+                else if(c.is_sword() && old == TOK_NUM_POKE)
                     continue;
-                else if(c.is_byte() && old == "TOK_VAR_LOAD")
+                else if(c.is_byte() && old == TOK_VAR_LOAD)
                     continue;
-                else if(c.is_byte() && old == "TOK_VAR_ADDR")
+                else if(c.is_byte() && old == TOK_VAR_ADDR)
                     continue;
                 else
-                    old.clear();
+                    old = -1;
             }
         }
+        for(auto &c : n1)
+            c1[codew::interned(c.first)] = c.second;
+        for(auto &c : n2)
+            c2[{codew::interned(c.first.first), codew::interned(c.first.second)}] = c.second;
+        for(auto &c : n3)
+            c3[{codew::interned(c.first.first), c.first.second}] = c.second;
         // Show results
         for(auto &c : c1)
             std::cerr << "\t" << c.second << "\t" << c.first << "\n";
@@ -81,3 +101,234 @@ void do_opstat(std::vector<codew> &code)
 {
     opstat op(code);
 }
+
+// Tokens loading a constant, with the cycles and bytes saved by using a
+// token for one value. The "PUSH" tokens call "pushAX" before the load.
+class const_token
+{
+  public:
+    const char *name;
+    bool is_word;
+    bool push;
+    unsigned cycles, bytes;
+};
+static const const_token const_tokens[] = {
+    {"TOK_BYTE", false, false, 11, 1},
+    {"TOK_NUM", true, false, 26, 2},
+    {"TOK_PUSH_BYTE", false, true, 11, 1},
+    {"TOK_PUSH_NUM", true, true, 26, 2},
+};
+
+static const const_token *get_const_token(int tok)
+{
+    for(auto &c : const_tokens)
+        if(codew::intern(c.name) == tok)
+            return &c;
+    return nullptr;
+}
+
+void fusestat::add(const std::vector<codew> &code)
+{
+    programs++;
+    for(size_t i = 0; i < code.size(); i++)
+    {
+        if(!code[i].is_tok())
+            continue;
+        auto t = code[i].get_tok_id();
+        tokens.insert(t);
+        // Get the arguments, tokens with a variable number are not joined
+        size_t j = i + 1;
+        while(j < code.size() && !code[j].is_tok() && !code[j].is_label())
+            j++;
+        int n = j - i - 1;
+        auto it = nargs.find(t);
+        if(it == nargs.end())
+            nargs[t] = n;
+        else if(it->second != n)
+            it->second = -1;
+
+        auto ct = get_const_token(t);
+        if(ct && n == 1 && (ct->is_word ? code[i + 1].is_word() : code[i + 1].is_byte()))
+            consts[{t, code[i + 1].get_val()}]++;
+        // Only tokens continuing to the next one can be joined, and the next
+        // token must not be the target of a jump.
+        if(tokinfo::get(t).flow == tokinfo::f_none && j < code.size() && code[j].is_tok())
+            pairs[{t, code[j].get_tok_id()}]++;
+    }
+}
+
+void fusestat::merge(const fusestat &other)
+{
+    programs += other.programs;
+    tokens.insert(other.tokens.begin(), other.tokens.end());
+    for(auto &n : other.nargs)
+    {
+        auto it = nargs.find(n.first);
+        if(it == nargs.end())
+            nargs[n.first] = n.second;
+        else if(it->second != n.second)
+            it->second = -1;
+    }
+    for(auto &c : other.consts)
+        consts[c.first] += c.second;
+    for(auto &p : other.pairs)
+        pairs[p.first] += p.second;
+}
+
+namespace
+{
+// A proposed new token
+class fused
+{
+  public:
+    std::string name;         // Token name
+    int first, second;        // Joined tokens, or token and constant value
+    const const_token *ct;    // Constant token, or null
+    unsigned uses, cycles, bytes;
+};
+} // namespace
+
+// Returns the token name without the "TOK_" prefix
+static std::string short_name(const std::string &tok) { return tok.substr(4); }
+
+bool fusestat::write(const std::string &name, unsigned num, const token_costs &costs) const
+{
+    std::vector<fused> list;
+    auto add = [&](fused f) {
+        if(f.uses < 2 || tokens.count(codew::intern(f.name)))
+            return;
+        list.push_back(f);
+    };
+    for(auto &p : pairs)
+    {
+        auto a = nargs.find(p.first.first), b = nargs.find(p.first.second);
+        if(a == nargs.end() || b == nargs.end() || a->second < 0 || b->second < 0)
+            continue;
+        auto n = "TOK_" + short_name(codew::interned(p.first.first)) + "_" +
+                 short_name(codew::interned(p.first.second));
+        add({n, p.first.first, p.first.second, nullptr, p.second,
+             p.second * costs.dispatch(), p.second});
+    }
+    for(auto &c : consts)
+    {
+        auto ct = get_const_token(c.first.first);
+        auto v = c.first.second;
+        auto n = std::string(ct->name) + "_" + (v < 0 ? "M" : "") + std::to_string(std::abs(v));
+        add({n, c.first.first, v, ct, c.second, c.second * ct->cycles, c.second * ct->bytes});
+    }
+    std::sort(list.begin(), list.end(), [](const fused &a, const fused &b) {
+        if(a.cycles != b.cycles)
+            return a.cycles > b.cycles;
+        return a.name < b.name;
+    });
+    if(list.size() > num)
+        list.resize(num);
+
+    std::ofstream opt(name + ".opt"), asm_file(name + ".asm");
+    if(!opt.is_open() || !asm_file.is_open())
+        return false;
+
+    // Description of each token, also shown in the console
+    auto describe = [](const fused &f) {
+        if(f.ct)
+            return codew::interned(f.first) + " " + std::to_string(f.second);
+        return codew::interned(f.first) + " + " + codew::interned(f.second);
+    };
+    std::cerr << "superinstructions from " << programs << " programs:\n"
+              << "\trank\tuses\tcycles\tbytes\ttoken\n";
+    asm_file << "; Superinstructions generated by \"fastbasic -superinst\" from " << programs
+             << " programs,\n"
+                "; ranked by the cycles saved in one execution of all the uses.\n"
+                "; Overlapping sequences are counted in each of the tokens.\n"
+                "; Note that the jump table can hold up to 128 tokens.\n"
+                ";\n"
+                ";  Rank   Uses Cycles  Bytes  Token\n";
+    for(size_t i = 0; i < list.size(); i++)
+    {
+        auto &f = list[i];
+        std::cerr << "\t" << i + 1 << "\t" << f.uses << "\t" << f.cycles << "\t" << f.bytes
+                  << "\t" << f.name << " = " << describe(f) << "\n";
+        asm_file << ";" << std::setw(6) << i + 1 << std::setw(7) << f.uses << std::setw(7)
+                 << f.cycles << std::setw(7) << f.bytes << "  " << f.name << " = "
+                 << describe(f) << "\n";
+    }
+
+    // Peephole rules, in their own phase applied after all the others
+    opt << "# Superinstructions generated by \"fastbasic -superinst\" from " << programs
+        << " programs.\n"
+           "# Add this file to the \"peephole\" list of the target, the interpreter\n"
+           "# must include the tokens from \"" << name << ".asm\".\n"
+           "\nPHASE fuse\n";
+    for(auto &f : list)
+    {
+        opt << "\n# " << describe(f) << ": " << f.uses << " uses, " << f.cycles << " cycles\n";
+        if(f.ct)
+        {
+            opt << codew::interned(f.first) << " x:" << (f.ct->is_word ? "word" : "byte")
+                << " IF x == " << f.second << " => " << f.name << " NEXT\n";
+            continue;
+        }
+        std::string pat = codew::interned(f.first), repl = f.name;
+        for(int i = 0; i < nargs.at(f.first); i++)
+        {
+            pat += " x" + std::to_string(i + 1);
+            repl += " x" + std::to_string(i + 1);
+        }
+        pat += " " + codew::interned(f.second);
+        for(int i = 0; i < nargs.at(f.second); i++)
+        {
+            pat += " y" + std::to_string(i + 1);
+            repl += " y" + std::to_string(i + 1);
+        }
+        opt << pat << " => " << repl << " NEXT\n";
+    }
+
+    // Interpreter code: complete for the constants, for two joined tokens
+    // the code of the first one must be copied by hand.
+    std::set<std::string> imports;
+    bool push = false;
+    for(auto &f : list)
+    {
+        if(!f.ct)
+            imports.insert("EXE_" + short_name(codew::interned(f.second)));
+        else if(f.ct->push)
+            push = true;
+    }
+    asm_file << "\n";
+    if(push)
+        asm_file << "        .import         pushAX\n";
+    for(auto &i : imports)
+        asm_file << "        .import         " << i << "\n";
+    asm_file << "        .importzp       next_instruction\n"
+                "\n"
+                "        .segment        \"RUNTIME\"\n";
+    for(auto &f : list)
+    {
+        auto proc = "EXE_" + short_name(f.name);
+        asm_file << "\n.proc   " << proc << "\t; " << describe(f) << "\n";
+        if(f.ct)
+        {
+            auto v = std::to_string(f.second);
+            if(f.ct->push)
+                asm_file << "        jsr     pushAX\n";
+            asm_file << "        lda     #<(" << v << ")\n"
+                     << "        ldx     #>(" << v << ")\n"
+                     << "        jmp     next_instruction\n";
+        }
+        else
+        {
+            auto a = "EXE_" + short_name(codew::interned(f.first));
+            auto b = "EXE_" + short_name(codew::interned(f.second));
+            asm_file << "        ; TODO: copy the code of " << a << ", replacing the final\n"
+                     << "        ; jump to next_instruction with the jump to " << b << ".\n"
+                     << "        .warning \"" << proc << ": missing the code of " << a << "\"\n"
+                     << "        jmp     " << b << "\n";
+        }
+        asm_file << ".endproc\n";
+    }
+    asm_file << "\n        .include \"deftok.inc\"\n";
+    for(auto &f : list)
+        asm_file << "        deftoken \"" << short_name(f.name) << "\"\n";
+    asm_file << "\n; vi:syntax=asm_ca65\n";
+    return true;
+}
@@ -18,7 +18,36 @@
 
 // codestat.h: Generate code statistics
 
+#pragma once
+
 #include "codew.h"
+#include "costmodel.h"
+#include <map>
+#include <set>
+#include <string>
 #include <vector>
 
 void do_opstat(std::vector<codew> &code);
+
+// Statistics of the token sequences that could be joined into new tokens
+// (superinstructions), collected over many programs.
+class fusestat
+{
+  private:
+    unsigned programs = 0;
+    std::map<std::pair<int, int>, unsigned> pairs;  // Two consecutive tokens
+    std::map<std::pair<int, int>, unsigned> consts; // Token loading a constant
+    std::map<int, int> nargs;                       // Number of arguments of each token
+    std::set<int> tokens;                           // All the tokens used
+
+  public:
+    // Adds the statistics of the code of one program
+    void add(const std::vector<codew> &code);
+    // Adds the statistics collected in other object
+    void merge(const fusestat &other);
+    // Writes up to "num" new tokens, ranked by the estimated cycles saved
+    // using the dispatch time from "costs":
+    // the peephole rules to "name.opt" and the interpreter code to
+    // "name.asm". Returns false if the files can't be written.
+    bool write(const std::string &name, unsigned num, const token_costs &costs) const;
+};
@@ -0,0 +1,112 @@
+/*
+ * FastBasic - Fast basic interpreter for the Atari 8-bit computers
+ * Copyright (C) 2017-2025 Daniel Serpell
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+// codew.cc: Representation of bytecode
+#include "codew.h"
+#include <memory>
+#include <mutex>
+
+namespace
+{
+// Table of interned token names. The strings are stored in blocks that are
+// never moved nor freed, so the names are read without locking: a thread
+// holding an ID got it after the name was stored.
+class name_table
+{
+  public:
+    static const int block_bits = 10;
+    static const int block_size = 1 << block_bits;
+    static const int max_blocks = 1 << 10;
+    std::mutex lock;
+    std::unordered_map<std::string, int> ids;
+    std::unique_ptr<std::string[]> blocks[max_blocks];
+    int count = 0;
+};
+
+name_table &names()
+{
+    static name_table t;
+    return t;
+}
+
+// The string pool of the current compilation in this thread
+thread_local codew::string_pool *current_pool = nullptr;
+
+codew::string_pool &pool()
+{
+    if(current_pool)
+        return *current_pool;
+    // Strings created outside of a compilation are kept in a pool for the
+    // thread, that becomes the current one when constructed
+    static thread_local codew::string_pool thread_pool;
+    return thread_pool;
+}
+} // namespace
+
+int codew::intern(const std::string &s)
+{
+    auto &t = names();
+    std::lock_guard<std::mutex> guard(t.lock);
+    auto it = t.ids.find(s);
+    if(it != t.ids.end())
+        return it->second;
+    int id = t.count;
+    if((id >> name_table::block_bits) >= name_table::max_blocks)
+        throw std::runtime_error("internal error: too many token names");
+    auto &blk = t.blocks[id >> name_table::block_bits];
+    if(!blk)
+        blk.reset(new std::string[name_table::block_size]);
+    blk[id & (name_table::block_size - 1)] = s;
+    t.ids.emplace(s, id);
+    t.count++;
+    return id;
+}
+
+const std::string &codew::interned(int id)
+{
+    auto &t = names();
+    return t.blocks[id >> name_table::block_bits][id & (name_table::block_size - 1)];
+}
+
+codew::string_pool::string_pool() : prev(current_pool)
+{
+    current_pool = this;
+}
+
+codew::string_pool::~string_pool()
+{
+    if(current_pool == this)
+        current_pool = prev;
+}
+
+int codew::pool_add(const std::string &s)
+{
+    auto &p = pool();
+    auto it = p.ids.find(s);
+    if(it != p.ids.end())
+        return it->second;
+    int id = p.strings.size();
+    p.strings.push_back(s);
+    p.ids.emplace(s, id);
+    return id;
+}
+
+const std::string &codew::pooled(int id)
+{
+    return pool().strings[id];
+}
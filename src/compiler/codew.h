@@ -20,12 +20,16 @@
 #pragma once
 
 #include "atarifp.h"
+#include <cstdint>
+#include <deque>
 #include <stdexcept>
+#include <string>
+#include <unordered_map>
 
 class codew
 {
   private:
-    enum
+    enum : uint8_t
     {
         tok,      // A bytecode TOKEN
         byte,     // One byte, as number (0 to 255)
@@ -37,12 +41,17 @@ class codew
         fp,       // A FP number, 6 bytes.
         string    // A constant string, length+bytes
     } type;
-    int num;
-    std::string str; // String or token
-    atari_fp x;
+    // Variable number, for "varn" type
+    uint16_t vnum;
     int lnum;
+    union
+    {
+        int num;   // Number value
+        int id;    // Token name ID, or string ID in the current string pool
+        double x;  // FP number
+    };
     // Escape string to include in assembly output
-    std::string escape(std::string str)
+    static std::string escape(const std::string &str)
     {
         std::string ret;
         bool quote = false;
@@ -68,25 +77,60 @@ class codew
         return ret;
     }
     codew(){};
+    static codew cstr(decltype(tok) type, const std::string &s, int lnum)
+    {
+        codew c;
+        c.type = type;
+        c.lnum = lnum;
+        c.id = type == tok ? intern(s) : pool_add(s);
+        return c;
+    }
+    // Adds a string to the current pool, returning the ID
+    static int pool_add(const std::string &s);
+    // Returns the string with the given ID in the current pool
+    static const std::string &pooled(int id);
 
   public:
-    static codew ctok(std::string t, int lnum)
+    // Returns the ID of an interned token name, adding it if needed, so the
+    // ID can be used to compare tokens. The names are interned at startup and
+    // on loading a target, getting the name of an ID does not lock.
+    static int intern(const std::string &s);
+    // Returns the token name with the given ID
+    static const std::string &interned(int id);
+
+    // The labels, variable names, symbols and string constants of one
+    // compilation. Creating a pool makes it the current one in the thread
+    // until destroyed, so the strings of each program are freed after the
+    // compilation instead of accumulating in the token names.
+    class string_pool
+    {
+      private:
+        friend class codew;
+        std::deque<std::string> strings;
+        std::unordered_map<std::string, int> ids;
+        string_pool *prev;
+
+      public:
+        string_pool();
+        ~string_pool();
+        string_pool(const string_pool &) = delete;
+        string_pool &operator=(const string_pool &) = delete;
+    };
+
+    static codew ctok(int t, int lnum)
     {
         codew c;
         c.type = tok;
         c.lnum = lnum;
-        c.str = t;
+        c.id = t;
         return c;
     }
-    static codew cbyte(std::string s, int lnum)
+    static codew ctok(const std::string &t, int lnum) { return cstr(tok, t, lnum); }
+    static codew cbyte(const std::string &s, int lnum)
     {
         if(s.find_first_not_of("0123456789") == s.npos)
             return cbyte((int16_t)(std::stoul(s)), lnum);
-        codew c;
-        c.type = byte_str;
-        c.lnum = lnum;
-        c.str = s;
-        return c;
+        return cstr(byte_str, s, lnum);
     }
     static codew cbyte(int n, int lnum)
     {
@@ -96,15 +140,11 @@ class codew
         c.num = n;
         return c;
     }
-    static codew cword(std::string s, int lnum)
+    static codew cword(const std::string &s, int lnum)
     {
         if(s.find_first_not_of("0123456789") == s.npos)
             return cword((int16_t)(std::stoul(s)), lnum);
-        codew c;
-        c.type = word_str;
-        c.lnum = lnum;
-        c.str = s;
-        return c;
+        return cstr(word_str, s, lnum);
     }
     static codew cword(int n, int lnum)
     {
@@ -114,21 +154,11 @@ class codew
         c.num = n;
         return c;
     }
-    static codew clabel(std::string s, int lnum)
+    static codew clabel(const std::string &s, int lnum) { return cstr(label, s, lnum); }
+    static codew cvarn(const std::string &name, int vnum, int lnum)
     {
-        codew c;
-        c.type = label;
-        c.lnum = lnum;
-        c.str = s;
-        return c;
-    }
-    static codew cvarn(std::string name, int vnum, int lnum)
-    {
-        codew c;
-        c.type = varn;
-        c.lnum = lnum;
-        c.num = vnum;
-        c.str = name;
+        codew c = cstr(varn, name, lnum);
+        c.vnum = vnum;
         return c;
     }
     static codew cfp(atari_fp x, int lnum)
@@ -136,21 +166,15 @@ class codew
         codew c;
         c.type = fp;
         c.lnum = lnum;
-        c.x = x;
-        return c;
-    }
-    static codew cstring(std::string s, int lnum)
-    {
-        codew c;
-        c.type = string;
-        c.lnum = lnum;
-        c.str = s;
+        c.x = x.value();
         return c;
     }
+    static codew cstring(const std::string &s, int lnum) { return cstr(string, s, lnum); }
     // Test type
-    bool is_tok(std::string t) const { return type == tok && str == t; }
-    bool is_sbyte(std::string s) const { return type == byte_str && str == s; }
-    bool is_sword(std::string s) const { return type == word_str && str == s; }
+    bool is_tok(int t) const { return type == tok && id == t; }
+    bool is_tok(const std::string &t) const { return type == tok && interned(id) == t; }
+    bool is_sbyte(const std::string &s) const { return type == byte_str && pooled(id) == s; }
+    bool is_sword(const std::string &s) const { return type == word_str && pooled(id) == s; }
     bool is_tok() const { return type == tok; }
     bool is_byte() const { return type == byte; }
     bool is_varn() const { return type == varn; }
@@ -159,15 +183,16 @@ class codew
     bool is_sword() const { return type == word_str; }
     bool is_label() const { return type == label; }
     bool is_string() const { return type == string; }
+    bool is_fp() const { return type == fp; }
     bool is_symbol() const
     {
         return type == byte_str || type == word_str || type == label;
     }
     // Get data
-    std::string get_str()
+    const std::string &get_str() const
     {
         if(type == byte_str || type == word_str || type == label || type == string)
-            return str;
+            return pooled(id);
         else
             throw std::runtime_error("internal error: not a string");
     }
@@ -181,41 +206,81 @@ class codew
     int get_varn() const
     {
         if(type == varn)
-            return num;
+            return vnum;
+        else
+            throw std::runtime_error("internal error: not a variable");
+    }
+    const std::string &get_varname() const
+    {
+        if(type == varn)
+            return pooled(id);
         else
             throw std::runtime_error("internal error: not a variable");
     }
-    std::string get_tok() const
+    const std::string &get_tok() const { return interned(get_tok_id()); }
+    int get_tok_id() const
     {
         if(type == tok)
-            return str;
+            return id;
         else
             throw std::runtime_error("internal error: not a token");
     }
+    atari_fp get_fp() const
+    {
+        if(type == fp)
+            return atari_fp(x);
+        else
+            throw std::runtime_error("internal error: not a FP number");
+    }
     int linenum() const { return lnum; }
-    std::string to_asm()
+    // Number of bytes in the compiled program
+    unsigned size() const
+    {
+        switch(type)
+        {
+        case tok:
+        case byte:
+        case byte_str:
+        case varn:
+            return 1;
+        case word:
+        case word_str:
+            return 2;
+        case fp:
+            return 6;
+        case label:
+            return 0;
+        case string:
+            return 1 + pooled(id).length();
+        }
+        return 0;
+    }
+    std::string to_asm() const
     {
         switch(type)
         {
         case tok:
-            return "\t.byte\t" + str;
+            return "\t.byte\t" + interned(id);
         case byte:
             return "\t.byte\t" + std::to_string(num & 0xFF);
         case word:
             return "\t.word\t" + std::to_string(num & 0xFFFF);
         case varn:
-            return "\tmakevar\t\"" + str + "\"";
+            return "\tmakevar\t\"" + pooled(id) + "\"";
         case byte_str:
-            return "\t.byte\t" + str;
+            return "\t.byte\t" + pooled(id);
         case word_str:
-            return "\t.word\t" + str;
+            return "\t.word\t" + pooled(id);
         case fp:
-            return "\t.byte\t" + x.to_asm();
+            return "\t.byte\t" + atari_fp(x).to_asm();
         case label:
-            return str + ":";
+            return pooled(id) + ":";
         case string:
+        {
+            auto &str = pooled(id);
             return "\t.byte\t" + std::to_string(str.length()) + escape(str);
         }
+        }
         return std::string();
     }
 };
@@ -21,11 +21,24 @@
 #include "compile.h"
 #include <fstream>
 #include <iostream>
+#include <sstream>
 
+#include "cfg.h"
 #include "codestat.h"
+#include "constprop.h"
+#include "costmodel.h"
+#include "cse.h"
+#include "deadcode.h"
+#include "deadstore.h"
+#include "inliner.h"
+#include "licm.h"
+#include "native.h"
+#include "objfile.h"
+#include "os.h"
 #include "parser.h"
 #include "peephole.h"
 #include "vartype.h"
+#include "zpvars.h"
 
 // Reads a complete source line, respecting ATASCII and ASCII EOL inly
 // outside strings.
@@ -86,13 +99,13 @@ static int readLine(std::string &r, std::istream &is)
 
 // Parses one source line
 static bool parse_line(std::string line, int ln, parse &s, bool show_text,
-                       unsigned short_text, const syntax::sm_list &sl,
+                       unsigned short_text, const syntax::parser_tables &pt,
                        std::string &short_line, std::ostream &list_file)
 {
     s.new_line(line, ln);
     while(s.pos != line.length())
     {
-        if(!syntax::parse_start(s, sl) || (s.pos != line.length() && !s.peek(':')))
+        if(!syntax::parse_start(s, pt) || (s.pos != line.length() && !s.peek(':')))
         {
             std::string msg = "parse error";
             if(!s.saved_errors.empty())
@@ -152,6 +165,136 @@ static int show_error(std::string msg)
     return 1;
 }
 
+// Writes the compiled program to an object file, the same as the assembly
+// output. Returns an empty string or the reason the program can't be
+// written without the assembler.
+static std::string write_object(obj_file &obj, parse &s, const std::string &segname,
+                                const std::vector<std::string> &zp_list,
+                                const std::map<int, std::string> &vlist,
+                                const std::set<std::string> &globals,
+                                const std::set<std::string> &globals_zp,
+                                const asm_symbols &syms)
+{
+    // Imported symbols, the ones defined in the target include files are
+    // replaced by the value.
+    for(auto &g : {&globals, &globals_zp})
+        for(auto &name : *g)
+        {
+            long val;
+            if(syms.is_unknown(name))
+                return "unsupported symbol '" + name + "'";
+            if(!syms.get(name, val))
+                obj.import(name, g == &globals_zp);
+        }
+    for(auto &i : s.used_tokens())
+        obj.import(i, true);
+    obj.import("__HEAP_RUN__", false);
+
+    // Variables
+    if(!zp_list.empty())
+        obj.segment("ZPVARS", true);
+    for(auto &v : zp_list)
+    {
+        obj.label("fb_var_" + v);
+        obj.export_label("fb_var_" + v);
+        obj.fill(2);
+    }
+    obj.segment("HEAP");
+    for(auto &v : vlist)
+    {
+        obj.label("fb_var_" + v.second);
+        obj.export_label("fb_var_" + v.second);
+        obj.fill(get_vt_size(VarType(v.first & 0xFF)));
+    }
+
+    // Bytecode
+    obj.segment(segname);
+    obj.label("bytecode_start");
+    obj.export_label("bytecode_start");
+    int ln = -1;
+    std::map<int, int> line_labels;
+    for(auto &c : s.full_code())
+    {
+        if(c.linenum() != ln)
+        {
+            ln = c.linenum();
+            obj.line(ln);
+            std::string lbl = "@FastBasic_LINE_" + std::to_string(ln);
+            if(line_labels.find(ln) != line_labels.end())
+            {
+                line_labels[ln]++;
+                lbl = lbl + "_" + std::to_string(line_labels[ln]);
+            }
+            else
+                line_labels[ln] = 0;
+            obj.label(lbl);
+        }
+        if(c.is_label())
+        {
+            auto &full_name = c.get_str();
+            auto pl = std::string(s.label_prefix).length();
+            bool exported = full_name.substr(0, pl) == s.label_prefix;
+            if(exported)
+            {
+                auto it = s.labels.find(full_name.substr(pl));
+                if(it == s.labels.end())
+                    return "unknown label '" + full_name + "'";
+                auto lbl = it->second;
+                auto seg = lbl.get_segment();
+                if(seg.size())
+                    obj.segment(seg);
+                else if(lbl.is_proc())
+                    obj.segment(segname);
+                else
+                    obj.segment("DATA");
+            }
+            obj.label(full_name);
+            if(exported)
+                obj.export_label(full_name);
+        }
+        else if(c.is_tok())
+            obj.ref(c.get_tok(), 1);
+        else if(c.is_byte())
+            obj.data(std::string(1, char(c.get_val())));
+        else if(c.is_word())
+            obj.data({char(c.get_val()), char(c.get_val() >> 8)});
+        else if(c.is_varn())
+            obj.var_id("fb_var_" + c.get_varname());
+        else if(c.is_fp())
+            obj.data(c.get_fp().to_bytes());
+        else if(c.is_string())
+        {
+            auto &str = c.get_str();
+            if(str.size() > 255)
+                return "string too long";
+            obj.data(char(str.size()) + str);
+        }
+        else if(c.is_sbyte() || c.is_sword())
+        {
+            // Only symbol names, resolved by the linker or by the value
+            auto &name = c.get_str();
+            auto size = c.is_sbyte() ? 1 : 2;
+            long val;
+            if(name.empty() || std::isdigit(name[0]) ||
+               name.find_first_not_of("ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz"
+                                      "0123456789_") != name.npos)
+                return "unsupported expression '" + name + "'";
+            if(syms.get(name, val))
+            {
+                if(val < 0 || val >= (1L << (8 * size)))
+                    return "value of '" + name + "' out of range";
+                std::string bytes(1, char(val));
+                if(size > 1)
+                    bytes += char(val >> 8);
+                obj.data(bytes);
+            }
+            else
+                obj.ref(name, size);
+        }
+    }
+    return std::string();
+}
+
 static char printable(char c)
 {
     if(c < 32)
@@ -165,26 +308,65 @@ static char printable(char c)
 compiler::compiler()
 {
     optimize = true;
+    opt_level = opt_goal::o_speed;
+    inline_limit = 64;
+    native_all = false;
+    zp_vars = 0;
     segname = "BYTECODE";
     show_stats = false;
+    show_cfg = false;
     show_text = false;
+    show_cost = false;
     short_text = 0;
     do_debug = false;
+    packrat = false;
+    collect_fuse = false;
+    target_syms = nullptr;
+    input_text = nullptr;
+    obj_written = false;
+}
+
+std::string compiler::options() const
+{
+    std::string ret = segname + "\n";
+    ret += optimize ? "O" + std::to_string(int(opt_level)) : "n";
+    ret += " inline:" + std::to_string(inline_limit);
+    ret += " zp:" + std::to_string(zp_vars);
+    ret += native_all ? " native" : "";
+    for(auto &n : native_procs)
+        ret += " native:" + n;
+    return ret;
 }
 
 int compiler::compile_file(std::string iname, std::string output_filename,
-                           const syntax::sm_list &sl, std::string listing_filename)
+                           const syntax::parser_tables &pt, const peephole_rules &rules,
+                           const token_costs &costs, std::string listing_filename,
+                           std::string cost_filename, std::string obj_filename)
 {
-    std::ifstream ifile;
-    std::ofstream ofile, lstfile;
+    codew::string_pool strings;
+    std::ifstream in_file;
+    std::istringstream in_text;
+    std::ofstream ofile, lstfile, costfile;
 
-    ifile.open(iname, std::ios::binary);
-    if(!ifile.is_open())
-        return show_error("can't open input file '" + iname + "'");
+    obj_written = false;
+    data_files.clear();
+    if(input_text)
+        in_text.str(*input_text);
+    else
+    {
+        in_file.open(iname, std::ios::binary);
+        if(!in_file.is_open())
+            return show_error("can't open input file '" + iname + "'");
+    }
+    std::istream &ifile = input_text ? static_cast<std::istream &>(in_text) : in_file;
 
+    // Check that the output file can be written before compiling, it is
+    // opened again if the assembly is needed.
     ofile.open(output_filename);
     if(!ofile.is_open())
         return show_error("can't open output file '" + output_filename + "'");
+    ofile.close();
+    os::remove_file(output_filename);
 
     if(show_text)
     {
@@ -193,11 +375,20 @@ int compiler::compile_file(std::string iname, std::string output_filename,
             return show_error("can't open listing file '" + listing_filename + "'");
     }
 
+    if(show_cost)
+    {
+        costfile.open(cost_filename);
+        if(!costfile.is_open())
+            return show_error("can't open cost listing file '" + cost_filename + "'");
+    }
+
     parse s(do_debug);
+    s.packrat = packrat;
     s.set_input_file(iname);
 
     int ln = 1;
     std::string list_prog;
+    std::map<int, std::string> source; // Source lines, for the cost listing
     while(1)
     {
         try
@@ -206,9 +397,11 @@ int compiler::compile_file(std::string iname, std::string output_filename,
             int lines = readLine(line, ifile);
             if(!lines && line.empty())
                 break;
+            if(show_cost)
+                source[ln] = line;
             if(do_debug)
                 std::cout << iname << ": parsing line " << ln << "\n";
-            parse_line(line, ln, s, show_text, short_text, sl, list_prog, lstfile);
+            parse_line(line, ln, s, show_text, short_text, pt, list_prog, lstfile);
             ln += lines;
         }
         catch(parse_error &e)
@@ -248,6 +441,10 @@ int compiler::compile_file(std::string iname, std::string output_filename,
         std::cout << "parse end:\n";
         std::cout << "MAX LEVEL: " << s.maxlvl << "\n";
     }
+    if(packrat)
+        std::cerr << "packrat cache: " << s.memo_hits << " hits, " << s.memo_misses
+                  << " misses\n";
+    data_files = s.data_files;
 
     // Show short line
     if(short_text && list_prog.size())
@@ -263,16 +460,65 @@ int compiler::compile_file(std::string iname, std::string output_filename,
 
     s.emit_tok("TOK_END");
     // Optimize
+    opt_goal goal(opt_level, costs);
     if(optimize)
-        do_peephole(s.full_code());
+    {
+        // Inline the PROCs before joining all the code, except the ones
+        // translated to native code.
+        auto keep = native_selected(s.procs, native_procs, native_all);
+        do_inline(s.procs, inline_limit, goal, keep, show_stats);
+        // Remove the unused code before the data flow analysis, and again at
+        // the end as the peephole can remove conditional jumps.
+        unsigned dead = do_deadcode(s.full_code(), show_stats);
+        do_peephole(s.full_code(), rules, goal);
+        // Propagate constants across statements and remove the unused
+        // stores, each pass can expose more constants after folding the
+        // expressions.
+        for(int i = 0; i < 8; i++)
+        {
+            bool changed = do_constprop(s.full_code());
+            changed = do_deadstore(s.full_code()) || changed;
+            if(!changed)
+                break;
+            do_peephole(s.full_code(), rules, goal);
+        }
+        bool changed = do_licm(s.full_code(), s.vars, goal);
+        changed = do_cse(s.full_code(), s.vars, goal) || changed;
+        if(changed)
+            do_peephole(s.full_code(), rules, goal);
+        unsigned d = do_deadcode(s.full_code(), show_stats);
+        if(d)
+            do_peephole(s.full_code(), rules, goal);
+        dead += d;
+        if(show_stats)
+            std::cerr << "dead code: " << dead << " bytes removed\n";
+    }
+    // Statistics of the sequences of tokens, before joining them
+    if(collect_fuse)
+        fuse_stats.add(s.full_code());
+    // Translate PROCs to native code, before joining the tokens
+    native_code native;
+    if(native_all || !native_procs.empty())
+        do_native(s.full_code(), native_procs, native_all, show_stats, native);
+    if(optimize)
+        do_fuse(s.full_code(), rules);
+    // Place the most used variables in the zero page, after all the passes
+    // that use the variable tokens.
+    std::vector<std::string> zp_list;
+    if(optimize && zp_vars)
+        zp_list = do_zpvars(s.full_code(), s.vars, zp_vars, show_stats);
+    std::set<std::string> zp_set(zp_list.begin(), zp_list.end());
     // Statistics
     if(show_stats)
         do_opstat(s.full_code());
+    if(show_cfg)
+        print_cfg(s.full_code(), std::cerr);
+    if(show_cost)
+        cost_listing(s.full_code(), costs, source, iname, costfile);
 
     // Get global symbols
     std::set<std::string> globals, globals_zp;
-    for(auto &c : s.full_code())
-    {
+    auto add_global = [&](const codew &c) {
         if(c.is_symbol())
         {
             // Lower-case symbols are internal
@@ -285,8 +531,47 @@ int compiler::compile_file(std::string iname, std::string output_filename,
                     globals_zp.insert(c.get_str());
             }
         }
+    };
+    for(auto &c : s.full_code())
+        add_global(c);
+    for(auto &c : native.args)
+        add_global(c);
+
+    // Create a map to reorder variables by number:
+    // Variables not used in the optimized code are not needed
+    auto used_vars = used_variables(s.full_code());
+    for(auto v : used_variables(native.args))
+        used_vars.insert(v);
+    auto vlist = std::map<int, std::string>();
+    for(auto &v : s.vars)
+        if(!v.first.empty() && v.first[0] != '-')
+            if(!optimize || (used_vars.count(v.second >> 8) && !zp_set.count(v.first)))
+                vlist.emplace(v.second, v.first);
+
+    // Write the object file directly, if possible
+    if(!obj_filename.empty() && target_syms)
+    {
+        ifile.clear();
+        ifile.seekg(0, std::ios::end);
+        obj_file obj(iname, unsigned(ifile.tellg()));
+        auto err = native.text.empty() ? write_object(obj, s, segname, zp_list, vlist,
+                                                      globals, globals_zp, *target_syms)
+                                       : "program with native code";
+        if(err.empty())
+            err = obj.write(obj_filename);
+        if(err.empty())
+        {
+            obj_written = true;
+            return 0;
+        }
+        if(show_stats)
+            std::cerr << "object file: " << err << ", using the assembler\n";
     }
 
+    ofile.open(output_filename);
+    if(!ofile.is_open())
+        return show_error("can't open output file '" + output_filename + "'");
+
     // Output all global symbols
     ofile << "; Imported symbols\n";
     for(auto &c : globals)
@@ -311,11 +596,16 @@ int compiler::compile_file(std::string iname, std::string output_filename,
              "\t.byte <((.ident (.concat (\"fb_var_\", name)) - __HEAP_RUN__)/2)\n"
              ".endmacro\n"
              "; Variables\n";
-    // Create a map to reorder variables by number:
-    auto vlist = std::map<int, std::string>();
-    for(auto &v : s.vars)
-        if(!v.first.empty() && v.first[0] != '-')
-            vlist.emplace(v.second, v.first);
+    if(!zp_list.empty())
+    {
+        ofile << "\t.segment \"ZPVARS\": zeropage\n";
+        for(auto &v : zp_list)
+        {
+            ofile << "\t.exportzp fb_var_" << v << "\n";
+            ofile << "fb_var_" << v << ":\t.res 2\t; " << get_vt_name(VT_WORD)
+                  << " variable\n";
+        }
+    }
     ofile << "\t.segment \"HEAP\"\n";
     // And now, output all variables:
     for(auto &v : vlist)
@@ -382,6 +672,7 @@ int compiler::compile_file(std::string iname, std::string output_filename,
         }
         ofile << c.to_asm() << "\n";
     }
+    ofile << native.text;
 
     return 0;
 }
@@ -20,24 +20,52 @@
 
 #pragma once
 
+#include "codestat.h"
+#include "costmodel.h"
+#include <set>
 #include <string>
 
 namespace syntax
 {
-class sm_list;
+class parser_tables;
 }
+class peephole_rules;
+class asm_symbols;
 
 class compiler
 {
   public:
     std::string segname;
     bool do_debug;
+    bool packrat;
     bool optimize;
+    opt_goal::level opt_level;
+    unsigned inline_limit;
+    bool native_all;                     // Translate all PROCs to native code
+    std::set<std::string> native_procs; // PROCs to translate to native code
+    unsigned zp_vars;                    // Bytes of zero page for the variables
     bool show_stats;
+    bool show_cfg;
     bool show_text;
+    bool show_cost;
     unsigned short_text;
+    bool collect_fuse;   // Collect statistics of the tokens to join
+    fusestat fuse_stats; // Statistics of all the compiled files
+    const asm_symbols *target_syms; // Symbols of the target include files, to
+                                    // write object files without the assembler
+    const std::string *input_text;  // Text of the input file, or null to read it
+    bool obj_written;               // Last file was written as an object file
+    std::set<std::string> data_files; // Files included by the last file
 
     compiler();
+    // Returns a text with all the options that change the compiled code, to
+    // identify the output in the build cache.
+    std::string options() const;
+    // Compiles the input file to assembly, or directly to the object file if
+    // "obj_filename" is given, "target_syms" is set and the program can be
+    // written without the assembler; in that case, sets "obj_written".
     int compile_file(std::string input_filename, std::string output_filename,
-                     const syntax::sm_list &sl, std::string listing_filename);
+                     const syntax::parser_tables &pt, const peephole_rules &rules,
+                     const token_costs &costs, std::string listing_filename,
+                     std::string cost_filename, std::string obj_filename = std::string());
 };
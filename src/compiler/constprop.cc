@@ -0,0 +1,285 @@
+/*
+ * FastBasic - Fast basic interpreter for the Atari 8-bit computers
+ * Copyright (C) 2017-2025 Daniel Serpell
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+// constprop.cc: Constant and copy propagation of variables
+
+#include "constprop.h"
+#include "cfg.h"
+#include "tokinfo.h"
+#include <deque>
+#include <map>
+
+// Token IDs used by the optimizer
+static const int TOK_0 = codew::intern("TOK_0");
+static const int TOK_1 = codew::intern("TOK_1");
+static const int TOK_ADD = codew::intern("TOK_ADD");
+static const int TOK_ADD_VAR = codew::intern("TOK_ADD_VAR");
+static const int TOK_BYTE = codew::intern("TOK_BYTE");
+static const int TOK_NUM = codew::intern("TOK_NUM");
+static const int TOK_PUSH = codew::intern("TOK_PUSH");
+static const int TOK_PUSH_0 = codew::intern("TOK_PUSH_0");
+static const int TOK_PUSH_1 = codew::intern("TOK_PUSH_1");
+static const int TOK_PUSH_BYTE = codew::intern("TOK_PUSH_BYTE");
+static const int TOK_PUSH_NUM = codew::intern("TOK_PUSH_NUM");
+static const int TOK_PUSH_VAR_LOAD = codew::intern("TOK_PUSH_VAR_LOAD");
+static const int TOK_VAR_LOAD = codew::intern("TOK_VAR_LOAD");
+static const int TOK_VAR_STORE = codew::intern("TOK_VAR_STORE");
+static const int TOK_VAR_STORE_0 = codew::intern("TOK_VAR_STORE_0");
+
+// Returns the constant value loaded into AX by the instruction at "pos",
+// or -1 if not a constant
+static int const_load(const std::vector<codew> &code, size_t pos)
+{
+    auto &c = code[pos];
+    if(c.is_tok(TOK_0) || c.is_tok(TOK_PUSH_0))
+        return 0;
+    if(c.is_tok(TOK_1) || c.is_tok(TOK_PUSH_1))
+        return 1;
+    if(pos + 1 >= code.size())
+        return -1;
+    auto &arg = code[pos + 1];
+    if((c.is_tok(TOK_BYTE) || c.is_tok(TOK_PUSH_BYTE)) && arg.is_byte())
+        return arg.get_val() & 0xFF;
+    if((c.is_tok(TOK_NUM) || c.is_tok(TOK_PUSH_NUM)) && arg.is_word())
+        return arg.get_val() & 0xFFFF;
+    return -1;
+}
+
+namespace
+{
+// Copies of one variable to other, "TOK_VAR_LOAD src / TOK_VAR_STORE dst",
+// available at the start of each block: in all the paths to the block the
+// copy was done and neither variable was written after.
+class avail_copies
+{
+  public:
+    class copy
+    {
+      public:
+        size_t pos; // Position of the store
+        int dst, src;
+    };
+    const cfg &g;
+    std::vector<copy> copies;
+    std::vector<bitvec> in, out;
+
+    explicit avail_copies(const cfg &g);
+    // Updates "avail" from before to after the instruction at "pos"
+    void step(size_t pos, bitvec &avail) const;
+    // Returns the source of the available copy to "var", or -1
+    int source(const bitvec &avail, int var) const;
+
+  private:
+    std::vector<int> copy_at;                 // Copy at each code position
+    std::vector<bitvec> var_copies;           // Copies from or to each variable
+    std::vector<std::vector<size_t>> to_var;  // Copies to each variable
+    bitvec aliased_copies;                    // Copies of variables with the address taken
+    bitvec external_copies;                   // Copies of external variables
+};
+} // namespace
+
+avail_copies::avail_copies(const cfg &g)
+    : g(g), copy_at(g.code.size(), -1), to_var(g.num_vars)
+{
+    auto nb = g.blocks.size();
+    std::vector<std::vector<size_t>> ins(nb);
+    for(size_t b = 0; b < nb; b++)
+    {
+        ins[b] = g.instructions(b);
+        for(size_t i = 1; i < ins[b].size(); i++)
+        {
+            auto ld = ins[b][i - 1], st = ins[b][i];
+            if(!g.code[ld].is_tok(TOK_VAR_LOAD) || !g.code[st].is_tok(TOK_VAR_STORE))
+                continue;
+            auto src = g.get_effect(ld).var, dst = g.get_effect(st).var;
+            if(src < 0 || dst < 0 || src == dst)
+                continue;
+            copy_at[st] = copies.size();
+            to_var[dst].push_back(copies.size());
+            copies.push_back(copy{st, dst, src});
+        }
+    }
+
+    auto nc = copies.size();
+    var_copies.assign(g.num_vars, bitvec(nc));
+    aliased_copies = bitvec(nc);
+    external_copies = bitvec(nc);
+    for(size_t c = 0; c < nc; c++)
+    {
+        var_copies[copies[c].dst].set(c);
+        var_copies[copies[c].src].set(c);
+        if(g.aliased.test(copies[c].dst) || g.aliased.test(copies[c].src))
+            aliased_copies.set(c);
+        if(g.external.test(copies[c].dst) || g.external.test(copies[c].src))
+            external_copies.set(c);
+    }
+
+    // Iterate up to the fixed point, starting from all the copies available
+    // in all the blocks except the ones without predecessors.
+    bitvec all(nc);
+    all.set_all(nc);
+    in.assign(nb, bitvec(nc));
+    out.assign(nb, all);
+    std::deque<size_t> work;
+    std::vector<uint8_t> queued(nb, 1);
+    for(size_t b = 0; b < nb; b++)
+        work.push_back(b);
+    while(!work.empty())
+    {
+        auto b = work.front();
+        work.pop_front();
+        queued[b] = 0;
+        bitvec a = g.blocks[b].pred.empty() ? bitvec(nc) : all;
+        for(auto p : g.blocks[b].pred)
+            a &= out[p];
+        // The external variables can change at the start of the loops
+        if(g.blocks[b].loop_head)
+            a -= external_copies;
+        in[b] = a;
+        for(auto pos : ins[b])
+            step(pos, a);
+        if(a != out[b])
+        {
+            out[b] = a;
+            for(auto s : g.blocks[b].succ)
+            {
+                if(!queued[s])
+                {
+                    queued[s] = 1;
+                    work.push_back(s);
+                }
+            }
+        }
+    }
+}
+
+void avail_copies::step(size_t pos, bitvec &avail) const
+{
+    auto e = g.get_effect(pos);
+    if(e.clobber)
+    {
+        avail = bitvec(copies.size());
+        return;
+    }
+    if(e.mem_write)
+        avail -= aliased_copies;
+    if(e.var >= 0 && (e.access == tokinfo::v_write || e.access == tokinfo::v_modify))
+        avail -= var_copies[e.var];
+    if(copy_at[pos] >= 0)
+        avail.set(copy_at[pos]);
+}
+
+int avail_copies::source(const bitvec &avail, int var) const
+{
+    for(auto c : to_var[var])
+        if(avail.test(c))
+            return copies[c].src;
+    return -1;
+}
+
+bool do_constprop(std::vector<codew> &code)
+{
+    cfg g(code);
+    if(!g.num_vars)
+        return false;
+    avail_copies ac(g);
+
+    // Get the value of the stores of constants
+    std::vector<int> const_at(code.size(), -1);
+    for(size_t b = 0; b < g.blocks.size(); b++)
+    {
+        size_t prev = code.size();
+        for(auto pos : g.instructions(b))
+        {
+            if(code[pos].is_tok(TOK_VAR_STORE_0))
+                const_at[pos] = 0;
+            else if(code[pos].is_tok(TOK_VAR_STORE) && prev < code.size())
+                const_at[pos] = const_load(code, prev);
+            prev = pos;
+        }
+    }
+    reaching_consts rc(g, const_at);
+
+    // Get the replacement of each load
+    std::map<size_t, std::vector<codew>> repl;
+    for(size_t b = 0; b < g.blocks.size(); b++)
+    {
+        auto vals = rc.in[b];
+        auto avail = ac.in[b];
+        bool prev_const = false; // The previous instruction loads a constant
+        for(auto pos : g.instructions(b))
+        {
+            auto e = g.get_effect(pos);
+            bool is_const = const_load(code, pos) >= 0;
+            if(e.var >= 0 && e.access == tokinfo::v_read)
+            {
+                auto &c = code[pos];
+                auto ln = c.linenum();
+                int val = vals[e.var] >= 0 ? vals[e.var] : -1;
+                int src = ac.source(avail, e.var);
+                if(val >= 0 && c.is_tok(TOK_VAR_LOAD))
+                {
+                    repl[pos] = {codew::ctok(TOK_NUM, ln), codew::cword(int16_t(val), ln)};
+                    is_const = true;
+                }
+                else if(val >= 0 && c.is_tok(TOK_PUSH_VAR_LOAD))
+                {
+                    repl[pos] = {codew::ctok(TOK_PUSH_NUM, ln), codew::cword(int16_t(val), ln)};
+                    is_const = true;
+                }
+                else if(val == 0 && c.is_tok(TOK_ADD_VAR))
+                {
+                    // Adding 0 does nothing
+                    repl[pos] = {};
+                    is_const = prev_const;
+                }
+                else if(val > 0 && c.is_tok(TOK_ADD_VAR) && prev_const)
+                {
+                    // Only when the addition can be folded with the constant
+                    repl[pos] = {codew::ctok(TOK_PUSH, ln), codew::ctok(TOK_NUM, ln),
+                                 codew::cword(int16_t(val), ln), codew::ctok(TOK_ADD, ln)};
+                }
+                else if(src >= 0)
+                    repl[pos] = {c, codew::cvarn(g.var_names[src], src, ln)};
+            }
+            rc.step(pos, vals);
+            ac.step(pos, avail);
+            prev_const = is_const;
+        }
+    }
+    if(repl.empty())
+        return false;
+
+    // Build the new code
+    std::vector<codew> ret;
+    ret.reserve(code.size());
+    auto it = repl.begin();
+    for(size_t pos = 0; pos < code.size();)
+    {
+        if(it != repl.end() && it->first == pos)
+        {
+            ret.insert(ret.end(), it->second.begin(), it->second.end());
+            pos = g.next(pos);
+            ++it;
+        }
+        else
+            ret.push_back(code[pos++]);
+    }
+    code.swap(ret);
+    return true;
+}
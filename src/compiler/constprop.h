@@ -0,0 +1,30 @@
+/*
+ * FastBasic - Fast basic interpreter for the Atari 8-bit computers
+ * Copyright (C) 2017-2025 Daniel Serpell
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+// constprop.h: Constant and copy propagation of variables
+
+#pragma once
+
+#include "codew.h"
+#include <vector>
+
+// Replaces loads of variables holding a known constant with the constant,
+// and loads of variables holding a copy of other variable with a load of
+// the original. Returns true if the code was changed, the peephole
+// optimizer should run again to fold the new constants.
+bool do_constprop(std::vector<codew> &code);
@@ -0,0 +1,201 @@
+/*
+ * FastBasic - Fast basic interpreter for the Atari 8-bit computers
+ * Copyright (C) 2017-2025 Daniel Serpell
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+// costmodel.cc: Estimated execution cost of the bytecode
+
+#include "costmodel.h"
+#include "tokinfo.h"
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+void token_costs::parse(std::istream &in, const std::string &fname)
+{
+    std::string line;
+    int lnum = 0;
+    while(std::getline(in, line))
+    {
+        lnum++;
+        auto c = line.find('#');
+        if(c != line.npos)
+            line.erase(c);
+        std::istringstream is(line);
+        std::string name;
+        unsigned val;
+        if(!(is >> name))
+            continue;
+        if(!(is >> val) || !(is >> std::ws).eof())
+            throw std::runtime_error(fname + ":" + std::to_string(lnum) +
+                                     ": expected token name and cycles");
+        if(name == "dispatch")
+            dispatch_ = val;
+        else
+            cycles_[codew::intern(name)] = val;
+    }
+}
+
+unsigned token_costs::cycles(int tok) const
+{
+    auto it = cycles_.find(tok);
+    return dispatch_ + (it == cycles_.end() ? default_cycles : it->second);
+}
+
+// Cycles that one byte of code is worth at each level
+static const double byte_cycles[] = {1e9, 16, 1};
+// Assumed iterations of each loop
+static const double loop_iterations = 10;
+
+double opt_goal::cost(int bytes, double cycles) const
+{
+    return bytes * byte_cycles[lvl] + cycles;
+}
+
+double opt_goal::executions(unsigned depth)
+{
+    double n = 1;
+    for(unsigned i = 0; i < depth && i < 3; i++)
+        n *= loop_iterations;
+    return n;
+}
+
+unsigned opt_goal::size(const std::vector<codew> &code) const
+{
+    unsigned n = 0;
+    for(auto &c : code)
+        n += c.size();
+    return n;
+}
+
+unsigned opt_goal::cycles(const std::vector<codew> &code) const
+{
+    unsigned n = 0;
+    for(auto &c : code)
+        if(c.is_tok())
+            n += costs.cycles(c.get_tok_id());
+    return n;
+}
+
+opt_goal::level opt_goal::from_name(const std::string &name)
+{
+    if(name == "size")
+        return o_size;
+    else if(name == "speed")
+        return o_speed;
+    else if(name == "max-speed")
+        return o_max_speed;
+    throw std::runtime_error("invalid optimization level '" + name + "'");
+}
+
+std::vector<unsigned> loop_depth(const std::vector<codew> &code)
+{
+    std::unordered_map<std::string, size_t> labels;
+    for(size_t pos = 0; pos < code.size(); pos++)
+        if(code[pos].is_label())
+            labels[code[pos].get_str()] = pos;
+
+    // Get the last jump back to each label
+    std::map<size_t, size_t> loops;
+    for(size_t pos = 0; pos + 1 < code.size(); pos++)
+    {
+        if(!code[pos].is_tok() || !code[pos + 1].is_sword())
+            continue;
+        auto flow = tokinfo::get(code[pos].get_tok_id()).flow;
+        if(flow != tokinfo::f_jump && flow != tokinfo::f_cjump)
+            continue;
+        auto it = labels.find(code[pos + 1].get_str());
+        if(it != labels.end() && it->second < pos)
+            loops[it->second] = pos;
+    }
+
+    std::vector<unsigned> depth(code.size());
+    for(auto &l : loops)
+        for(auto pos = l.first; pos <= l.second; pos++)
+            depth[pos]++;
+    return depth;
+}
+
+namespace
+{
+// Cost of one line of the program
+class line_cost
+{
+  public:
+    unsigned bytes = 0, cycles = 0, depth = 0;
+    bool hot = false; // One of the most expensive lines inside loops
+};
+} // namespace
+
+// Number of lines inside loops marked as the most expensive
+static const size_t num_hot_lines = 5;
+
+void cost_listing(const std::vector<codew> &code, const token_costs &costs,
+                  const std::map<int, std::string> &source, const std::string &fname,
+                  std::ostream &os)
+{
+    auto depth = loop_depth(code);
+    std::map<int, line_cost> lines;
+    unsigned total_bytes = 0;
+    for(size_t pos = 0; pos < code.size(); pos++)
+    {
+        auto &c = code[pos];
+        auto &l = lines[c.linenum()];
+        l.bytes += c.size();
+        total_bytes += c.size();
+        if(c.is_tok())
+            l.cycles += costs.cycles(c.get_tok_id());
+        l.depth = std::max(l.depth, depth[pos]);
+    }
+
+    // Mark the most expensive lines inside loops
+    std::vector<std::pair<unsigned, int>> in_loop;
+    for(auto &l : lines)
+        if(l.second.depth)
+            in_loop.emplace_back(l.second.cycles, l.first);
+    std::sort(in_loop.begin(), in_loop.end(),
+              [](const std::pair<unsigned, int> &a, const std::pair<unsigned, int> &b) {
+                  return a.first != b.first ? a.first > b.first : a.second < b.second;
+              });
+    for(size_t i = 0; i < in_loop.size() && i < num_hot_lines; i++)
+        lines[in_loop[i].second].hot = true;
+
+    os << "; Estimated cost of '" << fname << "', " << total_bytes << " bytes of bytecode.\n"
+       << "; The cycles are for one execution of each line, including " << costs.dispatch()
+       << " cycles of\n"
+          "; dispatch per token. LOOP is the loop nesting depth, and \"***\" marks the\n"
+          "; lines inside loops with the highest cost per iteration.\n"
+          ";\n"
+          "; LABEL                   BYTES  CYCLES  LOOP\n";
+    for(auto &l : lines)
+    {
+        if(!l.second.bytes)
+            continue;
+        std::string text;
+        auto it = source.find(l.first);
+        if(it != source.end())
+            text = it->second;
+        auto e = text.find_first_of("\r\n\x9B");
+        if(e != text.npos)
+            text.erase(e);
+        os << std::left << std::setw(24) << "@FastBasic_LINE_" + std::to_string(l.first)
+           << std::right << std::setw(6) << l.second.bytes << std::setw(8) << l.second.cycles
+           << std::setw(6) << l.second.depth << (l.second.hot ? " *** " : "     ") << text
+           << "\n";
+    }
+}
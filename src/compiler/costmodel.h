@@ -0,0 +1,86 @@
+/*
+ * FastBasic - Fast basic interpreter for the Atari 8-bit computers
+ * Copyright (C) 2017-2025 Daniel Serpell
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+// costmodel.h: Estimated execution cost of the bytecode
+
+#pragma once
+
+#include "codew.h"
+#include <iosfwd>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Cycles of each token, read from the cost table of the target
+class token_costs
+{
+  private:
+    unsigned dispatch_ = 27;
+    std::unordered_map<int, unsigned> cycles_;
+
+  public:
+    // Cycles of the tokens not in the table
+    static const unsigned default_cycles = 50;
+    // Reads the table from a file, adding to the values already read.
+    // Throws std::runtime_error on errors.
+    void parse(std::istream &in, const std::string &fname);
+    // Cycles of the interpreter loop for each token
+    unsigned dispatch() const { return dispatch_; }
+    // Cycles of one execution of the token, including the dispatch
+    unsigned cycles(int tok) const;
+};
+
+// Objective of the optimizer, used by the passes to decide if a change to
+// the code is worth doing.
+class opt_goal
+{
+  public:
+    enum level
+    {
+        o_size,     // Smaller code, faster only at the same size
+        o_speed,    // Faster code, if it does not grow too much
+        o_max_speed // Fastest code, even if it grows
+    };
+    opt_goal(level lvl, const token_costs &costs) : lvl(lvl), costs(costs) {}
+    level lvl;
+    const token_costs &costs;
+    // Cost of a change that adds "bytes" to the size of the program and
+    // "cycles" to the execution time, negative if the change is an
+    // improvement.
+    double cost(int bytes, double cycles) const;
+    bool better(int bytes, double cycles) const { return cost(bytes, cycles) < 0; }
+    // Estimated number of executions of code at the given loop depth
+    static double executions(unsigned depth);
+    // Size and cycles of one execution of the code
+    unsigned size(const std::vector<codew> &code) const;
+    unsigned cycles(const std::vector<codew> &code) const;
+    // Returns the level with the given name, "size", "speed" or "max-speed".
+    // Throws std::runtime_error if the name is not valid.
+    static level from_name(const std::string &name);
+};
+
+// Returns the loop nesting depth of each position of the code, a loop is
+// the code from a label up to the last jump back to it.
+std::vector<unsigned> loop_depth(const std::vector<codew> &code);
+
+// Writes a listing with the size and the estimated cycles of one execution
+// of each line of the program, using the lines of the "source" text.
+void cost_listing(const std::vector<codew> &code, const token_costs &costs,
+                  const std::map<int, std::string> &source, const std::string &fname,
+                  std::ostream &os);
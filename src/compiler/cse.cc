@@ -0,0 +1,286 @@
+/*
+ * FastBasic - Fast basic interpreter for the Atari 8-bit computers
+ * Copyright (C) 2017-2025 Daniel Serpell
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+// cse.cc: Common subexpression elimination
+
+#include "cse.h"
+#include "cfg.h"
+#include "costmodel.h"
+#include "tokinfo.h"
+#include "vartype.h"
+#include <unordered_map>
+
+// Token IDs used by the optimizer
+static const int TOK_PUSH = codew::intern("TOK_PUSH");
+static const int TOK_VAR_LOAD = codew::intern("TOK_VAR_LOAD");
+static const int TOK_VAR_STORE = codew::intern("TOK_VAR_STORE");
+
+// Maximum number of tokens in the expressions searched
+static const size_t max_expr = 32;
+
+namespace
+{
+// One occurrence of an expression, as indexes in the instructions of the
+// block, "end" is one past the last.
+class occurrence
+{
+  public:
+    size_t start, end;
+};
+
+class cse
+{
+  private:
+    std::vector<codew> &code;
+    std::map<std::string, int> &vars;
+    const opt_goal &goal;
+    cfg g;
+    std::vector<unsigned> loops; // Loop depth of each position
+    std::vector<int> temps; // Variables used to store the values
+    // Changes to the code
+    std::map<size_t, std::vector<codew>> insert;                   // Code to insert before
+    std::map<size_t, std::pair<size_t, std::vector<codew>>> repl; // Replaced code
+
+    bool do_block(size_t b);
+
+  public:
+    cse(std::vector<codew> &code, std::map<std::string, int> &vars, const opt_goal &goal)
+        : code(code), vars(vars), goal(goal), g(code), loops(loop_depth(code))
+    {
+    }
+    bool run();
+};
+} // namespace
+
+bool cse::do_block(size_t b)
+{
+    auto ins = g.instructions(b);
+    auto n = ins.size();
+    std::vector<tokinfo::expr_type> expr(n);
+    std::vector<cfg::effect> eff(n);
+    for(size_t i = 0; i < n; i++)
+    {
+        expr[i] = tokinfo::get(code[ins[i]].get_tok_id()).expr;
+        eff[i] = g.get_effect(ins[i]);
+    }
+    auto end_pos = [&](size_t i) { return i < n ? ins[i] : g.blocks[b].last; };
+
+    // Size and cycles of the instructions before each one, to get the cost
+    // of the expressions
+    std::vector<int> bytes(n + 1);
+    std::vector<double> cycles(n + 1);
+    for(size_t i = 0; i < n; i++)
+    {
+        int sz = 0;
+        for(auto p = ins[i]; p < end_pos(i + 1); p++)
+            sz += code[p].size();
+        bytes[i + 1] = bytes[i] + sz;
+        cycles[i + 1] = cycles[i] + goal.costs.cycles(code[ins[i]].get_tok_id());
+    }
+    auto runs = n ? opt_goal::executions(loops[ins[0]]) : 1;
+    auto push_cycles = goal.costs.cycles(TOK_PUSH);
+    auto load_cycles = goal.costs.cycles(TOK_VAR_LOAD);
+    auto store_cycles = goal.costs.cycles(TOK_VAR_STORE);
+
+    // Get all the expressions in the block, with the same key for the ones
+    // calculating the same value
+    std::map<std::string, std::vector<occurrence>> exprs;
+    for(size_t i = 0; i < n; i++)
+    {
+        if(expr[i] != tokinfo::e_load && expr[i] != tokinfo::e_push_load)
+            continue;
+        int depth = 0;
+        std::string key;
+        for(size_t j = i; j < n && j < i + max_expr; j++)
+        {
+            auto tok = code[ins[j]].get_tok_id();
+            if(expr[j] == tokinfo::e_none)
+                break;
+            if(j == i)
+                tok = tokinfo::load_token(tok);
+            else if(expr[j] == tokinfo::e_push || expr[j] == tokinfo::e_push_load)
+                depth++;
+            else if(expr[j] == tokinfo::e_binary)
+            {
+                if(!depth)
+                    break;
+                depth--;
+            }
+            key += codew::interned(tok);
+            for(auto p = ins[j] + 1; p < end_pos(j + 1); p++)
+                key += " " + code[p].to_asm();
+            key += "\n";
+            if(!depth && j > i)
+                exprs[key].push_back(occurrence{i, j + 1});
+        }
+    }
+
+    // Select the best group of occurrences of one expression, until no
+    // group makes the code better for the objective.
+    std::vector<uint8_t> used(n);
+    size_t num_temps = 0;
+    bool changed = false;
+    while(true)
+    {
+        double best_gain = 0;
+        std::vector<occurrence> best;
+        for(auto &ex : exprs)
+        {
+            // Variables read by the expression
+            std::vector<int> reads;
+            for(auto i = ex.second[0].start; i < ex.second[0].end; i++)
+                if(eff[i].var >= 0 && eff[i].access == tokinfo::v_read)
+                    reads.push_back(eff[i].var);
+            auto killed = [&](size_t i) {
+                if(eff[i].clobber)
+                    return true;
+                for(auto v : reads)
+                {
+                    if(eff[i].mem_write && g.aliased.test(v))
+                        return true;
+                    if(eff[i].var == v && (eff[i].access == tokinfo::v_write ||
+                                           eff[i].access == tokinfo::v_modify))
+                        return true;
+                }
+                return false;
+            };
+            // Split the non overlapping occurrences in groups without a
+            // change of the variables between them
+            std::vector<occurrence> group;
+            auto eval_group = [&]() {
+                if(group.size() < 2)
+                    return;
+                // Change in size and cycles of replacing the expressions,
+                // the first value is stored in a temporary and reloaded. Note
+                // that TOK_PUSH does not keep the value in AX, so it is
+                // always loaded again.
+                int db = 4;
+                double dc = store_cycles + load_cycles;
+                for(size_t k = 1; k < group.size(); k++)
+                {
+                    auto &o = group[k];
+                    db -= bytes[o.end] - bytes[o.start] - 2;
+                    dc -= cycles[o.end] - cycles[o.start] - load_cycles;
+                    if(expr[o.start] == tokinfo::e_push_load)
+                    {
+                        db += 1;
+                        dc += push_cycles;
+                    }
+                }
+                auto gain = -goal.cost(db, dc * runs);
+                if(gain > best_gain)
+                {
+                    best_gain = gain;
+                    best = group;
+                }
+            };
+            size_t last = 0;
+            for(auto &o : ex.second)
+            {
+                if(o.start < last)
+                    continue;
+                bool free = true;
+                for(auto i = o.start; i < o.end; i++)
+                    if(used[i])
+                        free = false;
+                if(!free)
+                    continue;
+                bool kill = false;
+                if(!group.empty())
+                    for(auto i = group.back().end; i < o.start; i++)
+                        kill = kill || killed(i);
+                if(kill)
+                {
+                    eval_group();
+                    group.clear();
+                }
+                group.push_back(o);
+                last = o.end;
+            }
+            eval_group();
+        }
+        if(!best_gain)
+            break;
+
+        // Apply the changes
+        for(auto &o : best)
+            for(auto i = o.start; i < o.end; i++)
+                used[i] = 1;
+        if(num_temps == temps.size())
+        {
+            auto t = add_temp_var(vars);
+            if(t < 0)
+                return changed;
+            temps.push_back(t);
+        }
+        int var = temps[num_temps++];
+        auto name = temp_var_name(var);
+        auto ln = code[ins[best[0].end - 1]].linenum();
+        insert[end_pos(best[0].end)] = {
+            codew::ctok(TOK_VAR_STORE, ln), codew::cvarn(name, var, ln),
+            codew::ctok(TOK_VAR_LOAD, ln), codew::cvarn(name, var, ln)};
+        for(size_t k = 1; k < best.size(); k++)
+        {
+            auto pos = ins[best[k].start];
+            auto ln = code[pos].linenum();
+            std::vector<codew> r;
+            if(expr[best[k].start] == tokinfo::e_push_load)
+                r.push_back(codew::ctok(TOK_PUSH, ln));
+            r.push_back(codew::ctok(TOK_VAR_LOAD, ln));
+            r.push_back(codew::cvarn(name, var, ln));
+            repl[pos] = {end_pos(best[k].end), r};
+        }
+        changed = true;
+    }
+    return changed;
+}
+
+bool cse::run()
+{
+    bool changed = false;
+    for(size_t b = 0; b < g.blocks.size(); b++)
+        changed = do_block(b) || changed;
+    if(!changed)
+        return false;
+
+    // Build the new code
+    std::vector<codew> ret;
+    ret.reserve(code.size());
+    for(size_t pos = 0; pos < code.size();)
+    {
+        auto i = insert.find(pos);
+        if(i != insert.end())
+            ret.insert(ret.end(), i->second.begin(), i->second.end());
+        auto r = repl.find(pos);
+        if(r != repl.end())
+        {
+            ret.insert(ret.end(), r->second.second.begin(), r->second.second.end());
+            pos = r->second.first;
+        }
+        else
+            ret.push_back(code[pos++]);
+    }
+    code.swap(ret);
+    return true;
+}
+
+bool do_cse(std::vector<codew> &code, std::map<std::string, int> &vars, const opt_goal &goal)
+{
+    cse c(code, vars, goal);
+    return c.run();
+}
@@ -0,0 +1,180 @@
+/*
+ * FastBasic - Fast basic interpreter for the Atari 8-bit computers
+ * Copyright (C) 2017-2025 Daniel Serpell
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+// deadcode.cc: Removal of unreachable code and unused PROC and DATA
+
+#include "deadcode.h"
+#include "cfg.h"
+#include "parser.h"
+#include "tokinfo.h"
+#include <iostream>
+#include <unordered_map>
+
+unsigned do_deadcode(std::vector<codew> &code, bool report)
+{
+    cfg g(code);
+    if(g.blocks.empty())
+        return 0;
+
+    // Blocks of the labels in the code and DATA arrays
+    std::unordered_map<std::string, size_t> label_block, label_data;
+    for(size_t pos = 0; pos < code.size(); pos++)
+        if(code[pos].is_label() && g.block_at(pos) != size_t(-1))
+            label_block[code[pos].get_str()] = g.block_at(pos);
+    for(size_t i = 0; i < g.procs.size(); i++)
+        if(g.procs[i].is_data)
+            label_data[g.procs[i].name] = i;
+
+    // Follow the edges from the start of the program, any label referenced
+    // from the reachable code or DATA is also reachable.
+    std::vector<uint8_t> reach(g.blocks.size()), reach_data(g.procs.size());
+    std::vector<size_t> work, work_data;
+    auto add_block = [&](size_t b) {
+        if(!reach[b])
+        {
+            reach[b] = 1;
+            work.push_back(b);
+        }
+    };
+    auto add_refs = [&](size_t start, size_t end) {
+        for(auto pos = start; pos < end; pos++)
+        {
+            if(!code[pos].is_sword() && !code[pos].is_sbyte())
+                continue;
+            auto &name = code[pos].get_str();
+            auto b = label_block.find(name);
+            if(b != label_block.end())
+                add_block(b->second);
+            auto d = label_data.find(name);
+            if(d != label_data.end() && !reach_data[d->second])
+            {
+                reach_data[d->second] = 1;
+                work_data.push_back(d->second);
+            }
+        }
+    };
+    add_block(0);
+
+    // The DATA arrays not referenced from the BASIC code are kept, as the
+    // exported labels can be used from assembly modules; only the DATA
+    // referenced exclusively from removed code is removed.
+    std::vector<uint8_t> referenced(g.procs.size());
+    for(size_t pos = 0; pos < code.size(); pos++)
+    {
+        if(!code[pos].is_sword() && !code[pos].is_sbyte())
+            continue;
+        auto d = label_data.find(code[pos].get_str());
+        if(d == label_data.end())
+            continue;
+        auto &p = g.procs[d->second];
+        if(pos < p.start || pos >= p.end)
+            referenced[d->second] = 1;
+    }
+    for(size_t i = 0; i < g.procs.size(); i++)
+    {
+        if(g.procs[i].is_data && !referenced[i])
+        {
+            reach_data[i] = 1;
+            work_data.push_back(i);
+        }
+    }
+
+    while(!work.empty() || !work_data.empty())
+    {
+        if(!work_data.empty())
+        {
+            auto &p = g.procs[work_data.back()];
+            work_data.pop_back();
+            add_refs(p.start, p.end);
+            continue;
+        }
+        auto b = work.back();
+        work.pop_back();
+        auto &blk = g.blocks[b];
+        add_refs(blk.first, blk.last);
+        for(auto s : blk.succ)
+            add_block(s);
+        // Always keep the code after a call, even if the procedure does
+        // not return.
+        auto ins = g.instructions(b);
+        if(!ins.empty() && code[ins.back()].is_tok() &&
+           tokinfo::get(code[ins.back()].get_tok_id()).flow == tokinfo::f_call &&
+           b + 1 < g.blocks.size() && g.blocks[b + 1].first == blk.last)
+            add_block(b + 1);
+    }
+
+    // Mark the code to remove and count the bytes in each procedure
+    std::vector<uint8_t> remove(code.size());
+    std::vector<unsigned> removed(g.procs.size()), total(g.procs.size());
+    for(size_t i = 0; i < g.procs.size(); i++)
+    {
+        auto &p = g.procs[i];
+        for(auto pos = p.start; pos < p.end; pos++)
+            total[i] += code[pos].size();
+        if(p.is_data)
+        {
+            if(reach_data[i])
+                continue;
+            for(auto pos = p.start; pos < p.end; pos++)
+                remove[pos] = 1;
+            removed[i] = total[i];
+            continue;
+        }
+        for(auto b = p.first; b < p.last; b++)
+        {
+            if(reach[b])
+                continue;
+            for(auto pos = g.blocks[b].first; pos < g.blocks[b].last; pos++)
+            {
+                remove[pos] = 1;
+                removed[i] += code[pos].size();
+            }
+        }
+    }
+
+    unsigned bytes = 0;
+    bool changed = false;
+    for(size_t i = 0; i < g.procs.size(); i++)
+    {
+        auto &p = g.procs[i];
+        for(auto pos = p.start; pos < p.end; pos++)
+            changed = changed || remove[pos];
+        bytes += removed[i];
+        if(!report || !removed[i])
+            continue;
+        std::string name = p.name.empty() ? "main program"
+                           : (p.is_data ? "DATA " : "PROC ") +
+                                 p.name.substr(std::string(parse::label_prefix).size());
+        if(removed[i] == total[i] && !p.name.empty())
+            std::cerr << "dead code: removed " << name << " (" << removed[i] << " bytes)\n";
+        else
+            std::cerr << "dead code: removed " << removed[i] << " bytes of unreachable code in "
+                      << name << "\n";
+    }
+    if(!changed)
+        return 0;
+
+    // Build the new code
+    std::vector<codew> ret;
+    ret.reserve(code.size());
+    for(size_t pos = 0; pos < code.size(); pos++)
+        if(!remove[pos])
+            ret.push_back(code[pos]);
+    code.swap(ret);
+    return bytes;
+}
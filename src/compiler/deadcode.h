@@ -0,0 +1,30 @@
+/*
+ * FastBasic - Fast basic interpreter for the Atari 8-bit computers
+ * Copyright (C) 2017-2025 Daniel Serpell
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+// deadcode.h: Removal of unreachable code and unused PROC and DATA
+
+#pragma once
+
+#include "codew.h"
+#include <vector>
+
+// Removes the code not reachable from the start of the program, including
+// the PROCs never called, and the DATA arrays referenced only from the
+// removed code. If "report" is true, shows each removed PROC and DATA.
+// Returns the number of bytes removed.
+unsigned do_deadcode(std::vector<codew> &code, bool report);
@@ -0,0 +1,100 @@
+/*
+ * FastBasic - Fast basic interpreter for the Atari 8-bit computers
+ * Copyright (C) 2017-2025 Daniel Serpell
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+// deadstore.cc: Dead store elimination
+
+#include "deadstore.h"
+#include "cfg.h"
+
+// Token IDs used by the optimizer
+static const int TOK_0 = codew::intern("TOK_0");
+static const int TOK_1 = codew::intern("TOK_1");
+static const int TOK_BYTE = codew::intern("TOK_BYTE");
+static const int TOK_NUM = codew::intern("TOK_NUM");
+static const int TOK_VAR_LOAD = codew::intern("TOK_VAR_LOAD");
+static const int TOK_VAR_STORE = codew::intern("TOK_VAR_STORE");
+static const int TOK_VAR_STORE_0 = codew::intern("TOK_VAR_STORE_0");
+
+// Returns true if the instruction only loads a value into AX, without
+// other effects. The value in AX is not used after a store.
+static bool is_simple_load(const codew &c)
+{
+    return c.is_tok(TOK_0) || c.is_tok(TOK_1) || c.is_tok(TOK_BYTE) || c.is_tok(TOK_NUM) ||
+           c.is_tok(TOK_VAR_LOAD);
+}
+
+bool do_deadstore(std::vector<codew> &code)
+{
+    cfg g(code);
+    if(!g.num_vars)
+        return false;
+    liveness live(g);
+
+    // Mark the instructions to remove
+    std::vector<uint8_t> remove(code.size());
+    bool changed = false;
+    for(size_t b = 0; b < g.blocks.size(); b++)
+    {
+        auto l = live.out[b];
+        auto ins = g.instructions(b);
+        for(size_t i = ins.size(); i > 0; i--)
+        {
+            auto pos = ins[i - 1];
+            auto &c = code[pos];
+            if(c.is_tok(TOK_VAR_STORE) || c.is_tok(TOK_VAR_STORE_0))
+            {
+                auto var = g.get_effect(pos).var;
+                if(var >= 0 && !l.test(var))
+                {
+                    remove[pos] = 1;
+                    if(i > 1 && c.is_tok(TOK_VAR_STORE) && is_simple_load(code[ins[i - 2]]))
+                        remove[ins[i - 2]] = 1;
+                    changed = true;
+                    continue;
+                }
+            }
+            // Removed loads don't make the variable live
+            if(!remove[pos])
+                live.step(pos, l);
+        }
+    }
+    if(!changed)
+        return false;
+
+    // Build the new code
+    std::vector<codew> ret;
+    ret.reserve(code.size());
+    for(size_t pos = 0; pos < code.size();)
+    {
+        if(remove[pos])
+            pos = g.next(pos);
+        else
+            ret.push_back(code[pos++]);
+    }
+    code.swap(ret);
+    return true;
+}
+
+std::set<int> used_variables(const std::vector<codew> &code)
+{
+    std::set<int> ret;
+    for(auto &c : code)
+        if(c.is_varn())
+            ret.insert(c.get_varn());
+    return ret;
+}
@@ -0,0 +1,33 @@
+/*
+ * FastBasic - Fast basic interpreter for the Atari 8-bit computers
+ * Copyright (C) 2017-2025 Daniel Serpell
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+// deadstore.h: Dead store elimination
+
+#pragma once
+
+#include "codew.h"
+#include <set>
+#include <vector>
+
+// Removes the stores to variables that are never read after, and the
+// loads of the stored values. Returns true if the code was changed.
+bool do_deadstore(std::vector<codew> &code);
+
+// Returns the number of each variable used in the code, the rest can be
+// removed from the variable list.
+std::set<int> used_variables(const std::vector<codew> &code);
@@ -0,0 +1,347 @@
+/*
+ * FastBasic - Fast basic interpreter for the Atari 8-bit computers
+ * Copyright (C) 2017-2025 Daniel Serpell
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+// inliner.cc: Inline expansion of PROC calls
+
+#include "inliner.h"
+#include "costmodel.h"
+#include "parser.h"
+#include <algorithm>
+#include <iostream>
+#include <set>
+
+// Token IDs used by the optimizer
+static const int TOK_CALL = codew::intern("TOK_CALL");
+static const int TOK_POP = codew::intern("TOK_POP");
+static const int TOK_PUSH = codew::intern("TOK_PUSH");
+static const int TOK_RET = codew::intern("TOK_RET");
+
+namespace
+{
+// A reference to a PROC label
+class reference
+{
+  public:
+    size_t pos;     // Position of the label argument
+    bool call;      // Argument of a TOK_CALL
+    bool push;      // The call follows a TOK_PUSH
+    unsigned depth; // Loop depth of the reference
+};
+
+class inliner
+{
+  private:
+    std::map<std::string, std::vector<codew>> &procs;
+    unsigned limit;
+    const opt_goal &goal;
+    const std::set<std::string> &keep;
+    bool report;
+    int copies = 0; // Number of inlined copies, used to rename the labels
+    // References to each PROC label, by the PROC containing them, and the
+    // labels referenced from each PROC, updated on each expansion.
+    std::map<std::string, std::map<std::string, std::vector<reference>>> refs_to;
+    std::map<std::string, std::set<std::string>> refs_from;
+
+    bool is_proc_label(const codew &c) const;
+    void add_ref(const std::string &key, const std::vector<codew> &code, size_t i,
+                 unsigned depth);
+    void index_refs(const std::string &key);
+    void remove_refs(const std::string &key);
+    bool can_inline(const std::vector<codew> &body) const;
+    void expand(const std::string &key, const std::string &name,
+                const std::vector<codew> &body, const std::vector<unsigned> &depth);
+    void show(const std::string &name, unsigned size, int calls, const char *msg) const;
+
+  public:
+    inliner(std::map<std::string, std::vector<codew>> &procs, unsigned limit,
+            const opt_goal &goal, const std::set<std::string> &keep, bool report)
+        : procs(procs), limit(limit), goal(goal), keep(keep), report(report)
+    {
+    }
+    bool run();
+};
+} // namespace
+
+bool inliner::is_proc_label(const codew &c) const
+{
+    std::string prefix = parse::label_prefix;
+    return c.is_label() && c.get_str().compare(0, prefix.size(), prefix) == 0;
+}
+
+// Stores the reference from the PROC "key" if the word at position "i" of
+// the code is a PROC label.
+void inliner::add_ref(const std::string &key, const std::vector<codew> &code, size_t i,
+                      unsigned depth)
+{
+    std::string prefix = parse::label_prefix;
+    auto &c = code[i];
+    if((!c.is_sword() && !c.is_sbyte()) || c.get_str().compare(0, prefix.size(), prefix))
+        return;
+    reference r{i, false, false, depth};
+    if(i > 0 && code[i - 1].is_tok(TOK_CALL))
+    {
+        r.call = true;
+        r.push = i > 1 && code[i - 2].is_tok(TOK_PUSH);
+    }
+    refs_to[c.get_str()][key].push_back(r);
+    refs_from[key].insert(c.get_str());
+}
+
+// Stores all the references to PROC labels in the code of the PROC "key"
+void inliner::index_refs(const std::string &key)
+{
+    auto &code = procs[key];
+    auto depth = loop_depth(code);
+    for(size_t i = 0; i < code.size(); i++)
+        add_ref(key, code, i, depth[i]);
+}
+
+// Removes all the references from the PROC "key"
+void inliner::remove_refs(const std::string &key)
+{
+    for(auto &name : refs_from[key])
+        refs_to[name].erase(key);
+    refs_from.erase(key);
+}
+
+// Checks that the PROC has the expected structure: the label, the code
+// without other returns and the final TOK_RET.
+bool inliner::can_inline(const std::vector<codew> &body) const
+{
+    if(body.size() < 2 || !is_proc_label(body[0]) || !body.back().is_tok(TOK_RET))
+        return false;
+    for(size_t i = 1; i < body.size() - 1; i++)
+        if(body[i].is_tok(TOK_RET) || is_proc_label(body[i]))
+            return false;
+    return true;
+}
+
+// Replaces all the calls to "name" in the code of the PROC "key" with the
+// body of the PROC, with "depth" the loop depth of each position of the body.
+// The other references from the code are moved to the new positions, and
+// the inlined ones are stored with the depth of the call added.
+void inliner::expand(const std::string &key, const std::string &name,
+                     const std::vector<codew> &body, const std::vector<unsigned> &depth)
+{
+    auto &code = procs[key];
+
+    // Labels defined in the PROC, renamed on each copy
+    std::set<std::string> labels;
+    for(size_t i = 1; i < body.size() - 1; i++)
+        if(body[i].is_label())
+            labels.insert(body[i].get_str());
+
+    // The calls to replace, in code order. The last parameter is pushed
+    // before the call and popped at the start of the PROC, keep it in the
+    // register instead.
+    std::vector<reference> calls, others;
+    for(auto &r : refs_to[name][key])
+        (r.call ? calls : others).push_back(r);
+    std::sort(calls.begin(), calls.end(),
+              [](const reference &a, const reference &b) { return a.pos < b.pos; });
+    if(others.empty())
+    {
+        refs_to[name].erase(key);
+        refs_from[key].erase(name);
+    }
+    else
+        refs_to[name][key].swap(others);
+    bool pop = body[1].is_tok(TOK_POP);
+
+    // Move the other references by the change in size of the calls before
+    std::vector<size_t> ends;
+    std::vector<long> moved;
+    long diff = 0;
+    for(auto &r : calls)
+    {
+        // The copied words replace the PUSH, CALL and label
+        bool reg = r.push && pop;
+        diff += long(body.size() - 2 - reg) - long(2 + reg);
+        ends.push_back(r.pos);
+        moved.push_back(diff);
+    }
+    for(auto &n : refs_from[key])
+    {
+        for(auto &r : refs_to[n][key])
+        {
+            auto k = std::lower_bound(ends.begin(), ends.end(), r.pos) - ends.begin();
+            if(k)
+                r.pos += moved[k - 1];
+        }
+    }
+
+    // Replace the calls from the last one, so the positions of the others
+    // don't change, and store the new references after.
+    std::vector<size_t> starts(calls.size());
+    for(size_t k = calls.size(); k > 0; k--)
+    {
+        auto &r = calls[k - 1];
+        bool reg = r.push && pop;
+        auto suffix = "_i" + std::to_string(copies + k);
+        std::vector<codew> copy;
+        for(size_t j = reg ? 2 : 1; j < body.size() - 1; j++)
+        {
+            auto &c = body[j];
+            if(c.is_label() && labels.count(c.get_str()))
+                copy.push_back(codew::clabel(c.get_str() + suffix, c.linenum()));
+            else if(c.is_sword() && labels.count(c.get_str()))
+                copy.push_back(codew::cword(c.get_str() + suffix, c.linenum()));
+            else
+                copy.push_back(c);
+        }
+        // Overwrite the PUSH, CALL and label, and insert or remove the rest
+        auto at = code.begin() + r.pos - 1 - reg;
+        size_t n = std::min(copy.size(), size_t(2 + reg));
+        std::copy(copy.begin(), copy.begin() + n, at);
+        if(copy.size() > n)
+            code.insert(at + n, copy.begin() + n, copy.end());
+        else
+            code.erase(at + n, at + 2 + reg);
+        starts[k - 1] = r.pos - 1 - reg + (k > 1 ? moved[k - 2] : 0);
+    }
+    for(size_t k = 0; k < calls.size(); k++)
+    {
+        bool reg = calls[k].push && pop;
+        for(size_t j = reg ? 2 : 1, i = starts[k]; j < body.size() - 1; j++, i++)
+            add_ref(key, code, i, calls[k].depth + depth[j]);
+    }
+    copies += calls.size();
+}
+
+void inliner::show(const std::string &name, unsigned size, int calls, const char *msg) const
+{
+    if(report)
+        std::cerr << "inline: PROC " << name.substr(std::string(parse::label_prefix).size())
+                  << " (" << size << " bytes, " << calls << (calls == 1 ? " call): " : " calls): ")
+                  << msg << "\n";
+}
+
+bool inliner::run()
+{
+    // Process the PROCs in source order, so the results don't depend on the
+    // label numbers.
+    std::vector<std::string> order;
+    for(auto &p : procs)
+        if(!p.first.empty() && p.second.size())
+            order.push_back(p.first);
+    std::sort(order.begin(), order.end(), [&](const std::string &a, const std::string &b) {
+        return procs[a][0].linenum() < procs[b][0].linenum();
+    });
+
+    // Index the references to the PROCs in all the code
+    for(auto &p : procs)
+        index_refs(p.first);
+
+    bool changed = false;
+    for(auto &key : order)
+    {
+        auto &body = procs[key];
+        if(!can_inline(body))
+            continue;
+        auto &name = body[0].get_str();
+        unsigned size = 0;
+        for(size_t i = 1; i < body.size() - 1; i++)
+            size += body[i].size();
+
+        // Count the calls and other references to the PROC, and estimate
+        // the change in size and cycles of inlining all the calls.
+        int calls = 0, refs = 0, bytes = 0;
+        double cycles = 0;
+        bool recursive = false;
+        auto call_cycles = goal.costs.cycles(TOK_CALL) + goal.costs.cycles(TOK_RET);
+        auto arg_cycles = goal.costs.cycles(TOK_PUSH) + goal.costs.cycles(TOK_POP);
+        std::vector<std::string> callers;
+        for(auto &p : refs_to[name])
+        {
+            if(p.second.empty())
+                continue;
+            if(p.first == key)
+            {
+                recursive = true;
+                continue;
+            }
+            callers.push_back(p.first);
+            for(auto &r : p.second)
+            {
+                if(!r.call)
+                {
+                    refs++;
+                    continue;
+                }
+                auto n = opt_goal::executions(r.depth);
+                calls++;
+                bytes += int(size) - 3;
+                cycles -= n * call_cycles;
+                if(r.push && body[1].is_tok(TOK_POP))
+                {
+                    bytes -= 2;
+                    cycles -= n * arg_cycles;
+                }
+            }
+        }
+        if(!refs)
+            bytes -= int(size) + 1;
+        if(recursive)
+        {
+            show(name, size, calls, "recursive, not inlined");
+            continue;
+        }
+        if(!calls)
+        {
+            show(name, size, calls, "not called");
+            continue;
+        }
+        if(keep.count(name))
+        {
+            show(name, size, calls, "native code, not inlined");
+            continue;
+        }
+        if(size > limit && (calls > 1 || refs))
+        {
+            show(name, size, calls, "too big, not inlined");
+            continue;
+        }
+        if((calls > 1 || refs) && !goal.better(bytes, cycles))
+        {
+            show(name, size, calls, "no gain, not inlined");
+            continue;
+        }
+
+        // Expand into the code calling it, the PROC is not needed after if
+        // there are no other references.
+        auto copy = body;
+        auto depth = loop_depth(copy);
+        for(auto &c : callers)
+            expand(c, name, copy, depth);
+        if(!refs)
+        {
+            procs[key].clear();
+            remove_refs(key);
+        }
+        show(copy[0].get_str(), size, calls, refs ? "inlined" : "inlined, removed");
+        changed = true;
+    }
+    return changed;
+}
+
+bool do_inline(std::map<std::string, std::vector<codew>> &procs, unsigned limit,
+               const opt_goal &goal, const std::set<std::string> &keep, bool report)
+{
+    inliner i(procs, limit, goal, keep, report);
+    return i.run();
+}
@@ -0,0 +1,39 @@
+/*
+ * FastBasic - Fast basic interpreter for the Atari 8-bit computers
+ * Copyright (C) 2017-2025 Daniel Serpell
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+// inliner.h: Inline expansion of PROC calls
+
+#pragma once
+
+#include "codew.h"
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+class opt_goal;
+
+// Replaces the calls to the PROCs with the body of the PROC, for PROCs
+// called only once, or of up to "limit" bytes when the estimated size and
+// cycles are better for the objective. Works on the code of each PROC before
+// joining all the code, and removes the PROCs that are not used after
+// inlining. The PROCs with the labels in "keep" are not inlined. If "report"
+// is true, shows the decision on each PROC. Returns true if the code was
+// changed.
+bool do_inline(std::map<std::string, std::vector<codew>> &procs, unsigned limit,
+               const opt_goal &goal, const std::set<std::string> &keep, bool report);
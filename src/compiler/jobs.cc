@@ -0,0 +1,150 @@
+/*
+ * FastBasic - Fast basic interpreter for the Atari 8-bit computers
+ * Copyright (C) 2017-2025 Daniel Serpell
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+// jobs.cc: Run independent compilation jobs in parallel
+
+#include "jobs.h"
+#include <atomic>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+
+namespace
+{
+// The output of one job, as a list of texts with the destination stream
+class job_output
+{
+  public:
+    std::vector<std::pair<std::streambuf *, std::string>> parts;
+};
+
+// Output of the job running in the current thread, or null
+thread_local job_output *current_output = nullptr;
+
+// A stream buffer installed in std::cout and std::cerr while the jobs are
+// running, stores the output of each thread in the current job output.
+class capture_buf : public std::streambuf
+{
+    std::ostream &os;
+    std::streambuf *orig;
+
+  public:
+    capture_buf(std::ostream &os) : os(os), orig(os.rdbuf(this)) {}
+    ~capture_buf() { os.rdbuf(orig); }
+
+  protected:
+    std::streamsize xsputn(const char *s, std::streamsize n) override
+    {
+        auto out = current_output;
+        if(!out)
+            return orig->sputn(s, n);
+        if(out->parts.empty() || out->parts.back().first != orig)
+            out->parts.emplace_back(orig, std::string());
+        out->parts.back().second.append(s, n);
+        return n;
+    }
+    int_type overflow(int_type c) override
+    {
+        if(traits_type::eq_int_type(c, traits_type::eof()))
+            return traits_type::not_eof(c);
+        char ch = traits_type::to_char_type(c);
+        return xsputn(&ch, 1) == 1 ? c : traits_type::eof();
+    }
+    int sync() override { return current_output ? 0 : orig->pubsync(); }
+};
+} // namespace
+
+unsigned jobs::max_threads()
+{
+    auto n = std::thread::hardware_concurrency();
+    return n ? n : 1;
+}
+
+int jobs::run(const std::vector<job> &list, unsigned threads)
+{
+    if(threads > list.size())
+        threads = list.size();
+
+    // Run in the current thread if there is nothing to parallelize
+    if(threads < 2)
+    {
+        for(auto &j : list)
+        {
+            auto e = j();
+            if(e)
+                return e;
+        }
+        return 0;
+    }
+
+    std::vector<job_output> outputs(list.size());
+    std::vector<int> results(list.size(), 0);
+    std::vector<bool> done(list.size(), false);
+    std::atomic<size_t> next_job(0);
+    std::atomic<bool> failed(false);
+    std::mutex lock;
+    size_t next_write = 0; // First job with the output not written yet
+    int error = 0;
+
+    capture_buf cout_buf(std::cout), cerr_buf(std::cerr);
+
+    auto worker = [&]() {
+        while(!failed)
+        {
+            auto n = next_job++;
+            if(n >= list.size())
+                break;
+            current_output = &outputs[n];
+            auto e = list[n]();
+            current_output = nullptr;
+            if(e)
+                failed = true;
+
+            // Write the output of all the finished jobs, in order
+            std::lock_guard<std::mutex> guard(lock);
+            results[n] = e;
+            done[n] = true;
+            while(next_write < list.size() && done[next_write])
+            {
+                for(auto &p : outputs[next_write].parts)
+                {
+                    p.first->sputn(p.second.data(), p.second.size());
+                    p.first->pubsync();
+                }
+                outputs[next_write].parts.clear();
+                error = results[next_write++];
+                if(error)
+                {
+                    // Skip the output of the following jobs
+                    next_write = list.size();
+                    break;
+                }
+            }
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for(unsigned i = 0; i < threads; i++)
+        pool.emplace_back(worker);
+    for(auto &t : pool)
+        t.join();
+
+    return error;
+}
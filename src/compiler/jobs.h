@@ -0,0 +1,40 @@
+/*
+ * FastBasic - Fast basic interpreter for the Atari 8-bit computers
+ * Copyright (C) 2017-2025 Daniel Serpell
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+// jobs.h: Run independent compilation jobs in parallel
+#pragma once
+
+#include <functional>
+#include <vector>
+
+namespace jobs
+{
+// A job, returns 0 on success or the error code
+using job = std::function<int()>;
+
+// Runs the jobs in the list using up to "threads" threads at the same time.
+// The output of each job to std::cout and std::cerr is buffered and written
+// in the order of the list, as if the jobs were run one after the other.
+// After a job fails no new jobs are started, and the output of the jobs after
+// the failed one is discarded. Returns the error of the first failed job.
+int run(const std::vector<job> &list, unsigned threads);
+
+// Returns the number of threads that can run at the same time in the host
+unsigned max_threads();
+
+} // namespace jobs
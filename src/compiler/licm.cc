@@ -0,0 +1,418 @@
+/*
+ * FastBasic - Fast basic interpreter for the Atari 8-bit computers
+ * Copyright (C) 2017-2025 Daniel Serpell
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+// licm.cc: Loop invariant code motion
+
+#include "licm.h"
+#include "cfg.h"
+#include "costmodel.h"
+#include "parser.h"
+#include "tokinfo.h"
+#include "vartype.h"
+#include <algorithm>
+#include <unordered_map>
+
+// Token IDs used by the optimizer
+static const int TOK_CSTRING = codew::intern("TOK_CSTRING");
+static const int TOK_DECVAR = codew::intern("TOK_DECVAR");
+static const int TOK_INCVAR = codew::intern("TOK_INCVAR");
+static const int TOK_PUSH = codew::intern("TOK_PUSH");
+static const int TOK_VAR_LOAD = codew::intern("TOK_VAR_LOAD");
+static const int TOK_VAR_SADDR = codew::intern("TOK_VAR_SADDR");
+static const int TOK_VAR_STORE = codew::intern("TOK_VAR_STORE");
+
+static const size_t npos = size_t(-1);
+
+namespace
+{
+// A loop: the code from a label up to the last jump back to the label
+class loop
+{
+  public:
+    size_t start = 0, end = 0; // Code positions, "start" is the label
+    size_t proc = 0;
+};
+
+class licm
+{
+  private:
+    std::vector<codew> &code;
+    std::map<std::string, int> &vars;
+    const opt_goal &goal;
+    cfg g;
+    std::vector<unsigned> loops; // Loop depth of each position
+    std::vector<bitvec> proc_writes;  // Variables written by each procedure
+    std::vector<uint8_t> proc_clobber; // Procedures with unknown effects
+    std::vector<std::pair<size_t, size_t>> jumps; // Jump position and target position
+    std::vector<uint8_t> taken;                   // Code moved out of a loop
+    // Changes to the code
+    std::map<size_t, std::vector<codew>> header;  // Code to insert after the loop label
+    std::map<size_t, std::pair<size_t, int>> repl; // Expression end and variable
+    std::map<size_t, std::string> retarget;      // New label of the jumps
+
+    size_t flow_last(size_t b) const;
+    void get_proc_writes();
+    bool loop_writes(const loop &l, bitvec &writes) const;
+    bool ax_unused(const loop &l) const;
+    size_t expr_end(size_t pos, size_t end, const bitvec &writes) const;
+    bool worth(size_t pos, size_t end, const std::vector<codew> &ex, bool is_new) const;
+    void do_loop(const loop &l);
+
+  public:
+    licm(std::vector<codew> &code, std::map<std::string, int> &vars, const opt_goal &goal)
+        : code(code), vars(vars), goal(goal), g(code), loops(loop_depth(code)),
+          taken(code.size())
+    {
+    }
+    bool run();
+};
+} // namespace
+
+// Returns the position of the last instruction of the block if it is a
+// control flow token, or npos
+size_t licm::flow_last(size_t b) const
+{
+    auto ins = g.instructions(b);
+    if(ins.empty() || tokinfo::get(code[ins.back()].get_tok_id()).flow == tokinfo::f_none)
+        return npos;
+    return ins.back();
+}
+
+// Gets the variables written by each procedure, including the procedures
+// called and the ones continued into by falling through the end or by a
+// jump.
+void licm::get_proc_writes()
+{
+    auto np = g.procs.size();
+    proc_writes.assign(np, bitvec(g.num_vars));
+    proc_clobber.assign(np, 0);
+    std::vector<std::vector<size_t>> callees(np);
+    for(size_t b = 0; b < g.blocks.size(); b++)
+    {
+        auto p = g.blocks[b].proc;
+        for(auto pos : g.instructions(b))
+        {
+            auto e = g.get_effect(pos);
+            if(e.clobber)
+                proc_clobber[p] = 1;
+            if(e.mem_write)
+                proc_writes[p] |= g.aliased;
+            if(e.var >= 0 && (e.access == tokinfo::v_write || e.access == tokinfo::v_modify))
+                proc_writes[p].set(e.var);
+        }
+        auto last = flow_last(b);
+        if(last != npos && tokinfo::get(code[last].get_tok_id()).flow == tokinfo::f_ret)
+            continue;
+        for(auto s : g.blocks[b].succ)
+            if(g.blocks[s].proc != p)
+                callees[p].push_back(g.blocks[s].proc);
+    }
+    for(bool changed = true; changed;)
+    {
+        changed = false;
+        for(size_t p = 0; p < np; p++)
+        {
+            for(auto q : callees[p])
+            {
+                auto w = proc_writes[p];
+                w |= proc_writes[q];
+                if(w != proc_writes[p] || proc_clobber[q] > proc_clobber[p])
+                {
+                    proc_writes[p] = w;
+                    proc_clobber[p] |= proc_clobber[q];
+                    changed = true;
+                }
+            }
+        }
+    }
+}
+
+// Gets the variables that can be written while the loop executes, returns
+// false if the loop has unknown effects.
+bool licm::loop_writes(const loop &l, bitvec &writes) const
+{
+    // The external variables can be written by other code on each iteration
+    writes = g.external;
+    for(auto pos = l.start; pos < l.end; pos = g.next(pos))
+    {
+        if(!code[pos].is_tok())
+            continue;
+        auto e = g.get_effect(pos);
+        if(e.clobber)
+            return false;
+        if(e.mem_write)
+            writes |= g.aliased;
+        if(e.var >= 0 && (e.access == tokinfo::v_write || e.access == tokinfo::v_modify))
+            writes.set(e.var);
+        if(tokinfo::get(code[pos].get_tok_id()).flow == tokinfo::f_call)
+        {
+            for(auto s : g.blocks[g.block_at(pos)].succ)
+            {
+                auto p = g.blocks[s].proc;
+                if(proc_clobber[p])
+                    return false;
+                writes |= proc_writes[p];
+            }
+        }
+    }
+    return true;
+}
+
+// Checks that the loop body sets AX before reading it, so the value left
+// by the code inserted at the start is not used.
+bool licm::ax_unused(const loop &l) const
+{
+    for(auto pos = l.start; pos < l.end; pos++)
+    {
+        auto &c = code[pos];
+        if(c.is_label())
+            continue;
+        if(!c.is_tok())
+            return false;
+        auto tok = c.get_tok_id();
+        if(tokinfo::get(tok).expr == tokinfo::e_load || tok == TOK_VAR_SADDR ||
+           tok == TOK_CSTRING)
+            return true;
+        if(tok != TOK_INCVAR && tok != TOK_DECVAR)
+            return false;
+        pos = g.next(pos) - 1;
+    }
+    return false;
+}
+
+// Returns the end of the longest invariant expression starting at "pos",
+// or npos if there is no expression worth moving.
+size_t licm::expr_end(size_t pos, size_t end, const bitvec &writes) const
+{
+    size_t ret = npos;
+    int depth = 0, count = 0;
+    for(auto p = pos; p < end; p = g.next(p))
+    {
+        auto &c = code[p];
+        if(!c.is_tok() || taken[p])
+            break;
+        auto &info = tokinfo::get(c.get_tok_id());
+        auto e = g.get_effect(p);
+        if(info.expr == tokinfo::e_none)
+            break;
+        if(e.var >= 0 && e.access == tokinfo::v_read && writes.test(e.var))
+            break;
+        if(p == pos)
+        {
+            // The push of the first token is not part of the expression
+            if(info.expr != tokinfo::e_load && info.expr != tokinfo::e_push_load)
+                break;
+        }
+        else if(info.expr == tokinfo::e_push || info.expr == tokinfo::e_push_load)
+            depth++;
+        else if(info.expr == tokinfo::e_binary)
+        {
+            if(!depth)
+                break;
+            depth--;
+        }
+        count++;
+        if(!depth && count > 1)
+            ret = g.next(p);
+    }
+    return ret;
+}
+
+// Returns true if replacing the expression from "pos" to "end" with a
+// variable is better for the objective, "ex" is the code to calculate the
+// value before the loop, only added if "is_new".
+bool licm::worth(size_t pos, size_t end, const std::vector<codew> &ex, bool is_new) const
+{
+    std::vector<codew> old(code.begin() + pos, code.begin() + end);
+    int bytes = 2 - int(goal.size(old));
+    double cycles = double(goal.costs.cycles(TOK_VAR_LOAD)) - goal.cycles(old);
+    if(tokinfo::get(code[pos].get_tok_id()).expr == tokinfo::e_push_load)
+    {
+        bytes++;
+        cycles += goal.costs.cycles(TOK_PUSH);
+    }
+    auto d = loops[pos];
+    cycles *= opt_goal::executions(d);
+    if(is_new)
+    {
+        bytes += goal.size(ex) + 2;
+        cycles += (goal.cycles(ex) + goal.costs.cycles(TOK_VAR_STORE)) *
+                  opt_goal::executions(d ? d - 1 : 0);
+    }
+    return goal.better(bytes, cycles);
+}
+
+void licm::do_loop(const loop &l)
+{
+    // The loop must only be entered from the label
+    for(auto &j : jumps)
+        if((j.first < l.start || j.first >= l.end) && j.second > l.start && j.second < l.end)
+            return;
+    bitvec writes;
+    if(!loop_writes(l, writes) || !ax_unused(l))
+        return;
+
+    // Search the expressions
+    auto ln = code[l.start].linenum();
+    std::vector<codew> hoist;
+    std::unordered_map<std::string, int> expr_var;
+    for(auto pos = l.start; pos < l.end;)
+    {
+        auto e = expr_end(pos, l.end, writes);
+        if(e == npos)
+        {
+            pos = g.next(pos);
+            continue;
+        }
+        // Get the code to calculate the expression, without the first push
+        std::vector<codew> ex;
+        ex.push_back(codew::ctok(tokinfo::load_token(code[pos].get_tok_id()), ln));
+        ex.insert(ex.end(), code.begin() + pos + 1, code.begin() + e);
+        std::string key;
+        for(auto &c : ex)
+            key += c.to_asm() + "\n";
+        int var;
+        auto it = expr_var.find(key);
+        if(!worth(pos, e, ex, it == expr_var.end()))
+        {
+            pos = g.next(pos);
+            continue;
+        }
+        if(it != expr_var.end())
+            var = it->second;
+        else
+        {
+            var = add_temp_var(vars);
+            if(var < 0)
+                break;
+            expr_var[key] = var;
+            hoist.insert(hoist.end(), ex.begin(), ex.end());
+            hoist.push_back(codew::ctok(TOK_VAR_STORE, ln));
+            hoist.push_back(codew::cvarn(temp_var_name(var), var, ln));
+        }
+        repl[pos] = {e, var};
+        for(auto p = pos; p < e; p++)
+            taken[p] = 1;
+        pos = e;
+    }
+    if(hoist.empty())
+        return;
+
+    // Insert the code at the label and jump back after it
+    auto &name = code[l.start].get_str();
+    header[l.start] = hoist;
+    header[l.start].push_back(codew::clabel(name + "_in", ln));
+    for(auto &j : jumps)
+        if(j.second == l.start && j.first >= l.start && j.first < l.end)
+            retarget[j.first + 1] = name + "_in";
+}
+
+bool licm::run()
+{
+    if(!g.num_vars)
+        return false;
+    get_proc_writes();
+
+    // Get all the jumps and the loops
+    std::unordered_map<std::string, size_t> label_pos;
+    for(size_t pos = 0; pos < code.size(); pos++)
+        if(code[pos].is_label() && g.block_at(pos) != npos)
+            label_pos[code[pos].get_str()] = pos;
+    std::map<size_t, loop> loops;
+    std::string prefix = parse::label_prefix;
+    for(size_t b = 0; b < g.blocks.size(); b++)
+    {
+        auto pos = flow_last(b);
+        if(pos == npos || pos + 1 >= code.size() || !code[pos + 1].is_sword())
+            continue;
+        auto flow = tokinfo::get(code[pos].get_tok_id()).flow;
+        if(flow != tokinfo::f_jump && flow != tokinfo::f_cjump)
+            continue;
+        auto &name = code[pos + 1].get_str();
+        auto it = label_pos.find(name);
+        if(it == label_pos.end())
+            continue;
+        auto target = it->second;
+        jumps.emplace_back(pos, target);
+        // A jump back inside the same procedure is a loop
+        auto proc = g.blocks[b].proc;
+        if(target < pos && g.blocks[g.block_at(target)].proc == proc &&
+           name.compare(0, prefix.size(), prefix) != 0)
+        {
+            auto &l = loops[target];
+            l.start = target;
+            l.end = std::max(l.end, g.next(pos));
+            l.proc = proc;
+        }
+    }
+
+    // Process the outer loops first, so the expressions are moved as far
+    // as possible.
+    std::vector<loop> order;
+    for(auto &l : loops)
+        order.push_back(l.second);
+    std::stable_sort(order.begin(), order.end(), [](const loop &a, const loop &b) {
+        return a.end - a.start > b.end - b.start;
+    });
+    for(auto &l : order)
+        do_loop(l);
+    if(header.empty())
+        return false;
+
+    // Build the new code
+    std::vector<codew> ret;
+    ret.reserve(code.size());
+    for(size_t pos = 0; pos < code.size();)
+    {
+        auto &c = code[pos];
+        auto ln = c.linenum();
+        auto h = header.find(pos);
+        auto r = repl.find(pos);
+        auto t = retarget.find(pos);
+        if(h != header.end())
+        {
+            ret.push_back(c);
+            ret.insert(ret.end(), h->second.begin(), h->second.end());
+            pos++;
+        }
+        else if(r != repl.end())
+        {
+            auto var = r->second.second;
+            if(tokinfo::get(c.get_tok_id()).expr == tokinfo::e_push_load)
+                ret.push_back(codew::ctok(TOK_PUSH, ln));
+            ret.push_back(codew::ctok(TOK_VAR_LOAD, ln));
+            ret.push_back(codew::cvarn(temp_var_name(var), var, ln));
+            pos = r->second.first;
+        }
+        else if(t != retarget.end())
+        {
+            ret.push_back(codew::cword(t->second, ln));
+            pos++;
+        }
+        else
+            ret.push_back(code[pos++]);
+    }
+    code.swap(ret);
+    return true;
+}
+
+bool do_licm(std::vector<codew> &code, std::map<std::string, int> &vars, const opt_goal &goal)
+{
+    licm l(code, vars, goal);
+    return l.run();
+}
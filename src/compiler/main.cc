@@ -18,13 +18,27 @@
 
 // main.cc: Main compiler file
 
+#include "cache.h"
 #include "compile.h"
+#include "ifile.h"
+#include "jobs.h"
+#include "objfile.h"
 #include "os.h"
+#include "server.h"
 #include "target.h"
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <sstream>
 #include <tuple>
 #include <vector>
 
+// Main functions of the CA65 assembler and LD65 linker, linked into the
+// compiler.
+extern "C" int ca65_main(int argc, char *argv[]);
+extern "C" int ld65_main(int argc, char *argv[]);
+
 static int show_version()
 {
     std::cerr << "FastBasic " VERSION " - (c) 2025 dmsc\n";
@@ -39,14 +53,36 @@ static int show_help()
                  "Options:\n"
                  " -d\t\tenable parser debug options (only useful to debug parser)\n"
                  " -n\t\tdon't run the optimizer, produces same code as 6502 version\n"
-                 " -prof\t\tshow token usage statistics\n"
+                 " -Os\t\toptimize for size, default for cartridge targets\n"
+                 " -O2\t\toptimize for speed without growing the code too much\n"
+                 " -O3\t\toptimize for speed, even if the code grows\n"
+                 " -prof\t\tshow token usage statistics and inlining decisions\n"
+                 " -inline-limit:<n>\tmaximum size in bytes of PROCs to inline\n"
+                 " -native\ttranslate the PROCs with loops or enough supported\n"
+                 "\t\ttokens to native 6502 code\n"
+                 " -native:<name,...>\ttranslate the given PROCs to native 6502 code\n"
+                 " -zp-vars:<n>\tbytes of zero page for the most used variables\n"
+                 " -superinst:<name>\tpropose new tokens from the statistics of all the\n"
+                 "\t\tcompiled files, writes <name>.opt and <name>.asm\n"
+                 " -cfg\t\tshow the control flow graph of the compiled code\n"
+                 " -packrat\tcache parsing results, faster with complex expressions\n"
                  " -s:<name>\tplace code into given segment\n"
                  " -t:<target>\tselect compiler target ('atari-fp', 'atari-int', etc.)\n"
                  " -l\t\twrite a long BASIC listing of the parsed source\n"
                  " -l:<extension>\tspecify the extension of the BASIC listing\n"
                  " -ls:<num>\twrite a shortened/abbreviated BASIC listing with num columns\n"
+                 " -lc\t\twrite a listing with the size and estimated cycles of each line\n"
                  " -c\t\tonly compile to assembler, don't produce binary\n"
                  " -keep\t\tkeep intermediate files on compilation\n"
+                 " -external-tools\tcall external CA65 and LD65 programs\n"
+                 " -no-cache\tdon't use the build cache of compiled files\n"
+                 " -cache-stats\tshow the statistics of the build cache\n"
+                 " -cache-clear\tremove all the files in the build cache\n"
+                 " -server\trun as a server, reading requests from the standard input\n"
+                 " -server:<socket>\trun as a server, listening at the given socket\n"
+                 " -client:<socket>\tsend the compilation to the server at the socket\n"
+                 " -j<n>\t\tcompile and assemble up to <n> files at the same time,\n"
+                 "\t\tor one per CPU core if not given\n"
                  " -g\t\tsave listing and label files after compilation\n"
                  " -C:<name>\tselect linker config file name\n"
                  " -S:<addr>\tselect binary starting address\n"
@@ -67,6 +103,52 @@ static int show_error(std::string msg)
     return 1;
 }
 
+static bool read_file(const std::string &name, std::string &data)
+{
+    std::ifstream f(name, std::ios::binary);
+    if(!f.is_open())
+        return false;
+    std::ostringstream s;
+    s << f.rdbuf();
+    data = s.str();
+    return true;
+}
+
+static bool write_file(const std::string &name, const std::string &data)
+{
+    std::ofstream f(name, std::ios::binary);
+    f << data;
+    f.close();
+    return bool(f);
+}
+
+// Returns the key of the contents of a file included from a BASIC source
+static std::string data_file_key(const std::string &bas_name, const std::string &name)
+{
+    auto f = open_include_file(bas_name, name);
+    if(!f)
+        return std::string();
+    std::ostringstream s;
+    s << f->rdbuf();
+    cache_key k;
+    k.add(s.str());
+    return k.str();
+}
+
+static void show_cache_stats(const build_cache &cache)
+{
+    if(!cache.enabled())
+    {
+        std::cerr << "build cache: disabled\n";
+        return;
+    }
+    auto st = cache.total();
+    std::cerr << "build cache: '" << cache.folder() << "'\n"
+              << "    hits: " << st.hits << ", misses: " << st.misses << "\n"
+              << "    size: " << (st.size + 1023) / 1024 << " KiB of "
+              << cache.size_limit() / 1024 << " KiB\n";
+}
+
 static std::string to_lower(std::string in)
 {
     auto ret = in;
@@ -93,27 +175,77 @@ static std::vector<std::string> parse_path_list(const std::string &str)
     }
 }
 
-int main(int argc, char **argv)
+// A target with the symbols of the target include files, loaded once and
+// kept for all the requests in the server mode, until any of the files changes.
+class loaded_target
 {
-    // OS specific initializations
-    os::init(argv[0]);
+  public:
+    target tgt;
+    asm_symbols syms;
+    bool syms_loaded = false;
+    bool syms_valid = false;
+    std::string stamp;
+    // Returns the size and modification time of all the files read
+    std::string get_stamp() const
+    {
+        std::string st;
+        for(auto &f : tgt.files())
+            st += f + " " + os::file_stamp(f) + "\n";
+        auto inc = os::compiler_path("asminc");
+        for(auto &f : os::list_dir(inc))
+            st += f.name + " " + std::to_string(f.size) + " " + std::to_string(f.mtime) + "\n";
+        return st;
+    }
+};
 
+static loaded_target &load_target(const std::vector<std::string> &target_folder,
+                                  const std::vector<std::string> &syntax_folder,
+                                  const std::string &target_name)
+{
+    static std::map<std::string, std::unique_ptr<loaded_target>> targets;
+    std::string key = target_name;
+    for(auto &p : target_folder)
+        key += "\n" + p;
+    key += "\n";
+    for(auto &p : syntax_folder)
+        key += "\n" + p;
+    auto &t = targets[key];
+    if(t && t->stamp != t->get_stamp())
+        t.reset();
+    if(!t)
+    {
+        std::unique_ptr<loaded_target> n(new loaded_target());
+        n->tgt.load(target_folder, syntax_folder, target_name);
+        n->stamp = n->get_stamp();
+        t = std::move(n);
+    }
+    return *t;
+}
+
+// Compiles the files given in the command line arguments of the request
+static int compile_request(server::request &req)
+{
     // Default folders for target and syntax files
     auto syntax_folder = os::get_search_path("syntax");
     auto target_folder = os::get_search_path("");
-    std::vector<std::string> args(argv + 1, argv + argc);
+    auto &args = req.args;
     std::string out_name;
     std::string exe_name;
     bool got_outname = false, one_step = false, next_is_output = false;
-    bool keep_temps = false, do_listing = false;
+    bool keep_temps = false, do_listing = false, external_tools = false;
+    bool use_cache = true, cache_stats = false, cache_clear = false;
     std::string target_name = "default";
     std::string cfg_file_def;
     std::string listing_ext = ".list";
+    std::string superinst_name;
+    int opt_level = -1; // Optimization level, or -1 to use the target default
+    int zp_vars = -1;   // Zero page for variables, or -1 to use the target default
+    unsigned threads = 1; // Files to compile and assemble at the same time
     compiler comp;
     std::vector<std::string> link_opts;
     std::vector<std::string> asm_opts = {"-g"};
-    // BAS files, compile INPUT(BAS) to OUTPUT(ASM)
-    std::vector<std::tuple<std::string, std::string>> bas_files;
+    // BAS files, compile INPUT(BAS) to OUTPUT(ASM) and then to OUTPUT(OBJ)
+    std::vector<std::tuple<std::string, std::string, std::string>> bas_files;
     // ASM files, assemble INPUT(ASM) to OUTPUT(OBJ) producing a listing
     std::vector<std::tuple<std::string, std::string>> asm_files;
     // OBJ files, link INPUT(OBJ) to output executable
@@ -140,8 +272,63 @@ int main(int argc, char **argv)
             comp.do_debug = true;
         else if(arg == "-n")
             comp.optimize = false;
+        else if(arg == "-Os")
+            opt_level = opt_goal::o_size;
+        else if(arg == "-O2")
+            opt_level = opt_goal::o_speed;
+        else if(arg == "-O3")
+            opt_level = opt_goal::o_max_speed;
         else if(arg == "-prof")
             comp.show_stats = true;
+        else if(arg.rfind("-inline-limit:", 0) == 0 || arg.rfind("-inline-limit=", 0) == 0)
+        {
+            size_t pos = 0;
+            int len = -1;
+            try {
+                len = std::stoi(arg.substr(14), &pos, 0);
+            }
+            catch(...) { }
+            if(pos != arg.size() - 14 || len < 0)
+                return show_error("'-inline-limit' option needs a size in bytes");
+            comp.inline_limit = len;
+        }
+        else if(arg == "-native")
+            comp.native_all = true;
+        else if(arg.rfind("-native:", 0) == 0 || arg.rfind("-native=", 0) == 0)
+        {
+            auto list = arg.substr(8);
+            for(size_t pos = 0; pos <= list.size();)
+            {
+                auto end = list.find(',', pos);
+                if(end == list.npos)
+                    end = list.size();
+                if(end == pos)
+                    return show_error("'-native' option needs a list of PROC names");
+                comp.native_procs.insert(list.substr(pos, end - pos));
+                pos = end + 1;
+            }
+        }
+        else if(arg.rfind("-zp-vars:", 0) == 0 || arg.rfind("-zp-vars=", 0) == 0)
+        {
+            size_t pos = 0;
+            try {
+                zp_vars = std::stoi(arg.substr(9), &pos, 0);
+            }
+            catch(...) { }
+            if(pos != arg.size() - 9 || zp_vars < 0 || zp_vars > 256)
+                return show_error("'-zp-vars' option needs a size in bytes");
+        }
+        else if(arg.rfind("-superinst:", 0) == 0 || arg.rfind("-superinst=", 0) == 0)
+        {
+            superinst_name = arg.substr(11);
+            if(superinst_name.empty())
+                return show_error("'-superinst' option needs a file name");
+            comp.collect_fuse = true;
+        }
+        else if(arg == "-cfg")
+            comp.show_cfg = true;
+        else if(arg == "-packrat")
+            comp.packrat = true;
         else if(arg == "-v")
             return show_version();
         else if(arg == "-c")
@@ -158,6 +345,8 @@ int main(int argc, char **argv)
             comp.show_text = true;
             listing_ext = "." + arg.substr(3);
         }
+        else if(arg == "-lc")
+            comp.show_cost = true;
         else if(arg == "-ls")
         {
             comp.show_text = true;
@@ -178,6 +367,29 @@ int main(int argc, char **argv)
         }
         else if(arg == "-h")
             return show_help();
+        else if(arg == "-external-tools")
+            external_tools = true;
+        else if(arg == "-no-cache")
+            use_cache = false;
+        else if(arg == "-cache-stats")
+            cache_stats = true;
+        else if(arg == "-cache-clear")
+            cache_clear = true;
+        else if(arg == "-j")
+            threads = jobs::max_threads();
+        else if(arg.rfind("-j", 0) == 0)
+        {
+            auto num = arg.substr((arg[2] == ':' || arg[2] == '=') ? 3 : 2);
+            size_t pos = 0;
+            int n = 0;
+            try {
+                n = std::stoi(num, &pos, 10);
+            }
+            catch(...) { }
+            if(pos != num.size() || n < 1)
+                return show_error("'-j' option needs a number of jobs");
+            threads = n;
+        }
         else if(arg == "-keep")
         {
             keep_temps = true;
@@ -274,57 +486,105 @@ int main(int argc, char **argv)
                 got_outname = false;
             }
 
-            bas_files.emplace_back(arg, asm_name);
+            bas_files.emplace_back(arg, asm_name, one_step ? std::string() : obj_name);
             if(!one_step)
-            {
-                asm_files.emplace_back(asm_name, obj_name);
                 link_files.push_back(obj_name);
-            }
         }
     }
-    if(!bas_files.size() && !asm_files.size() && !link_files.size())
+    if(!bas_files.size() && !asm_files.size() && !link_files.size() && !cache_stats &&
+       !cache_clear)
         return show_error("missing input file name");
     if(next_is_output)
         return show_error("option '-o' must supply a file name");
 
+    // Build cache, with the maximum size in MiB from the environment
+    unsigned long long cache_size = 64;
+    if(const char *env = getenv("FASTBASIC_CACHE_SIZE"))
+    {
+        char *end;
+        cache_size = strtoull(env, &end, 10);
+        if(!*env || *end)
+            return show_error("invalid FASTBASIC_CACHE_SIZE, must be a size in MiB");
+    }
+    build_cache cache(use_cache ? cache_size << 20 : 0);
+    if(cache_clear)
+        cache.clear();
+    if(!bas_files.size() && !asm_files.size() && !link_files.size())
+    {
+        if(cache_stats)
+            show_cache_stats(cache);
+        return 0;
+    }
+
     // Read target definition
-    target tgt;
+    loaded_target *ltgt;
 
     try
     {
-        tgt.load(target_folder, syntax_folder, target_name);
+        ltgt = &load_target(target_folder, syntax_folder, target_name);
     }
     catch(std::exception &e)
     {
         std::cerr << e.what() << "\n";
         return 1;
     }
+    const target &tgt = ltgt->tgt;
+    comp.opt_level = opt_level < 0 ? tgt.opt_level() : opt_goal::level(opt_level);
+    comp.zp_vars = zp_vars < 0 ? tgt.zp_vars() : zp_vars;
     std::string lib_name = os::compiler_path(tgt.lib());
     std::string cfg_file =
         cfg_file_def.size() ? cfg_file_def : os::compiler_path(tgt.cfg());
+    // Write the BASIC sources directly to object files, except when the
+    // assembly is kept, listed or needs options for the assembler.
+    if(!keep_temps && !do_listing && !external_tools && asm_opts.size() == 1)
+    {
+        if(!ltgt->syms_loaded)
+            ltgt->syms_valid = ltgt->syms.load(
+                os::full_path(os::compiler_path("asminc"), "target.inc"), tgt.ca65_args());
+        ltgt->syms_loaded = true;
+        if(ltgt->syms_valid)
+            comp.target_syms = &ltgt->syms;
+    }
     asm_opts.insert(asm_opts.end(), tgt.ca65_args().begin(), tgt.ca65_args().end());
 
+    // Base of the cache keys of the BASIC files: the target files and the
+    // compiler options, and the include files used to write object files.
+    // The options that show information of the compilation disable the cache.
+    bool cache_bas = cache.enabled() && !comp.show_stats && !comp.show_cfg &&
+                     !comp.show_text && !comp.show_cost && !comp.do_debug && !comp.packrat &&
+                     !comp.collect_fuse;
+    cache_key bas_key;
+    bas_key.add("BAS " VERSION);
+    bas_key.add(os::program_stamp());
+    bas_key.add(target_name);
+    bas_key.add(std::to_string(tgt.hash()));
+    bas_key.add(comp.options());
+    if(comp.target_syms)
+        cache_bas = cache_bas && bas_key.add_asm_file(
+                                     os::full_path(os::compiler_path("asminc"), "target.inc"),
+                                     {os::compiler_path("asminc")});
+
+    // Folders searched by the assembler, to get the included files
+    std::vector<std::string> asm_dirs{os::compiler_path("asminc")};
+    for(size_t i = 0; i < asm_opts.size(); i++)
+    {
+        auto &o = asm_opts[i];
+        if((o == "-I" || o == "--include-dir" || o == "--bin-include-dir") &&
+           i + 1 < asm_opts.size())
+            asm_dirs.push_back(asm_opts[i + 1]);
+        else if(o.size() > 2 && o.compare(0, 2, "-I") == 0)
+            asm_dirs.push_back(o.substr(2));
+    }
+    if(const char *env = getenv("CA65_INC"))
+        asm_dirs.push_back(env);
+
     // Guess final exe file name
     if(link_files.size() && exe_name.empty())
         exe_name = os::add_extension(link_files[0], tgt.bin_ext());
 
-    for(auto &f : bas_files)
-    {
-        auto bas_name = std::get<0>(f), asm_name = std::get<1>(f);
-        auto listing_name = os::add_extension(bas_name, listing_ext);
-        std::cerr << "BAS compile '" << bas_name << "' to '" << asm_name << "'\n";
-        if(comp.show_text)
-            std::cerr <<"    with " << (comp.short_text ? "minimized" : "expanded")
-                      << " listing to '" << listing_name << "'\n";
-        auto e = comp.compile_file(bas_name, asm_name, tgt.sl(), listing_name);
-        if(e)
-            return e;
-        if(!one_step)
-            temp_files.push_back(asm_name);
-    }
-    for(auto &f : asm_files)
-    {
-        auto asm_name = std::get<0>(f), obj_name = std::get<1>(f);
+    // Assembles one file, storing the output of the assembler if needed to
+    // show it in order with the output of other jobs.
+    auto assemble = [&](const std::string &asm_name, const std::string &obj_name) {
         auto lst_name = os::add_extension(obj_name, ".lst");
 
         std::cerr << "ASM assemble '" << asm_name << "' to '" << obj_name << "'\n";
@@ -335,11 +595,158 @@ int main(int argc, char **argv)
         for(auto &o : asm_opts)
             args.push_back(o);
         args.push_back(asm_name);
-        auto e = os::prog_exec("ca65", args);
+
+        // The cache key includes all the arguments except the output name
+        cache_key key;
+        bool try_cache = cache.enabled() && !do_listing;
+        if(try_cache)
+        {
+            key.add("ASM " VERSION);
+            key.add(os::program_stamp());
+            for(auto &a : args)
+                if(a != obj_name)
+                    key.add(a);
+            try_cache = key.add_asm_file(asm_name, asm_dirs);
+        }
+        build_cache::entry ce;
+        if(try_cache && cache.get(key.str(), ce))
+        {
+            std::cerr << ce.output;
+            if(!write_file(obj_name, ce.data))
+                return show_error("can't write output file '" + obj_name + "'");
+            return 0;
+        }
+
+        std::string out;
+        auto pout = (try_cache || threads > 1 || req.capture_tools) ? &out : nullptr;
+        // The included assembler runs in a forked copy of the compiler, that
+        // is not safe with other threads running, so the external one is used.
+        auto e = (external_tools || threads > 1)
+                     ? os::prog_exec("ca65", args, pout)
+                     : os::prog_call(ca65_main, "ca65", args, pout);
+        std::cerr << out;
         if(e)
             return show_error("can't assemble file\n");
-        if(!one_step)
-            temp_files.push_back(obj_name);
+        if(try_cache && read_file(obj_name, ce.data))
+        {
+            ce.kind = "obj";
+            ce.output = out;
+            cache.put(key.str(), ce);
+        }
+        return 0;
+    };
+
+    // Each BASIC file is compiled and assembled in one job, followed by the
+    // assembly files. Each job uses a copy of the compiler options and
+    // stores the temporary files in its own list.
+    std::vector<jobs::job> job_list;
+    std::vector<compiler> job_comp(bas_files.size(), comp);
+    std::vector<std::vector<std::string>> job_temps(bas_files.size() + asm_files.size());
+    for(size_t i = 0; i < bas_files.size(); i++)
+    {
+        job_list.push_back([&, i]() {
+            auto &f = bas_files[i];
+            auto &c = job_comp[i];
+            auto bas_name = std::get<0>(f), asm_name = std::get<1>(f), obj_name = std::get<2>(f);
+            auto listing_name = os::add_extension(bas_name, listing_ext);
+            auto cost_name = os::add_extension(bas_name, ".cost");
+            std::cerr << "BAS compile '" << bas_name << "' to '"
+                      << (c.target_syms && obj_name.size() ? obj_name : asm_name) << "'\n";
+            if(c.show_text)
+                std::cerr <<"    with " << (c.short_text ? "minimized" : "expanded")
+                          << " listing to '" << listing_name << "'\n";
+            if(c.show_cost)
+                std::cerr << "    with cost listing to '" << cost_name << "'\n";
+
+            // Search the output in the cache, checking that the included
+            // files did not change.
+            cache_key key = bas_key;
+            key.add(c.target_syms && obj_name.size() ? "obj" : "asm");
+            key.add(bas_name);
+            auto text = req.files.find(bas_name);
+            if(text != req.files.end())
+            {
+                c.input_text = &text->second;
+                key.add(text->second);
+            }
+            bool try_cache = cache_bas && (c.input_text || key.add_file(bas_name));
+            build_cache::entry ce;
+            auto valid = [&](const build_cache::entry &e) {
+                for(auto &d : e.deps)
+                    if(data_file_key(bas_name, d.first) != d.second)
+                        return false;
+                return true;
+            };
+            if(try_cache && cache.get(key.str(), ce, valid))
+            {
+                c.obj_written = ce.kind == "obj";
+                auto out_name = c.obj_written ? obj_name : asm_name;
+                if(!write_file(out_name, ce.data))
+                    return show_error("can't write output file '" + out_name + "'");
+            }
+            else
+            {
+                auto e = c.compile_file(bas_name, asm_name, tgt.tables(), tgt.peephole(),
+                                        tgt.costs(), listing_name, cost_name, obj_name);
+                if(e)
+                    return e;
+                ce.kind = c.obj_written ? "obj" : "asm";
+                ce.deps.clear();
+                for(auto &d : c.data_files)
+                    ce.deps.emplace_back(d, data_file_key(bas_name, d));
+                if(try_cache && read_file(c.obj_written ? obj_name : asm_name, ce.data))
+                    cache.put(key.str(), ce);
+            }
+            if(c.obj_written)
+                job_temps[i].push_back(obj_name);
+            else if(!one_step)
+            {
+                job_temps[i].push_back(asm_name);
+                auto e = assemble(asm_name, obj_name);
+                if(e)
+                    return e;
+                job_temps[i].push_back(obj_name);
+            }
+            return 0;
+        });
+    }
+    for(size_t i = 0; i < asm_files.size(); i++)
+    {
+        job_list.push_back([&, i]() {
+            auto &f = asm_files[i];
+            auto e = assemble(std::get<0>(f), std::get<1>(f));
+            if(!e && !one_step)
+                job_temps[bas_files.size() + i].push_back(std::get<1>(f));
+            return e;
+        });
+    }
+    auto e = jobs::run(job_list, threads);
+    if(e)
+        return e;
+    for(auto &t : job_temps)
+        temp_files.insert(temp_files.end(), t.begin(), t.end());
+
+    // Store the names of the files written
+    for(auto &f : bas_files)
+    {
+        if(comp.show_text)
+            req.outputs.push_back(os::add_extension(std::get<0>(f), listing_ext));
+        if(comp.show_cost)
+            req.outputs.push_back(os::add_extension(std::get<0>(f), ".cost"));
+        if(one_step)
+            req.outputs.push_back(std::get<1>(f));
+    }
+    if(one_step)
+        for(auto &f : asm_files)
+            req.outputs.push_back(std::get<1>(f));
+    if(keep_temps)
+        req.outputs.insert(req.outputs.end(), temp_files.begin(), temp_files.end());
+    if(comp.collect_fuse)
+    {
+        for(auto &c : job_comp)
+            comp.fuse_stats.merge(c.fuse_stats);
+        if(!comp.fuse_stats.write(superinst_name, 16, tgt.costs()))
+            return show_error("can't write superinstruction files '" + superinst_name + "'");
     }
     if(link_files.size())
     {
@@ -357,14 +764,58 @@ int main(int argc, char **argv)
         for(auto &f : link_files)
             args.push_back(f);
         args.push_back(lib_name);
-        auto e = os::prog_exec("ld65", args);
+        std::string out;
+        auto pout = req.capture_tools ? &out : nullptr;
+        auto e = external_tools ? os::prog_exec("ld65", args, pout)
+                                : os::prog_call(ld65_main, "ld65", args, pout);
+        std::cerr << out;
         if(e)
             return show_error("can't assemble file\n");
+        req.outputs.push_back(exe_name);
+        if(do_listing)
+            req.outputs.push_back(os::add_extension(exe_name, ".lbl"));
     }
     // Remove all intermediate files
     if(!keep_temps)
         for(auto &name: temp_files)
             os::remove_file(name);
 
+    if(cache_stats)
+        show_cache_stats(cache);
+
     return 0;
 }
+
+int main(int argc, char **argv)
+{
+    // OS specific initializations
+    os::init(argv[0]);
+
+    server::request req;
+    req.args.assign(argv + 1, argv + argc);
+    for(size_t i = 0; i < req.args.size(); i++)
+    {
+        auto &arg = req.args[i];
+        if(arg == "-server" || arg.rfind("-server:", 0) == 0 ||
+           arg.rfind("-server=", 0) == 0)
+        {
+            if(req.args.size() != 1)
+                return show_error("'-server' option can't be used with other arguments");
+            if(arg.size() > 7)
+                return server::serve_socket(arg.substr(8), compile_request);
+            return server::serve_stdio(compile_request);
+        }
+        else if(arg.rfind("-client:", 0) == 0 || arg.rfind("-client=", 0) == 0)
+        {
+            // Send the other arguments to the server, compile here if the
+            // server is not available.
+            auto path = arg.substr(8);
+            req.args.erase(req.args.begin() + i);
+            auto e = server::client(path, req.args);
+            if(e >= 0)
+                return e;
+            break;
+        }
+    }
+    return compile_request(req);
+}
@@ -0,0 +1,745 @@
+/*
+ * FastBasic - Fast basic interpreter for the Atari 8-bit computers
+ * Copyright (C) 2017-2025 Daniel Serpell
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+// native.cc: Translation of PROCs to native 6502 code
+
+#include "native.h"
+#include "cfg.h"
+#include "parser.h"
+#include <algorithm>
+#include <cctype>
+#include <iostream>
+#include <map>
+
+// Token IDs translated to native code
+static const int TOK_NUM = codew::intern("TOK_NUM");
+static const int TOK_BYTE = codew::intern("TOK_BYTE");
+static const int TOK_0 = codew::intern("TOK_0");
+static const int TOK_1 = codew::intern("TOK_1");
+static const int TOK_PUSH = codew::intern("TOK_PUSH");
+static const int TOK_PUSH_NUM = codew::intern("TOK_PUSH_NUM");
+static const int TOK_PUSH_BYTE = codew::intern("TOK_PUSH_BYTE");
+static const int TOK_PUSH_0 = codew::intern("TOK_PUSH_0");
+static const int TOK_PUSH_1 = codew::intern("TOK_PUSH_1");
+static const int TOK_PUSH_VAR_LOAD = codew::intern("TOK_PUSH_VAR_LOAD");
+static const int TOK_POP = codew::intern("TOK_POP");
+static const int TOK_VAR_LOAD = codew::intern("TOK_VAR_LOAD");
+static const int TOK_VAR_STORE = codew::intern("TOK_VAR_STORE");
+static const int TOK_VAR_STORE_0 = codew::intern("TOK_VAR_STORE_0");
+static const int TOK_VAR_ADDR = codew::intern("TOK_VAR_ADDR");
+static const int TOK_VAR_SADDR = codew::intern("TOK_VAR_SADDR");
+static const int TOK_ADD_VAR = codew::intern("TOK_ADD_VAR");
+static const int TOK_INCVAR = codew::intern("TOK_INCVAR");
+static const int TOK_DECVAR = codew::intern("TOK_DECVAR");
+static const int TOK_ADD = codew::intern("TOK_ADD");
+static const int TOK_SUB = codew::intern("TOK_SUB");
+static const int TOK_MUL = codew::intern("TOK_MUL");
+static const int TOK_NEG = codew::intern("TOK_NEG");
+static const int TOK_ABS = codew::intern("TOK_ABS");
+static const int TOK_USHL = codew::intern("TOK_USHL");
+static const int TOK_SHL8 = codew::intern("TOK_SHL8");
+static const int TOK_BIT_AND = codew::intern("TOK_BIT_AND");
+static const int TOK_BIT_OR = codew::intern("TOK_BIT_OR");
+static const int TOK_BIT_EXOR = codew::intern("TOK_BIT_EXOR");
+static const int TOK_L_AND = codew::intern("TOK_L_AND");
+static const int TOK_L_OR = codew::intern("TOK_L_OR");
+static const int TOK_L_NOT = codew::intern("TOK_L_NOT");
+static const int TOK_COMP_0 = codew::intern("TOK_COMP_0");
+static const int TOK_EQ = codew::intern("TOK_EQ");
+static const int TOK_NEQ = codew::intern("TOK_NEQ");
+static const int TOK_LT = codew::intern("TOK_LT");
+static const int TOK_GT = codew::intern("TOK_GT");
+static const int TOK_SADDR = codew::intern("TOK_SADDR");
+static const int TOK_POKE = codew::intern("TOK_POKE");
+static const int TOK_DPOKE = codew::intern("TOK_DPOKE");
+static const int TOK_NUM_POKE = codew::intern("TOK_NUM_POKE");
+static const int TOK_BYTE_POKE = codew::intern("TOK_BYTE_POKE");
+static const int TOK_PEEK = codew::intern("TOK_PEEK");
+static const int TOK_DPEEK = codew::intern("TOK_DPEEK");
+static const int TOK_BYTE_PEEK = codew::intern("TOK_BYTE_PEEK");
+static const int TOK_JUMP = codew::intern("TOK_JUMP");
+static const int TOK_CJUMP = codew::intern("TOK_CJUMP");
+static const int TOK_CNJUMP = codew::intern("TOK_CNJUMP");
+static const int TOK_RET = codew::intern("TOK_RET");
+static const int TOK_CRET = codew::intern("TOK_CRET");
+static const int TOK_CNRET = codew::intern("TOK_CNRET");
+static const int TOK_FOR = codew::intern("TOK_FOR");
+static const int TOK_FOR_NEXT = codew::intern("TOK_FOR_NEXT");
+static const int TOK_FOR_EXIT = codew::intern("TOK_FOR_EXIT");
+// Tokens used to call the native code
+static const int TOK_USR_ADDR = codew::intern("TOK_USR_ADDR");
+static const int TOK_USR_CALL = codew::intern("TOK_USR_CALL");
+
+// Minimum number of tokens translated before the first one returning to
+// the interpreter, for PROCs selected automatically without loops.
+static const unsigned min_tokens = 8;
+
+// Routines used by the native code, only included if used.
+static const char *native_for =
+    "\t; FOR and FOR_NEXT, returns 1 at the end of the loop\n"
+    "nat_for:\n"
+    "\tldy\tsptr\n"
+    "\tjsr\tpushAX\n"
+    "\tsec\n"
+    "\t.byte\t$90\t; BCC not taken, skips next CLC\n"
+    "nat_for_next:\n"
+    "\tclc\n"
+    "\tldy\tsptr\n"
+    "\tlda\tstack_l+2, y\n"
+    "\tsta\ttmp3\n"
+    "\tlda\tstack_h+2, y\n"
+    "\tsta\ttmp3+1\n"
+    "\tlda\tstack_l, y\n"
+    "\tldx\tstack_h, y\n"
+    "\tphp\n"
+    "\tldy\t#0\n"
+    "\tbcc\t@add\n"
+    "\tlda\t#255\n"
+    "\ttax\n"
+    "@add:\tadc\t(tmp3), y\n"
+    "\tsta\t(tmp3), y\n"
+    "\tpha\n"
+    "\tiny\n"
+    "\ttxa\n"
+    "\tadc\t(tmp3), y\n"
+    "\tsta\t(tmp3), y\n"
+    "\ttax\n"
+    "\tpla\n"
+    "\tldy\tsptr\n"
+    "\tplp\n"
+    "\tbmi\t@neg\n"
+    "\tclc\n"
+    "\tsbc\tstack_l+1, y\n"
+    "\ttxa\n"
+    "\tsbc\tstack_h+1, y\n"
+    "\tbvc\t@pos\n"
+    "\teor\t#$80\n"
+    "@pos:\tasl\n"
+    "\tlda\t#0\n"
+    "\ttax\n"
+    "\trol\n"
+    "\teor\t#1\n"
+    "\trts\n"
+    "@neg:\tcmp\tstack_l+1, y\n"
+    "\ttxa\n"
+    "\tsbc\tstack_h+1, y\n"
+    "\tbvc\t@set\n"
+    "\teor\t#$80\n"
+    "@set:\tasl\n"
+    "\tlda\t#0\n"
+    "\ttax\n"
+    "\trol\n"
+    "\trts\n";
+
+static const char *native_mul =
+    "\t; AX = (SP+) * AX\n"
+    "nat_mul:\n"
+    "\tldy\tsptr\n"
+    "\tinc\tsptr\n"
+    "\tsta\ttmp3\n"
+    "\tlda\tstack_h, y\n"
+    "\tlsr\n"
+    "\tsta\ttmp1+1\n"
+    "\tlda\tstack_l, y\n"
+    "\tror\n"
+    "\tsta\ttmp1\n"
+    "\tlda\t#0\n"
+    "\tsta\ttmp2+1\n"
+    "\tldy\t#16\n"
+    "@loop:\tbcc\t@skip\n"
+    "\tclc\n"
+    "\tadc\ttmp3\n"
+    "\tsta\ttmp2\n"
+    "\ttxa\n"
+    "\tadc\ttmp2+1\n"
+    "\tsta\ttmp2+1\n"
+    "\tlda\ttmp2\n"
+    "@skip:\tror\ttmp2+1\n"
+    "\tror\n"
+    "\tror\ttmp1+1\n"
+    "\tror\ttmp1\n"
+    "\tdey\n"
+    "\tbne\t@loop\n"
+    "\tlda\ttmp1\n"
+    "\tldx\ttmp1+1\n"
+    "\trts\n";
+
+namespace
+{
+// An operand of a binary operation, as the 6502 addressing of the low and
+// high bytes.
+class operand
+{
+  public:
+    std::string lo, hi;
+};
+
+// Translates the bytecode of one PROC
+class translator
+{
+  private:
+    const std::vector<codew> &code;
+    const cfg &g;
+    const cfg::proc &p;
+    unsigned &num_labels; // Counter used to build unique labels
+    std::set<std::string> labels;              // Labels inside the PROC
+    std::map<std::string, std::string> exits; // Native labels returning to bytecode labels
+
+    void emit(std::initializer_list<const char *> lines);
+    void emit_resume(const std::string &name, const std::string &target);
+    std::string target(size_t pos);
+    bool get_operand(size_t pos, operand &op) const;
+    bool binary(int tok, const operand &op);
+    const char *compare(int tok, const operand *op);
+    void compare_result(const char *branch, size_t &nxt);
+    bool translate(size_t pos, size_t &nxt);
+
+  public:
+    std::string text;                     // The native code
+    std::map<size_t, std::string> resume; // Tokens returning to the interpreter
+    unsigned tokens = 0;                  // Number of tokens in the PROC
+    unsigned first_resume = 0;            // Tokens translated before the first return
+    bool has_loop = false;                // A jump back before the first return
+    bool use_for = false, use_mul = false;
+
+    translator(const std::vector<codew> &code, const cfg &g, const cfg::proc &p,
+               unsigned &num_labels)
+        : code(code), g(g), p(p), num_labels(num_labels)
+    {
+    }
+    bool run();
+};
+} // namespace
+
+// Returns the name of the variable in the arguments
+static std::string var(const codew &c)
+{
+    return "fb_var_" + c.get_varname();
+}
+
+// Returns the value of a word or byte argument, as a number or a symbol
+static std::string value(const codew &c, int mask)
+{
+    if(c.is_word() || c.is_byte())
+        return std::to_string(c.get_val() & mask);
+    return c.get_str();
+}
+
+// Adds lines of code, replacing "%" with the argument
+static std::string subst(const char *line, const std::string &arg)
+{
+    std::string ret;
+    for(; *line; line++)
+    {
+        if(*line == '%')
+            ret += arg;
+        else
+            ret += *line;
+    }
+    return ret;
+}
+
+void translator::emit(std::initializer_list<const char *> lines)
+{
+    // Lines starting with ':' are anonymous labels, the rest are indented
+    for(auto l : lines)
+    {
+        if(*l != ':')
+            text += "\t";
+        text += l;
+        text += "\n";
+    }
+}
+
+// Emits the code returning to the interpreter at the bytecode label
+// "target", the interpreter continues at the address in "cptr".
+void translator::emit_resume(const std::string &name, const std::string &target)
+{
+    if(!name.empty())
+        text += name + ":\n";
+    text += "\tpha\n"
+            "\tlda\t#<" + target + "\n"
+            "\tsta\tcptr\n"
+            "\tlda\t#>" + target + "\n"
+            "\tsta\tcptr+1\n"
+            "\tpla\n"
+            "\trts\n";
+}
+
+// Returns the native label of the jump target in the arguments, labels
+// outside the PROC return to the interpreter.
+std::string translator::target(size_t pos)
+{
+    auto &l = code[pos + 1].get_str();
+    if(labels.count(l))
+        return "nat_" + l;
+    auto &e = exits[l];
+    if(e.empty())
+        e = "nat_exit_" + std::to_string(num_labels++);
+    return e;
+}
+
+// Gets the operand of a "push and load" token
+bool translator::get_operand(size_t pos, operand &op) const
+{
+    auto tok = code[pos].get_tok_id();
+    if(tok == TOK_PUSH_NUM)
+    {
+        auto v = value(code[pos + 1], 0xFFFF);
+        op = operand{"#<" + v, "#>" + v};
+    }
+    else if(tok == TOK_PUSH_BYTE)
+        op = operand{"#" + value(code[pos + 1], 0xFF), "#0"};
+    else if(tok == TOK_PUSH_0)
+        op = operand{"#0", "#0"};
+    else if(tok == TOK_PUSH_1)
+        op = operand{"#1", "#0"};
+    else if(tok == TOK_PUSH_VAR_LOAD)
+        op = operand{var(code[pos + 1]), var(code[pos + 1]) + "+1"};
+    else
+        return false;
+    return true;
+}
+
+// Translates a binary operation with the left value in AX and the right
+// value in the operand, instead of the stack.
+bool translator::binary(int tok, const operand &op)
+{
+    auto bitop = [&](const char *ins) {
+        text += subst("\t%\t", ins) + op.lo + "\n\tpha\n\ttxa\n";
+        text += subst("\t%\t", ins) + op.hi + "\n\ttax\n\tpla\n";
+    };
+    if(tok == TOK_ADD)
+    {
+        text += "\tclc\n\tadc\t" + op.lo + "\n\tpha\n\ttxa\n";
+        text += "\tadc\t" + op.hi + "\n\ttax\n\tpla\n";
+    }
+    else if(tok == TOK_SUB)
+    {
+        text += "\tsec\n\tsbc\t" + op.lo + "\n\tpha\n\ttxa\n";
+        text += "\tsbc\t" + op.hi + "\n\ttax\n\tpla\n";
+    }
+    else if(tok == TOK_BIT_AND)
+        bitop("and");
+    else if(tok == TOK_BIT_OR)
+        bitop("ora");
+    else if(tok == TOK_BIT_EXOR)
+        bitop("eor");
+    else
+        return false;
+    return true;
+}
+
+// Translates a comparison, with the right value in the operand if given or
+// in the stack, leaving the result in the CPU flags. Returns the branch
+// instruction taken if the result is true, or null if the token is not a
+// comparison.
+const char *translator::compare(int tok, const operand *op)
+{
+    if(tok == TOK_COMP_0)
+    {
+        emit({"stx\ttmp1", "ora\ttmp1"});
+        return "bne";
+    }
+    if(tok != TOK_EQ && tok != TOK_NEQ && tok != TOK_LT && tok != TOK_GT)
+        return nullptr;
+    if(!op)
+        emit({"ldy\tsptr", "inc\tsptr"});
+    if(tok == TOK_EQ || tok == TOK_NEQ)
+    {
+        if(op)
+            text += "\tcmp\t" + op->lo + "\n\tbne\t:+\n\tcpx\t" + op->hi + "\n:\n";
+        else
+            emit({"cmp\tstack_l, y", "bne\t:+", "txa", "eor\tstack_h, y", ":"});
+        return tok == TOK_EQ ? "beq" : "bne";
+    }
+    // Get the sign of the subtraction, the left value is in AX with an
+    // operand and in the stack without.
+    if(tok == TOK_GT && op)
+    {
+        emit({"sta\ttmp1", "stx\ttmp1+1"});
+        text += "\tlda\t" + op->lo + "\n\tcmp\ttmp1\n\tlda\t" + op->hi + "\n\tsbc\ttmp1+1\n";
+    }
+    else if(op)
+        text += "\tcmp\t" + op->lo + "\n\ttxa\n\tsbc\t" + op->hi + "\n";
+    else if(tok == TOK_GT)
+        emit({"cmp\tstack_l, y", "txa", "sbc\tstack_h, y"});
+    else
+        emit({"clc", "sbc\tstack_l, y", "txa", "sbc\tstack_h, y"});
+    emit({"bvc\t:+", "eor\t#$80", ":"});
+    return (tok == TOK_LT && !op) ? "bpl" : "bmi";
+}
+
+// Emits the code after a comparison, jumping if the following token is a
+// conditional jump or loading the result in AX.
+void translator::compare_result(const char *branch, size_t &nxt)
+{
+    if(nxt < p.end && (code[nxt].is_tok(TOK_CJUMP) || code[nxt].is_tok(TOK_CNJUMP)))
+    {
+        // Invert the branch to skip the jump
+        static const std::map<std::string, const char *> inverse = {
+            {"beq", "bne"}, {"bne", "beq"}, {"bmi", "bpl"}, {"bpl", "bmi"}};
+        if(code[nxt].is_tok(TOK_CNJUMP))
+            branch = inverse.at(branch);
+        text += std::string("\t") + branch + "\t:+\n\tjmp\t" + target(nxt) + "\n:\n";
+        nxt = g.next(nxt);
+        tokens++;
+    }
+    else
+        text += std::string("\t") + branch + "\t:+\n\tlda\t#0\n\tbeq\t:++\n"
+                                             ":\tlda\t#1\n:\tldx\t#0\n";
+}
+
+// Translates the instruction at "pos", updating "nxt" with the position of
+// the next instruction. Returns false if the token is not supported.
+bool translator::translate(size_t pos, size_t &nxt)
+{
+    auto tok = code[pos].get_tok_id();
+    operand op;
+    // Loads and operations with a constant or variable operand don't need to
+    // use the stack.
+    if(get_operand(pos, op) && nxt < p.end && code[nxt].is_tok())
+    {
+        auto op_tok = code[nxt].get_tok_id();
+        auto save = text.size();
+        if(binary(op_tok, op))
+        {
+            nxt = g.next(nxt);
+            tokens++;
+            return true;
+        }
+        text.resize(save);
+        if(auto branch = compare(op_tok, &op))
+        {
+            nxt = g.next(nxt);
+            tokens++;
+            compare_result(branch, nxt);
+            return true;
+        }
+        text.resize(save);
+    }
+    if(auto branch = compare(tok, nullptr))
+    {
+        compare_result(branch, nxt);
+        return true;
+    }
+
+    auto &arg = code[pos + 1];
+    if(get_operand(pos, op))
+    {
+        emit({"ldy\tsptr", "jsr\tpushAX"});
+        text += "\tlda\t" + op.lo + "\n\tldx\t" + op.hi + "\n";
+    }
+    else if(tok == TOK_NUM)
+    {
+        auto v = value(arg, 0xFFFF);
+        text += "\tlda\t#<" + v + "\n\tldx\t#>" + v + "\n";
+    }
+    else if(tok == TOK_BYTE)
+        text += "\tlda\t#" + value(arg, 0xFF) + "\n\tldx\t#0\n";
+    else if(tok == TOK_0)
+        emit({"lda\t#0", "tax"});
+    else if(tok == TOK_1)
+        emit({"lda\t#1", "ldx\t#0"});
+    else if(tok == TOK_PUSH)
+        emit({"ldy\tsptr", "jsr\tpushAX"});
+    else if(tok == TOK_POP)
+        emit({"ldy\tsptr", "lda\tstack_l, y", "ldx\tstack_h, y", "inc\tsptr"});
+    else if(tok == TOK_VAR_LOAD)
+        text += "\tlda\t" + var(arg) + "\n\tldx\t" + var(arg) + "+1\n";
+    else if(tok == TOK_VAR_STORE)
+        text += "\tsta\t" + var(arg) + "\n\tstx\t" + var(arg) + "+1\n";
+    else if(tok == TOK_VAR_STORE_0)
+        text += "\tlda\t#0\n\ttax\n\tsta\t" + var(arg) + "\n\tsta\t" + var(arg) + "+1\n";
+    else if(tok == TOK_VAR_ADDR)
+        text += "\tlda\t#<" + var(arg) + "\n\tldx\t#>" + var(arg) + "\n";
+    else if(tok == TOK_VAR_SADDR)
+    {
+        text += "\tlda\t#<" + var(arg) + "\n\tldx\t#>" + var(arg) + "\n";
+        emit({"sta\tsaddr", "stx\tsaddr+1"});
+    }
+    else if(tok == TOK_ADD_VAR)
+        binary(TOK_ADD, operand{var(arg), var(arg) + "+1"});
+    else if(tok == TOK_INCVAR)
+        text += "\tinc\t" + var(arg) + "\n\tbne\t:+\n\tinc\t" + var(arg) + "+1\n:\n";
+    else if(tok == TOK_DECVAR)
+        text += "\tlda\t" + var(arg) + "\n\tbne\t:+\n\tdec\t" + var(arg) + "+1\n:\tdec\t" +
+                var(arg) + "\n";
+    else if(tok == TOK_ADD)
+        emit({"ldy\tsptr", "clc", "adc\tstack_l, y", "pha", "txa", "adc\tstack_h, y", "tax",
+              "pla", "inc\tsptr"});
+    else if(tok == TOK_SUB)
+        emit({"sta\ttmp1", "stx\ttmp1+1", "ldy\tsptr", "inc\tsptr", "lda\tstack_l, y", "sec",
+              "sbc\ttmp1", "pha", "lda\tstack_h, y", "sbc\ttmp1+1", "tax", "pla"});
+    else if(tok == TOK_BIT_AND || tok == TOK_BIT_OR || tok == TOK_BIT_EXOR)
+    {
+        auto ins = tok == TOK_BIT_AND ? "and" : tok == TOK_BIT_OR ? "ora" : "eor";
+        emit({"ldy\tsptr", "inc\tsptr"});
+        text += subst("\t%\tstack_l, y\n\tpha\n\ttxa\n\t%\tstack_h, y\n\ttax\n\tpla\n", ins);
+    }
+    else if(tok == TOK_MUL)
+    {
+        emit({"jsr\tnat_mul"});
+        use_mul = true;
+    }
+    else if(tok == TOK_NEG)
+        emit({"jsr\tneg_AX"});
+    else if(tok == TOK_ABS)
+        emit({"cpx\t#$80", "bcc\t:+", "jsr\tneg_AX", ":"});
+    else if(tok == TOK_USHL)
+        emit({"asl", "tay", "txa", "rol", "tax", "tya"});
+    else if(tok == TOK_SHL8)
+        emit({"tax", "lda\t#0"});
+    else if(tok == TOK_L_AND)
+        emit({"ldy\tsptr", "and\tstack_l, y", "inc\tsptr"});
+    else if(tok == TOK_L_OR)
+        emit({"ldy\tsptr", "ora\tstack_l, y", "inc\tsptr"});
+    else if(tok == TOK_L_NOT)
+        emit({"eor\t#1"});
+    else if(tok == TOK_SADDR)
+        emit({"sta\tsaddr", "stx\tsaddr+1"});
+    else if(tok == TOK_POKE)
+        emit({"ldy\t#0", "sta\t(saddr), y"});
+    else if(tok == TOK_DPOKE)
+        emit({"ldy\t#0", "sta\t(saddr), y", "iny", "txa", "sta\t(saddr), y"});
+    else if(tok == TOK_NUM_POKE)
+        text += "\tsta\t" + value(arg, 0xFFFF) + "\n";
+    else if(tok == TOK_BYTE_POKE)
+        text += "\tsta\t" + value(arg, 0xFF) + "\n";
+    else if(tok == TOK_PEEK)
+        emit({"sta\ttmp1", "stx\ttmp1+1", "ldy\t#0", "lda\t(tmp1), y", "ldx\t#0"});
+    else if(tok == TOK_DPEEK)
+        emit({"sta\ttmp1", "stx\ttmp1+1", "ldy\t#1", "lda\t(tmp1), y", "tax", "dey",
+              "lda\t(tmp1), y"});
+    else if(tok == TOK_BYTE_PEEK)
+        text += "\tlda\t" + value(arg, 0xFF) + "\n\tldx\t#0\n";
+    else if(tok == TOK_JUMP)
+        text += "\tjmp\t" + target(pos) + "\n";
+    else if(tok == TOK_CJUMP)
+        text += "\tlsr\n\tbcs\t:+\n\tjmp\t" + target(pos) + "\n:\n";
+    else if(tok == TOK_CNJUMP)
+        text += "\tlsr\n\tbcc\t:+\n\tjmp\t" + target(pos) + "\n:\n";
+    else if(tok == TOK_RET)
+        emit({"rts"});
+    else if(tok == TOK_CRET)
+        emit({"lsr", "bcs\t:+", "rts", ":"});
+    else if(tok == TOK_CNRET)
+        emit({"lsr", "bcc\t:+", "rts", ":"});
+    else if(tok == TOK_FOR)
+    {
+        emit({"jsr\tnat_for"});
+        use_for = true;
+    }
+    else if(tok == TOK_FOR_NEXT)
+    {
+        emit({"jsr\tnat_for_next"});
+        use_for = true;
+    }
+    else if(tok == TOK_FOR_EXIT)
+        emit({"inc\tsptr", "inc\tsptr", "inc\tsptr"});
+    else
+        return false;
+    return true;
+}
+
+bool translator::run()
+{
+    for(auto pos = p.start + 1; pos < p.end; pos++)
+        if(code[pos].is_label())
+            labels.insert(code[pos].get_str());
+
+    text += "nat_" + code[p.start].get_str() + ":\n";
+    bool live = true; // The code can continue to the next instruction
+    std::set<std::string> seen;
+    for(auto pos = p.start + 1; pos < p.end;)
+    {
+        auto &c = code[pos];
+        if(c.is_label())
+        {
+            text += "nat_" + c.get_str() + ":\n";
+            seen.insert(c.get_str());
+            live = true;
+            pos++;
+            continue;
+        }
+        tokens++;
+        auto nxt = g.next(pos);
+        auto tok = c.get_tok_id();
+        if(translate(pos, nxt))
+        {
+            if(resume.empty())
+            {
+                first_resume = tokens;
+                // Search jumps back, also in the fused tokens
+                for(auto j = pos; j < nxt; j = g.next(j))
+                    if((code[j].is_tok(TOK_JUMP) || code[j].is_tok(TOK_CJUMP) ||
+                        code[j].is_tok(TOK_CNJUMP)) &&
+                       seen.count(code[j + 1].get_str()))
+                        has_loop = true;
+            }
+            live = tok != TOK_JUMP && tok != TOK_RET;
+        }
+        else
+        {
+            // Return to the interpreter, at a new label before the token
+            auto name = "resume_lbl_" + std::to_string(num_labels++);
+            resume[pos] = name;
+            emit_resume(std::string(), name);
+            live = false;
+        }
+        pos = nxt;
+    }
+    // Code continuing after the end of the PROC
+    if(live)
+    {
+        if(p.end >= code.size() || !code[p.end].is_label())
+            return false;
+        emit_resume(std::string(), code[p.end].get_str());
+    }
+    for(auto &e : exits)
+        emit_resume(e.second, e.first);
+    return true;
+}
+
+// Returns true if the PROC name is in the list, ignoring the case
+static bool is_named(const std::string &name, const std::set<std::string> &names)
+{
+    for(auto &n : names)
+        if(n.size() == name.size() &&
+           std::equal(n.begin(), n.end(), name.begin(),
+                      [](char a, char b) { return std::toupper(a) == std::toupper(b); }))
+            return true;
+    return false;
+}
+
+std::set<std::string> native_selected(const std::map<std::string, std::vector<codew>> &procs,
+                                      const std::set<std::string> &names, bool all)
+{
+    std::string prefix = parse::label_prefix;
+    std::set<std::string> ret;
+    for(auto &p : procs)
+    {
+        auto &body = p.second;
+        if(body.empty() || !body[0].is_label())
+            continue;
+        auto &label = body[0].get_str();
+        if(label.compare(0, prefix.size(), prefix))
+            continue;
+        bool selected = is_named(label.substr(prefix.size()), names);
+        // Search jumps to a previous label
+        std::set<std::string> seen;
+        for(size_t i = 1; all && !selected && i < body.size(); i++)
+        {
+            if(body[i].is_label())
+                seen.insert(body[i].get_str());
+            else if((body[i].is_tok(TOK_JUMP) || body[i].is_tok(TOK_CJUMP) ||
+                     body[i].is_tok(TOK_CNJUMP)) &&
+                    i + 1 < body.size() && body[i + 1].is_sword())
+                selected = seen.count(body[i + 1].get_str());
+        }
+        if(selected)
+            ret.insert(label);
+    }
+    return ret;
+}
+
+bool do_native(std::vector<codew> &code, const std::set<std::string> &names, bool all,
+               bool report, native_code &out)
+{
+    cfg g(code);
+    std::string prefix = parse::label_prefix;
+    unsigned num_labels = 0;
+    bool use_for = false, use_mul = false;
+    std::vector<codew> ret;
+    size_t last = 0; // Position of the code not yet copied
+    for(auto &p : g.procs)
+    {
+        if(p.name.empty() || p.is_data)
+            continue;
+        // Check if the PROC is selected
+        auto name = p.name.substr(prefix.size());
+        bool named = is_named(name, names);
+        if(!all && !named)
+            continue;
+
+        translator t(code, g, p, num_labels);
+        const char *msg = nullptr;
+        auto first = g.next(p.start);
+        if(first >= p.end || !t.run())
+            msg = "not translated";
+        else if(t.resume.count(first))
+            msg = "not translated, first token not supported";
+        else if(!named && !t.resume.empty() && !t.has_loop && t.first_resume < min_tokens)
+            msg = "not translated, too few tokens before the interpreter";
+        if(report)
+        {
+            std::cerr << "native: PROC " << name << " (" << t.tokens << " tokens): ";
+            if(msg)
+                std::cerr << msg << "\n";
+            else if(t.resume.empty())
+                std::cerr << "translated\n";
+            else
+                std::cerr << "translated, " << t.resume.size()
+                          << (t.resume.size() == 1 ? " token runs" : " tokens run")
+                          << " in the interpreter\n";
+        }
+        if(msg)
+            continue;
+
+        // Replace the bytecode with the call to the native code, and keep the
+        // bytecode if needed to continue in the interpreter.
+        ret.insert(ret.end(), code.begin() + last, code.begin() + p.start + 1);
+        auto ln = code[p.start].linenum();
+        ret.push_back(codew::ctok(TOK_NUM, ln));
+        ret.push_back(codew::cword("nat_" + p.name, ln));
+        ret.push_back(codew::ctok(TOK_USR_ADDR, ln));
+        ret.push_back(codew::ctok(TOK_USR_CALL, ln));
+        ret.push_back(codew::ctok(TOK_RET, ln));
+        if(!t.resume.empty())
+        {
+            for(auto pos = p.start + 1; pos < p.end; pos++)
+            {
+                auto r = t.resume.find(pos);
+                if(r != t.resume.end())
+                    ret.push_back(codew::clabel(r->second, code[pos].linenum()));
+                ret.push_back(code[pos]);
+            }
+        }
+        last = p.end;
+        out.args.insert(out.args.end(), code.begin() + p.start + 1, code.begin() + p.end);
+        out.text += t.text;
+        use_for = use_for || t.use_for;
+        use_mul = use_mul || t.use_mul;
+    }
+    if(!last)
+        return false;
+    ret.insert(ret.end(), code.begin() + last, code.end());
+    code.swap(ret);
+
+    if(use_for)
+        out.text += native_for;
+    if(use_mul)
+        out.text += native_mul;
+    out.text = ";-----------------------------\n"
+               "; Native code\n"
+               "\t.segment \"CODE\"\n"
+               "\t.import pushAX, neg_AX, stack_l, stack_h\n"
+               "\t.importzp sptr, cptr, saddr, tmp1, tmp2, tmp3\n" +
+               out.text;
+    return true;
+}
@@ -0,0 +1,51 @@
+/*
+ * FastBasic - Fast basic interpreter for the Atari 8-bit computers
+ * Copyright (C) 2017-2025 Daniel Serpell
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+// native.h: Translation of PROCs to native 6502 code
+
+#pragma once
+
+#include "codew.h"
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+// The native code of the translated PROCs
+class native_code
+{
+  public:
+    std::string text;        // Assembly code, in the CODE segment
+    std::vector<codew> args; // Arguments of the translated tokens, to get the
+                             // variables and symbols used by the native code
+};
+
+// Returns the labels of the PROCs selected for the translation to native
+// code, the ones in "names" and, if "all" is true, the ones with loops. Those
+// should not be inlined.
+std::set<std::string> native_selected(const std::map<std::string, std::vector<codew>> &procs,
+                                      const std::set<std::string> &names, bool all);
+
+// Translates the PROCs in "names" (without the label prefix), or all the
+// PROCs that can benefit if "all" is true, to native 6502 code. The bytecode
+// of each PROC is replaced by a call to the native code, followed by the
+// original bytecode if there are tokens that are not translated: the native
+// code returns to the interpreter at those tokens. If "report" is true, shows
+// the result for each PROC. Returns true if the code was changed.
+bool do_native(std::vector<codew> &code, const std::set<std::string> &names, bool all,
+               bool report, native_code &out);
@@ -0,0 +1,745 @@
+/*
+ * FastBasic - Fast basic interpreter for the Atari 8-bit computers
+ * Copyright (C) 2017-2025 Daniel Serpell
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+// objfile.cc: Writes CA65 object files directly from the bytecode
+
+#include "objfile.h"
+#include "os.h"
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+
+// Object file format definitions, from "cc65/common" headers
+namespace
+{
+const uint32_t OBJ_MAGIC = 0x616E7A55;
+const uint16_t OBJ_VERSION = 0x0011;
+const uint16_t OBJ_FLAGS_DBGINFO = 0x0001;
+const uint8_t ADDR_SIZE_ZP = 0x01;
+const uint8_t ADDR_SIZE_ABS = 0x02;
+const uint8_t FRAG_LITERAL = 0x00;
+const uint8_t FRAG_EXPR = 0x08;
+const uint8_t FRAG_FILL = 0x20;
+const uint8_t EXPR_LITERAL = 0x81;
+const uint8_t EXPR_SYMBOL = 0x82;
+const uint8_t EXPR_SECTION = 0x83;
+const uint8_t EXPR_PLUS = 0x01;
+const uint8_t EXPR_MINUS = 0x02;
+const uint8_t EXPR_DIV = 0x04;
+const uint8_t EXPR_BYTE0 = 0x48;
+const unsigned SYM_EXPR = 0x0010;
+const unsigned SYM_LABEL = 0x0020;
+const unsigned SYM_CHEAP_LOCAL = 0x0040;
+const unsigned SCOPE_GLOBAL = 0;
+
+// Binary data in the object file format
+class obj_data
+{
+  public:
+    std::string buf;
+    void put8(unsigned x) { buf += char(x & 0xFF); }
+    void put16(unsigned x)
+    {
+        put8(x);
+        put8(x >> 8);
+    }
+    void put32(uint32_t x)
+    {
+        put16(x);
+        put16(x >> 16);
+    }
+    void var(uint32_t x)
+    {
+        while(x > 0x7F)
+        {
+            put8(0x80 | (x & 0x7F));
+            x >>= 7;
+        }
+        put8(x);
+    }
+    void str(const std::string &s)
+    {
+        var(s.size());
+        buf += s;
+    }
+    void add(const obj_data &d) { buf += d.buf; }
+};
+
+// The string pool of the object file
+class str_pool
+{
+  public:
+    std::map<std::string, unsigned> ids;
+    std::vector<std::string> list;
+    str_pool() { id(""); }
+    unsigned id(const std::string &s)
+    {
+        auto it = ids.find(s);
+        if(it != ids.end())
+            return it->second;
+        ids.emplace(s, list.size());
+        list.push_back(s);
+        return list.size() - 1;
+    }
+};
+
+std::string to_upper(std::string s)
+{
+    for(auto &c : s)
+        c = std::toupper(c);
+    return s;
+}
+
+bool is_ident_char(char c)
+{
+    return std::isalnum(c) || c == '_' || c == '@';
+}
+
+// Simple expression evaluator, supports the operators used in the include
+// files with the CA65 precedence.
+class expr_parser
+{
+    const std::string &str;
+    const std::map<std::string, long> &values;
+    size_t pos = 0;
+    bool ok = true;
+
+    void skip()
+    {
+        while(pos < str.size() && std::isspace(str[pos]))
+            pos++;
+    }
+    bool next(const char *op)
+    {
+        skip();
+        auto l = std::char_traits<char>::length(op);
+        if(str.compare(pos, l, op) != 0)
+            return false;
+        pos += l;
+        return true;
+    }
+    long factor()
+    {
+        skip();
+        if(pos >= str.size())
+            return ok = false;
+        char c = str[pos];
+        if(next("-"))
+            return -factor();
+        if(next("~"))
+            return ~factor();
+        if(next("<"))
+            return factor() & 0xFF;
+        if(next(">"))
+            return (factor() >> 8) & 0xFF;
+        if(next("("))
+        {
+            auto x = expr();
+            if(!next(")"))
+                ok = false;
+            return x;
+        }
+        if(c == '\'')
+        {
+            if(pos + 2 >= str.size() || str[pos + 2] != '\'')
+                return ok = false;
+            pos += 3;
+            return (unsigned char)str[pos - 2];
+        }
+        int base = 10;
+        if(c == '$' || c == '%')
+        {
+            base = c == '$' ? 16 : 2;
+            pos++;
+        }
+        if(base != 10 || std::isdigit(c))
+        {
+            size_t end = 0;
+            long x = 0;
+            try
+            {
+                x = std::stol(str.substr(pos), &end, base);
+            }
+            catch(...)
+            {
+            }
+            if(!end)
+                return ok = false;
+            pos += end;
+            return x;
+        }
+        auto end = pos;
+        while(end < str.size() && is_ident_char(str[end]))
+            end++;
+        auto it = values.find(str.substr(pos, end - pos));
+        if(end == pos || it == values.end())
+            return ok = false;
+        pos = end;
+        return it->second;
+    }
+    long term()
+    {
+        auto x = factor();
+        while(ok)
+        {
+            if(next("*"))
+                x = x * factor();
+            else if(next("/"))
+            {
+                auto y = factor();
+                if(!y)
+                    return ok = false;
+                x = x / y;
+            }
+            else if(next("&") && !next("&"))
+                x = x & factor();
+            else if(next("^"))
+                x = x ^ factor();
+            else if(next("<<"))
+                x = x << factor();
+            else if(next(">>"))
+                x = x >> factor();
+            else
+                break;
+        }
+        return x;
+    }
+    long expr()
+    {
+        auto x = term();
+        while(ok)
+        {
+            if(next("+"))
+                x = x + term();
+            else if(next("-"))
+                x = x - term();
+            else if(next("|") && !next("|"))
+                x = x | term();
+            else
+                break;
+        }
+        return x;
+    }
+
+  public:
+    expr_parser(const std::string &str, const std::map<std::string, long> &values)
+        : str(str), values(values)
+    {
+    }
+    bool eval(long &val)
+    {
+        val = expr();
+        skip();
+        return ok && pos == str.size();
+    }
+};
+} // namespace
+
+bool asm_symbols::eval(const std::string &str, long &val) const
+{
+    return expr_parser(str, values).eval(val);
+}
+
+bool asm_symbols::read(const std::string &fname, int depth)
+{
+    std::ifstream f(fname);
+    if(!f.is_open() || depth > 16)
+        return false;
+
+    // Conditional assembly stack, each level is active if the condition and
+    // all the parent levels are true.
+    std::vector<bool> conds;
+    bool active = true;
+    auto update = [&]() {
+        active = true;
+        for(auto c : conds)
+            active = active && c;
+    };
+    auto defined = [&](const std::string &name) {
+        if(values.count(name) || unknown.count(name))
+            return true;
+        for(auto &d : defines)
+            if(d == name)
+                return true;
+        return false;
+    };
+
+    std::string line;
+    while(std::getline(f, line))
+    {
+        // Remove comments and spaces
+        char quote = 0;
+        for(size_t i = 0; i < line.size(); i++)
+        {
+            if(quote)
+            {
+                if(line[i] == quote)
+                    quote = 0;
+            }
+            else if(line[i] == '"' || line[i] == '\'')
+                quote = line[i];
+            else if(line[i] == ';')
+            {
+                line.resize(i);
+                break;
+            }
+        }
+        auto start = line.find_first_not_of(" \t\r");
+        if(start == line.npos)
+            continue;
+        line = line.substr(start, line.find_last_not_of(" \t\r") + 1 - start);
+
+        // Get first word and the rest of the line
+        auto end = line.find_first_of(" \t=:");
+        if(end == line.npos)
+            end = line.size();
+        auto word = line.substr(0, end);
+        auto rest = line.substr(end);
+        rest = rest.substr(std::min(rest.size(), rest.find_first_not_of(" \t")));
+
+        if(word[0] == '.')
+        {
+            auto dir = to_upper(word);
+            if(dir == ".IFDEF" || dir == ".IFNDEF")
+            {
+                conds.push_back(defined(rest) == (dir == ".IFDEF"));
+                update();
+            }
+            else if(dir == ".ELSE" && !conds.empty())
+            {
+                conds.back() = !conds.back();
+                update();
+            }
+            else if(dir == ".ENDIF" && !conds.empty())
+            {
+                conds.pop_back();
+                update();
+            }
+            else if(!active)
+                continue;
+            else if(dir == ".INCLUDE")
+            {
+                if(rest.size() < 2 || rest[0] != '"' || rest.back() != '"')
+                    return false;
+                auto name = rest.substr(1, rest.size() - 2);
+                if(!read(os::full_path(os::dir_name(fname), name), depth + 1))
+                    return false;
+            }
+            else if(dir == ".DEFINE")
+            {
+                auto e = rest.find_first_of(" \t(");
+                unknown[rest.substr(0, e)] = true;
+            }
+            else if(dir != ".GLOBAL" && dir != ".GLOBALZP" && dir != ".IMPORT" &&
+                    dir != ".IMPORTZP")
+                return false;
+        }
+        else if(!active)
+            continue;
+        else
+        {
+            // Only support symbol assignments
+            if(rest.compare(0, 2, ":=") == 0)
+                rest = rest.substr(2);
+            else if(rest.compare(0, 1, "=") == 0)
+                rest = rest.substr(1);
+            else
+                return false;
+            for(auto c : word)
+                if(!is_ident_char(c))
+                    return false;
+            long val;
+            if(eval(rest, val))
+                values[word] = val;
+            else
+                unknown[word] = true;
+        }
+    }
+    return conds.empty();
+}
+
+bool asm_symbols::load(const std::string &fname, const std::vector<std::string> &ca65_args)
+{
+    values.clear();
+    unknown.clear();
+    defines.clear();
+    // The assembler defines a symbol with the target name
+    for(size_t i = 0; i < ca65_args.size(); i++)
+    {
+        auto &a = ca65_args[i];
+        std::string t;
+        if(a.size() > 2 && a.compare(0, 2, "-t") == 0)
+            t = a.substr(2);
+        else if((a == "-t" || a == "--target") && i + 1 < ca65_args.size())
+            t = ca65_args[i + 1];
+        if(t.size())
+            defines.push_back("__" + to_upper(t) + "__");
+    }
+    return read(fname, 0);
+}
+
+bool asm_symbols::get(const std::string &name, long &val) const
+{
+    auto it = values.find(name);
+    if(it == values.end())
+        return false;
+    val = it->second;
+    return true;
+}
+
+obj_file::obj_file(const std::string &source, unsigned source_size)
+    : source(source), source_size(source_size), cur_zp(false), cur_sect(-1), cur_line(0)
+{
+    line(0);
+}
+
+obj_file::section &obj_file::sect()
+{
+    if(cur_sect < 0)
+    {
+        for(unsigned i = 0; i < sections.size(); i++)
+            if(sections[i].name == cur_seg)
+                cur_sect = i;
+        if(cur_sect < 0)
+        {
+            cur_sect = sections.size();
+            sections.push_back(section{cur_seg, cur_zp, 0, {}});
+        }
+    }
+    return sections[cur_sect];
+}
+
+void obj_file::add(fragment f)
+{
+    auto &s = sect();
+    f.line = cur_line;
+    s.size += f.size;
+    // Join literal data of the same line
+    if(f.type == fragment::literal && !s.frags.empty() &&
+       s.frags.back().type == fragment::literal && s.frags.back().line == f.line)
+    {
+        s.frags.back().size += f.size;
+        s.frags.back().data += f.data;
+    }
+    else
+        s.frags.push_back(f);
+}
+
+void obj_file::segment(const std::string &name, bool zp)
+{
+    if(name != cur_seg)
+    {
+        cur_seg = name;
+        cur_zp = zp;
+        cur_sect = -1;
+    }
+    // Create the section even if empty, the linker defines the symbols of
+    // the segments in the objects.
+    sect();
+}
+
+void obj_file::line(unsigned num)
+{
+    auto it = line_ids.find(num);
+    if(it == line_ids.end())
+    {
+        it = line_ids.emplace(num, line_infos.size()).first;
+        line_infos.push_back(num);
+    }
+    cur_line = it->second;
+}
+
+void obj_file::label(const std::string &name)
+{
+    int owner = -1;
+    if(name[0] == '@')
+    {
+        if(last_label.empty() && error.empty())
+            error = "cheap local label '" + name + "' without a parent";
+        owner = label_order.size();
+        while(owner > 0 && label_order[--owner] != last_label)
+            ;
+    }
+    else
+        last_label = name;
+    auto &s = sect();
+    if(!labels.emplace(name, symbol{unsigned(cur_sect), s.size, false, cur_line, owner}).second &&
+       error.empty())
+        error = "duplicated label '" + name + "'";
+    label_order.push_back(name);
+}
+
+void obj_file::export_label(const std::string &name)
+{
+    auto it = labels.find(name);
+    if(it != labels.end())
+        it->second.exported = true;
+    else if(error.empty())
+        error = "exported label '" + name + "' not defined";
+}
+
+void obj_file::import(const std::string &name, bool zp)
+{
+    imports.emplace(name, imported{zp, -1});
+}
+
+void obj_file::data(const std::string &bytes)
+{
+    if(bytes.size())
+        add(fragment{fragment::literal, unsigned(bytes.size()), bytes, 0});
+}
+
+void obj_file::fill(unsigned size)
+{
+    if(size)
+        add(fragment{fragment::fill, size, std::string(), 0});
+}
+
+void obj_file::ref(const std::string &name, unsigned size)
+{
+    add(fragment{fragment::ref, size, name, 0});
+}
+
+void obj_file::var_id(const std::string &name)
+{
+    add(fragment{fragment::var_id, 1, name, 0});
+}
+
+std::string obj_file::write(const std::string &fname)
+{
+    if(!error.empty())
+        return error;
+
+    str_pool strings;
+
+    // Assign the import numbers, only the referenced imports are written
+    std::map<std::string, unsigned> import_ids;
+    auto use_import = [&](const std::string &name, unsigned line) {
+        auto it = imports.find(name);
+        if(it == imports.end())
+            return false;
+        if(it->second.ref_line < 0)
+            it->second.ref_line = line;
+        return true;
+    };
+    for(auto &s : sections)
+        for(auto &f : s.frags)
+        {
+            if(f.type == fragment::var_id && !use_import("__HEAP_RUN__", f.line))
+                return "symbol '__HEAP_RUN__' not imported";
+            if((f.type == fragment::ref || f.type == fragment::var_id) && !labels.count(f.data))
+            {
+                if(f.type == fragment::var_id || !use_import(f.data, f.line))
+                    return "symbol '" + f.data + "' not defined";
+            }
+        }
+    for(auto &i : imports)
+        if(i.second.ref_line >= 0)
+            import_ids.emplace(i.first, import_ids.size());
+
+    // Expressions
+    auto expr_label = [&](obj_data &d, const symbol &s) {
+        if(s.offset)
+        {
+            d.put8(EXPR_PLUS);
+            d.put8(EXPR_SECTION);
+            d.var(s.sect);
+            d.put8(EXPR_LITERAL);
+            d.put32(s.offset);
+        }
+        else
+        {
+            d.put8(EXPR_SECTION);
+            d.var(s.sect);
+        }
+    };
+    auto expr_sym = [&](obj_data &d, const std::string &name) {
+        auto it = labels.find(name);
+        if(it != labels.end())
+            expr_label(d, it->second);
+        else
+        {
+            d.put8(EXPR_SYMBOL);
+            d.var(import_ids.at(name));
+        }
+    };
+    auto line_list = [&](obj_data &d, int line) {
+        if(line < 0)
+            d.var(0);
+        else
+        {
+            d.var(1);
+            d.var(line);
+        }
+    };
+
+    // Options
+    obj_data options;
+    options.var(0);
+
+    // Files
+    obj_data files;
+    files.var(1);
+    files.var(strings.id(source));
+    files.put32(0);
+    files.var(source_size);
+
+    // Segments
+    obj_data segs;
+    segs.var(sections.size());
+    for(auto &s : sections)
+    {
+        obj_data d;
+        d.var(strings.id(s.name));
+        d.var(0);
+        d.var(s.size);
+        d.var(1);
+        d.put8(s.zp ? ADDR_SIZE_ZP : ADDR_SIZE_ABS);
+        d.var(s.frags.size());
+        for(auto &f : s.frags)
+        {
+            switch(f.type)
+            {
+            case fragment::literal:
+                d.put8(FRAG_LITERAL);
+                d.str(f.data);
+                break;
+            case fragment::fill:
+                d.put8(FRAG_FILL);
+                d.var(f.size);
+                break;
+            case fragment::ref:
+                d.put8(FRAG_EXPR | f.size);
+                expr_sym(d, f.data);
+                break;
+            case fragment::var_id:
+                // Expression: <((label - __HEAP_RUN__) / 2)
+                d.put8(FRAG_EXPR | 1);
+                d.put8(EXPR_BYTE0);
+                d.put8(EXPR_DIV);
+                d.put8(EXPR_MINUS);
+                expr_sym(d, f.data);
+                expr_sym(d, "__HEAP_RUN__");
+                d.put8(EXPR_LITERAL);
+                d.put32(2);
+                d.put8(0);
+                break;
+            }
+            line_list(d, f.line);
+        }
+        segs.put32(d.buf.size());
+        segs.add(d);
+    }
+
+    // Imports
+    obj_data imps;
+    imps.var(import_ids.size());
+    for(auto &i : imports)
+    {
+        if(i.second.ref_line < 0)
+            continue;
+        imps.put8(i.second.zp ? ADDR_SIZE_ZP : ADDR_SIZE_ABS);
+        imps.var(strings.id(i.first));
+        line_list(imps, -1);
+        line_list(imps, i.second.ref_line);
+    }
+
+    // Exports and debug symbols, in definition order
+    obj_data exps, dbgs;
+    unsigned num_exports = 0;
+    dbgs.var(label_order.size());
+    for(auto &name : label_order)
+    {
+        auto &l = labels.at(name);
+        auto addr_size = sections[l.sect].zp ? ADDR_SIZE_ZP : ADDR_SIZE_ABS;
+        if(l.exported)
+        {
+            num_exports++;
+            exps.var(SYM_EXPR | SYM_LABEL);
+            exps.put8(addr_size);
+            exps.var(strings.id(name));
+            expr_label(exps, l);
+            line_list(exps, l.line);
+            line_list(exps, -1);
+        }
+        dbgs.var(SYM_EXPR | SYM_LABEL | (l.owner < 0 ? 0 : SYM_CHEAP_LOCAL));
+        dbgs.put8(addr_size);
+        dbgs.var(l.owner < 0 ? 0 : l.owner);
+        dbgs.var(strings.id(name));
+        expr_label(dbgs, l);
+        line_list(dbgs, l.line);
+        line_list(dbgs, -1);
+    }
+    dbgs.var(0); // No HLL debug symbols
+    obj_data exports;
+    exports.var(num_exports);
+    exports.add(exps);
+
+    // Only the global scope
+    obj_data scopes;
+    scopes.var(1);
+    scopes.var(0);
+    scopes.var(0);
+    scopes.var(0);
+    scopes.var(SCOPE_GLOBAL);
+    scopes.var(strings.id(""));
+    scopes.var(0);
+
+    // Line infos, at column 0 of the source file
+    obj_data lines;
+    lines.var(line_infos.size());
+    for(auto l : line_infos)
+    {
+        lines.var(l);
+        lines.var(0);
+        lines.var(0);
+        lines.var(0);
+        lines.var(0);
+    }
+
+    // String pool, must be last as all the other sections add strings
+    obj_data pool;
+    pool.var(strings.list.size());
+    for(auto &s : strings.list)
+        pool.str(s);
+
+    obj_data empty;
+    empty.var(0);
+
+    // Header, with the offset and size of each table
+    obj_data out;
+    out.put32(OBJ_MAGIC);
+    out.put16(OBJ_VERSION);
+    out.put16(OBJ_FLAGS_DBGINFO);
+    uint32_t offset = 4 + 2 + 2 + 22 * 4;
+    for(auto d : {&options, &files, &segs, &imps, &exports, &dbgs, &lines, &pool, &empty,
+                  &scopes, &empty})
+    {
+        out.put32(offset);
+        out.put32(d->buf.size());
+        offset += d->buf.size();
+    }
+    for(auto d : {&options, &files, &segs, &imps, &exports, &dbgs, &lines, &pool, &empty,
+                  &scopes, &empty})
+        out.add(*d);
+
+    std::ofstream f(fname, std::ios::binary);
+    if(!f.is_open() || !f.write(out.buf.data(), out.buf.size()))
+        return "can't write output file '" + fname + "'";
+    return std::string();
+}
@@ -0,0 +1,135 @@
+/*
+ * FastBasic - Fast basic interpreter for the Atari 8-bit computers
+ * Copyright (C) 2017-2025 Daniel Serpell
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+// objfile.h: Writes CA65 object files directly from the bytecode
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+// Symbols defined in the target assembly include files. Those are resolved
+// by the assembler, so the object file must include the values.
+class asm_symbols
+{
+  private:
+    std::map<std::string, long> values;
+    std::map<std::string, bool> unknown; // Symbols with a value not supported
+    std::vector<std::string> defines;    // Symbols defined by the assembler
+    bool read(const std::string &fname, int depth);
+    bool eval(const std::string &str, long &val) const;
+
+  public:
+    // Loads the symbols of the given include file, with the assembler target
+    // taken from the CA65 arguments. Returns false if the file has unsupported
+    // content.
+    bool load(const std::string &fname, const std::vector<std::string> &ca65_args);
+    // Returns the value of the symbol, if defined
+    bool get(const std::string &name, long &val) const;
+    // Returns true if the symbol is defined with an unsupported value
+    bool is_unknown(const std::string &name) const { return unknown.count(name) != 0; }
+};
+
+// An object file, built one segment and label at a time. The references to
+// symbols are resolved when writing the file, the symbols not defined in the
+// object must be declared as imports.
+class obj_file
+{
+  private:
+    class fragment
+    {
+      public:
+        enum
+        {
+            literal, // Bytes in "data"
+            fill,    // "size" zero bytes
+            ref,     // Value of symbol "data", "size" bytes
+            var_id   // Variable number from the address of "data"
+        } type;
+        unsigned size;
+        std::string data;
+        unsigned line; // Index of the line info
+    };
+    class section
+    {
+      public:
+        std::string name;
+        bool zp;
+        unsigned size;
+        std::vector<fragment> frags;
+    };
+    class symbol
+    {
+      public:
+        unsigned sect;   // Section of the label
+        unsigned offset; // Offset in the section
+        bool exported;
+        unsigned line;  // Index of the line info
+        int owner;      // For cheap local labels, the owner label
+    };
+    class imported
+    {
+      public:
+        bool zp;
+        int ref_line; // First reference, or -1 if not referenced
+    };
+    std::string source;                      // Source file name
+    unsigned source_size;                    // Source file size
+    std::vector<section> sections;           // All sections, in creation order
+    std::vector<unsigned> line_infos;        // Source line of each line info
+    std::map<unsigned, unsigned> line_ids;   // Line info index of each line
+    std::map<std::string, symbol> labels;    // Labels, by name
+    std::vector<std::string> label_order;    // Label names, in definition order
+    std::map<std::string, imported> imports; // Imports, by name
+    std::string cur_seg;                     // Name of the current segment
+    bool cur_zp;                             // Current segment is zero page
+    int cur_sect;                            // Current section, or -1 if not created
+    unsigned cur_line;                       // Current line info index
+    std::string last_label;                  // Owner of the cheap local labels
+    std::string error;                       // First error found
+    section &sect();
+    void add(fragment f);
+
+  public:
+    obj_file(const std::string &source, unsigned source_size);
+    // Selects the segment for the following labels and data, creating it
+    void segment(const std::string &name, bool zp = false);
+    // Sets the source line for the following labels and data
+    void line(unsigned num);
+    // Defines a label at the current position, names starting with '@' are
+    // cheap local labels.
+    void label(const std::string &name);
+    // Exports a label
+    void export_label(const std::string &name);
+    // Declares an imported symbol
+    void import(const std::string &name, bool zp);
+    // Adds bytes to the current segment
+    void data(const std::string &bytes);
+    // Adds "size" zero bytes to the current segment
+    void fill(unsigned size);
+    // Adds the value of a symbol, of 1 or 2 bytes, to the current segment
+    void ref(const std::string &name, unsigned size);
+    // Adds the number of the variable at the given label, from the start
+    // of the heap.
+    void var_id(const std::string &name);
+    // Writes the object file, returns an empty string or the reason of the
+    // error, if the object can't be written.
+    std::string write(const std::string &fname);
+};
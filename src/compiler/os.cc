@@ -18,23 +18,30 @@
 
 // os.cc: Host OS functions
 #include "os.h"
+#include <cstdio>
 #include <memory>
 #include <sys/stat.h>
 
 #ifdef _WIN32
+#include <direct.h>
+#include <sys/utime.h>
 #include <windows.h>
 #define HAVE_DRIVE 1
 static const char *path_sep = "\\/";
 #else
+#include <dirent.h>
+#include <mutex>
 #include <signal.h>
 #include <sys/wait.h>
 #include <unistd.h>
+#include <utime.h>
 #include <cerrno>
 #define HAVE_DRIVE 0
 static const char *path_sep = "/";
 #endif
 
 static std::vector<std::string> compiler_search_path;
+static std::string program_name;
 
 bool os::path_absolute(const std::string &path)
 {
@@ -117,6 +124,7 @@ void os::init(const std::string &prog)
     if(env)
         compiler_search_path.emplace_back(env);
     // The directory of the invoked program
+    program_name = prog;
     compiler_search_path.emplace_back(dir_name(prog));
     // And on Linux systems, the instalation path
 #ifndef _WIN32
@@ -156,7 +164,88 @@ std::vector<std::string> os::get_search_path(const std::string &filename)
     return ret;
 }
 
-int os::prog_exec(std::string exe, std::vector<std::string> &args)
+#ifndef _WIN32
+// Signal handlers replaced while waiting for child processes, shared by all
+// the threads calling "fork_wait".
+static std::mutex signal_lock;
+static unsigned signal_users = 0;
+static struct sigaction old_int, old_quit;
+
+// Calls "child" in a new process, waiting for the result. If "output" is
+// not null, stores the standard output and error of the child in it.
+template <class F> static int fork_wait(F child, std::string *output)
+{
+    // We reimplement "system" to allow passing arguments without escaping:
+
+    // Ignore INT and QUIT signals in the parent process:
+    {
+        std::lock_guard<std::mutex> guard(signal_lock);
+        if(!signal_users++)
+        {
+            struct sigaction sa = {{SIG_IGN}, 0};
+            sigaction(SIGINT, &sa, &old_int);
+            sigaction(SIGQUIT, &sa, &old_quit);
+        }
+    }
+
+    // Capture the output in a temporary file, as a pipe could be kept open
+    // by other children started at the same time from other threads.
+    FILE *tmp = output ? tmpfile() : nullptr;
+    int tmp_fd = tmp ? fileno(tmp) : -1;
+
+    // Block SIGCHLD
+    sigset_t oldmask, newmask;
+    sigemptyset(&newmask);
+    sigaddset(&newmask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &newmask, &oldmask);
+
+    int status = -1;
+    auto pid = fork();
+    if(pid == 0)
+    {
+        // Child, reset INT, QUIT and CHLD signals to default
+        struct sigaction sa = {{SIG_DFL}, 0};
+        sigaction(SIGINT, &sa, nullptr);
+        sigaction(SIGQUIT, &sa, nullptr);
+        sigprocmask(SIG_SETMASK, &oldmask, nullptr);
+        if(tmp_fd != -1)
+        {
+            dup2(tmp_fd, 1);
+            dup2(tmp_fd, 2);
+        }
+        _exit(child());
+    }
+    else if(pid != -1)
+    {
+        // Wait until child returns
+        while((waitpid(pid, &status, 0) == -1) && (errno == EINTR))
+            ;
+    }
+
+    // Restore signals
+    sigprocmask(SIG_SETMASK, &oldmask, NULL);
+    {
+        std::lock_guard<std::mutex> guard(signal_lock);
+        if(!--signal_users)
+        {
+            sigaction(SIGINT, &old_int, NULL);
+            sigaction(SIGQUIT, &old_quit, NULL);
+        }
+    }
+
+    if(tmp)
+    {
+        char buf[4096];
+        rewind(tmp);
+        while(auto n = fread(buf, 1, sizeof(buf), tmp))
+            output->append(buf, n);
+        fclose(tmp);
+    }
+    return status;
+}
+#endif
+
+int os::prog_exec(std::string exe, std::vector<std::string> &args, std::string *output)
 {
     std::vector<const char *> pargs;
 #ifdef _WIN32
@@ -184,54 +273,208 @@ int os::prog_exec(std::string exe, std::vector<std::string> &args)
         pargs.push_back(s.c_str());
     pargs.push_back(nullptr);
 
-    // We reimplement "system" to allow passing arguments without escaping:
+    return fork_wait([&]() {
+        // Exec process
+        execv(exe_path.c_str(), (char **)pargs.data());
+        // If we got here, it is an error
+        return 127;
+    }, output);
+#endif
+}
 
-    // Ignore INT and QUIT signals in the parent process:
-    sigset_t oldmask, newmask;
-    struct sigaction sa = {{SIG_IGN}, 0}, oldint, oldquit;
-    sigaction(SIGINT, &sa, &oldint);
-    sigaction(SIGQUIT, &sa, &oldquit);
+int os::prog_call(int (*entry)(int, char **), std::string exe,
+                  std::vector<std::string> &args, std::string *output)
+{
+#ifdef _WIN32
+    // No "fork" available, execute the external program
+    return prog_exec(exe, args, output);
+#else
+    // The linked tools keep their state in global variables and call "exit"
+    // on errors, so they run in a copy of this process. This is still a lot
+    // faster than loading the program from disk.
+    std::vector<std::string> cargs(args);
+    std::vector<char *> pargs;
+    for(auto &s : cargs)
+        pargs.push_back(&s[0]);
+    pargs.push_back(nullptr);
 
-    // Block SIGCHLD
-    sigemptyset(&newmask);
-    sigaddset(&newmask, SIGCHLD);
-    sigprocmask(SIG_BLOCK, &newmask, &oldmask);
+    // Don't duplicate pending output in the child
+    fflush(nullptr);
+    return fork_wait([&]() {
+        int ret = entry(int(pargs.size() - 1), pargs.data());
+        fflush(nullptr);
+        return ret;
+    }, output);
+#endif
+}
 
-    int status = -1;
-    auto pid = fork();
-    if(pid == 0)
+void os::remove_file(const std::string &path)
+{
+#ifdef _WIN32
+    _unlink(path.c_str());
+#else
+    unlink(path.c_str());
+#endif
+}
+
+bool os::rename_file(const std::string &from, const std::string &to)
+{
+#ifdef _WIN32
+    return 0 != MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING);
+#else
+    return 0 == rename(from.c_str(), to.c_str());
+#endif
+}
+
+// Creates a folder if it does not exists, returns true if exists.
+static bool make_dir(const std::string &path)
+{
+    struct stat st;
+    if(0 == stat(path.c_str(), &st))
+        return S_ISDIR(st.st_mode);
+#ifdef _WIN32
+    return 0 == _mkdir(path.c_str());
+#else
+    return 0 == mkdir(path.c_str(), 0755);
+#endif
+}
+
+std::string os::cache_dir(const std::string &sub)
+{
+    // Use the FASTBASIC_CACHE environment variable if set:
+    const char *env = getenv("FASTBASIC_CACHE");
+    if(env)
     {
-        // Child, reset INT, QUIT and CHLD signals to default
-        struct sigaction sa = {{SIG_DFL}, 0};
-        sigaction(SIGINT, &sa, nullptr);
-        sigaction(SIGQUIT, &sa, nullptr);
-        sigprocmask(SIG_SETMASK, &oldmask, nullptr);
-        // Exec process
-        execv(exe_path.c_str(), (char **)pargs.data());
-        // If we got here, it is an error
-        _exit(127);
+        if(!*env || !make_dir(env))
+            return std::string();
+        if(sub.empty())
+            return env;
+        auto path = full_path(env, sub);
+        return make_dir(path) ? path : std::string();
     }
-    else if(pid != -1)
+    // Get the user cache folder:
+    std::string base;
+#ifdef _WIN32
+    env = getenv("LOCALAPPDATA");
+    if(env && *env)
+        base = env;
+#else
+    env = getenv("XDG_CACHE_HOME");
+    if(env && *env)
+        base = env;
+    else
     {
-        // Wait until child returns
-        while((waitpid(pid, &status, 0) == -1) && (errno == EINTR))
-            ;
+        env = getenv("HOME");
+        if(!env || !*env)
+            return std::string();
+        base = full_path(env, ".cache");
     }
+#endif
+    if(base.empty() || !make_dir(base))
+        return std::string();
+    auto path = full_path(base, "fastbasic");
+    if(!make_dir(path))
+        return std::string();
+    if(!sub.empty())
+    {
+        path = full_path(path, sub);
+        if(!make_dir(path))
+            return std::string();
+    }
+    return path;
+}
 
-    // Restore signals
-    sigprocmask(SIG_SETMASK, &oldmask, NULL);
-    sigaction(SIGINT, &oldint, NULL);
-    sigaction(SIGQUIT, &oldquit, NULL);
+std::vector<os::file_info> os::list_dir(const std::string &path)
+{
+    std::vector<file_info> ret;
+#ifdef _WIN32
+    WIN32_FIND_DATAA fd;
+    auto h = FindFirstFileA(full_path(path, "*").c_str(), &fd);
+    if(h == INVALID_HANDLE_VALUE)
+        return ret;
+    do
+    {
+        if(fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+            continue;
+        file_info fi;
+        fi.name = fd.cFileName;
+        fi.size = (uint64_t(fd.nFileSizeHigh) << 32) | fd.nFileSizeLow;
+        fi.mtime = (int64_t(fd.ftLastWriteTime.dwHighDateTime) << 32) |
+                   fd.ftLastWriteTime.dwLowDateTime;
+        ret.push_back(fi);
+    } while(FindNextFileA(h, &fd));
+    FindClose(h);
+#else
+    auto d = opendir(path.c_str());
+    if(!d)
+        return ret;
+    while(auto e = readdir(d))
+    {
+        struct stat st;
+        if(0 != stat(full_path(path, e->d_name).c_str(), &st) || !S_ISREG(st.st_mode))
+            continue;
+        file_info fi;
+        fi.name = e->d_name;
+        fi.size = st.st_size;
+        fi.mtime = st.st_mtime;
+        ret.push_back(fi);
+    }
+    closedir(d);
+#endif
+    return ret;
+}
 
-    return status;
+std::string os::current_dir()
+{
+    char buf[4096];
+#ifdef _WIN32
+    if(!_getcwd(buf, sizeof(buf)))
+#else
+    if(!getcwd(buf, sizeof(buf)))
 #endif
+        return std::string();
+    return buf;
 }
 
-void os::remove_file(const std::string &path)
+bool os::change_dir(const std::string &path)
 {
 #ifdef _WIN32
-    _unlink(path.c_str());
+    return 0 == _chdir(path.c_str());
 #else
-    unlink(path.c_str());
+    return 0 == chdir(path.c_str());
+#endif
+}
+
+void os::touch_file(const std::string &path)
+{
+#ifdef _WIN32
+    _utime(path.c_str(), nullptr);
+#else
+    utime(path.c_str(), nullptr);
+#endif
+}
+
+std::string os::program_stamp()
+{
+#ifdef _WIN32
+    char buf[MAX_PATH];
+    auto len = GetModuleFileNameA(nullptr, buf, MAX_PATH);
+    std::string exe = (len > 0 && len < MAX_PATH) ? std::string(buf, len) : program_name;
+#else
+    // On Linux, the invoked program could be found in the PATH
+    std::string exe = "/proc/self/exe";
+    if(0 != access(exe.c_str(), F_OK))
+        exe = program_name;
 #endif
+    if(exe.empty())
+        return std::string();
+    return file_stamp(exe);
+}
+
+std::string os::file_stamp(const std::string &path)
+{
+    struct stat st;
+    if(0 != stat(path.c_str(), &st))
+        return std::string();
+    return std::to_string(st.st_size) + " " + std::to_string(int64_t(st.st_mtime));
 }
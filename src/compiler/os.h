@@ -19,11 +19,21 @@
 // os.h: Host OS functions
 #pragma once
 
+#include <cstdint>
 #include <string>
 #include <vector>
 
 namespace os
 {
+// Information of a file in a folder
+class file_info
+{
+  public:
+    std::string name;
+    uint64_t size;
+    int64_t mtime; // Modification time, only useful to compare
+};
+
 // Returns the current compiler search path for the given base
 std::vector<std::string> get_search_path(const std::string &filename);
 // Locates a file or folder in the compiler data and
@@ -46,11 +56,38 @@ std::string add_extension(std::string name, std::string ext);
 // NOTE: this only works on ASCII characters - it is expected that standard
 //        file extensions are ASCII only (like "asm" and "bas").
 std::string get_extension_lower(std::string name);
-// Execute external program, waiting for the result
-int prog_exec(std::string exe, std::vector<std::string> &args);
+// Execute external program, waiting for the result. If "output" is given,
+// stores the program output in it instead (not supported in Windows).
+int prog_exec(std::string exe, std::vector<std::string> &args,
+              std::string *output = nullptr);
+// Call the main function of a program linked into the compiler, waiting for
+// the result. Falls back to executing "exe" if not supported in the host OS.
+// The program runs in a forked copy of the process, so this must not be used
+// while other threads are running.
+int prog_call(int (*entry)(int, char **), std::string exe,
+              std::vector<std::string> &args, std::string *output = nullptr);
 // OS specific initializations
 void init(const std::string &prog);
 // Remove a file
 void remove_file(const std::string &path);
+// Rename a file, replacing the destination, returns false on error
+bool rename_file(const std::string &from, const std::string &to);
+// Returns the folder used to store cached data, or the given sub-folder inside
+// it, creating it if needed, or an empty string if not available.
+std::string cache_dir(const std::string &sub = std::string());
+// Returns the regular files in a folder
+std::vector<file_info> list_dir(const std::string &path);
+// Returns the current folder, or an empty string on error
+std::string current_dir();
+// Changes the current folder, returns false on error
+bool change_dir(const std::string &path);
+// Sets the modification time of a file to the current time
+void touch_file(const std::string &path);
+// Returns the size and modification time of the compiler executable, to
+// detect a changed compiler, or an empty string if not available
+std::string program_stamp();
+// Returns the size and modification time of a file, to detect changes, or an
+// empty string if the file does not exist
+std::string file_stamp(const std::string &path);
 
 } // namespace os
@@ -158,7 +158,7 @@ static bool get_asm_byte_constant(parse &s)
     return false;
 }
 
-static bool SMB_E_NUMBER_WORD(parse &s)
+bool SMB_E_NUMBER_WORD(parse &s)
 {
     s.debug("E_NUMBER_WORD");
     s.skipws();
@@ -172,7 +172,7 @@ static bool SMB_E_NUMBER_WORD(parse &s)
     return true;
 }
 
-static bool SMB_E_NUMBER_BYTE(parse &s)
+bool SMB_E_NUMBER_BYTE(parse &s)
 {
     s.debug("E_NUMBER_BYTE");
     s.skipws();
@@ -226,7 +226,7 @@ static bool get_const_string(parse &s, std::string &str)
     return false;
 }
 
-static bool SMB_E_CONST_STRING(parse &s)
+bool SMB_E_CONST_STRING(parse &s)
 {
     s.debug("E_CONST_STRING");
     std::string str;
@@ -235,7 +235,7 @@ static bool SMB_E_CONST_STRING(parse &s)
     return false;
 }
 
-static bool SMB_E_REM(parse &s)
+bool SMB_E_REM(parse &s)
 {
     s.debug("E_REM");
     // Remove "REM" from the shorted text
@@ -249,7 +249,7 @@ static bool SMB_E_REM(parse &s)
     return true;
 }
 
-static bool SMB_E_EOL(parse &s)
+bool SMB_E_EOL(parse &s)
 {
     s.debug("E_EOL");
     s.skipws();
@@ -261,7 +261,7 @@ static bool SMB_E_EOL(parse &s)
     return (s.eos() || s.peek(':') || s.eol());
 }
 
-static bool SMB_E_PUSH_VAR(parse &s)
+bool SMB_E_PUSH_VAR(parse &s)
 {
     // nothing to do!
     s.debug("E_PUSH_VAR");
@@ -269,7 +269,7 @@ static bool SMB_E_PUSH_VAR(parse &s)
     return true;
 }
 
-static bool SMB_E_POP_VAR(parse &s)
+bool SMB_E_POP_VAR(parse &s)
 {
     s.debug("E_POP_VAR");
     if(s.var_stk.empty())
@@ -279,7 +279,7 @@ static bool SMB_E_POP_VAR(parse &s)
     return true;
 }
 
-static bool SMB_E_PUSH_LT(parse &s)
+bool SMB_E_PUSH_LT(parse &s)
 {
     // nothing to do!
     s.debug("E_PUSH_LT");
@@ -313,7 +313,7 @@ static bool SMB_E_PUSH_LT(parse &s)
     return true;
 }
 
-static bool SMB_E_POP_LOOP(parse &s)
+bool SMB_E_POP_LOOP(parse &s)
 {
     // nothing to do!
     s.debug("E_POP_LOOP");
@@ -325,7 +325,7 @@ static bool SMB_E_POP_LOOP(parse &s)
     return true;
 }
 
-static bool SMB_E_POP_WHILE(parse &s)
+bool SMB_E_POP_WHILE(parse &s)
 {
     // nothing to do!
     s.debug("E_POP_WHILE");
@@ -339,7 +339,7 @@ static bool SMB_E_POP_WHILE(parse &s)
     return true;
 }
 
-static bool SMB_E_POP_IF(parse &s)
+bool SMB_E_POP_IF(parse &s)
 {
     // nothing to do!
     s.debug("E_POP_IF");
@@ -352,7 +352,7 @@ static bool SMB_E_POP_IF(parse &s)
     return true;
 }
 
-static bool SMB_E_ELSEIF(parse &s)
+bool SMB_E_ELSEIF(parse &s)
 {
     // nothing to do!
     s.debug("E_ELSEIF");
@@ -366,7 +366,7 @@ static bool SMB_E_ELSEIF(parse &s)
     return true;
 }
 
-static bool SMB_E_EXIT_LOOP(parse &s)
+bool SMB_E_EXIT_LOOP(parse &s)
 {
     // nothing to do!
     s.debug("E_EXIT_LOOP");
@@ -388,7 +388,7 @@ static bool SMB_E_EXIT_LOOP(parse &s)
     return true;
 }
 
-static bool SMB_E_POP_PROC_DATA(parse &s)
+bool SMB_E_POP_PROC_DATA(parse &s)
 {
     // nothing to do!
     s.debug("E_POP_PROC_DATA");
@@ -399,7 +399,7 @@ static bool SMB_E_POP_PROC_DATA(parse &s)
     return true;
 }
 
-static bool SMB_E_POP_PROC_2(parse &s)
+bool SMB_E_POP_PROC_2(parse &s)
 {
     // nothing to do!
     s.debug("E_POP_PROC_2");
@@ -410,7 +410,7 @@ static bool SMB_E_POP_PROC_2(parse &s)
     return true;
 }
 
-static bool SMB_E_POP_FOR(parse &s)
+bool SMB_E_POP_FOR(parse &s)
 {
     // nothing to do!
     s.debug("E_POP_FOR");
@@ -425,7 +425,7 @@ static bool SMB_E_POP_FOR(parse &s)
     return true;
 }
 
-static bool SMB_E_POP_REPEAT(parse &s)
+bool SMB_E_POP_REPEAT(parse &s)
 {
     // nothing to do!
     s.debug("E_POP_REPEAT");
@@ -437,8 +437,8 @@ static bool SMB_E_POP_REPEAT(parse &s)
     return true;
 }
 
-static std::string last_var_name;
-static bool SMB_E_VAR_CREATE(parse &s)
+static thread_local std::string last_var_name;
+bool SMB_E_VAR_CREATE(parse &s)
 {
     s.debug("E_VAR_CREATE");
     auto &v = s.vars;
@@ -456,7 +456,7 @@ static bool SMB_E_VAR_CREATE(parse &s)
     return true;
 }
 
-static bool SMB_E_VAR_SET_TYPE(parse &s)
+bool SMB_E_VAR_SET_TYPE(parse &s)
 {
     s.debug("E_VAR_SET_TYPE");
 
@@ -495,13 +495,13 @@ static bool var_check(parse &s, enum VarType type)
     return true;
 }
 
-static bool SMB_E_VAR_WORD(parse &s)
+bool SMB_E_VAR_WORD(parse &s)
 {
     s.debug("E_VAR_WORD");
     return var_check(s, VT_WORD);
 }
 
-static bool SMB_E_VAR_SEARCH(parse &s)
+bool SMB_E_VAR_SEARCH(parse &s)
 {
     enum VarType type = get_vartype(s.remove_last().get_str());
     s.debug("E_VAR_SEARCH: " + get_vt_name(type));
@@ -576,7 +576,7 @@ static atari_fp get_fp_number(parse &s)
     return fp;
 }
 
-static bool SMB_E_NUMBER_FP(parse &s)
+bool SMB_E_NUMBER_FP(parse &s)
 {
     s.debug("E_NUMBER_FP");
     s.skipws();
@@ -588,7 +588,7 @@ static bool SMB_E_NUMBER_FP(parse &s)
     return true;
 }
 
-static bool SMB_E_LABEL_DEF(parse &s)
+bool SMB_E_LABEL_DEF(parse &s)
 {
     auto l = s.push_loop(LT_PROC_DATA);
     s.remove_last();
@@ -604,7 +604,7 @@ static bool SMB_E_LABEL_DEF(parse &s)
     return true;
 }
 
-static bool SMB_E_LABEL(parse &s)
+bool SMB_E_LABEL(parse &s)
 {
     s.debug("E_LABEL");
     // Get type
@@ -625,7 +625,7 @@ static bool SMB_E_LABEL(parse &s)
     return true;
 }
 
-static bool SMB_E_COUNT_PARAM(parse &s)
+bool SMB_E_COUNT_PARAM(parse &s)
 {
     s.debug("E_COUNT_PARAM");
     s.current_params++;
@@ -634,7 +634,7 @@ static bool SMB_E_COUNT_PARAM(parse &s)
 
 // Called in EXEC, creates a label if not exists, if already exists checks
 // that it is a PROC.
-static bool SMB_E_LABEL_CREATE(parse &s)
+bool SMB_E_LABEL_CREATE(parse &s)
 {
     s.debug("E_LABEL_CREATE");
     std::string name;
@@ -653,7 +653,7 @@ static bool SMB_E_LABEL_CREATE(parse &s)
     return true;
 }
 
-static bool SMB_E_DO_EXEC(parse &s)
+bool SMB_E_DO_EXEC(parse &s)
 {
     int pnum = s.current_params;
     s.debug("E_DO_EXEC");
@@ -667,7 +667,7 @@ static bool SMB_E_DO_EXEC(parse &s)
     return true;
 }
 
-static bool SMB_E_PROC_CHECK(parse &s)
+bool SMB_E_PROC_CHECK(parse &s)
 {
     int pnum = s.current_params - 1;
     s.debug("E_PROC_CHECK");
@@ -681,7 +681,7 @@ static bool SMB_E_PROC_CHECK(parse &s)
     return true;
 }
 
-static bool SMB_E_LABEL_SET_TYPE(parse &s)
+bool SMB_E_LABEL_SET_TYPE(parse &s)
 {
     s.debug("E_LABEL_SET_TYPE");
     s.skipws();
@@ -690,7 +690,7 @@ static bool SMB_E_LABEL_SET_TYPE(parse &s)
     return true;
 }
 
-static bool SMB_E_DATA_SET_ROM_SEG(parse &s)
+bool SMB_E_DATA_SET_ROM_SEG(parse &s)
 {
     s.debug("E_DATA_SET_ROM_SEG");
     s.skipws();
@@ -698,7 +698,7 @@ static bool SMB_E_DATA_SET_ROM_SEG(parse &s)
     return true;
 }
 
-static bool SMB_E_DATA_SET_SEGMENT(parse &s)
+bool SMB_E_DATA_SET_SEGMENT(parse &s)
 {
     s.debug("E_DATA_SET_SEGMENT");
     s.skipws();
@@ -714,7 +714,7 @@ static bool SMB_E_DATA_SET_SEGMENT(parse &s)
 }
 
 // Reads a DATA array from a file
-static bool SMB_E_DATA_FILE(parse &s)
+bool SMB_E_DATA_FILE(parse &s)
 {
     s.debug("E_DATA_FILE");
     s.skipws();
@@ -727,6 +727,7 @@ static bool SMB_E_DATA_FILE(parse &s)
     auto f = open_include_file(s.in_fname, fname);
     if(!f)
         throw parse_error("can't open data file '" + fname + "'", pos);
+    s.data_files.insert(fname);
 
     // Read the file to a buffer of max 64k
     for(unsigned i = 0; i < 65536; i++)
@@ -740,7 +741,7 @@ static bool SMB_E_DATA_FILE(parse &s)
 }
 
 // List of all actions by name:
-static std::map<std::string, bool (*)(parse &s)> actions = {
+static std::map<std::string, parsing_action> actions = {
     {"E_CONST_STRING", SMB_E_CONST_STRING},
     {"E_COUNT_PARAM", SMB_E_COUNT_PARAM},
     {"E_DATA_FILE", SMB_E_DATA_FILE},
@@ -774,11 +775,11 @@ static std::map<std::string, bool (*)(parse &s)> actions = {
     {"E_VAR_SET_TYPE", SMB_E_VAR_SET_TYPE},
     {"E_VAR_WORD", SMB_E_VAR_WORD}};
 
-bool call_parsing_action(const std::string name, parse &s)
+parsing_action get_parsing_action(const std::string &name)
 {
     auto i = actions.find(name);
     if(i != actions.end())
-        return i->second(s);
+        return i->second;
     else
-        return false;
+        return nullptr;
 }
@@ -21,4 +21,7 @@
 #include <string>
 
 class parse;
-bool call_parsing_action(const std::string name, parse &s);
+// A parsing action, called from the parsing tables
+typedef bool (*parsing_action)(parse &s);
+// Returns the parsing action with the given name, or nullptr if not found
+parsing_action get_parsing_action(const std::string &name);
@@ -0,0 +1,43 @@
+/*
+ * FastBasic - Fast basic interpreter for the Atari 8-bit computers
+ * Copyright (C) 2017-2025 Daniel Serpell
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+// parser-compiled.cc: Parsers compiled to C++ from the syntax files
+#include "parser-compiled.h"
+#include <vector>
+
+using namespace syntax;
+
+static std::vector<const compiled_parser *> &registry()
+{
+    static std::vector<const compiled_parser *> list;
+    return list;
+}
+
+compiled_parser::compiled_parser(std::string name, uint64_t hash, bool (*start)(parse &s))
+    : name(name), hash(hash), start(start)
+{
+    registry().push_back(this);
+}
+
+const compiled_parser *compiled_parser::find(uint64_t hash)
+{
+    for(auto p : registry())
+        if(p->hash == hash)
+            return p;
+    return nullptr;
+}
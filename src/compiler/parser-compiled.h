@@ -0,0 +1,63 @@
+/*
+ * FastBasic - Fast basic interpreter for the Atari 8-bit computers
+ * Copyright (C) 2017-2025 Daniel Serpell
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+// parser-compiled.h: Parsers compiled to C++ from the syntax files
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <string>
+
+class parse;
+
+namespace syntax
+{
+// Hash of the syntax files contents, used to select the compiled parser
+class syntax_hash
+{
+  private:
+    uint64_t h = 0xCBF29CE484222325ull;
+
+  public:
+    void add(const std::string &data)
+    {
+        // FNV-1a hash of the data and the length
+        for(unsigned char c : data)
+            h = (h ^ c) * 0x100000001B3ull;
+        for(auto l = data.size(); l; l >>= 8)
+            h = (h ^ (l & 0xFF)) * 0x100000001B3ull;
+    }
+    uint64_t get() const { return h; }
+};
+
+// A parser compiled from syntax files
+class compiled_parser
+{
+  public:
+    std::string name;
+    uint64_t hash;
+    bool (*start)(parse &s);
+    // Registers the parser, called from the generated code
+    compiled_parser(std::string name, uint64_t hash, bool (*start)(parse &s));
+    // Returns the compiled parser for the given syntax hash, or nullptr
+    static const compiled_parser *find(uint64_t hash);
+};
+
+// Parses one table using the packrat cache, calling "fn" to do the parsing
+bool parse_cached(parse &s, int idx, size_t ntables, const std::string &name,
+                  const std::function<bool()> &fn);
+} // namespace syntax
@@ -0,0 +1,587 @@
+/*
+ * FastBasic - Fast basic interpreter for the Atari 8-bit computers
+ * Copyright (C) 2017-2025 Daniel Serpell
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+// parser-tables.cc: Parsing tables linked for use by the C++ parser
+#include "parser-tables.h"
+#include "parser-compiled.h"
+#include "synt-sm-list.h"
+#include <functional>
+#include <istream>
+#include <iterator>
+#include <map>
+#include <ostream>
+#include <set>
+
+using namespace syntax;
+
+// List of actions that only modify the position, the emitted code and the
+// listing text, so the result of parsing can be cached:
+static const std::set<std::string> pure_actions = {
+    "E_CONST_STRING", "E_EOL",        "E_LABEL",
+    "E_NUMBER_BYTE",  "E_NUMBER_FP",  "E_NUMBER_WORD",
+    "E_REM",          "E_VAR_SEARCH", "E_VAR_WORD"};
+
+// Builds the literal data from the string
+static parser_tables::literal make_literal(const std::string &lit)
+{
+    parser_tables::literal l;
+    l.str = lit;
+    for(auto c : lit)
+    {
+        if(c >= 'a' && c <= 'z')
+            c = c - 'a' + 'A';
+        l.ucase += c;
+    }
+    l.error = "'" + l.ucase + "'";
+    // Convert some simple alternatives
+    auto s = lit;
+    l.remove_parens = false;
+    if(s == "EXEc")
+        s = "@";
+    else if(s == "PRInt")
+        s = "?";
+    else if(s == "ADR(")
+    {
+        s = "&";
+        l.remove_parens = true;
+    }
+    for(auto c : s)
+    {
+        if(c >= 'a' && c <= 'z')
+        {
+            l.stext += '.';
+            break;
+        }
+        l.stext += c;
+    }
+    return l;
+}
+
+void parser_tables::link(const sm_list &sl, parsing_action (*resolve)(const std::string &))
+{
+    tables.clear();
+    lines.clear();
+    code.clear();
+    literals.clear();
+    emits.clear();
+    actions.clear();
+    missing.clear();
+
+    // Assign an index to each table
+    std::map<std::string, int> tnum, lnum, mnum, anum;
+    int n = 0;
+    for(auto &sm : sl.sms)
+        tnum.emplace(sm.first, n++);
+
+    auto get_table = [&](const std::string &name) {
+        auto t = tnum.find(name);
+        if(t != tnum.end())
+            return t->second;
+        auto m = mnum.find(name);
+        if(m != mnum.end())
+            return m->second;
+        missing.push_back(name);
+        int idx = -int(missing.size());
+        mnum.emplace(name, idx);
+        return idx;
+    };
+
+    auto get_literal = [&](const std::string &lit) {
+        auto l = lnum.find(lit);
+        if(l != lnum.end())
+            return l->second;
+        int idx = literals.size();
+        literals.push_back(make_literal(lit));
+        lnum.emplace(lit, idx);
+        return idx;
+    };
+
+    auto get_action = [&](const std::string &name) {
+        auto a = anum.find(name);
+        if(a != anum.end())
+            return a->second;
+        int idx = actions.size();
+        actions.push_back(name);
+        anum.emplace(name, idx);
+        return idx;
+    };
+
+    // Now, copy all tables resolving references
+    for(auto &sm : sl.sms)
+    {
+        table t;
+        t.name = sm.second->name();
+        t.error = sm.second->error_text();
+        t.lnum = sm.second->line_num();
+        t.first = lines.size();
+        for(auto &l : sm.second->get_code())
+        {
+            line ln;
+            ln.lnum = l.lnum;
+            ln.chars = l.first;
+            ln.skip = false;
+            ln.err_first = ln.err_last = 0;
+            ln.depth = -1;
+            ln.first = code.size();
+            for(auto &c : l.pc)
+            {
+                pcode pc{c.type, 0, nullptr, true};
+                switch(c.type)
+                {
+                case statemachine::pcode::c_literal:
+                    pc.idx = get_literal(c.str);
+                    break;
+                case statemachine::pcode::c_emit:
+                case statemachine::pcode::c_emit_return:
+                    pc.idx = emits.size();
+                    emits.push_back(c.data);
+                    break;
+                case statemachine::pcode::c_call_table:
+                    pc.idx = get_table(c.str);
+                    break;
+                case statemachine::pcode::c_call_ext:
+                    pc.idx = get_action(c.str);
+                    pc.action = resolve ? resolve(c.str) : nullptr;
+                    pc.pure = pure_actions.find(c.str) != pure_actions.end();
+                    break;
+                case statemachine::pcode::c_return:
+                    break;
+                }
+                code.push_back(pc);
+            }
+            ln.last = code.size();
+            lines.push_back(ln);
+        }
+        t.last = lines.size();
+        tables.push_back(t);
+    }
+    start = get_table("PARSE_START");
+    link_skip();
+}
+
+void parser_tables::link_skip()
+{
+    first_errors.clear();
+
+    // Returns the first code in the line that is not an emit
+    auto first_code = [&](const line &l) -> const pcode * {
+        for(auto i = l.first; i < l.last; i++)
+            if(code[i].type != statemachine::pcode::c_emit)
+                return &code[i];
+        return nullptr;
+    };
+
+    // A line can be skipped if it starts with a literal or with a call to
+    // a table with all lines that can be skipped.
+    std::vector<bool> tskip(tables.size(), false);
+    bool changed = true;
+    while(changed)
+    {
+        changed = false;
+        for(size_t t = 0; t < tables.size(); t++)
+        {
+            bool all = true;
+            for(auto i = tables[t].first; i < tables[t].last; i++)
+            {
+                auto &l = lines[i];
+                if(l.skip)
+                    continue;
+                auto c = first_code(l);
+                if(c && ((c->type == statemachine::pcode::c_literal &&
+                          !literals[c->idx].str.empty()) ||
+                         (c->type == statemachine::pcode::c_call_table && c->idx >= 0 &&
+                          tskip[c->idx])))
+                {
+                    l.skip = true;
+                    changed = true;
+                }
+                else
+                    all = false;
+            }
+            if(all && !tskip[t])
+            {
+                tskip[t] = true;
+                changed = true;
+            }
+        }
+    }
+
+    // Now, calculate the errors produced by the skipped lines, with the
+    // level relative to the level of the line. The errors of a table are
+    // relative to the caller, and the depth is the maximum relative level
+    // of the recursion check.
+    using err_set = std::set<std::pair<int, std::string>>;
+    std::vector<err_set> terrs(tables.size());
+    std::vector<int> tdepth(tables.size(), -2);
+    std::function<int(const line &, err_set &)> line_errors;
+    auto table_errors = [&](int t) {
+        if(tdepth[t] != -2)
+            return;
+        err_set e;
+        if(!tables[t].error.empty())
+            e.emplace(1, tables[t].error);
+        int d = 0;
+        for(auto i = tables[t].first; i < tables[t].last; i++)
+        {
+            err_set le;
+            d = std::max(d, 1 + line_errors(lines[i], le));
+            for(auto &x : le)
+                e.emplace(x.first + 1, x.second);
+        }
+        terrs[t] = e;
+        tdepth[t] = d;
+    };
+    line_errors = [&](const line &l, err_set &errs) {
+        auto c = first_code(l);
+        if(c->type == statemachine::pcode::c_literal)
+        {
+            auto &lit = literals[c->idx];
+            errs.emplace(0, lit.error);
+            if(lit.str[0] == ')')
+                errs.emplace(0, "right parenthesis");
+            else if(lit.str[0] == ']')
+                errs.emplace(0, "right bracket");
+            return -1;
+        }
+        table_errors(c->idx);
+        errs.insert(terrs[c->idx].begin(), terrs[c->idx].end());
+        return tdepth[c->idx];
+    };
+
+    for(auto &l : lines)
+    {
+        if(!l.skip)
+            continue;
+        err_set errs;
+        l.depth = line_errors(l, errs);
+        l.err_first = first_errors.size();
+        for(auto &e : errs)
+            first_errors.push_back({e.first, e.second});
+        l.err_last = first_errors.size();
+    }
+}
+
+// Binary format of the saved tables, change the version on any change to
+// the format or to the parser_tables class.
+static const char file_magic[8] = {'F', 'B', 'S', 'Y', 'N', 'T', 'A', 'B'};
+static const uint32_t file_version = 1;
+
+namespace
+{
+// Writes values to the binary file
+class table_writer
+{
+  private:
+    std::string &buf;
+
+  public:
+    table_writer(std::string &buf) : buf(buf) {}
+    void num(uint64_t n, int bytes)
+    {
+        for(int i = 0; i < bytes; i++)
+            buf += char((n >> (i * 8)) & 0xFF);
+    }
+    void u32(uint32_t n) { num(n, 4); }
+    void i32(int n) { num(uint32_t(n), 4); }
+    void str(const std::string &s)
+    {
+        u32(s.size());
+        buf += s;
+    }
+    void bits(const std::bitset<256> &b)
+    {
+        for(int i = 0; i < 256; i += 8)
+        {
+            int x = 0;
+            for(int j = 0; j < 8; j++)
+                if(b[i + j])
+                    x |= 1 << j;
+            buf += char(x);
+        }
+    }
+};
+
+// Reads values from the binary file, sets "ok" to false on errors
+class table_reader
+{
+  private:
+    const std::string &buf;
+    size_t pos;
+
+  public:
+    bool ok;
+    table_reader(const std::string &buf) : buf(buf), pos(0), ok(true) {}
+    uint64_t num(int bytes)
+    {
+        uint64_t n = 0;
+        if(pos + bytes > buf.size())
+        {
+            ok = false;
+            return 0;
+        }
+        for(int i = 0; i < bytes; i++)
+            n |= uint64_t((unsigned char)buf[pos++]) << (i * 8);
+        return n;
+    }
+    uint32_t u32() { return num(4); }
+    int i32() { return int32_t(num(4)); }
+    // Reads a count, checking that it fits in the remaining data
+    size_t count()
+    {
+        size_t n = u32();
+        if(n > buf.size() - pos)
+            ok = false;
+        return ok ? n : 0;
+    }
+    std::string str()
+    {
+        auto n = count();
+        auto s = buf.substr(pos, n);
+        pos += n;
+        return s;
+    }
+    std::bitset<256> bits()
+    {
+        std::bitset<256> b;
+        for(int i = 0; i < 256; i += 8)
+        {
+            auto x = num(1);
+            for(int j = 0; j < 8; j++)
+                b[i + j] = (x >> j) & 1;
+        }
+        return b;
+    }
+    bool end() const { return pos == buf.size(); }
+};
+} // namespace
+
+void parser_tables::save(std::ostream &os, uint64_t key) const
+{
+    std::string buf(file_magic, sizeof(file_magic));
+    table_writer w(buf);
+    w.u32(file_version);
+    w.num(key, 8);
+
+    w.u32(tables.size());
+    for(auto &t : tables)
+    {
+        w.str(t.name);
+        w.str(t.error);
+        w.i32(t.lnum);
+        w.u32(t.first);
+        w.u32(t.last);
+    }
+    w.u32(lines.size());
+    for(auto &l : lines)
+    {
+        w.u32(l.first);
+        w.u32(l.last);
+        w.i32(l.lnum);
+        w.bits(l.chars);
+        w.num(l.skip, 1);
+        w.u32(l.err_first);
+        w.u32(l.err_last);
+        w.i32(l.depth);
+    }
+    w.u32(code.size());
+    for(auto &c : code)
+    {
+        w.num(c.type, 1);
+        w.i32(c.idx);
+        w.num(c.pure, 1);
+    }
+    w.u32(literals.size());
+    for(auto &l : literals)
+    {
+        w.str(l.str);
+        w.str(l.ucase);
+        w.str(l.error);
+        w.str(l.stext);
+        w.num(l.remove_parens, 1);
+    }
+    w.u32(emits.size());
+    for(auto &e : emits)
+    {
+        w.u32(e.size());
+        for(auto &d : e)
+        {
+            w.num(d.type, 1);
+            w.str(d.str);
+            w.i32(d.num);
+        }
+    }
+    w.u32(first_errors.size());
+    for(auto &e : first_errors)
+    {
+        w.i32(e.lvl);
+        w.str(e.msg);
+    }
+    w.u32(actions.size());
+    for(auto &a : actions)
+        w.str(a);
+    w.u32(missing.size());
+    for(auto &m : missing)
+        w.str(m);
+    w.i32(start);
+    // Add a checksum of all the data
+    syntax_hash h;
+    h.add(buf);
+    w.num(h.get(), 8);
+
+    os.write(buf.data(), buf.size());
+}
+
+bool parser_tables::load(std::istream &is, uint64_t key,
+                         parsing_action (*resolve)(const std::string &))
+{
+    std::string buf((std::istreambuf_iterator<char>(is)), std::istreambuf_iterator<char>());
+    if(buf.size() < sizeof(file_magic) + 8 ||
+       buf.compare(0, sizeof(file_magic), file_magic, sizeof(file_magic)))
+        return false;
+    // Verify and remove the checksum
+    auto sum = buf.substr(buf.size() - 8);
+    buf.resize(buf.size() - 8);
+    syntax_hash h;
+    h.add(buf);
+    if(table_reader(sum).num(8) != h.get())
+        return false;
+    table_reader r(buf);
+    r.num(sizeof(file_magic));
+    if(r.u32() != file_version || r.num(8) != key)
+        return false;
+
+    parser_tables pt;
+    for(auto n = r.count(); n; n--)
+    {
+        table t;
+        t.name = r.str();
+        t.error = r.str();
+        t.lnum = r.i32();
+        t.first = r.u32();
+        t.last = r.u32();
+        pt.tables.push_back(t);
+    }
+    for(auto n = r.count(); n; n--)
+    {
+        line l;
+        l.first = r.u32();
+        l.last = r.u32();
+        l.lnum = r.i32();
+        l.chars = r.bits();
+        l.skip = r.num(1);
+        l.err_first = r.u32();
+        l.err_last = r.u32();
+        l.depth = r.i32();
+        pt.lines.push_back(l);
+    }
+    for(auto n = r.count(); n; n--)
+    {
+        pcode c;
+        c.type = statemachine::pcode::ctype(r.num(1));
+        c.idx = r.i32();
+        c.action = nullptr;
+        c.pure = r.num(1);
+        pt.code.push_back(c);
+    }
+    for(auto n = r.count(); n; n--)
+    {
+        literal l;
+        l.str = r.str();
+        l.ucase = r.str();
+        l.error = r.str();
+        l.stext = r.str();
+        l.remove_parens = r.num(1);
+        pt.literals.push_back(l);
+    }
+    for(auto n = r.count(); n; n--)
+    {
+        std::vector<statemachine::dcode> e;
+        for(auto m = r.count(); m; m--)
+        {
+            statemachine::dcode d;
+            d.type = statemachine::dcode::dtype(r.num(1));
+            d.str = r.str();
+            d.num = r.i32();
+            e.push_back(d);
+        }
+        pt.emits.push_back(e);
+    }
+    for(auto n = r.count(); n; n--)
+    {
+        first_error e;
+        e.lvl = r.i32();
+        e.msg = r.str();
+        pt.first_errors.push_back(e);
+    }
+    for(auto n = r.count(); n; n--)
+        pt.actions.push_back(r.str());
+    for(auto n = r.count(); n; n--)
+        pt.missing.push_back(r.str());
+    pt.start = r.i32();
+    if(!r.ok || !r.end())
+        return false;
+
+    // Check all indexes, so a corrupted file can't crash the parser
+    auto bad_range = [](size_t first, size_t last, size_t size) {
+        return first > last || last > size;
+    };
+    auto bad_table = [&](int idx) {
+        return idx >= int(pt.tables.size()) || -idx > int(pt.missing.size());
+    };
+    if(bad_table(pt.start))
+        return false;
+    for(auto &t : pt.tables)
+        if(bad_range(t.first, t.last, pt.lines.size()))
+            return false;
+    for(auto &l : pt.lines)
+        if(bad_range(l.first, l.last, pt.code.size()) ||
+           bad_range(l.err_first, l.err_last, pt.first_errors.size()))
+            return false;
+    for(auto &c : pt.code)
+    {
+        switch(c.type)
+        {
+        case statemachine::pcode::c_literal:
+            if(c.idx < 0 || c.idx >= int(pt.literals.size()))
+                return false;
+            break;
+        case statemachine::pcode::c_emit:
+        case statemachine::pcode::c_emit_return:
+            if(c.idx < 0 || c.idx >= int(pt.emits.size()))
+                return false;
+            break;
+        case statemachine::pcode::c_call_table:
+            if(bad_table(c.idx))
+                return false;
+            break;
+        case statemachine::pcode::c_call_ext:
+            if(c.idx < 0 || c.idx >= int(pt.actions.size()))
+                return false;
+            c.action = resolve ? resolve(pt.actions[c.idx]) : nullptr;
+            break;
+        case statemachine::pcode::c_return:
+            break;
+        default:
+            return false;
+        }
+    }
+
+    pt.compiled = compiled;
+    *this = std::move(pt);
+    return true;
+}
@@ -0,0 +1,133 @@
+/*
+ * FastBasic - Fast basic interpreter for the Atari 8-bit computers
+ * Copyright (C) 2017-2025 Daniel Serpell
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+// parser-tables.h: Parsing tables linked for use by the C++ parser
+#pragma once
+#include "parser-actions.h"
+#include "synt-sm.h"
+#include <bitset>
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+namespace syntax
+{
+class sm_list;
+class compiled_parser;
+
+// The parsing tables, with all the references resolved.
+//
+// All the tables, lines and parsing codes are stored in contiguous vectors,
+// calls to other tables are resolved to an index, calls to external
+// actions are resolved to a function pointer and literals are interned
+// with the error and listing text pre-calculated.
+class parser_tables
+{
+  public:
+    // A literal string to match
+    class literal
+    {
+      public:
+        std::string str;    // Characters to match
+        std::string ucase;  // Upper-case text, added to the listing
+        std::string error;  // Error text if the literal does not match
+        std::string stext;  // Text added to the short listing
+        bool remove_parens; // True if the closing parenthesis is omitted
+    };
+    // A parsing code
+    class pcode
+    {
+      public:
+        statemachine::pcode::ctype type;
+        // Index of the called table, of the literal, of the emit data or of
+        // the action name. Calls to missing tables use negative indexes.
+        int idx;
+        // The external action to call
+        parsing_action action;
+        // True if the action does not modify the parser state
+        bool pure;
+    };
+    // An error produced when a line fails at the first character
+    class first_error
+    {
+      public:
+        int lvl;
+        std::string msg;
+    };
+    // A line, with the codes from "first" to "last"
+    class line
+    {
+      public:
+        size_t first, last;
+        int lnum;
+        // Characters that can start the line
+        std::bitset<256> chars;
+        // If the line can be skipped when the first character does not match,
+        // the errors produced (from "err_first" to "err_last") and the max
+        // recursion depth reached.
+        bool skip;
+        size_t err_first, err_last;
+        int depth;
+    };
+    // A table, with the lines from "first" to "last"
+    class table
+    {
+      public:
+        std::string name;
+        std::string error;
+        int lnum;
+        size_t first, last;
+    };
+    std::vector<table> tables;
+    std::vector<line> lines;
+    std::vector<pcode> code;
+    std::vector<literal> literals;
+    std::vector<std::vector<statemachine::dcode>> emits;
+    std::vector<first_error> first_errors;
+    // Names of the external actions
+    std::vector<std::string> actions;
+    // Names of called tables that are not defined, referenced as -1, -2, etc.
+    std::vector<std::string> missing;
+    // Index of the starting table
+    int start;
+    // Parser compiled from the same syntax files, used instead of the tables
+    const compiled_parser *compiled;
+
+    parser_tables() : start(-1), compiled(nullptr) {}
+    // Builds the linked tables from the parsed syntax list, using "resolve"
+    // to get the function for each external action.
+    void link(const sm_list &sl, parsing_action (*resolve)(const std::string &) = nullptr);
+    // Writes the linked tables to a binary file, identified by "key".
+    void save(std::ostream &os, uint64_t key) const;
+    // Reads the linked tables from a binary file, returns false if the file
+    // is not valid or has a different key.
+    bool load(std::istream &is, uint64_t key,
+              parsing_action (*resolve)(const std::string &) = nullptr);
+
+    // Returns the name of a table
+    const std::string &table_name(int idx) const
+    {
+        return idx < 0 ? missing[-1 - idx] : tables[idx].name;
+    }
+
+  private:
+    // Calculates the lines that can be skipped using the first character
+    void link_skip();
+};
+} // namespace syntax
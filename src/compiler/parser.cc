@@ -18,21 +18,14 @@
 
 // parser-actions.cc: parser functions called from the parsing tables
 #include "parser.h"
-#include "synt-sm-list.h"
+#include "parser-compiled.h"
+#include "parser-tables.h"
 #include <stdexcept>
 
 using namespace syntax;
 using dcode = statemachine::dcode;
 
-static const syntax::statemachine &get(const sm_list &sl, std::string name)
-{
-    auto smi = sl.sms.find(name);
-    if(smi == sl.sms.end())
-        throw std::runtime_error("missing syntax table for '" + name + "'");
-    return *(smi->second);
-}
-
-static bool parse_table(parse &s, const sm_list &sl, std::string name);
+static bool parse_table(parse &s, const parser_tables &pt, int idx);
 
 static void emit_bytes(parse &s, const std::vector<dcode> &data)
 {
@@ -53,26 +46,16 @@ static void emit_bytes(parse &s, const std::vector<dcode> &data)
             s.emit_byte(c.num);
             break;
         case dcode::d_token:
-            s.emit_tok(c.str);
+            s.emit_tok(c.num);
             break;
         }
     }
 }
 
-static std::string ucase(std::string s)
-{
-    for(auto &c : s)
-    {
-        if(c >= 'a' && c <= 'z')
-            c = c - 'a' + 'A';
-    }
-    return s;
-}
-
-static bool parse_literal(parse &s, std::string lit)
+static bool parse_literal(parse &s, const parser_tables::literal &lit)
 {
-    s.error("'" + ucase(lit) + "'");
-    for(auto ch : lit)
+    s.error(lit.error);
+    for(auto ch : lit.str)
     {
         if(ch >= 'a' && ch <= 'z')
         {
@@ -88,54 +71,41 @@ static bool parse_literal(parse &s, std::string lit)
         else if(!s.expect(ch))
             return false;
     }
-    s.debug("GOT '" + lit + "'");
-    s.add_text(ucase(lit));
-    // Convert some simple alternatives
-    if(lit == "EXEc")
-        lit = "@";
-    else if(lit == "PRInt")
-        lit = "?";
-    else if(lit == "ADR(")
-    {
-        lit = "&";
+    if(s.do_debug)
+        s.debug("GOT '" + lit.str + "'");
+    s.add_text(lit.ucase);
+    if(lit.remove_parens)
         s.expand.remove_parens++;
-    }
-
-    for(auto c: lit)
-    {
-        if(c >= 'a' && c <= 'z')
-        {
-            s.add_s_lit('.');
-            break;
-        }
+    for(auto c : lit.stext)
         s.add_s_lit(c);
-    }
     return true;
 }
 
-static bool parse_line(parse &s, const sm_list &sl,
-                       const syntax::statemachine::line &line)
+static bool parse_line(parse &s, const parser_tables &pt, const parser_tables::line &line)
 {
-    for(const auto &c : line.pc)
+    for(auto i = line.first; i < line.last; i++)
     {
+        const auto &c = pt.code[i];
         switch(c.type)
         {
         case statemachine::pcode::c_literal:
-            if(!parse_literal(s, c.str))
+            if(!parse_literal(s, pt.literals[c.idx]))
                 return false;
             break;
         case statemachine::pcode::c_emit:
-            emit_bytes(s, c.data);
+            emit_bytes(s, pt.emits[c.idx]);
             break;
         case statemachine::pcode::c_emit_return:
-            emit_bytes(s, c.data);
+            emit_bytes(s, pt.emits[c.idx]);
             return true;
         case statemachine::pcode::c_call_ext:
-            if(!call_parsing_action(c.str, s))
+            if(!c.pure)
+                s.state_gen++;
+            if(!c.action || !c.action(s))
                 return false;
             break;
         case statemachine::pcode::c_call_table:
-            if(!parse_table(s, sl, c.str))
+            if(!parse_table(s, pt, c.idx))
                 return false;
             break;
         case statemachine::pcode::c_return:
@@ -145,25 +115,44 @@ static bool parse_line(parse &s, const sm_list &sl,
     return true;
 }
 
-static bool parse_table(parse &s, const sm_list &sl, std::string name)
+static bool parse_table_lines(parse &s, const parser_tables &pt, int idx)
 {
-    // Parse using the parsing tables in sl:
-    auto current = get(sl, name);
-    s.debug(current.name() + " (" + std::to_string(current.line_num()) + ")");
+    // Parse using the linked parsing tables:
+    const auto &current = pt.tables[idx];
+    if(s.do_debug)
+        s.debug(current.name + " (" + std::to_string(current.lnum) + ")");
     s.check_level();
     s.skipws();
-    s.error(current.error_text());
+    s.error(current.error);
     auto spos = s.save();
 
-    for(const auto &line : current.get_code())
+    // Get current character, used to skip lines that can't match
+    int ch = (s.eos() || s.do_debug) ? -1 : (unsigned char)s.str[s.pos];
+
+    for(auto l = current.first; l < current.last; l++)
     {
-        if(parse_line(s, sl, line))
+        const auto &line = pt.lines[l];
+        if(ch >= 0 && line.skip && !line.chars[ch] && s.check_depth(line.depth))
+        {
+            // Skip the line, adding the errors from parsing the first character
+            for(auto i = line.err_first; i < line.err_last; i++)
+            {
+                const auto &e = pt.first_errors[i];
+                s.add_error(s.pos, s.lvl + e.lvl, e.msg);
+            }
+            if(s.lvl + line.depth > s.lvl_high)
+                s.lvl_high = s.lvl + line.depth;
+            continue;
+        }
+        if(parse_line(s, pt, line))
         {
-            s.debug("<-- OK (" + std::to_string(line.lnum) + ")");
+            if(s.do_debug)
+                s.debug("<-- OK (" + std::to_string(line.lnum) + ")");
             s.lvl--;
             return true;
         }
-        s.debug("-! " + std::to_string(line.lnum));
+        if(s.do_debug)
+            s.debug("-! " + std::to_string(line.lnum));
         s.restore(spos);
     }
 
@@ -171,8 +160,107 @@ static bool parse_table(parse &s, const sm_list &sl, std::string name)
     return false;
 }
 
-bool syntax::parse_start(parse &s, const sm_list &sl)
+// Replays a stored parsing result, returns false if not valid in the
+// current parser state.
+static bool memo_replay(parse &s, const parse::memo_entry &e)
+{
+    if(e.state != s.state_gen || !s.check_depth(e.depth) || !(e.expand == s.expand))
+        return false;
+
+    s.pos = e.end;
+    s.code->insert(s.code->end(), e.code.begin(), e.code.end());
+    s.expand = e.end_expand;
+    if(s.lvl + e.depth > s.lvl_high)
+        s.lvl_high = s.lvl + e.depth;
+    for(auto &err : e.errors)
+        s.add_error(e.err_pos, s.lvl + err.lvl, err.msg);
+    return true;
+}
+
+// Stores the errors logged from "first" into the entry. Only the errors at
+// the maximum position can change the saved errors, so the log is truncated
+// to those.
+static void memo_errors(parse &s, size_t first, parse::memo_entry &e)
+{
+    auto &log = s.memo_errors;
+    e.err_pos = 0;
+    for(auto i = first; i < log.size(); i++)
+        if(log[i].pos > e.err_pos)
+            e.err_pos = log[i].pos;
+    std::vector<parse::memo_error> keep;
+    for(auto i = first; i < log.size(); i++)
+    {
+        if(log[i].pos == e.err_pos)
+        {
+            e.errors.emplace_back(log[i].lvl - s.lvl, log[i].msg);
+            keep.push_back(log[i]);
+        }
+    }
+    log.resize(first);
+    log.insert(log.end(), keep.begin(), keep.end());
+}
+
+bool syntax::parse_cached(parse &s, int idx, size_t ntables, const std::string &name,
+                          const std::function<bool()> &fn)
+{
+    auto key = s.pos * ntables + idx;
+    auto it = s.memo.find(key);
+    if(it != s.memo.end() && memo_replay(s, it->second))
+    {
+        if(s.do_debug)
+            s.debug(name + " (cached)");
+        s.memo_hits++;
+        return it->second.ok;
+    }
+    s.memo_misses++;
+
+    // Parse the table, tracking the changes to the state
+    auto spos = s.save();
+    auto state = s.state_gen;
+    auto err_first = s.memo_errors.size();
+    auto old_low = s.code_low;
+    auto old_high = s.lvl_high;
+    s.code_low = spos.opos;
+    s.lvl_high = s.lvl;
+
+    bool ok = fn();
+
+    // Only store the result if the state was not modified and no code
+    // emitted before was removed
+    if(state == s.state_gen && s.code_low >= spos.opos)
+    {
+        auto &e = s.memo[key];
+        e.state = state;
+        e.expand = spos.expand;
+        e.ok = ok;
+        e.end = s.pos;
+        e.code.assign(s.code->begin() + spos.opos, s.code->end());
+        e.end_expand = s.expand;
+        e.depth = s.lvl_high - s.lvl;
+        e.errors.clear();
+        memo_errors(s, err_first, e);
+    }
+    s.code_low = std::min(old_low, s.code_low);
+    s.lvl_high = std::max(old_high, s.lvl_high);
+    return ok;
+}
+
+static bool parse_table(parse &s, const parser_tables &pt, int idx)
+{
+    if(idx < 0)
+        throw std::runtime_error("missing syntax table for '" + pt.table_name(idx) + "'");
+    if(s.packrat)
+        return parse_cached(s, idx, pt.tables.size(), pt.tables[idx].name,
+                            [&]() { return parse_table_lines(s, pt, idx); });
+    else
+        return parse_table_lines(s, pt, idx);
+}
+
+bool syntax::parse_start(parse &s, const parser_tables &pt)
 {
-    // Parse using the parsing tables in sl:
-    return parse_table(s, sl, "PARSE_START");
+    // Use the compiled parser if available
+    if(pt.compiled)
+        return pt.compiled->start(s);
+    // Parse using the parsing tables in pt:
+    return parse_table(s, pt, pt.start);
 }
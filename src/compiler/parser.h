@@ -30,6 +30,7 @@
 #include <map>
 #include <set>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 // Exception class for a parsing error
@@ -71,6 +72,12 @@ class parse
             text.clear();
             stext.clear();
         }
+        bool operator==(const expand_line &b) const
+        {
+            return indent == b.indent && next_indent == b.next_indent &&
+                   remove_parens == b.remove_parens && text == b.text &&
+                   stext == b.stext;
+        }
         // Returns expanded line
         std::string get()
         {
@@ -138,6 +145,29 @@ class parse
         size_t opos;
         struct expand_line expand;
     };
+    // Error logged while parsing, used to replay the errors from the
+    // packrat cache.
+    class memo_error
+    {
+      public:
+        size_t pos;
+        int lvl;
+        std::string msg;
+    };
+    // Result of parsing a table at one position, stored in the packrat cache
+    class memo_entry
+    {
+      public:
+        unsigned state;          // Parser state generation when stored
+        expand_line expand;      // Listing text before parsing
+        bool ok;                 // Result of the parsing
+        size_t end;              // Position after parsing
+        std::vector<codew> code; // Emitted code
+        expand_line end_expand;  // Listing text after parsing
+        int depth;               // Max recursion depth reached
+        size_t err_pos;          // Position of the saved errors
+        std::vector<saved_error> errors; // Saved errors, with relative level
+    };
     class jump
     {
       public:
@@ -147,6 +177,7 @@ class parse
     };
     bool do_debug = false;
     std::string in_fname;
+    std::set<std::string> data_files; // Files included by "DATA FILE"
     std::vector<codew> var_stk;
     int lvl, maxlvl;
     std::string str;
@@ -162,9 +193,18 @@ class parse
     int label_num;
     bool finalized;
     std::vector<codew> *code;
+    int tok_end = codew::intern("TOK_END");
     std::string last_label; // Last label to be referenced in an EXEC
     int current_params;     // Number of parameters in PROC/EXEC being parsed
     expand_line expand;
+    // Packrat parsing cache, cleared on each new line
+    bool packrat = false;
+    unsigned state_gen = 0; // Incremented on each action that changes state
+    std::unordered_map<size_t, memo_entry> memo;
+    std::vector<memo_error> memo_errors;
+    size_t code_low = 0; // Lowest code size after "remove_last"
+    int lvl_high = 0;    // Highest recursion level reached
+    unsigned long memo_hits = 0, memo_misses = 0;
 
     parse(bool do_debug)
         : do_debug(do_debug), lvl(0), maxlvl(0), pos(0), max_pos(0), linenum(0),
@@ -250,6 +290,8 @@ class parse
         saved_errors.clear();
         expand.clear();
         linenum = ln;
+        memo.clear();
+        memo_errors.clear();
     }
 
     saved_pos save() { return saved_pos{pos, code->size(), expand}; }
@@ -259,28 +301,36 @@ class parse
     {
         if(lvl > MAX_RECURSE_LEVEL)
             throw parse_error("expression too complex for the compiler", pos);
+        if(lvl > lvl_high)
+            lvl_high = lvl;
         lvl++;
     }
-    bool error(std::string str)
+    // Checks if we can recurse "depth" levels more without error
+    bool check_depth(int depth) const { return lvl + depth <= MAX_RECURSE_LEVEL; }
+    bool error(const std::string &str)
     {
         if(!str.empty())
+            add_error(pos, lvl, str);
+        return false;
+    }
+    void add_error(size_t epos, int elvl, const std::string &str)
+    {
+        if(packrat)
+            memo_errors.push_back({epos, elvl, str});
+        if(epos >= max_pos)
         {
-            if(pos >= max_pos)
+            debug("Set error='" + str + "' @ pos=" + std::to_string(epos) +
+                  " mp=" + std::to_string(max_pos) + " lvl=" + std::to_string(elvl));
+            if(epos > max_pos)
             {
-                debug("Set error='" + str + "' @ pos=" + std::to_string(pos) +
-                      " mp=" + std::to_string(max_pos) + " lvl=" + std::to_string(lvl));
-                if(pos > max_pos)
-                {
-                    debug("ERROR SAVED");
-                    saved_errors.clear();
-                }
-                else
-                    debug("ERROR ADDED");
-                saved_errors.emplace(lvl, str);
-                max_pos = pos;
+                debug("ERROR SAVED");
+                saved_errors.clear();
             }
+            else
+                debug("ERROR ADDED");
+            saved_errors.emplace(elvl, str);
+            max_pos = epos;
         }
-        return false;
     }
 
     bool loop_error(std::string str)
@@ -300,7 +350,7 @@ class parse
         if(pos != s.pos)
             debug("restore pos=" + std::to_string(pos) + " <= " + std::to_string(s.pos));
         pos = s.pos;
-        code->resize(s.opos, codew::ctok("TOK_END", 0));
+        code->resize(s.opos, codew::ctok(tok_end, 0));
         expand = s.expand;
     }
 
@@ -308,6 +358,8 @@ class parse
     {
         codew ret = code->back();
         code->pop_back();
+        if(code->size() < code_low)
+            code_low = code->size();
         return ret;
     }
     void debug(const std::string &c)
@@ -553,7 +605,12 @@ class parse
         code->push_back(codew::clabel(s, linenum));
         return true;
     }
-    bool emit_tok(std::string tk)
+    bool emit_tok(const std::string &tk)
+    {
+        code->push_back(codew::ctok(tk, linenum));
+        return true;
+    }
+    bool emit_tok(int tk)
     {
         code->push_back(codew::ctok(tk, linenum));
         return true;
@@ -605,8 +662,8 @@ class parse
         {
             finalized = true;
             // Correctly terminate main code
-            if(!p.size() || !p.back().is_tok("TOK_END"))
-                p.push_back(codew::ctok("TOK_END", 0));
+            if(!p.size() || !p.back().is_tok(tok_end))
+                p.push_back(codew::ctok(tok_end, 0));
             // To emit procs sorted by line number, copy to a vector
             std::vector<std::vector<codew> *> sprocs;
             for(auto &c : procs)
@@ -624,7 +681,7 @@ class parse
     }
     std::vector<std::string> used_tokens()
     {
-        auto code = full_code();
+        auto &code = full_code();
         std::set<std::string> set;
         for(auto &c : code)
         {
@@ -641,6 +698,6 @@ class parse
 // Main parser function
 namespace syntax
 {
-class sm_list;
-bool parse_start(parse &s, const sm_list &sl);
+class parser_tables;
+bool parse_start(parse &s, const parser_tables &pt);
 } // namespace syntax
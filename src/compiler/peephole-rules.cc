@@ -0,0 +1,625 @@
+/*
+ * FastBasic - Fast basic interpreter for the Atari 8-bit computers
+ * Copyright (C) 2017-2025 Daniel Serpell
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+// peephole-rules.cc: Rules for the peephole optimizer, read from text files
+
+#include "peephole-rules.h"
+#include "codew.h"
+#include <cctype>
+#include <istream>
+#include <stdexcept>
+
+// Names of the phases, in the order the optimizer applies them
+static const char *phase_names[] = {"expand", "main", "shorten", "fold", "fuse"};
+
+// Names of the variables, in the same order as the enum
+static const char *var_names[] = {"print_color"};
+
+namespace
+{
+// Splits a rule into lexical tokens
+class rule_lexer
+{
+  public:
+    enum
+    {
+        l_end,
+        l_ident,
+        l_num,
+        l_str,
+        l_punct
+    } type;
+    std::string text;
+    int num;
+
+  private:
+    const std::string &s;
+    size_t pos;
+    const std::string &where;
+
+  public:
+    rule_lexer(const std::string &s, const std::string &where)
+        : s(s), pos(0), where(where)
+    {
+        next();
+    }
+    [[noreturn]] void error(const std::string &msg) const
+    {
+        throw std::runtime_error(where + ": " + msg);
+    }
+    void next()
+    {
+        pos = s.find_first_not_of(" \t\r\n", pos);
+        text.clear();
+        if(pos == s.npos)
+        {
+            pos = s.size();
+            type = l_end;
+            return;
+        }
+        char c = s[pos];
+        if(c == '_' || isalpha(c))
+        {
+            type = l_ident;
+            while(pos < s.size() && (s[pos] == '_' || isalnum(s[pos])))
+                text += s[pos++];
+        }
+        else if(isdigit(c) || c == '$')
+        {
+            int base = 10;
+            if(c == '$')
+            {
+                base = 16;
+                pos++;
+            }
+            type = l_num;
+            while(pos < s.size() && isxdigit(s[pos]) && (base == 16 || isdigit(s[pos])))
+                text += s[pos++];
+            if(text.empty())
+                error("invalid number");
+            num = std::stoi(text, nullptr, base);
+        }
+        else if(c == '"')
+        {
+            type = l_str;
+            auto e = s.find('"', pos + 1);
+            if(e == s.npos)
+                error("unterminated string");
+            text = s.substr(pos + 1, e - pos - 1);
+            pos = e + 1;
+        }
+        else
+        {
+            type = l_punct;
+            static const char *two[] = {"=>", "==", "!=", "<=", ">=", "&&", "||"};
+            for(auto t : two)
+                if(s.compare(pos, 2, t) == 0)
+                    text = t;
+            if(text.empty())
+                text = c;
+            pos += text.size();
+        }
+    }
+    bool is(const char *p) const { return type == l_punct && text == p; }
+    bool is_ident(const char *id) const { return type == l_ident && text == id; }
+    void expect(const char *p)
+    {
+        if(!is(p))
+            error(std::string("expected '") + p + "'");
+        next();
+    }
+};
+
+// Parses one rule
+class rule_parser
+{
+  private:
+    rule_lexer &lex;
+    peephole_rules::rule &r;
+    std::map<std::string, int> captures;
+
+    int find_capture(const std::string &name) const
+    {
+        auto it = captures.find(name);
+        return it == captures.end() ? -1 : it->second;
+    }
+    int new_capture(const std::string &name)
+    {
+        if(find_capture(name) >= 0)
+            lex.error("repeated capture name '" + name + "'");
+        for(auto v : var_names)
+            if(name == v)
+                lex.error("capture name '" + name + "' is a variable");
+        r.captures.push_back(r.pattern.size());
+        return captures[name] = r.captures.size() - 1;
+    }
+    static bool is_token(const std::string &s) { return s.compare(0, 4, "TOK_") == 0; }
+
+    // Expressions, from lower to higher precedence
+    typedef peephole_rules::expr expr;
+    static expr make(decltype(expr::type) type, int op, std::vector<expr> args = {})
+    {
+        expr e;
+        e.type = type;
+        e.op = op;
+        e.args = std::move(args);
+        return e;
+    }
+    expr primary()
+    {
+        if(lex.type == rule_lexer::l_num)
+        {
+            auto e = make(expr::e_num, lex.num);
+            lex.next();
+            return e;
+        }
+        if(lex.type == rule_lexer::l_str)
+        {
+            auto e = make(expr::e_str, 0);
+            e.str = lex.text;
+            lex.next();
+            return e;
+        }
+        if(lex.is("("))
+        {
+            lex.next();
+            auto e = cond();
+            lex.expect(")");
+            return e;
+        }
+        if(lex.is("-") || lex.is("~") || lex.is("!"))
+        {
+            int op = lex.text[0];
+            lex.next();
+            return make(expr::e_unary, op, {primary()});
+        }
+        if(lex.type != rule_lexer::l_ident)
+            lex.error("invalid expression");
+        auto name = lex.text;
+        lex.next();
+        if(name == "len" || name == "chr")
+        {
+            lex.expect("(");
+            auto e = make(name == "len" ? expr::e_len : expr::e_chr, 0, {cond()});
+            lex.expect(")");
+            return e;
+        }
+        for(int i = 0; i < peephole_rules::var_count; i++)
+            if(name == var_names[i])
+                return make(expr::e_var, i);
+        int c = find_capture(name);
+        if(c < 0)
+            lex.error("unknown name '" + name + "' in expression");
+        return make(expr::e_capture, c);
+    }
+    // Binary operators by precedence level
+    int binary_op(int level) const
+    {
+        static const char *ops[][5] = {{"||"},
+                                       {"&&"},
+                                       {"|"},
+                                       {"^"},
+                                       {"&"},
+                                       {"==", "!="},
+                                       {"<", "<=", ">", ">="},
+                                       {"+", "-"},
+                                       {"*", "/", "%"}};
+        if(lex.type != rule_lexer::l_punct)
+            return 0;
+        for(auto op : ops[level])
+            if(op && lex.text == op)
+                return op[1] ? (op[0] << 8) | op[1] : op[0];
+        return 0;
+    }
+    expr binary(int level)
+    {
+        if(level == 9)
+            return primary();
+        auto e = binary(level + 1);
+        while(int op = binary_op(level))
+        {
+            lex.next();
+            e = make(expr::e_binary, op, {std::move(e), binary(level + 1)});
+        }
+        return e;
+    }
+    expr cond()
+    {
+        auto e = binary(0);
+        if(lex.is("?"))
+        {
+            lex.next();
+            auto a = cond();
+            lex.expect(":");
+            e = make(expr::e_cond, 0, {std::move(e), std::move(a), cond()});
+        }
+        return e;
+    }
+
+    // Pattern elements
+    void pattern_type(peephole_rules::element &el, const std::string &name)
+    {
+        typedef peephole_rules::element element;
+        static const std::map<std::string, decltype(element::type)> types = {
+            {"word", element::m_word},     {"byte", element::m_byte},
+            {"num", element::m_num},       {"wsym", element::m_wsym},
+            {"bsym", element::m_bsym},     {"wlabel", element::m_wlabel},
+            {"label", element::m_label},   {"string", element::m_string},
+            {"var", element::m_var},       {"any", element::m_any}};
+        if(is_token(name))
+        {
+            el.type = element::m_tok;
+            el.toks.push_back(codew::intern(name));
+            while(lex.is("|"))
+            {
+                lex.next();
+                if(lex.type != rule_lexer::l_ident || !is_token(lex.text))
+                    lex.error("expected token name after '|'");
+                el.toks.push_back(codew::intern(lex.text));
+                lex.next();
+            }
+            return;
+        }
+        auto it = types.find(name);
+        if(it == types.end())
+            lex.error("unknown element type '" + name + "'");
+        el.type = it->second;
+    }
+    peephole_rules::element pattern_element()
+    {
+        typedef peephole_rules::element element;
+        element el;
+        if(lex.type == rule_lexer::l_str)
+        {
+            el.type = element::m_bsym;
+            el.sym = lex.text;
+            lex.next();
+            return el;
+        }
+        if(lex.is("!"))
+        {
+            lex.next();
+            if(!lex.is_ident("label"))
+                lex.error("expected 'label' after '!'");
+            lex.next();
+            el.type = element::m_not_label;
+            return el;
+        }
+        if(lex.type != rule_lexer::l_ident)
+            lex.error("invalid pattern element");
+        auto name = lex.text;
+        lex.next();
+        if(name == "_")
+            el.type = element::m_any;
+        else if(is_token(name))
+            pattern_type(el, name);
+        else if(lex.is(":"))
+        {
+            lex.next();
+            if(lex.type != rule_lexer::l_ident)
+                lex.error("expected element type after ':'");
+            auto type = lex.text;
+            lex.next();
+            pattern_type(el, type);
+            el.capture = new_capture(name);
+        }
+        else
+        {
+            el.type = element::m_any;
+            el.capture = new_capture(name);
+        }
+        return el;
+    }
+
+    // Replacement elements
+    peephole_rules::output output_element()
+    {
+        typedef peephole_rules::output output;
+        output o;
+        if(lex.type != rule_lexer::l_ident)
+            lex.error("invalid replacement element");
+        auto name = lex.text;
+        lex.next();
+        if(is_token(name))
+        {
+            o.type = output::o_tok;
+            o.arg = codew::intern(name);
+        }
+        else if(lex.is("("))
+        {
+            if(name == "word")
+                o.type = output::o_word;
+            else if(name == "byte")
+                o.type = output::o_byte;
+            else if(name == "string")
+                o.type = output::o_string;
+            else
+                lex.error("unknown replacement function '" + name + "'");
+            lex.next();
+            o.val = cond();
+            lex.expect(")");
+            r.uses_values = true;
+        }
+        else
+        {
+            o.type = output::o_copy;
+            o.arg = find_capture(name);
+            if(o.arg < 0)
+                lex.error("unknown capture '" + name + "' in replacement");
+            return o;
+        }
+        if(lex.is("@"))
+        {
+            lex.next();
+            if(lex.type != rule_lexer::l_ident || find_capture(lex.text) < 0)
+                lex.error("expected capture name after '@'");
+            o.lnum_from = find_capture(lex.text);
+            lex.next();
+        }
+        return o;
+    }
+
+  public:
+    rule_parser(rule_lexer &lex, peephole_rules::rule &r) : lex(lex), r(r) {}
+    void parse()
+    {
+        while(lex.type != rule_lexer::l_end && !lex.is("=>") && !lex.is_ident("IF"))
+            r.pattern.push_back(pattern_element());
+        if(r.pattern.empty() || r.pattern[0].type != peephole_rules::element::m_tok)
+            lex.error("rule pattern must start with a token");
+        for(size_t i = 1; i < r.pattern.size(); i++)
+            if(r.pattern[i].type == peephole_rules::element::m_tok && r.pattern[i].toks.size() == 1)
+                r.tok_checks.push_back(i);
+        if(lex.is_ident("IF"))
+        {
+            lex.next();
+            r.has_cond = true;
+            r.uses_values = true;
+            r.cond = cond();
+        }
+        lex.expect("=>");
+        while(lex.type != rule_lexer::l_end)
+        {
+            if(lex.is_ident("COST"))
+            {
+                r.by_cost = true;
+                lex.next();
+                if(lex.type != rule_lexer::l_end && !lex.is_ident("NEXT") &&
+                   !lex.is_ident("FALL"))
+                    lex.error("unexpected text after 'COST'");
+                continue;
+            }
+            if(lex.is_ident("NEXT") || lex.is_ident("FALL"))
+            {
+                r.next = lex.text == "NEXT" ? peephole_rules::f_next : peephole_rules::f_fall;
+                lex.next();
+                if(lex.type != rule_lexer::l_end)
+                    lex.error("unexpected text after '" + lex.text + "'");
+                break;
+            }
+            r.repl.push_back(output_element());
+        }
+    }
+};
+} // namespace
+
+// Evaluates an expression
+peephole_rules::value peephole_rules::expr::eval(const std::vector<value> &captures,
+                                                 const int *vars) const
+{
+    value v;
+    switch(type)
+    {
+    case e_num:
+        v.num = op;
+        return v;
+    case e_str:
+        v.is_str = true;
+        v.str = str;
+        return v;
+    case e_capture:
+        return captures[op];
+    case e_var:
+        v.num = vars[op];
+        return v;
+    case e_len:
+        v = args[0].eval(captures, vars);
+        if(!v.is_str)
+            throw std::runtime_error("peephole rule: 'len' of a number");
+        v.is_str = false;
+        v.num = v.str.size();
+        return v;
+    case e_chr:
+        v = args[0].eval(captures, vars);
+        if(v.is_str)
+            throw std::runtime_error("peephole rule: 'chr' of a string");
+        v.is_str = true;
+        v.str = std::string(1, char(v.num));
+        return v;
+    case e_unary:
+        v = args[0].eval(captures, vars);
+        if(v.is_str)
+            throw std::runtime_error("peephole rule: operator on a string");
+        v.num = op == '-' ? -v.num : op == '~' ? ~v.num : !v.num;
+        return v;
+    case e_cond:
+        v = args[0].eval(captures, vars);
+        return args[(v.is_str || v.num) ? 1 : 2].eval(captures, vars);
+    case e_binary:
+        break;
+    }
+    // Short-circuit logical operators
+    auto a = args[0].eval(captures, vars);
+    if(op == ('&' << 8 | '&') || op == ('|' << 8 | '|'))
+    {
+        bool t = a.is_str || a.num;
+        if(t == (op == ('|' << 8 | '|')))
+        {
+            v.num = t;
+            return v;
+        }
+        auto b = args[1].eval(captures, vars);
+        v.num = b.is_str || b.num;
+        return v;
+    }
+    auto b = args[1].eval(captures, vars);
+    if(a.is_str || b.is_str)
+    {
+        if(!a.is_str || !b.is_str)
+            throw std::runtime_error("peephole rule: mixing strings and numbers");
+        if(op == '+')
+        {
+            v.is_str = true;
+            v.str = a.str + b.str;
+        }
+        else if(op == ('=' << 8 | '='))
+            v.num = a.str == b.str;
+        else if(op == ('!' << 8 | '='))
+            v.num = a.str != b.str;
+        else
+            throw std::runtime_error("peephole rule: invalid operator on strings");
+        return v;
+    }
+    switch(op)
+    {
+    case '|':
+        v.num = a.num | b.num;
+        break;
+    case '^':
+        v.num = a.num ^ b.num;
+        break;
+    case '&':
+        v.num = a.num & b.num;
+        break;
+    case '=' << 8 | '=':
+        v.num = a.num == b.num;
+        break;
+    case '!' << 8 | '=':
+        v.num = a.num != b.num;
+        break;
+    case '<':
+        v.num = a.num < b.num;
+        break;
+    case '<' << 8 | '=':
+        v.num = a.num <= b.num;
+        break;
+    case '>':
+        v.num = a.num > b.num;
+        break;
+    case '>' << 8 | '=':
+        v.num = a.num >= b.num;
+        break;
+    case '+':
+        v.num = a.num + b.num;
+        break;
+    case '-':
+        v.num = a.num - b.num;
+        break;
+    case '*':
+        v.num = a.num * b.num;
+        break;
+    case '/':
+    case '%':
+        if(!b.num)
+            throw std::runtime_error("peephole rule: division by zero");
+        v.num = op == '/' ? a.num / b.num : a.num % b.num;
+        break;
+    }
+    return v;
+}
+
+void peephole_rules::parse(std::istream &in, const std::string &fname)
+{
+    phase *current = nullptr;
+    std::string line, text, where;
+    int lnum = 0;
+
+    // Adds the accumulated rule text to the current phase
+    auto add_rule = [&]() {
+        if(text.empty())
+            return;
+        rule_lexer lex(text, where);
+        if(!current)
+            lex.error("rule outside of a phase");
+        rule r;
+        r.pos = where;
+        rule_parser(lex, r).parse();
+        auto n = current->rules.size();
+        for(auto t : r.pattern[0].toks)
+        {
+            if(size_t(t) >= current->index.size())
+                current->index.resize(t + 1);
+            current->index[t].push_back(n);
+        }
+        current->rules.push_back(std::move(r));
+        text.clear();
+    };
+
+    while(std::getline(in, line))
+    {
+        lnum++;
+        // Remove comments, outside of strings
+        bool quote = false;
+        for(size_t i = 0; i < line.size(); i++)
+        {
+            if(line[i] == '"')
+                quote = !quote;
+            else if(line[i] == '#' && !quote)
+            {
+                line.erase(i);
+                break;
+            }
+        }
+        auto s = line.find_first_not_of(" \t\r\n");
+        if(s == line.npos)
+            continue;
+        // Lines starting with blanks continue the last rule
+        if(s > 0)
+        {
+            if(text.empty())
+                throw std::runtime_error(fname + ":" + std::to_string(lnum) +
+                                         ": continuation line without a rule");
+            text += " " + line;
+            continue;
+        }
+        add_rule();
+        where = fname + ":" + std::to_string(lnum);
+        if(line.compare(0, 6, "PHASE ") == 0)
+        {
+            auto name = line.substr(6);
+            name.erase(0, name.find_first_not_of(" \t"));
+            name.erase(name.find_last_not_of(" \t\r\n") + 1);
+            current = nullptr;
+            for(auto p : phase_names)
+                if(name == p)
+                    current = &phases[name];
+            if(!current)
+                throw std::runtime_error(where + ": unknown phase '" + name + "'");
+        }
+        else
+            text = line;
+    }
+    add_rule();
+}
+
+const peephole_rules::phase &peephole_rules::get(const std::string &name) const
+{
+    static const phase empty;
+    auto it = phases.find(name);
+    return it == phases.end() ? empty : it->second;
+}
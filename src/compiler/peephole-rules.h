@@ -0,0 +1,157 @@
+/*
+ * FastBasic - Fast basic interpreter for the Atari 8-bit computers
+ * Copyright (C) 2017-2025 Daniel Serpell
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+// peephole-rules.h: Rules for the peephole optimizer, read from text files
+#pragma once
+#include <iosfwd>
+#include <map>
+#include <string>
+#include <vector>
+
+// The rewrite rules of the peephole optimizer.
+//
+// Rules are grouped in phases, each phase is applied by one of the passes of
+// the optimizer. Inside a phase, the rules are indexed by the token that can
+// start the match, so the optimizer only tries the rules that can apply at
+// each position.
+class peephole_rules
+{
+  public:
+    // Value of an expression, a number or a string
+    class value
+    {
+      public:
+        bool is_str = false;
+        int num = 0;
+        std::string str;
+    };
+    // Variables from the optimizer state available to the expressions
+    enum variable
+    {
+        var_print_color,
+        var_count
+    };
+    // An expression, in a condition or in a replacement element
+    class expr
+    {
+      public:
+        enum
+        {
+            e_num,
+            e_str,
+            e_capture,
+            e_var,
+            e_len,
+            e_chr,
+            e_unary,
+            e_binary,
+            e_cond
+        } type;
+        int op;  // Operator, or number / capture / variable index
+        std::string str;
+        std::vector<expr> args;
+        value eval(const std::vector<value> &captures, const int *vars) const;
+    };
+    // One element of the pattern to match
+    class element
+    {
+      public:
+        enum
+        {
+            m_tok,       // Any of the tokens in "toks"
+            m_word,      // A numeric word
+            m_byte,      // A numeric byte
+            m_num,       // A numeric word or byte
+            m_wsym,      // A word symbol
+            m_bsym,      // A byte symbol, with name "sym" if not empty
+            m_wlabel,    // A word symbol pointing to a label
+            m_label,     // A label
+            m_not_label, // Anything but a label
+            m_string,    // A constant string
+            m_var,       // A variable
+            m_any        // Anything
+        } type;
+        std::vector<int> toks;
+        std::string sym;
+        int capture = -1;
+    };
+    // One element of the replacement
+    class output
+    {
+      public:
+        enum
+        {
+            o_copy,  // Copy of the captured element
+            o_tok,   // A token
+            o_word,  // A numeric word, with value "val"
+            o_byte,  // A numeric byte, with value "val"
+            o_string // A constant string, with value "val"
+        } type;
+        int arg; // Capture index or token ID
+        expr val;
+        // Capture giving the line number, or -1 to use the element at the
+        // same position
+        int lnum_from = -1;
+    };
+    // What to do after a rule is applied
+    enum flow
+    {
+        f_retry, // Try all rules again at the same position
+        f_next,  // Continue at the next position
+        f_fall   // Continue with the following rules at the same position
+    };
+    class rule
+    {
+      public:
+        std::vector<element> pattern;
+        bool has_cond = false;
+        expr cond;
+        std::vector<output> repl;
+        enum flow next = f_retry;
+        bool by_cost = false; // Only applied if the cost model rates it better
+        // Position in the pattern of each capture
+        std::vector<size_t> captures;
+        // Positions of the elements matching one token, checked first
+        std::vector<size_t> tok_checks;
+        bool uses_values = false; // True if the captured values are needed
+        std::string pos; // File and line, for error messages
+    };
+    class phase
+    {
+      public:
+        std::vector<rule> rules;
+        // Indexes of the rules that can start with each token ID
+        std::vector<std::vector<size_t>> index;
+        const std::vector<size_t> *rules_for(int tok) const
+        {
+            if(size_t(tok) >= index.size() || index[tok].empty())
+                return nullptr;
+            return &index[tok];
+        }
+    };
+
+  private:
+    std::map<std::string, phase> phases;
+
+  public:
+    // Reads rules from a file, adding them after the rules already read.
+    // Throws std::runtime_error on errors.
+    void parse(std::istream &in, const std::string &fname);
+    // Returns the rules of the given phase, empty if not defined
+    const phase &get(const std::string &name) const;
+};
@@ -19,36 +19,134 @@
 // peephole.cc: Peephole optimizer
 
 #include "peephole.h"
+#include "costmodel.h"
+#include "parser.h"
+#include "peephole-rules.h"
+#include <algorithm>
 #include <map>
 #include <set>
+#include <stdexcept>
+// Token IDs used by the optimizer
+static const int TOK_BYTE_POKE = codew::intern("TOK_BYTE_POKE");
+static const int TOK_BYTE_PUT = codew::intern("TOK_BYTE_PUT");
+static const int TOK_CALL = codew::intern("TOK_CALL");
+static const int TOK_CJUMP = codew::intern("TOK_CJUMP");
+static const int TOK_CNJUMP = codew::intern("TOK_CNJUMP");
+static const int TOK_CNRET = codew::intern("TOK_CNRET");
+static const int TOK_CRET = codew::intern("TOK_CRET");
+static const int TOK_CSTRING = codew::intern("TOK_CSTRING");
+static const int TOK_IOCHN = codew::intern("TOK_IOCHN");
+static const int TOK_JUMP = codew::intern("TOK_JUMP");
+static const int TOK_NUM = codew::intern("TOK_NUM");
+static const int TOK_PRINT_STR = codew::intern("TOK_PRINT_STR");
+static const int TOK_RET = codew::intern("TOK_RET");
+
+// A gap buffer holding the code being optimized.
+//
+// The optimizer passes go through the code from start to end, inserting and
+// deleting near the current position. Keeping the free space at the last
+// modified position makes each change cost proportional to the distance to
+// the previous one, instead of to the size of the program.
+class code_buffer
+{
+  private:
+    std::vector<codew> buf;
+    size_t gap_start, gap_end;
+
+    void move_gap(size_t pos)
+    {
+        if(pos < gap_start)
+        {
+            std::move_backward(buf.begin() + pos, buf.begin() + gap_start,
+                               buf.begin() + gap_end);
+            gap_end -= gap_start - pos;
+            gap_start = pos;
+        }
+        else if(pos > gap_start)
+        {
+            std::move(buf.begin() + gap_end, buf.begin() + gap_end + (pos - gap_start),
+                      buf.begin() + gap_start);
+            gap_end += pos - gap_start;
+            gap_start = pos;
+        }
+    }
+
+  public:
+    code_buffer(const std::vector<codew> &code)
+        : buf(code), gap_start(code.size()), gap_end(code.size())
+    {
+    }
+    size_t size() const { return buf.size() - (gap_end - gap_start); }
+    codew &operator[](size_t idx)
+    {
+        return buf[idx < gap_start ? idx : idx + gap_end - gap_start];
+    }
+    void erase(size_t pos)
+    {
+        move_gap(pos);
+        gap_end++;
+    }
+    void insert(size_t pos, codew c)
+    {
+        if(gap_start == gap_end)
+        {
+            // Grow the buffer, adding the new space at the end of the gap
+            auto n = std::max<size_t>(buf.size(), 64);
+            buf.insert(buf.begin() + gap_end, n, c);
+            gap_end += n;
+        }
+        move_gap(pos);
+        buf[gap_start++] = c;
+    }
+    // Moves the code to a vector, leaving the buffer empty
+    void get(std::vector<codew> &code)
+    {
+        move_gap(size());
+        buf.erase(buf.begin() + gap_start, buf.end());
+        code.swap(buf);
+        buf.clear();
+        gap_start = gap_end = 0;
+    }
+};
 
 // Implements a simple peephole optimizer
 class peephole
 {
   private:
     bool changed;
-    std::vector<codew> &code;
+    code_buffer code;
     size_t current;
+    const peephole_rules &rules;
+    // Objective of the optimizer, null if only applying one phase
+    const opt_goal *goal;
+    // State variables available to the rules
+    int vars[peephole_rules::var_count];
+    // Values of the captured elements of the last match
+    std::vector<peephole_rules::value> cap_val;
     // Matching functions for the peephole opt
-    bool mtok(size_t idx, std::string tok)
+    bool mtok(size_t idx, int tok)
     {
         idx += current;
         return idx < code.size() && code[idx].is_tok(tok);
     }
-    bool mcbyte(size_t idx, std::string name)
+    bool mcbyte(size_t idx, const std::string &name)
     {
         idx += current;
         return idx < code.size() && code[idx].is_sbyte(name);
     }
-    bool mcword(size_t idx, std::string name)
+    bool mlabel(size_t idx)
     {
         idx += current;
-        return idx < code.size() && code[idx].is_sword(name);
+        return idx < code.size() && code[idx].is_label();
     }
-    bool mlabel(size_t idx)
+    // Matches the label of a DATA array
+    bool mdata(size_t idx)
     {
         idx += current;
-        return idx < code.size() && code[idx].is_label();
+        std::string prefix = parse::label_prefix;
+        return idx + 1 < code.size() && code[idx].is_label() &&
+               code[idx].get_str().compare(0, prefix.size(), prefix) == 0 &&
+               !code[idx + 1].is_tok() && !code[idx + 1].is_label();
     }
     bool mlblw(size_t idx)
     {
@@ -61,11 +159,6 @@ class peephole
         idx += current;
         return idx < code.size() && code[idx].is_word();
     }
-    bool mbyte(size_t idx)
-    {
-        idx += current;
-        return idx < code.size() && code[idx].is_byte();
-    }
     // Returns 256 if not a string
     unsigned mstring(size_t idx)
     {
@@ -98,14 +191,6 @@ class peephole
         else
             return 0x8000;
     }
-    int varn(size_t idx)
-    {
-        idx += current;
-        if(idx < code.size())
-            return code[idx].get_varn();
-        else
-            return 0x8000;
-    }
     std::string str(size_t idx)
     {
         idx += current;
@@ -119,192 +204,55 @@ class peephole
         if(idx + current < code.size())
         {
             changed = true;
-            code.erase(code.begin() + idx + current);
+            code.erase(idx + current);
         }
     }
-    void ins_w(size_t idx, int16_t x)
-    {
-        int lnum = 0;
-        changed = true;
-        if(code.size() > idx + current)
-            lnum = code[idx + current].linenum();
-        code.insert(code.begin() + idx + current, codew::cword(x, lnum));
-    }
     void ins_b(size_t idx, int16_t x)
     {
         int lnum = 0;
         changed = true;
         if(code.size() > idx + current)
             lnum = code[idx + current].linenum();
-        code.insert(code.begin() + idx + current, codew::cbyte(x & 0xFF, lnum));
+        code.insert(idx + current, codew::cbyte(x & 0xFF, lnum));
     }
-    void ins_tok(size_t idx, std::string tok)
+    void ins_tok(size_t idx, int tok)
     {
         int lnum = 0;
         changed = true;
         if(code.size() > idx + current)
             lnum = code[idx + current].linenum();
-        code.insert(code.begin() + idx + current, codew::ctok(tok, lnum));
-    }
-    // Detect "X (op) Y"
-    bool const_op(std::string tok)
-    {
-        return mtok(0, "TOK_NUM") && mword(1) && mtok(2, "TOK_PUSH") &&
-               mtok(3, "TOK_NUM") && mword(4) && mtok(5, tok);
-    }
-    void copy(size_t idx, size_t from, size_t num)
-    {
-        changed = true;
-        while(num)
-        {
-            code.insert(code.begin() + idx + current, code[from + current]);
-            num--;
-            idx++;
-            from++;
-            if(from >= idx)
-                from++;
-        }
+        code.insert(idx + current, codew::ctok(tok, lnum));
     }
     void set_ws(size_t idx, std::string str)
     {
         changed = true;
         code[idx + current] = codew::cword(str, code[idx + current].linenum());
     }
-    void set_w(size_t idx, int16_t x)
-    {
-        changed = true;
-        code[idx + current] = codew::cword(x & 0xFFFF, code[idx + current].linenum());
-    }
-    void set_b(size_t idx, int16_t x)
-    {
-        changed = true;
-        code[idx + current] = codew::cbyte(x & 0xFF, code[idx + current].linenum());
-    }
-    void set_tok(size_t idx, std::string tok)
+    void set_tok(size_t idx, int tok)
     {
         changed = true;
         code[idx + current] = codew::ctok(tok, code[idx + current].linenum());
     }
-    void set_string(size_t idx, std::string str)
-    {
-        changed = true;
-        code[idx + current] = codew::cstring(str, code[idx + current].linenum());
-    }
-    // Transforms all "numeric" tokens to TOK_NUM, so that the next phases can
-    // optimize
-    void expand_numbers()
-    {
-        for(size_t i = 0; i < code.size(); i++)
-        {
-            // Skip non-tokens
-            if(!code[i].is_tok())
-                continue;
-
-            current = i;
-            // Sequences:
-            //   TOK_BYTE / x
-            if(mtok(0, "TOK_BYTE") && mbyte(1))
-            {
-                set_tok(0, "TOK_NUM");
-                set_w(1, val(1));
-                i++;
-            }
-            //   TOK_1
-            else if(mtok(0, "TOK_1"))
-            {
-                set_tok(0, "TOK_NUM");
-                ins_w(1, 1);
-                i++;
-            }
-            //   TOK_0
-            else if(mtok(0, "TOK_0"))
-            {
-                set_tok(0, "TOK_NUM");
-                ins_w(1, 0);
-                i++;
-            }
-        }
-    }
-    // Transforms small "numeric" tokens to TOK_BYTE, TOK_1 and TOK_0
-    void shorten_numbers()
+    // Returns the code after the final phases, in the form it will have in
+    // the program
+    std::vector<codew> final_form(std::vector<codew> c) const
     {
-        for(size_t i = 0; i < code.size(); i++)
-        {
-            // Skip non-tokens
-            if(!code[i].is_tok())
-                continue;
-
-            current = i;
-            // Sequences:
-            //   TOK_NUM / x == 0
-            if(mtok(0, "TOK_NUM") && mword(1) && val(1) == 0)
-            {
-                del(1);
-                set_tok(0, "TOK_0");
-            }
-            //   TOK_NUM / x == 1
-            else if(mtok(0, "TOK_NUM") && mword(1) && val(1) == 1)
-            {
-                del(1);
-                set_tok(0, "TOK_1");
-            }
-            //   TOK_NUM / x == -1
-            else if(mtok(0, "TOK_NUM") && mword(1) && val(1) == -1)
-            {
-                set_tok(0, "TOK_1");
-                set_tok(1, "TOK_NEG");
-            }
-            //   TOK_NUM / x < 256
-            else if(mtok(0, "TOK_NUM") && mword(1) && 0 == (val(1) & ~0xFF))
-            {
-                set_tok(0, "TOK_BYTE");
-                set_b(1, val(1));
-            }
-        }
+        peephole s(c, rules, "shorten");
+        peephole f(c, rules, "fold");
+        return c;
     }
-    // Expands PUSH and SADDR tokens
-    void expand_push()
+    // Returns true if replacing the code "from" with "to" improves the code
+    // for the selected objective
+    bool worth(const std::vector<codew> &from, const std::vector<codew> &to) const
     {
-        for(size_t i = 0; i < code.size(); i++)
-        {
-            // Skip non-tokens
-            if(!code[i].is_tok())
-                continue;
-
-            current = i;
-            if(mtok(0, "TOK_PUSH_BYTE"))
-            {
-                set_tok(0, "TOK_BYTE");
-                ins_tok(0, "TOK_PUSH");
-            }
-            else if(mtok(0, "TOK_PUSH_NUM"))
-            {
-                set_tok(0, "TOK_NUM");
-                ins_tok(0, "TOK_PUSH");
-            }
-            else if(mtok(0, "TOK_PUSH_0"))
-            {
-                set_tok(0, "TOK_0");
-                ins_tok(0, "TOK_PUSH");
-            }
-            else if(mtok(0, "TOK_PUSH_1"))
-            {
-                set_tok(0, "TOK_1");
-                ins_tok(0, "TOK_PUSH");
-            }
-            else if(mtok(0, "TOK_PUSH_VAR_LOAD"))
-            {
-                set_tok(0, "TOK_VAR_LOAD");
-                ins_tok(0, "TOK_PUSH");
-            }
-            else if(mtok(0, "TOK_VAR_SADDR"))
-            {
-                set_tok(0, "TOK_VAR_ADDR");
-                ins_tok(2, "TOK_SADDR");
-            }
-        }
+        if(!goal)
+            return false;
+        auto a = final_form(from), b = final_form(to);
+        return goal->better(int(goal->size(b)) - int(goal->size(a)),
+                            double(goal->cycles(b)) - double(goal->cycles(a)));
     }
-    // Transforms print of small constant strings to sequence of BYTE_PUT
+    // Transforms print of constant strings to sequence of BYTE_PUT, if the
+    // result is better
     void print_chars()
     {
         int print_color = 0;
@@ -312,98 +260,55 @@ class peephole
         {
             current = i;
             // Track current print color
-            if(mtok(2, "TOK_BYTE_POKE") && mcbyte(3, "PRINT_COLOR"))
+            if(mtok(2, TOK_BYTE_POKE) && mcbyte(3, "PRINT_COLOR"))
             {
-                if(mtok(0, "TOK_NUM") && mword(1))
+                if(mtok(0, TOK_NUM) && mword(1))
                     print_color = val(1);
                 else
                     print_color = -1;
             }
-            if(print_color >= 0 && mtok(0, "TOK_CSTRING") && mstring(1) < 3 &&
-               mtok(2, "TOK_PRINT_STR"))
+            if(print_color >= 0 && mtok(0, TOK_CSTRING) && mstring(1) < 256 &&
+               mtok(2, TOK_PRINT_STR))
             {
                 auto s = str(1);
+                std::vector<codew> from, to;
+                for(size_t j = 0; j < 3; j++)
+                    from.push_back(code[current + j]);
+                for(char c : s)
+                {
+                    to.push_back(codew::ctok(TOK_BYTE_PUT, 0));
+                    to.push_back(codew::cbyte((c ^ print_color) & 0xFF, 0));
+                }
+                if(!worth(from, to))
+                    continue;
                 del(2);
                 del(1);
                 del(0);
                 for(char c : s)
                 {
-                    ins_tok(0, "TOK_BYTE_PUT");
+                    ins_tok(0, TOK_BYTE_PUT);
                     ins_b(1, (c ^ print_color) & 0xFF);
                     current += 2;
                 }
             }
         }
     }
-    // Folds PUSH followed by known sequences
-    void fold_push()
-    {
-        for(size_t i = 0; i < code.size(); i++)
-        {
-            current = i;
-            if(mtok(0, "TOK_PUSH"))
-            {
-                //   TOK_BYTE
-                if(mtok(1, "TOK_BYTE"))
-                {
-                    set_tok(1, "TOK_PUSH_BYTE");
-                    del(0);
-                }
-                //   TOK_NUM
-                else if(mtok(1, "TOK_NUM"))
-                {
-                    set_tok(1, "TOK_PUSH_NUM");
-                    del(0);
-                }
-                //   TOK_1
-                else if(mtok(1, "TOK_1"))
-                {
-                    set_tok(1, "TOK_PUSH_1");
-                    del(0);
-                }
-                //   TOK_0
-                else if(mtok(1, "TOK_0"))
-                {
-                    set_tok(1, "TOK_PUSH_0");
-                    del(0);
-                }
-                //   TOK_VAR_LOAD / x
-                if(mtok(1, "TOK_VAR_LOAD"))
-                {
-                    set_tok(1, "TOK_PUSH_VAR_LOAD");
-                    del(0);
-                }
-            }
-        }
-    }
-    // Folds SADDR after known sequences
-    void fold_saddr()
-    {
-        for(size_t i = 0; i < code.size(); i++)
-        {
-            current = i;
-            if(mtok(0, "TOK_VAR_ADDR") && mtok(2, "TOK_SADDR"))
-            {
-                set_tok(0, "TOK_VAR_SADDR");
-                del(2);
-            }
-        }
-    }
     // Unused labels removal
     void remove_unused_labels()
     {
         // Go through code accumulating all label expressions
         std::set<std::string> labels;
-        for(auto &c : code)
+        for(size_t i = 0; i < code.size(); i++)
         {
-            if(c.is_sword())
-                labels.insert(c.get_str());
+            if(code[i].is_sword())
+                labels.insert(code[i].get_str());
         }
-        // And go through code removing labels not in the list
+        // And go through code removing labels not in the list, keeping the
+        // DATA arrays as the labels are exported to assembly modules.
         for(size_t i = 0; i < code.size(); i++)
         {
             current = i;
-            if(mlabel(0) && !labels.count(lbl(0)))
+            if(mlabel(0) && !labels.count(lbl(0)) && !mdata(0))
             {
                 del(0);
                 i--;
@@ -423,9 +328,9 @@ class peephole
                     ioch = 0; // Assume 0 after any label or CALL
                 continue;
             }
-            if(mtok(0, "TOK_CALL"))
+            if(mtok(0, TOK_CALL))
                 ioch = 0; // Assume 0 after any label or CALL
-            else if(mtok(0, "TOK_NUM") && mword(1) && mtok(2, "TOK_IOCHN"))
+            else if(mtok(0, TOK_NUM) && mword(1) && mtok(2, TOK_IOCHN))
             {
                 if(ioch == val(1))
                 {
@@ -441,12 +346,12 @@ class peephole
                     current += 2;
                 }
             }
-            else if(mtok(0, "TOK_IOCHN"))
+            else if(mtok(0, TOK_IOCHN))
             {
                 ioch = -1;
             }
-            else if(mtok(0, "TOK_NUM") && mword(1) && mtok(2, "TOK_IOCHN") &&
-                    mtok(3, "TOK_NUM") && mword(4) && mtok(5, "TOK_IOCHN"))
+            else if(mtok(0, TOK_NUM) && mword(1) && mtok(2, TOK_IOCHN) &&
+                    mtok(3, TOK_NUM) && mword(4) && mtok(5, TOK_IOCHN))
             {
                 // Setting I/O channel just after IOCHN, delete redundant one
                 del(2);
@@ -475,9 +380,9 @@ class peephole
                         break;
                     else
                         tgt[l] = lbl(i);
-                if(mtok(i, "TOK_RET"))
+                if(mtok(i, TOK_RET))
                     tgt[l] = "__TOK_RET__";
-                else if(mtok(i, "TOK_JUMP") && mlblw(i + 1))
+                else if(mtok(i, TOK_JUMP) && mlblw(i + 1))
                     tgt[l] = wlbl(i + 1);
             }
         }
@@ -489,27 +394,27 @@ class peephole
                 if(!code[current].is_tok())
                     continue;
 
-                if((mtok(0, "TOK_CJUMP") || mtok(0, "TOK_CNJUMP") ||
-                    mtok(0, "TOK_JUMP")) &&
+                if((mtok(0, TOK_CJUMP) || mtok(0, TOK_CNJUMP) ||
+                    mtok(0, TOK_JUMP)) &&
                    mlblw(1) && tgt.find(wlbl(1)) != tgt.end())
                 {
                     std::string t = tgt[wlbl(1)];
                     if(t == "__TOK_RET__")
                     {
                         // We can only replace JUMP to RET with RET, not ConditionalJUMP
-                        if(mtok(0, "TOK_JUMP"))
+                        if(mtok(0, TOK_JUMP))
                         {
-                            set_tok(0, "TOK_RET");
+                            set_tok(0, TOK_RET);
                             del(1);
                         }
-                        else if(mtok(0, "TOK_CJUMP"))
+                        else if(mtok(0, TOK_CJUMP))
                         {
-                            set_tok(0, "TOK_CRET");
+                            set_tok(0, TOK_CRET);
                             del(1);
                         }
-                        else if(mtok(0, "TOK_CNJUMP"))
+                        else if(mtok(0, TOK_CNJUMP))
                         {
-                            set_tok(0, "TOK_CNRET");
+                            set_tok(0, TOK_CNRET);
                             del(1);
                         }
                     }
@@ -519,38 +424,223 @@ class peephole
             }
         }
     }
+    // Matches one element of a rule pattern
+    bool match_element(const peephole_rules::element &el, size_t idx)
+    {
+        typedef peephole_rules::element element;
+        idx += current;
+        if(idx >= code.size())
+            return false;
+        auto &c = code[idx];
+        switch(el.type)
+        {
+        case element::m_tok:
+            return c.is_tok() &&
+                   std::find(el.toks.begin(), el.toks.end(), c.get_tok_id()) != el.toks.end();
+        case element::m_word:
+            return c.is_word();
+        case element::m_byte:
+            return c.is_byte();
+        case element::m_num:
+            return c.is_word() || c.is_byte();
+        case element::m_wsym:
+            return c.is_sword();
+        case element::m_bsym:
+            return el.sym.empty() ? c.is_sbyte() : c.is_sbyte(el.sym);
+        case element::m_wlabel:
+            return c.is_sword() && c.get_str().find("lbl") != std::string::npos;
+        case element::m_label:
+            return c.is_label();
+        case element::m_not_label:
+            return !c.is_label();
+        case element::m_string:
+            return c.is_string();
+        case element::m_var:
+            return c.is_varn();
+        case element::m_any:
+            return true;
+        }
+        return false;
+    }
+    // Value of a code element inside rule expressions
+    static peephole_rules::value element_value(const codew &c)
+    {
+        peephole_rules::value v;
+        if(c.is_word() || c.is_byte())
+            v.num = int16_t(c.get_val());
+        else if(c.is_varn())
+            v.num = c.get_varn();
+        else if(c.is_tok())
+            v.num = c.get_tok_id();
+        else if(c.is_symbol() || c.is_string())
+        {
+            v.is_str = true;
+            v.str = c.get_str();
+        }
+        return v;
+    }
+    // Matches a rule at the current position. The first element is known to
+    // match, and the elements with only one token are tested first as those
+    // reject most rules.
+    bool match(const peephole_rules::rule &r)
+    {
+        auto n = r.pattern.size();
+        if(current + n > code.size())
+            return false;
+        for(auto i : r.tok_checks)
+            if(!code[current + i].is_tok(r.pattern[i].toks[0]))
+                return false;
+        for(size_t i = 1; i < n; i++)
+            if(!match_element(r.pattern[i], i))
+                return false;
+        if(r.uses_values)
+        {
+            cap_val.resize(r.captures.size());
+            for(size_t i = 0; i < r.captures.size(); i++)
+                cap_val[i] = element_value(code[current + r.captures[i]]);
+        }
+        return !r.has_cond || r.cond.eval(cap_val, vars).num;
+    }
+    int eval_num(const peephole_rules::rule &r, const peephole_rules::expr &e)
+    {
+        auto v = e.eval(cap_val, vars);
+        if(v.is_str)
+            throw std::runtime_error(r.pos + ": expected a number");
+        return v.num;
+    }
+    // Returns the replacement of the matched elements
+    std::vector<codew> replacement(const peephole_rules::rule &r)
+    {
+        typedef peephole_rules::output output;
+        std::vector<codew> out;
+        for(size_t i = 0; i < r.repl.size(); i++)
+        {
+            auto &o = r.repl[i];
+            if(o.type == output::o_copy)
+            {
+                out.push_back(code[current + r.captures[o.arg]]);
+                continue;
+            }
+            // New elements take the line number of the element at the same
+            // position, or from the given capture.
+            int lnum = 0;
+            if(o.lnum_from >= 0)
+                lnum = code[current + r.captures[o.lnum_from]].linenum();
+            else if(current + i < code.size())
+                lnum = code[current + i].linenum();
+            switch(o.type)
+            {
+            case output::o_copy:
+            case output::o_tok:
+                out.push_back(codew::ctok(o.arg, lnum));
+                break;
+            case output::o_word:
+                out.push_back(codew::cword(int16_t(eval_num(r, o.val)) & 0xFFFF, lnum));
+                break;
+            case output::o_byte:
+                out.push_back(codew::cbyte(int16_t(eval_num(r, o.val)) & 0xFF, lnum));
+                break;
+            case output::o_string:
+            {
+                auto v = o.val.eval(cap_val, vars);
+                if(!v.is_str)
+                    throw std::runtime_error(r.pos + ": expected a string");
+                out.push_back(codew::cstring(v.str, lnum));
+                break;
+            }
+            }
+        }
+        return out;
+    }
+    // Replaces the matched elements with the code "out"
+    void replace(const peephole_rules::rule &r, const std::vector<codew> &out)
+    {
+        // Overwrite the matched elements, deleting or inserting the rest
+        size_t n = r.pattern.size(), m = out.size();
+        for(size_t i = 0; i < n && i < m; i++)
+            code[current + i] = out[i];
+        for(size_t i = m; i < n; i++)
+            code.erase(current + m);
+        for(size_t i = n; i < m; i++)
+            code.insert(current + i, out[i]);
+        changed = true;
+    }
+    // Applies the rules of the phase at the current position, returns true
+    // if the position must be examined again.
+    bool apply_rules(const peephole_rules::phase &ph)
+    {
+        auto list = ph.rules_for(code[current].get_tok_id());
+        for(size_t i = 0; list && i < list->size(); i++)
+        {
+            auto n = (*list)[i];
+            auto &r = ph.rules[n];
+            if(!match(r))
+                continue;
+            auto out = replacement(r);
+            if(r.by_cost)
+            {
+                std::vector<codew> from;
+                for(size_t j = 0; j < r.pattern.size(); j++)
+                    from.push_back(code[current + j]);
+                if(!worth(from, out))
+                    continue;
+            }
+            replace(r, out);
+            if(r.next == peephole_rules::f_retry)
+                return true;
+            if(r.next == peephole_rules::f_next || current >= code.size() ||
+               !code[current].is_tok())
+                return false;
+            // Continue with the rules after this one, the token at the
+            // current position could have changed.
+            list = ph.rules_for(code[current].get_tok_id());
+            if(list)
+                i = std::upper_bound(list->begin(), list->end(), n) - list->begin() - 1;
+        }
+        return false;
+    }
+    // Applies the rules of the phase in one pass over the code
+    void apply_phase(const peephole_rules::phase &ph)
+    {
+        if(ph.rules.empty())
+            return;
+        for(current = 0; current < code.size(); current++)
+        {
+            while(current < code.size() && code[current].is_tok() && apply_rules(ph))
+                ;
+        }
+    }
 
   public:
-    peephole(std::vector<codew> &code) : code(code), current(0)
+    peephole(std::vector<codew> &out, const peephole_rules &rules, const opt_goal &goal)
+        : code(out), current(0), rules(rules), goal(&goal), vars()
     {
-        expand_push();
-        expand_numbers();
+        auto &main_rules = rules.get("main");
+        apply_phase(rules.get("expand"));
         do
         {
             changed = false;
             remove_unused_labels();
             replace_label_targets();
             trace_iochn();
-            int print_color = 0;
+            int &print_color = vars[peephole_rules::var_print_color];
+            print_color = 0;
             // Tracks last top-of-stack value, if known
             int last_TOS_value = -1;
 
-            for(size_t i = 0; i < code.size(); i++)
+            for(current = 0; current < code.size(); current++)
             {
-
                 // Only go through tokens
-                if(!code[i].is_tok())
+                if(!code[current].is_tok())
                 {
                     // Invalidate TOS after a label
-                    if(code[i].is_label())
+                    if(code[current].is_label())
                         last_TOS_value = -1;
                     continue;
                 }
 
-                current = i;
-
                 // Track current print color
-                if(mtok(0, "TOK_BYTE_POKE") && mcbyte(1, "PRINT_COLOR"))
+                if(mtok(0, TOK_BYTE_POKE) && mcbyte(1, "PRINT_COLOR"))
                 {
                     print_color = last_TOS_value;
                     last_TOS_value = -1;
@@ -558,1028 +648,35 @@ class peephole
                 }
 
                 // Track TOS value
-                if(mtok(0, "TOK_NUM") && mword(1))
+                if(mtok(0, TOK_NUM) && mword(1))
                     last_TOS_value = val(1);
                 else
                     last_TOS_value = -1;
 
-                // Remove extra PRINT COLOR
-                if(mtok(0, "TOK_NUM") && mword(1) && mtok(2, "TOK_BYTE_POKE") &&
-                   mcbyte(3, "PRINT_COLOR"))
-                {
-                    // Remove if we are setting the same color as already set:
-                    if(val(1) == print_color)
-                    {
-                        del(3);
-                        del(2);
-                        del(1);
-                        del(0);
-                        i--;
-                        continue;
-                    }
-                }
-
-                // Sequences:
-                //   TOK_NUM / x / TOK_NEG  -> TOK_NUM / -x
-                if(mtok(0, "TOK_NUM") && mword(1) && mtok(2, "TOK_NEG"))
-                {
-                    del(2);
-                    set_w(1, -val(1));
-                    i--;
-                    continue;
-                }
-                //   TOK_NUM / x / TOK_USHL  -> TOK_NUM / 2*x
-                if(mtok(0, "TOK_NUM") && mword(1) && mtok(2, "TOK_USHL"))
-                {
-                    del(2);
-                    set_w(1, 2 * val(1));
-                    i--;
-                    continue;
-                }
-                //   TOK_NUM / x / TOK_SHL8  -> TOK_NUM / 256*x
-                if(mtok(0, "TOK_NUM") && mword(1) && mtok(2, "TOK_SHL8"))
-                {
+                if(apply_rules(main_rules))
+                    current--;
+            }
+        } while(changed);
+        print_chars();
+        apply_phase(rules.get("shorten"));
+        apply_phase(rules.get("fold"));
+        code.get(out);
+    }
+    // Applies only the rules of the given phase
+    peephole(std::vector<codew> &out, const peephole_rules &rules, const std::string &phase)
+        : code(out), current(0), rules(rules), goal(nullptr), vars()
+    {
+        apply_phase(rules.get(phase));
+        code.get(out);
+    }
+};
 
-                    del(2);
-                    set_w(1, 256 * val(1));
-                    i--;
-                    continue;
-                }
-                //   TOK_PUSH / TOK_NUM / 256 / TOK_MUL   -> TOK_SHL8
-                if(mtok(0, "TOK_PUSH") && mtok(1, "TOK_NUM") && mword(2) &&
-                   val(2) == 256 && mtok(3, "TOK_MUL"))
-                {
-                    del(3);
-                    del(2);
-                    del(1);
-                    set_tok(0, "TOK_SHL8");
-                    i--;
-                    continue;
-                }
-                //   TOK_PUSH / TOK_NUM / 4 / TOK_MUL   -> TOK_USHL TOK_USHL
-                if(mtok(0, "TOK_PUSH") && mtok(1, "TOK_NUM") && mword(2) && val(2) == 4 &&
-                   mtok(3, "TOK_MUL"))
-                {
-                    del(3);
-                    del(2);
-                    set_tok(1, "TOK_USHL");
-                    set_tok(0, "TOK_USHL");
-                    i--;
-                    continue;
-                }
-                //   TOK_PUSH / TOK_NUM / 2 / TOK_MUL   -> TOK_USHL
-                if(mtok(0, "TOK_PUSH") && mtok(1, "TOK_NUM") && mword(2) && val(2) == 2 &&
-                   mtok(3, "TOK_MUL"))
-                {
-                    del(3);
-                    del(2);
-                    del(1);
-                    set_tok(0, "TOK_USHL");
-                    i--;
-                    continue;
-                }
-                //   TOK_PUSH / TOK_NUM / 1 / TOK_MUL   -> -
-                if(mtok(0, "TOK_PUSH") && mtok(1, "TOK_NUM") && mword(2) && val(2) == 1 &&
-                   mtok(3, "TOK_MUL"))
-                {
-                    del(3);
-                    del(2);
-                    del(1);
-                    del(0);
-                    i--;
-                    continue;
-                }
-                //   TOK_PUSH / TOK_NUM / 1 / TOK_DIV   -> -
-                if(mtok(0, "TOK_PUSH") && mtok(1, "TOK_NUM") && mword(2) && val(2) == 1 &&
-                   mtok(3, "TOK_DIV"))
-                {
-                    del(3);
-                    del(2);
-                    del(1);
-                    del(0);
-                    i--;
-                    continue;
-                }
-                //   TOK_PUSH / TOK_NUM / 0 / TOK_ADD   -> -
-                if(mtok(0, "TOK_PUSH") && mtok(1, "TOK_NUM") && mword(2) && val(2) == 0 &&
-                   mtok(3, "TOK_ADD"))
-                {
-                    del(3);
-                    del(2);
-                    del(1);
-                    del(0);
-                    i--;
-                    continue;
-                }
-                //   TOK_NUM / 0 / TOK_ADD_VAR -> TOK_VAR_LOAD
-                if(mtok(0, "TOK_NUM") && mword(1) && val(1) == 0 &&
-                   mtok(2, "TOK_ADD_VAR"))
-                {
-                    del(1);
-                    del(0);
-                    set_tok(0, "TOK_VAR_LOAD");
-                    i--;
-                    continue;
-                }
-                //   TOK_PUSH / TOK_NUM / 0 / TOK_SUB   -> -
-                if(mtok(0, "TOK_PUSH") && mtok(1, "TOK_NUM") && mword(2) && val(2) == 0 &&
-                   mtok(3, "TOK_SUB"))
-                {
-                    del(3);
-                    del(2);
-                    del(1);
-                    del(0);
-                    i--;
-                    continue;
-                }
-                //   TOK_PUSH / TOK_NUM / 0 / TOK_NEQ   -> TOK_COMP_0
-                if(mtok(0, "TOK_PUSH") && mtok(1, "TOK_NUM") && mword(2) && val(2) == 0 &&
-                   mtok(3, "TOK_NEQ"))
-                {
-                    del(3);
-                    del(2);
-                    del(1);
-                    set_tok(0, "TOK_COMP_0");
-                    i--;
-                    continue;
-                }
-                //   TOK_PUSH / TOK_BYTE / 0 / TOK_EQ   -> TOK_COMP_0 TOK_L_NOT
-                if(mtok(0, "TOK_PUSH") && mtok(1, "TOK_NUM") && mword(2) && val(2) == 0 &&
-                   mtok(3, "TOK_EQ"))
-                {
-                    del(3);
-                    del(2);
-                    set_tok(0, "TOK_COMP_0");
-                    set_tok(1, "TOK_L_NOT");
-                    i--;
-                    continue;
-                }
-                //   TOK_NUM / x / TOK_PUSH / TOK_NUM / y / TOK_ADD   -> TOK_NUM (x+y)
-                if(const_op("TOK_ADD"))
-                {
-                    set_tok(0, "TOK_NUM");
-                    set_w(1, val(1) + val(4));
-                    del(5);
-                    del(4);
-                    del(3);
-                    del(2);
-                    i--;
-                    continue;
-                }
-                //   TOK_NUM / x / TOK_PUSH / TOK_NUM / y / TOK_SUB   -> TOK_NUM (x-y)
-                if(const_op("TOK_SUB"))
-                {
-                    set_tok(0, "TOK_NUM");
-                    set_w(1, val(1) - val(4));
-                    del(5);
-                    del(4);
-                    del(3);
-                    del(2);
-                    i--;
-                    continue;
-                }
-                //   TOK_NUM / 0 / TOK_VAR_STORE / x  ->  TOK_VAR_STORE_0
-                if(mtok(0, "TOK_NUM") && mword(1) && val(1) == 0 &&
-                   mtok(2, "TOK_VAR_STORE"))
-                {
-                    set_tok(2, "TOK_VAR_STORE_0");
-                    del(1);
-                    del(0);
-                    i--;
-                    continue;
-                }
-                //   TOK_VAR_ADDR / x / TOK_SADDR / TOK_GET / TOK_DPOKE
-                //      -> TOK_GET / TOK_VAR_STORE / x
-                if(mtok(0, "TOK_VAR_ADDR") && mtok(2, "TOK_SADDR") &&
-                   mtok(3, "TOK_GET") && mtok(4, "TOK_DPOKE"))
-                {
-                    ins_tok(0, "TOK_GET");
-                    set_tok(1, "TOK_VAR_STORE");
-                    del(5);
-                    del(4);
-                    del(3);
-                    i--;
-                    continue;
-                }
-                //   TOK_VAR_ADDR / x / TOK_SADDR / TOK_GETKEY / TOK_DPOKE
-                //      -> TOK_GET / TOK_VAR_STORE / x
-                if(mtok(0, "TOK_VAR_ADDR") && mtok(2, "TOK_SADDR") &&
-                   mtok(3, "TOK_GETKEY") && mtok(4, "TOK_DPOKE"))
-                {
-                    ins_tok(0, "TOK_GETKEY");
-                    set_tok(1, "TOK_VAR_STORE");
-                    del(5);
-                    del(4);
-                    del(3);
-                    i--;
-                    continue;
-                }
-                //   TOK_NUM / x / TOK_PUT
-                //      -> TOK_BYTE_PUT / x
-                if(mtok(0, "TOK_NUM") && mword(1) && mtok(2, "TOK_PUT"))
-                {
-                    set_tok(0, "TOK_BYTE_PUT");
-                    set_b(1, val(1) & 255);
-                    del(2);
-                    i--;
-                    continue;
-                }
-                //   TOK_BYTE / x / TOK_PUT
-                //      -> TOK_BYTE_PUT / x
-                if(mtok(0, "TOK_BYTE") && mtok(2, "TOK_PUT"))
-                {
-                    set_tok(0, "TOK_BYTE_PUT");
-                    del(2);
-                    i--;
-                    continue;
-                }
-                //   TOK_NUM / x<256 / TOK_PEEK
-                //      -> TOK_BYTE_PEEK / x
-                if(mtok(0, "TOK_NUM") && mword(1) && val(1) < 256 && val(1) >= 0 &&
-                   mtok(2, "TOK_PEEK"))
-                {
-                    set_tok(0, "TOK_BYTE_PEEK");
-                    set_b(1, val(1));
-                    del(2);
-                    i--;
-                    continue;
-                }
-                //   TOK_BYTE / x / TOK_PEEK
-                //      -> TOK_BYTE_PEEK / x
-                if(mtok(0, "TOK_BYTE") && mtok(2, "TOK_PEEK"))
-                {
-                    set_tok(0, "TOK_BYTE_PEEK");
-                    del(2);
-                    i--;
-                    continue;
-                }
-                // TODO: should support complex expressions on "y"
-                //   TOK_NUM / x<256 / TOK_SADDR / TOK_NUM / y / TOK_POKE
-                //      -> TOK_NUM / (y&255) / TOK_BYTE_POKE / x
-                if(mtok(0, "TOK_NUM") && mword(1) && mtok(2, "TOK_SADDR") &&
-                   mtok(3, "TOK_NUM") && mword(4) && mtok(5, "TOK_POKE") && val(1) >= 0 &&
-                   val(1) <= 255)
-                {
-                    int x = val(1);
-                    set_w(1, val(4) & 255);
-                    set_b(4, x);
-                    set_tok(3, "TOK_BYTE_POKE");
-                    del(5);
-                    del(2);
-                    i--;
-                    continue;
-                }
-                //   TOK_NUM / x<256 / TOK_SADDR / TOK_VAR_LOAD / y / TOK_POKE
-                //      -> TOK_VAR_LOAD / y / TOK_BYTE_POKE / x
-                if(mtok(0, "TOK_NUM") && mword(1) && mtok(2, "TOK_SADDR") &&
-                   mtok(3, "TOK_VAR_LOAD") && mtok(5, "TOK_POKE") && val(1) >= 0 &&
-                   val(1) <= 255)
-                {
-                    int x = val(1);
-                    set_tok(0, "TOK_VAR_LOAD");
-                    copy(1, 4, 1);
-                    del(2);
-                    set_b(4, x);
-                    set_tok(3, "TOK_BYTE_POKE");
-                    del(5);
-                    del(2);
-                    i--;
-                    continue;
-                }
-                // TODO: should support complex expressions on "y"
-                //   TOK_BYTE / x / TOK_SADDR / TOK_NUM / y / TOK_POKE
-                //      -> TOK_NUM / (y&255) / TOK_BYTE_POKE / x
-                if(mtok(0, "TOK_BYTE") && mtok(2, "TOK_SADDR") && mtok(3, "TOK_NUM") &&
-                   mword(4) && mtok(5, "TOK_POKE"))
-                {
-                    copy(4, 1, 1);
-                    set_w(1, val(5) & 255);
-                    set_tok(0, "TOK_NUM");
-                    set_tok(3, "TOK_BYTE_POKE");
-                    del(6);
-                    del(5);
-                    del(2);
-                    i--;
-                    continue;
-                }
-                //   TOK_BYTE / x / TOK_SADDR / TOK_VAR_LOAD / y / TOK_POKE
-                //      -> TOK_VAR_LOAD / y / TOK_BYTE_POKE / x
-                if(mtok(0, "TOK_BYTE") && mtok(2, "TOK_SADDR") &&
-                   mtok(3, "TOK_VAR_LOAD") && mtok(5, "TOK_POKE"))
-                {
-                    copy(0, 3, 2);
-                    set_tok(2, "TOK_BYTE_POKE");
-                    del(7);
-                    del(6);
-                    del(5);
-                    del(4);
-                    i--;
-                    continue;
-                }
-                //   TOK_NUM / x / TOK_SADDR / TOK_NUM / y / TOK_POKE
-                //      -> TOK_NUM / (y&255) / TOK_NUM_POKE / x
-                if(mtok(0, "TOK_NUM") && mtok(2, "TOK_SADDR") && mtok(3, "TOK_NUM") &&
-                   mword(4) && mtok(5, "TOK_POKE"))
-                {
-                    copy(4, 1, 1);
-                    set_w(1, val(5) & 255);
-                    set_tok(3, "TOK_NUM_POKE");
-                    del(6);
-                    del(5);
-                    del(2);
-                    i--;
-                    continue;
-                }
-                //   TOK_NUM / x / TOK_SADDR / TOK_VAR_LOAD / y / TOK_POKE
-                //      -> TOK_VAR_LOAD / y / TOK_NUM_POKE / x
-                if(mtok(0, "TOK_NUM") && mword(1) && mtok(2, "TOK_SADDR") &&
-                   mtok(3, "TOK_VAR_LOAD") && mtok(5, "TOK_POKE"))
-                {
-                    int x = val(1);
-                    set_tok(0, "TOK_VAR_LOAD");
-                    copy(1, 4, 1);
-                    del(2);
-                    set_w(4, x);
-                    set_tok(3, "TOK_NUM_POKE");
-                    del(5);
-                    del(2);
-                    i--;
-                    continue;
-                }
-#if 0
-                    //   TOK_ADD / TOK_NUM / x / TOK_ADD
-                    //      ->   TOK_NUM x / TOK_ADD / TOK_ADD
-                    if( mtok(0,"TOK_ADD") && mtok(1,"TOK_NUM") && mword(2) && mtok(3,"TOK_ADD") )
-                    {
-                        set_tok(0, "TOK_NUM"); set_w(1,val(2)); set_tok(2, "TOK_ADD"); i--;
-                        continue;
-                    }
-                    //   TOK_ADD / TOK_NUM / x / TOK_SUB
-                    //      ->   TOK_NUM x / TOK_SUB / TOK_ADD
-                    if( mtok(0,"TOK_ADD") && mtok(1,"TOK_NUM") && mword(2) && mtok(3,"TOK_SUB") )
-                    {
-                        set_tok(0, "TOK_NUM"); set_w(1,val(2)); set_tok(2, "TOK_SUB");
-                        set_tok(3, "TOK_ADD"); i--;
-                        continue;
-                    }
-                    //   TOK_SUB / TOK_NUM / x / TOK_ADD
-                    //      ->   TOK_NUM x / TOK_SUB / TOK_SUB
-                    if( mtok(0,"TOK_SUB") && mtok(1,"TOK_NUM") && mword(2) && mtok(3,"TOK_ADD") )
-                    {
-                        set_tok(0, "TOK_NUM"); set_w(1,val(2)); set_tok(2, "TOK_SUB");
-                        set_tok(3, "TOK_SUB"); i--;
-                        continue;
-                    }
-                    //   TOK_SUB / TOK_NUM / x / TOK_SUB
-                    //      ->   TOK_NUM x / TOK_ADD / TOK_SUB
-                    if( mtok(0,"TOK_SUB") && mtok(1,"TOK_NUM") && mword(2) && mtok(3,"TOK_SUB") )
-                    {
-                        set_tok(0, "TOK_NUM"); set_w(1,val(2)); set_tok(2, "TOK_ADD");
-                        set_tok(3, "TOK_SUB"); i--;
-                        continue;
-                    }
-#endif
-                //   TOK_NUM / x / TOK_PUSH / TOK_NUM / y / TOK_MUL   -> TOK_NUM (x*y)
-                if(const_op("TOK_MUL"))
-                {
-                    set_tok(0, "TOK_NUM");
-                    set_w(1, val(1) * val(4));
-                    del(5);
-                    del(4);
-                    del(3);
-                    del(2);
-                    i--;
-                    continue;
-                }
-                //   TOK_NUM / x / TOK_PUSH / TOK_NUM / y / TOK_DIV   -> TOK_NUM (x/y)
-                if(const_op("TOK_DIV"))
-                {
-                    int16_t div = val(4);
-                    if(div)
-                        div = val(1) / div;
-                    else if(val(1) < 0)
-                        div = 1; // Probably a bug in the division routine, but we emulate
-                                 // the result
-                    else
-                        div = -1;
-                    set_tok(0, "TOK_NUM");
-                    set_w(1, div);
-                    del(5);
-                    del(4);
-                    del(3);
-                    del(2);
-                    i--;
-                    continue;
-                }
-                //   TOK_NUM / x / TOK_PUSH / TOK_NUM / y / TOK_MOD   -> TOK_NUM (x%y)
-                if(const_op("TOK_MOD"))
-                {
-                    int16_t div = val(4);
-                    if(div)
-                        div = val(1) % div;
-                    else
-                        div = val(1); // Probably a bug in the division routine, but we
-                                      // emulate the result
-                    set_tok(0, "TOK_NUM");
-                    set_w(1, div);
-                    del(5);
-                    del(4);
-                    del(3);
-                    del(2);
-                    i--;
-                    continue;
-                }
-                //   TOK_NUM / x / TOK_PUSH / TOK_NUM / y / TOK_BIT_AND   -> TOK_NUM (x&y)
-                if(const_op("TOK_BIT_AND"))
-                {
-                    set_tok(0, "TOK_NUM");
-                    set_w(1, val(1) & val(4));
-                    del(5);
-                    del(4);
-                    del(3);
-                    del(2);
-                    i--;
-                    continue;
-                }
-                //   TOK_NUM / x / TOK_PUSH / TOK_NUM / y / TOK_BIT_OR   -> TOK_NUM (x|y)
-                if(const_op("TOK_BIT_OR"))
-                {
-                    set_tok(0, "TOK_NUM");
-                    set_w(1, val(1) | val(4));
-                    del(5);
-                    del(4);
-                    del(3);
-                    del(2);
-                    i--;
-                    continue;
-                }
-                //   TOK_NUM / x / TOK_PUSH / TOK_NUM / y / TOK_BIT_EXOR   -> TOK_NUM
-                //   (x^y)
-                if(const_op("TOK_BIT_EXOR"))
-                {
-                    set_tok(0, "TOK_NUM");
-                    set_w(1, val(1) ^ val(4));
-                    del(5);
-                    del(4);
-                    del(3);
-                    del(2);
-                    i--;
-                    continue;
-                }
-                // Transform multiple subtractions to addition
-                //   TOK_PUSH / TOK_VAR / x / TOK_SUB / TOK_PUSH / TOK_VAR / y / TOK_SUB
-                //       ->
-                //   TOK_PUSH / TOK_VAR / x / TOK_PUSH / TOK_VAR / y / TOK_ADD / TOK_SUB
-                if(mtok(0, "TOK_PUSH") &&
-                   (mtok(1, "TOK_VAR_LOAD") || mtok(1, "TOK_NUM")) &&
-                   mtok(3, "TOK_SUB") && mtok(4, "TOK_PUSH") &&
-                   (mtok(5, "TOK_VAR_LOAD") || mtok(5, "TOK_NUM")) && mtok(7, "TOK_SUB"))
-                {
-                    ins_tok(7, "TOK_ADD");
-                    del(3);
-                }
-                //   TOK_PUSH / TOK_VAR / x / TOK_ADD   -> TOK_ADD_VAR / x
-                if(mtok(0, "TOK_PUSH") && mtok(1, "TOK_VAR_LOAD") && mtok(3, "TOK_ADD"))
-                {
-                    set_tok(1, "TOK_ADD_VAR");
-                    del(3);
-                    del(0);
-                    i--;
-                    continue;
-                }
-                //   TOK_VAR / x / TOK_PUSH / TOK_NUM / y / TOK_ADD   -> TOK_NUM / y /
-                //   TOK_ADD_VAR / x
-                if(mtok(0, "TOK_VAR_LOAD") && mtok(2, "TOK_PUSH") && mtok(3, "TOK_NUM") &&
-                   mword(4) && mtok(5, "TOK_ADD"))
-                {
-                    set_tok(0, "TOK_NUM");
-                    set_tok(2, "TOK_ADD_VAR");
-                    copy(3, 1, 1);
-                    del(4);
-                    set_w(1, val(4));
-                    del(5);
-                    del(4);
-                    i--;
-                    continue;
-                }
-                //   TOK_VAR / x / TOK_PUSH / TOK_VAR / y / TOK_USHL / TOK_ADD   ->
-                //        TOK_VAR / y / TOK_USHL / TOK_ADD_VAR / x
-                if(mtok(0, "TOK_VAR_LOAD") && mtok(2, "TOK_PUSH") &&
-                   mtok(3, "TOK_VAR_LOAD") && mtok(5, "TOK_USHL") && mtok(6, "TOK_ADD"))
-                {
-                    copy(1, 4, 1);
-                    copy(5, 2, 1);
-                    del(6);
-                    del(2);
-                    set_tok(2, "TOK_USHL");
-                    set_tok(3, "TOK_ADD_VAR");
-                    del(6);
-                    del(5);
-                    i--;
-                    continue;
-                }
-                //////////////////////////////////7
-                // This pattern is generated on array access: ARR(VAR + X)
-                //   TOK_VAR / x / TOK_PUSH /
-                //                 TOK_NUM / n / TOK_ADD_VAR / y /
-                //                 TOK_USHL / TOK_ADD ->
-                //
-                //      TOK_NUM / n / TOK_ADD_VAR / y / TOK_USHL / TOK_ADD:VAR / x
-                //
-                if(mtok(0, "TOK_VAR_LOAD") && mtok(2, "TOK_PUSH") && mtok(3, "TOK_NUM") &&
-                   mword(4) && mtok(5, "TOK_ADD_VAR") && mtok(7, "TOK_USHL") &&
-                   mtok(8, "TOK_ADD"))
-                {
-                    ins_w(9, 1);
-                    copy(9, 1, 1);
-                    del(10);
-                    set_tok(8, "TOK_ADD_VAR");
-                    del(2);
-                    del(1);
-                    del(0);
-                    i--;
-                    continue;
-                }
-                //  VAR + VAR    ==>   2 * VAR
-                //   TOK_VAR / x / TOK_PUSH / TOK_VAR / x / TOK_ADD   -> TOK_VAR / x /
-                //   TOK_USHL
-                if(mtok(0, "TOK_VAR_LOAD") && mtok(2, "TOK_PUSH") &&
-                   mtok(3, "TOK_VAR_LOAD") && mtok(5, "TOK_ADD") && varn(1) == varn(4))
-                {
-                    set_tok(2, "TOK_USHL");
-                    del(5);
-                    del(4);
-                    del(3);
-                    i--;
-                    continue;
-                }
-                //  VAR = VAR + 1   ==>  INC VAR
-                //   TOK_VAR / x / TOK_PUSH / TOK_NUM / 1 / TOK_ADD / TOK_VAR_STORE / x
-                //        -> TOK_INCVAR / x
-                if(mtok(0, "TOK_VAR_LOAD") && mtok(2, "TOK_PUSH") && mtok(3, "TOK_NUM") &&
-                   mword(4) && val(4) == 1 && mtok(5, "TOK_ADD") &&
-                   mtok(6, "TOK_VAR_STORE") && varn(1) == varn(7))
-                {
-                    set_tok(0, "TOK_INCVAR");
-                    del(7);
-                    del(6);
-                    del(5);
-                    del(4);
-                    del(3);
-                    del(2);
-                    i--;
-                    continue;
-                }
-                //  VAR = VAR + 1   ==>  INC VAR
-                //   TOK_VAR_A / x / TOK_SADDR / TOK_VAR / x / TOK_PUSH / TOK_NUM / 1 /
-                //   TOK_ADD / TOK_DPOKE
-                //        -> TOK_INCVAR / x
-                if(mtok(0, "TOK_VAR_ADDR") && mtok(2, "TOK_SADDR") &&
-                   mtok(3, "TOK_VAR_LOAD") && mtok(5, "TOK_PUSH") && mtok(6, "TOK_NUM") &&
-                   mword(7) && val(7) == 1 && mtok(8, "TOK_ADD") &&
-                   mtok(9, "TOK_DPOKE") && varn(1) == varn(4))
-                {
-                    set_tok(0, "TOK_INCVAR");
-                    del(9);
-                    del(8);
-                    del(7);
-                    del(6);
-                    del(5);
-                    del(4);
-                    del(3);
-                    del(2);
-                    i--;
-                    continue;
-                }
-                //  INC VAR  ==>  INC VAR (optimized)
-                //   TOK_VAR_A / x / TOK_INC -> TOK_INCVAR / x
-                if(mtok(0, "TOK_VAR_ADDR") && mtok(2, "TOK_INC"))
-                {
-                    set_tok(0, "TOK_INCVAR");
-                    del(2);
-                    i--;
-                    continue;
-                }
-                //  INC  ==>  INC (optimized)
-                //   TOK_SADDR / TOK_INC -> TOK_INC
-                if(mtok(0, "TOK_SADDR") && mtok(1, "TOK_INC"))
-                {
-                    del(0);
-                    i--;
-                    continue;
-                }
-                //  VAR = VAR - 1   ==>  DEC VAR
-                //   TOK_VAR / x / TOK_PUSH / TOK_NUM / 1 / TOK_SUB / TOK_VAR_STORE / x
-                //        -> TOK_DECVAR / x
-                if(mtok(0, "TOK_VAR_LOAD") && mtok(2, "TOK_PUSH") && mtok(3, "TOK_NUM") &&
-                   mword(4) && val(4) == 1 && mtok(5, "TOK_SUB") &&
-                   mtok(6, "TOK_VAR_STORE") && varn(1) == varn(7))
-                {
-                    set_tok(0, "TOK_DECVAR");
-                    del(7);
-                    del(6);
-                    del(5);
-                    del(4);
-                    del(3);
-                    del(2);
-                    i--;
-                    continue;
-                }
-                //  VAR = VAR - 1   ==>  DEC VAR
-                //   TOK_VAR_A / x / TOK_SADDR / TOK_VAR / x / TOK_PUSH / TOK_NUM / 1 /
-                //   TOK_SUB / TOK_DPOKE
-                //        -> TOK_DECVAR / x
-                if(mtok(0, "TOK_VAR_ADDR") && mtok(2, "TOK_SADDR") &&
-                   mtok(3, "TOK_VAR_LOAD") && mtok(5, "TOK_PUSH") && mtok(6, "TOK_NUM") &&
-                   mword(7) && val(7) == 1 && mtok(8, "TOK_SUB") &&
-                   mtok(9, "TOK_DPOKE") && varn(1) == varn(4))
-                {
-                    set_tok(0, "TOK_DECVAR");
-                    del(9);
-                    del(8);
-                    del(7);
-                    del(6);
-                    del(5);
-                    del(4);
-                    del(3);
-                    del(2);
-                    i--;
-                    continue;
-                }
-                //  DEC VAR  ==>  DEC VAR (optimized)
-                //   TOK_VAR_A / x / TOK_DEC -> TOK_DECVAR / x
-                if(mtok(0, "TOK_VAR_ADDR") && mtok(2, "TOK_DEC"))
-                {
-                    set_tok(0, "TOK_DECVAR");
-                    del(2);
-                    i--;
-                    continue;
-                }
-                //  DEC ==>  DEC (optimized)
-                //   TOK_SADDR / TOK_DEC -> TOK_DEC
-                if(mtok(0, "TOK_SADDR") && mtok(1, "TOK_DEC"))
-                {
-                    del(0);
-                    i--;
-                    continue;
-                }
-                // NOT NOT A -> A
-                //   TOK_L_NOT / TOK_L_NOT -> TOK_COMP_0
-                if(mtok(0, "TOK_L_NOT") && mtok(1, "TOK_L_NOT"))
-                {
-                    set_tok(0, "TOK_COMP_0");
-                    del(1);
-                    continue;
-                }
-                // NOT A=B -> A<>B
-                //   TOK_EQ / TOK_L_NOT -> TOK_NEQ
-                if(mtok(0, "TOK_EQ") && mtok(1, "TOK_L_NOT"))
-                {
-                    set_tok(0, "TOK_NEQ");
-                    del(1);
-                    continue;
-                }
-                // NOT A<>B -> A=B
-                //   TOK_NEQ / TOK_L_NOT -> TOK_EQ
-                if(mtok(0, "TOK_NEQ") && mtok(1, "TOK_L_NOT"))
-                {
-                    set_tok(0, "TOK_EQ");
-                    del(1);
-                    continue;
-                }
-                // (bool) != 0  -> (bool)
-                //   TOK_L_AND | TOK_L_OR | TOK_L_NOT |
-                //   TOK_NEQ | TOK_COMP_0 | TOK_EQ |
-                //   TOK_LT | TOK_GT
-                //       / TOK_COMP_0   ->  remove TOK_COMP_0
-                if((mtok(0, "TOK_NEQ") || mtok(0, "TOK_L_AND") || mtok(0, "TOK_L_OR") ||
-                    mtok(0, "TOK_L_NOT") || mtok(0, "TOK_COMP_0") || mtok(0, "TOK_EQ") ||
-                    mtok(0, "TOK_LT") || mtok(0, "TOK_GT")) &&
-                   mtok(1, "TOK_COMP_0"))
-                {
-                    del(1);
-                    continue;
-                }
-                // NOT (A > x)  ==  A <= x  ->  A < x+1
-                //    TOK_NUM / x / TOK_GT / TOK_L_NOT -> TOK_NUM / x+1 / TOK_LT
-                if(mtok(0, "TOK_NUM") && mword(1) && mtok(2, "TOK_GT") &&
-                   mtok(3, "TOK_L_NOT"))
-                {
-                    if(val(1) == 32637)
-                    {
-                        // If x=32767, the expression is always true.
-                        // We can't currently delete an expression, so
-                        // simply replace it with "OR 1"
-                        set_tok(0, "TOK_NUM");
-                        set_w(1, 1);
-                        set_tok(2, "TOK_BIT_OR");
-                        set_tok(3, "TOK_COMP_0");
-                    }
-                    else
-                    {
-                        set_tok(0, "TOK_NUM");
-                        set_w(1, val(1) + 1);
-                        set_tok(2, "TOK_LT");
-                        del(3);
-                    }
-                }
-                // STRING[i,n>255] -> STRING[i,255]
-                //   TOK_NUM / > 255 / TOK_STR_IDX
-                //        -> TOK_NUM / 255 / TOK_STR_IDX
-                if(mtok(0, "TOK_NUM") && mword(1) && mtok(2, "TOK_STR_IDX") &&
-                   val(1) > 255)
-                {
-                    set_w(1, 255);
-                    continue;
-                }
-#if 0
-                    // STRING[i][j,n] -> STRING[i+j-1,n]
-                    //   TOK_NUM / 255 / TOK_STR_IDX /
-                    //   ( TOK_NUM / j ) || ( TOK_VAR_LOAD / k ) /
-                    //   ( TOK_NUM / n ) || ( TOK_VAR_LOAD / n ) /
-                    //   TOK_STR_IDX
-                    //      ->
-                    //   TOK_NUM / j / TOK_ADD / TOK_NUM / 1 / TOK_SUB / TOK_NUM / n / TOK_STR_IDX
-                    if( mtok(0, "TOK_NUM") && mword(1) && (val(1) == 255) &&
-                        mtok(2, "TOK_STR_IDX") &&
-                        ( mtok(3, "TOK_NUM") || mtok(3, "TOK_VAR_LOAD") ) &&
-                        ( mtok(5, "TOK_NUM") || mtok(5, "TOK_VAR_LOAD") ) &&
-                        mtok(7, "TOK_STR_IDX") )
-                    {
-                        ins_tok(5, "TOK_ADD");
-                        ins_tok(6, "TOK_NUM"); ins_w(7, 1);
-                        ins_tok(8, "TOK_SUB");
-                        del(2); del(1); del(0);
-                        continue;
-                    }
-                    // STRING[i,n][j] -> STRING[i+j-1,n-j+1]
-                    //   ( TOK_NUM / n ) || ( TOK_VAR_LOAD / n ) / TOK_STR_IDX
-                    //   ( TOK_NUM / j ) || ( TOK_VAR_LOAD / k ) /
-                    //   TOK_NUM / 255 / TOK_STR_IDX
-                    //      ->
-                    //   TOK_NUM / j / TOK_ADD / TOK_NUM / 1 / TOK_SUB / TOK_NUM / n /
-                    //   TOK_NUM / j / TOK_SUB / TOK_NUM / 1 / TOK_ADD / TOK_STR_IDX
-                    if( ( mtok(0, "TOK_NUM") || mtok(0, "TOK_VAR_LOAD") ) &&
-                        mtok(2, "TOK_STR_IDX") &&
-                        ( mtok(3, "TOK_NUM") || mtok(3, "TOK_VAR_LOAD") ) &&
-                        mtok(5, "TOK_NUM") && mword(6) && (val(6) == 255) &&
-                        mtok(7, "TOK_STR_IDX") )
-                    {
-                        del(6); del(5);
-                        copy(0, 3, 2);
-                        ins_tok(2, "TOK_ADD");
-                        ins_tok(3, "TOK_NUM"); ins_w(4, 1);
-                        ins_tok(5, "TOK_SUB");
-                        del(8);
-                        ins_tok(10, "TOK_SUB");
-                        ins_tok(11, "TOK_NUM"); ins_w(12, 1);
-                        ins_tok(13, "TOK_ADD");
-                        continue;
-                    }
-                    // ASC( STRING[i,X (>=1) ] ) -> PEEK( ADR(STRING) + i )
-                    //
-                    //   TOK_NUM / X (>=1) / TOK_STR_IDX /
-                    //   TOK_NUM / Y (<=X) / TOK_ADD / TOK_PEEK
-                    //      ->
-                    //   TOK_ADD / TOK_NUM / Y - 1 / TOK_ADD / TOK_PEEK
-                    if( mtok(0, "TOK_NUM") && mword(1) && (val(1)>0) && mtok(2, "TOK_STR_IDX") &&
-                        mtok(3, "TOK_NUM") && mword(4) && (val(4)<=val(1)) &&
-                        (val(4)>=1) && mtok(5, "TOK_ADD") && mtok(6, "TOK_PEEK") )
-                    {
-                        set_tok(2, "TOK_ADD");
-                        set_w(4, val(4) - 1);
-                        del(1); del(0);
-                        continue;
-                    }
-#endif
-                // NOT (A < x)  ==  A >= x  ->  A > x-1
-                //    TOK_NUM / x / TOK_LT / TOK_L_NOT -> TOK_NUM / x+1 / TOK_LT
-                if(mtok(0, "TOK_NUM") && mword(1) && mtok(2, "TOK_LT") &&
-                   mtok(3, "TOK_L_NOT"))
-                {
-                    if(val(1) == -32768)
-                    {
-                        // If x=-32768, the expression is always true.
-                        // We can't currently delete an expression, so
-                        // simply replace it with "OR 1"
-                        set_tok(0, "TOK_NUM");
-                        set_w(1, 1);
-                        set_tok(2, "TOK_BIT_OR");
-                        set_tok(3, "TOK_COMP_0");
-                    }
-                    else
-                    {
-                        set_tok(0, "TOK_NUM");
-                        set_w(1, val(1) - 1);
-                        set_tok(2, "TOK_GT");
-                        del(3);
-                    }
-                }
-                //   x == 0 -> 1 / 0
-                if(mtok(0, "TOK_NUM") && mword(1) && mtok(2, "TOK_COMP_0"))
-                {
-                    set_w(1, val(1) ? 1 : 0);
-                    del(2);
-                    continue;
-                }
-                //   x / TOK_CNJUMP -> remove or always jump
-                if(mtok(0, "TOK_NUM") && mword(1) && mtok(2, "TOK_CNJUMP"))
-                {
-                    if(!val(1))
-                    {
-                        del(3);
-                        del(2);
-                        del(1);
-                        del(0);
-                    }
-                    else
-                    {
-                        set_tok(2, "TOK_JUMP");
-                        del(1);
-                        del(0);
-                    }
-                    continue;
-                }
-                //   x / TOK_CJUMP -> remove or always jump
-                if(mtok(0, "TOK_NUM") && mword(1) && mtok(2, "TOK_CJUMP"))
-                {
-                    if(val(1))
-                    {
-                        del(3);
-                        del(2);
-                        del(1);
-                        del(0);
-                    }
-                    else
-                    {
-                        set_tok(2, "TOK_JUMP");
-                        del(1);
-                        del(0);
-                    }
-                    continue;
-                }
-                // CALL xxxxx / RETURN  ->  JUMP xxxxx
-                //   TOK_CALL / x / TOK_RET -> TOK_JUMP / x
-                if(mtok(0, "TOK_CALL") && mtok(2, "TOK_RET"))
-                {
-                    set_tok(0, "TOK_JUMP");
-                    del(2);
-                    continue;
-                }
-                //   TOK_L_NOT / TOK_CJUMP
-                //     -> TOK_CNJUMP
-                if(mtok(0, "TOK_L_NOT") && mtok(1, "TOK_CJUMP"))
-                {
-                    set_tok(1, "TOK_CNJUMP");
-                    del(0);
-                    continue;
-                }
-                //   TOK_L_NOT / TOK_CNJUMP
-                //     -> TOK_CJUMP
-                if(mtok(0, "TOK_L_NOT") && mtok(1, "TOK_CNJUMP"))
-                {
-                    set_tok(1, "TOK_CJUMP");
-                    del(0);
-                    continue;
-                }
-                // Bypass CJUMP over another JUMP
-                //   TOK_CJUMP / x / TOK_JUMP / y / LABEL x
-                //     -> TOK_CNJUMP / y / LABEL x
-                if(mtok(0, "TOK_CJUMP") && mtok(2, "TOK_JUMP") && mlabel(4) &&
-                   lbl(4) == wlbl(1))
-                {
-                    set_tok(2, "TOK_CNJUMP");
-                    del(1);
-                    del(0);
-                    continue;
-                }
-                // Bypass CJUMP over a RET
-                //   TOK_CJUMP / x / TOK_RET / LABEL x
-                //     -> TOK_CNRET / LABEL x
-                if(mtok(0, "TOK_CJUMP") && mtok(2, "TOK_RET") && mlabel(3) &&
-                   lbl(3) == wlbl(1))
-                {
-                    set_tok(2, "TOK_CNRET");
-                    del(1);
-                    del(0);
-                    continue;
-                }
-                // Bypass CNJUMP over another JUMP
-                //   TOK_CNJUMP / x / TOK_JUMP / y / LABEL x
-                //     -> TOK_CJUMP / y / LABEL x
-                if(mtok(0, "TOK_CNJUMP") && mtok(2, "TOK_JUMP") && mlabel(4) &&
-                   lbl(4) == wlbl(1))
-                {
-                    set_tok(2, "TOK_CJUMP");
-                    del(1);
-                    del(0);
-                    continue;
-                }
-                // Bypass CNJUMP over a RET
-                //   TOK_CNJUMP / x / TOK_RET / LABEL x
-                //     -> TOK_CRET / LABEL x
-                if(mtok(0, "TOK_CNJUMP") && mtok(2, "TOK_RET") && mlabel(3) &&
-                   lbl(3) == wlbl(1))
-                {
-                    set_tok(2, "TOK_CRET");
-                    del(1);
-                    del(0);
-                    continue;
-                }
-                //   TOK_L_NOT / TOK_CRET  ->  TOK_CNRET
-                if(mtok(0, "TOK_L_NOT") && mtok(1, "TOK_CRET"))
-                {
-                    set_tok(1, "TOK_CNRET");
-                    del(0);
-                    continue;
-                }
-                //   TOK_L_NOT / TOK_CNRET  ->  TOK_CRET
-                if(mtok(0, "TOK_L_NOT") && mtok(1, "TOK_CNRET"))
-                {
-                    set_tok(1, "TOK_CRET");
-                    del(0);
-                    continue;
-                }
-                // Bypass JUMP to next instruction
-                //   TOK_JUMP / x / LABEL x
-                //     -> LABEL x
-                if(mtok(0, "TOK_JUMP") && mlabel(2) && lbl(2) == wlbl(1))
-                {
-                    del(1);
-                    del(0);
-                    continue;
-                }
-                // Remove dead code after a JUMP
-                if(mtok(0, "TOK_JUMP") && !mlabel(2))
-                {
-                    del(2);
-                    continue;
-                }
-                // Remove dead code after a RET or END
-                if((mtok(0, "TOK_RET") || mtok(0, "TOK_END")) && !mlabel(1))
-                {
-                    int last = 1;
-                    while(current + last < code.size() && !mlabel(last))
-                        last++;
-                    while(--last >= 1)
-                        del(last);
-                    continue;
-                }
-                // Convert PRINT CHR$(X) to PUT X
-                // TOK_CHR / TOK_PRINT_STR -> TOK_PUT
-                if(mtok(0, "TOK_CHR") && mtok(1, "TOK_PRINT_STR"))
-                {
-                    set_tok(0, "TOK_PUT");
-                    del(1);
-                    continue;
-                }
-                // Join print constant strings with a PUT, except if the color
-                // is not known.
-                // TOK_CSTRING / STR / TOK_PRINT_STR / TOK_NUM / X / TOK_PUT
-                //   -> TOK_CSTRING / STR+X / TOK_PRINT_STR
-                if(mtok(0, "TOK_CSTRING") && mstring(1) < 255 &&
-                   mtok(2, "TOK_PRINT_STR") && mtok(3, "TOK_NUM") && mword(4) &&
-                   mtok(5, "TOK_PUT") && print_color >= 0)
-                {
-                    set_string(1, str(1) + char(val(4) ^ print_color));
-                    del(5);
-                    del(4);
-                    del(3);
-                }
-                // Join print constant strings with a PUT, except if the color
-                // is not known.
-                // TOK_CSTRING / STR / TOK_PRINT_STR / TOK_BYTE_PUT / x
-                //   -> TOK_CSTRING / STR+X / TOK_PRINT_STR
-                if(mtok(0, "TOK_CSTRING") && mstring(1) < 255 &&
-                   mtok(2, "TOK_PRINT_STR") && mtok(3, "TOK_BYTE_PUT") &&
-                   (mbyte(4) || mword(4)) && print_color >= 0)
-                {
-                    set_string(1, str(1) + char(val(4) ^ print_color));
-                    del(4);
-                    del(3);
-                }
-                // Join two print constant strings
-                // TOK_CSTRING / S1 / TOK_PRINT_STR / TOK_CSTRING / S2 / TOK_PRINT_STR
-                //   -> TOK_CSTRING / S1+S2 / TOK_PRINT_STR
-                if(mtok(0, "TOK_CSTRING") && mtok(2, "TOK_PRINT_STR") &&
-                   mtok(3, "TOK_CSTRING") && mtok(5, "TOK_PRINT_STR") &&
-                   mstring(1) + mstring(4) < 256)
-                {
-                    set_string(1, str(1) + str(4));
-                    del(5);
-                    del(4);
-                    del(3);
-                }
-            }
-        } while(changed);
-        print_chars();
-        shorten_numbers();
-        fold_push();
-        fold_saddr();
-    }
-};
+void do_peephole(std::vector<codew> &code, const peephole_rules &rules, const opt_goal &goal)
+{
+    peephole pp(code, rules, goal);
+}
 
-void do_peephole(std::vector<codew> &code)
+void do_fuse(std::vector<codew> &code, const peephole_rules &rules)
 {
-    peephole pp(code);
+    peephole pp(code, rules, "fuse");
 }
@@ -23,4 +23,13 @@
 #include "codew.h"
 #include <vector>
 
-void do_peephole(std::vector<codew> &code);
+class opt_goal;
+class peephole_rules;
+
+// Applies the rules to the code, the rules marked with "COST" and the
+// expansion of PRINT of constant strings are only applied if the result is
+// better for the given objective.
+void do_peephole(std::vector<codew> &code, const peephole_rules &rules, const opt_goal &goal);
+// Joins tokens using the rules of the "fuse" phase, must be called after
+// all the other optimizations as the joined tokens are not known to them.
+void do_fuse(std::vector<codew> &code, const peephole_rules &rules);
@@ -0,0 +1,301 @@
+/*
+ * FastBasic - Fast basic interpreter for the Atari 8-bit computers
+ * Copyright (C) 2017-2025 Daniel Serpell
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+// server.cc: Compiler server, to compile many files without restarting
+//
+// The protocol uses text lines, with a keyword followed by one space and the
+// argument. At connection, the server sends:
+//     fastbasic-server <protocol version> <compiler version>
+// The client sends the request:
+//     cwd <folder>       optional, folder for relative file names
+//     arg <argument>     one for each command line argument
+//     file <size> <name> optional, followed by <size> bytes with the text of
+//                        the source file <name>, used instead of the disk file,
+//                        the size is limited to 16 MiB
+//     compile            compiles the request
+// The server responds with:
+//     message <text>     one for each line of output of the compiler and tools
+//     output <file>      one for each file written
+//     result <code>      the exit code, 0 on success, ends the response
+// After the response, the client can send another request, or "quit" to close
+// the connection or "stop" to also stop the server.
+
+#include "server.h"
+#include "os.h"
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+static const char *protocol_id = "fastbasic-server 1";
+
+// Maximum size of a source file sent by the client
+static const size_t max_file_size = 16 * 1024 * 1024;
+
+// Reads one line, without the line terminator
+static bool read_line(FILE *f, std::string &line)
+{
+    line.clear();
+    int c;
+    while((c = getc(f)) != EOF && c != '\n')
+        line += char(c);
+    return c != EOF || !line.empty();
+}
+
+// Runs the request storing all the output in "msg"
+static int run(server::request &r, const server::compile_fn &fn, std::string &msg)
+{
+    std::ostringstream os;
+    auto old_out = std::cout.rdbuf(os.rdbuf());
+    auto old_err = std::cerr.rdbuf(os.rdbuf());
+    auto old_dir = os::current_dir();
+    int e = 1;
+    if(!r.cwd.empty() && !os::change_dir(r.cwd))
+        std::cerr << "fastbasic: can't change to folder '" << r.cwd << "'\n";
+    else
+    {
+        try
+        {
+            r.capture_tools = true;
+            e = fn(r);
+        }
+        catch(std::exception &x)
+        {
+            std::cerr << "fastbasic: " << x.what() << "\n";
+            e = 1;
+        }
+    }
+    os::change_dir(old_dir);
+    std::cout.rdbuf(old_out);
+    std::cerr.rdbuf(old_err);
+    msg = os.str();
+    return e;
+}
+
+// Serves the requests from one connection, returns false to stop the server
+static bool serve(FILE *in, FILE *out, const server::compile_fn &fn)
+{
+    fprintf(out, "%s %s\n", protocol_id, VERSION);
+    fflush(out);
+
+    server::request r;
+    std::string line;
+    while(read_line(in, line))
+    {
+        auto sp = line.find(' ');
+        auto cmd = line.substr(0, sp);
+        auto arg = sp == line.npos ? std::string() : line.substr(sp + 1);
+        if(cmd == "arg")
+            r.args.push_back(arg);
+        else if(cmd == "cwd")
+            r.cwd = arg;
+        else if(cmd == "file")
+        {
+            size_t pos = 0, size = 0;
+            try {
+                size = std::stoul(arg, &pos);
+            }
+            catch(...) { }
+            if(!pos || pos >= arg.size())
+                return true;
+            if(size > max_file_size)
+            {
+                // The data can't be skipped, so the connection is closed
+                fprintf(out, "message fastbasic: file '%s' too big\nresult 1\n",
+                        arg.substr(pos + 1).c_str());
+                fflush(out);
+                return true;
+            }
+            try {
+                std::string data(size, '\0');
+                if(size && fread(&data[0], 1, size, in) != size)
+                    return true;
+                r.files[arg.substr(pos + 1)] = std::move(data);
+            }
+            catch(std::exception &x)
+            {
+                fprintf(out, "message fastbasic: %s\nresult 1\n", x.what());
+                fflush(out);
+                return true;
+            }
+        }
+        else if(cmd == "compile")
+        {
+            std::string msg;
+            auto e = run(r, fn, msg);
+            std::istringstream is(msg);
+            while(std::getline(is, line))
+                fprintf(out, "message %s\n", line.c_str());
+            for(auto &o : r.outputs)
+                fprintf(out, "output %s\n", o.c_str());
+            fprintf(out, "result %d\n", e);
+            fflush(out);
+            r = server::request();
+        }
+        else if(cmd == "quit")
+            return true;
+        else if(cmd == "stop")
+            return false;
+        else if(!cmd.empty())
+        {
+            fprintf(out, "message fastbasic: invalid request '%s'\nresult 1\n", cmd.c_str());
+            fflush(out);
+        }
+    }
+    return true;
+}
+
+int server::serve_stdio(const compile_fn &fn)
+{
+    serve(stdin, stdout, fn);
+    return 0;
+}
+
+#ifdef _WIN32
+int server::serve_socket(const std::string &path, const compile_fn &fn)
+{
+    std::cerr << "fastbasic: server sockets not supported in this OS\n";
+    return 1;
+}
+
+int server::client(const std::string &path, const std::vector<std::string> &args)
+{
+    return -1;
+}
+#else
+// Fills the address of the socket, returns false if the path is too long
+static bool socket_addr(const std::string &path, struct sockaddr_un &addr)
+{
+    addr = sockaddr_un();
+    addr.sun_family = AF_UNIX;
+    if(path.empty() || path.size() >= sizeof(addr.sun_path))
+        return false;
+    path.copy(addr.sun_path, path.size());
+    return true;
+}
+
+int server::serve_socket(const std::string &path, const compile_fn &fn)
+{
+    struct sockaddr_un addr;
+    if(!socket_addr(path, addr))
+    {
+        std::cerr << "fastbasic: invalid socket path '" << path << "'\n";
+        return 1;
+    }
+    // Remove the socket of a previous server
+    struct stat st;
+    if(0 == stat(path.c_str(), &st) && S_ISSOCK(st.st_mode))
+        os::remove_file(path);
+
+    int s = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(s < 0 || bind(s, (struct sockaddr *)&addr, sizeof(addr)) || listen(s, 8))
+    {
+        std::cerr << "fastbasic: can't create socket '" << path << "'\n";
+        if(s >= 0)
+            close(s);
+        return 1;
+    }
+    // Clients closing the connection should not stop the server
+    signal(SIGPIPE, SIG_IGN);
+
+    bool running = true;
+    while(running)
+    {
+        int c = accept(s, nullptr, nullptr);
+        if(c < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            break;
+        }
+        FILE *in = fdopen(c, "r"), *out = fdopen(dup(c), "w");
+        if(in && out)
+            running = serve(in, out, fn);
+        if(in)
+            fclose(in);
+        if(out)
+            fclose(out);
+    }
+    close(s);
+    os::remove_file(path);
+    return running ? 1 : 0;
+}
+
+int server::client(const std::string &path, const std::vector<std::string> &args)
+{
+    struct sockaddr_un addr;
+    if(!socket_addr(path, addr))
+        return -1;
+    for(auto &a : args)
+        if(a.find('\n') != a.npos)
+            return -1;
+    int s = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(s < 0)
+        return -1;
+    if(connect(s, (struct sockaddr *)&addr, sizeof(addr)))
+    {
+        close(s);
+        return -1;
+    }
+    FILE *in = fdopen(s, "r"), *out = fdopen(dup(s), "w");
+    if(!in || !out)
+    {
+        if(in)
+            fclose(in);
+        else
+            close(s);
+        if(out)
+            fclose(out);
+        return -1;
+    }
+
+    std::string line;
+    int ret = -1;
+    if(read_line(in, line) && line.compare(0, std::string(protocol_id).size(), protocol_id) == 0)
+    {
+        fprintf(out, "cwd %s\n", os::current_dir().c_str());
+        for(auto &a : args)
+            fprintf(out, "arg %s\n", a.c_str());
+        fprintf(out, "compile\n");
+        fflush(out);
+        while(read_line(in, line))
+        {
+            if(line.compare(0, 8, "message ") == 0)
+                std::cerr << line.substr(8) << "\n";
+            else if(line.compare(0, 7, "result ") == 0)
+            {
+                ret = std::atoi(line.c_str() + 7);
+                break;
+            }
+        }
+        fprintf(out, "quit\n");
+    }
+    fclose(in);
+    fclose(out);
+    return ret;
+}
+#endif
@@ -0,0 +1,55 @@
+/*
+ * FastBasic - Fast basic interpreter for the Atari 8-bit computers
+ * Copyright (C) 2017-2025 Daniel Serpell
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+// server.h: Compiler server, to compile many files without restarting
+#pragma once
+
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace server
+{
+// A compilation request
+class request
+{
+  public:
+    std::vector<std::string> args;            // Command line arguments
+    std::string cwd;                          // Folder for relative file names
+    std::map<std::string, std::string> files; // Text of sources not read from disk
+    bool capture_tools = false;               // Capture the output of CA65 and LD65
+    std::vector<std::string> outputs;         // Files written by the compilation
+};
+
+// Compiles one request, returns the exit code
+using compile_fn = std::function<int(request &r)>;
+
+// Serves requests read from the standard input, writing the responses to the
+// standard output, until the input ends.
+int serve_stdio(const compile_fn &fn);
+
+// Serves requests from the connections to a Unix domain socket created at
+// "path", until a "stop" request is received.
+int serve_socket(const std::string &path, const compile_fn &fn);
+
+// Sends the arguments to the server listening at "path", showing the
+// messages. Returns the result, or -1 if the server is not available.
+int client(const std::string &path, const std::vector<std::string> &args);
+
+} // namespace server
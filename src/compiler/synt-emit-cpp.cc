@@ -0,0 +1,356 @@
+/*
+ * FastBasic - Fast basic interpreter for the Atari 8-bit computers
+ * Copyright (C) 2017-2025 Daniel Serpell
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+// synt-emit-cpp.cc: emit parser as a C++ file
+#include "synt-emit-cpp.h"
+#include "parser-tables.h"
+
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+using namespace syntax;
+using dcode = statemachine::dcode;
+
+namespace
+{
+class cpp_emit
+{
+  private:
+    std::ostream &os;
+    const parser_tables &pt;
+    // Index of each emitted token in the "tok_id" array
+    std::map<std::string, int> tokens;
+
+    static std::string cpp_char(char c)
+    {
+        unsigned char u = c;
+        if(u < 32 || u > 126 || c == '\\' || c == '\'')
+        {
+            std::string ret = "'\\";
+            ret += char('0' + (u >> 6));
+            ret += char('0' + ((u >> 3) & 7));
+            ret += char('0' + (u & 7));
+            return ret + "'";
+        }
+        return std::string("'") + c + "'";
+    }
+    static std::string cpp_string(const std::string &s)
+    {
+        std::string ret = "\"";
+        for(unsigned char u : s)
+        {
+            if(u < 32 || u > 126 || u == '\\' || u == '"' || u == '?')
+            {
+                ret += '\\';
+                ret += char('0' + (u >> 6));
+                ret += char('0' + ((u >> 3) & 7));
+                ret += char('0' + (u & 7));
+            }
+            else
+                ret += char(u);
+        }
+        return ret + "\"";
+    }
+    template <class T, class F>
+    void print_list(const std::string &name, const std::vector<T> &v, F fn)
+    {
+        os << "const std::string " << name << "[] = {\n";
+        for(auto &x : v)
+            os << "    " << cpp_string(fn(x)) << ",\n";
+        os << "    \"\"};\n";
+    }
+
+    // Emits the function to match one literal, mirrors parse_literal()
+    void print_literal(size_t idx)
+    {
+        const auto &lit = pt.literals[idx];
+        bool has_goto = false;
+        os << "\n// " << lit.str << "\n"
+           << "bool lit_" << idx << "(parse &s)\n"
+           << "{\n"
+           << "    s.error(l_error[" << idx << "]);\n";
+        for(char ch : lit.str)
+        {
+            if(ch >= 'a' && ch <= 'z')
+            {
+                os << "    if(!s.expect(" << cpp_char(ch - 'a' + 'A') << "))\n"
+                   << "    {\n"
+                   << "        if(!s.expect('.'))\n"
+                   << "            return false;\n"
+                   << "        goto done;\n"
+                   << "    }\n";
+                has_goto = true;
+            }
+            else
+                os << "    if(!s.expect(" << cpp_char(ch) << "))\n"
+                   << "        return false;\n";
+        }
+        if(has_goto)
+            os << "done:\n";
+        os << "    if(s.do_debug)\n"
+           << "        s.debug(" << cpp_string("GOT '" + lit.str + "'") << ");\n"
+           << "    s.add_text(l_text[" << idx << "]);\n";
+        if(lit.remove_parens)
+            os << "    s.expand.remove_parens++;\n";
+        for(auto c : lit.stext)
+            os << "    s.add_s_lit(" << cpp_char(c) << ");\n";
+        os << "    return true;\n"
+           << "}\n";
+    }
+
+    // Returns the C++ expression to parse one code
+    std::string code_expr(const parser_tables::pcode &c)
+    {
+        switch(c.type)
+        {
+        case statemachine::pcode::c_literal:
+            return "lit_" + std::to_string(c.idx) + "(s)";
+        case statemachine::pcode::c_emit:
+        case statemachine::pcode::c_emit_return:
+        {
+            std::string ret;
+            for(auto &d : pt.emits[c.idx])
+            {
+                if(!ret.empty())
+                    ret += " && ";
+                switch(d.type)
+                {
+                case dcode::d_word_sym:
+                    ret += "s.emit_word(" + cpp_string(d.str) + ")";
+                    break;
+                case dcode::d_word_val:
+                    ret += "s.emit_word(" + std::to_string(d.num) + ")";
+                    break;
+                case dcode::d_byte_sym:
+                    ret += "s.emit_byte(" + cpp_string(d.str) + ")";
+                    break;
+                case dcode::d_byte_val:
+                    ret += "s.emit_byte(" + std::to_string(d.num) + ")";
+                    break;
+                case dcode::d_token:
+                    ret += "s.emit_tok(tok_id[" + std::to_string(tokens[d.str]) + "])";
+                    break;
+                }
+            }
+            return ret.empty() ? "true" : ret;
+        }
+        case statemachine::pcode::c_call_ext:
+            if(c.pure)
+                return "SMB_" + pt.actions[c.idx] + "(s)";
+            else
+                return "(s.state_gen++, SMB_" + pt.actions[c.idx] + "(s))";
+        case statemachine::pcode::c_call_table:
+            if(c.idx < 0)
+                return "missing_table(" + cpp_string(pt.table_name(c.idx)) + ")";
+            return "tab_" + std::to_string(c.idx) + "(s)";
+        case statemachine::pcode::c_return:
+            break;
+        }
+        return "true";
+    }
+
+    // Emits the function to parse one table, mirrors parse_table_lines()
+    void print_table(size_t idx)
+    {
+        const auto &tab = pt.tables[idx];
+        auto n = std::to_string(idx);
+        os << "\n// " << tab.name << "\n"
+           << "bool tab_lines_" << n << "(parse &s)\n"
+           << "{\n"
+           << "    if(s.do_debug)\n"
+           << "        s.debug(t_name[" << n << "] + "
+           << cpp_string(" (" + std::to_string(tab.lnum) + ")") << ");\n"
+           << "    s.check_level();\n"
+           << "    s.skipws();\n"
+           << "    s.error(t_error[" << n << "]);\n";
+        if(tab.first == tab.last)
+        {
+            os << "    s.lvl--;\n"
+               << "    return false;\n"
+               << "}\n";
+            return;
+        }
+        os << "    auto spos = s.save();\n"
+           << "    int ch = (s.eos() || s.do_debug) ? -1 : (unsigned char)s.str[s.pos];\n"
+           << "    (void)ch;\n";
+        for(auto l = tab.first; l < tab.last; l++)
+        {
+            const auto &line = pt.lines[l];
+            auto lnum = std::to_string(line.lnum);
+            os << "\n    // Line " << lnum << "\n";
+            std::string indent = "    ";
+            if(line.skip)
+            {
+                os << "    if(ch >= 0 && !(first_" << l << "[ch >> 3] & (1 << (ch & 7))) &&\n"
+                   << "       s.check_depth(" << line.depth << "))\n"
+                   << "    {\n";
+                for(auto i = line.err_first; i < line.err_last; i++)
+                    os << "        s.add_error(s.pos, s.lvl + " << pt.first_errors[i].lvl
+                       << ", f_error[" << i << "]);\n";
+                os << "        if(s.lvl + " << line.depth << " > s.lvl_high)\n"
+                   << "            s.lvl_high = s.lvl + " << line.depth << ";\n"
+                   << "    }\n"
+                   << "    else\n"
+                   << "    {\n";
+                indent = "        ";
+            }
+            // Join all codes up to the first return
+            std::string cond;
+            for(auto i = line.first; i < line.last; i++)
+            {
+                const auto &c = pt.code[i];
+                if(c.type == statemachine::pcode::c_return)
+                    break;
+                if(!cond.empty())
+                    cond += " &&\n" + indent + "   ";
+                cond += code_expr(c);
+                if(c.type == statemachine::pcode::c_emit_return)
+                    break;
+            }
+            if(cond.empty())
+                cond = "true";
+            os << indent << "if(" << cond << ")\n"
+               << indent << "{\n"
+               << indent << "    if(s.do_debug)\n"
+               << indent << "        s.debug(" << cpp_string("<-- OK (" + lnum + ")") << ");\n"
+               << indent << "    s.lvl--;\n"
+               << indent << "    return true;\n"
+               << indent << "}\n"
+               << indent << "if(s.do_debug)\n"
+               << indent << "    s.debug(" << cpp_string("-! " + lnum) << ");\n"
+               << indent << "s.restore(spos);\n";
+            if(line.skip)
+                os << "    }\n";
+        }
+        os << "\n"
+           << "    s.lvl--;\n"
+           << "    return false;\n"
+           << "}\n";
+    }
+
+  public:
+    cpp_emit(std::ostream &os, const parser_tables &pt) : os(os), pt(pt) {}
+    void print(std::string name, uint64_t hash)
+    {
+        os << "// Parser for the '" << name << "' syntax, generated by syntp.\n"
+           << "// DO NOT EDIT.\n"
+           << "#include \"parser-compiled.h\"\n"
+           << "#include \"parser.h\"\n"
+           << "#include <stdexcept>\n"
+           << "\n"
+           << "// External parsing actions\n";
+        for(auto &a : pt.actions)
+            os << "bool SMB_" << a << "(parse &s);\n";
+
+        os << "\nnamespace\n"
+           << "{\n"
+           << "const size_t num_tables = " << pt.tables.size() << ";\n";
+        print_list("t_name", pt.tables, [](const parser_tables::table &t) { return t.name; });
+        print_list("t_error", pt.tables,
+                   [](const parser_tables::table &t) { return t.error; });
+        print_list("l_error", pt.literals,
+                   [](const parser_tables::literal &l) { return l.error; });
+        print_list("l_text", pt.literals,
+                   [](const parser_tables::literal &l) { return l.ucase; });
+        print_list("f_error", pt.first_errors,
+                   [](const parser_tables::first_error &e) { return e.msg; });
+
+        // Interned IDs of all the emitted tokens
+        os << "const int tok_id[] = {\n";
+        for(auto &e : pt.emits)
+            for(auto &d : e)
+                if(d.type == dcode::d_token && !tokens.count(d.str))
+                {
+                    os << "    codew::intern(" << cpp_string(d.str) << "),\n";
+                    tokens.emplace(d.str, tokens.size());
+                }
+        os << "    0};\n";
+
+        // Bitmaps of the first characters of each line
+        for(size_t l = 0; l < pt.lines.size(); l++)
+        {
+            if(!pt.lines[l].skip)
+                continue;
+            os << "const unsigned char first_" << l << "[32] = {";
+            for(int i = 0; i < 32; i++)
+            {
+                int b = 0;
+                for(int j = 0; j < 8; j++)
+                    if(pt.lines[l].chars[i * 8 + j])
+                        b |= 1 << j;
+                os << (i ? ", " : "") << b;
+            }
+            os << "};\n";
+        }
+
+        os << "\n"
+           << "inline bool missing_table(const std::string &name)\n"
+           << "{\n"
+           << "    throw std::runtime_error(\"missing syntax table for '\" + name + \"'\");\n"
+           << "}\n";
+
+        // Literals
+        for(size_t i = 0; i < pt.literals.size(); i++)
+            print_literal(i);
+
+        // Table declarations, with the packrat cache
+        os << "\n";
+        for(size_t i = 0; i < pt.tables.size(); i++)
+            os << "bool tab_lines_" << i << "(parse &s);\n";
+        for(size_t i = 0; i < pt.tables.size(); i++)
+        {
+            auto n = std::to_string(i);
+            os << "\nbool tab_" << n << "(parse &s)\n"
+               << "{\n"
+               << "    if(s.packrat)\n"
+               << "        return syntax::parse_cached(s, " << n << ", num_tables, t_name[" << n
+               << "],\n"
+               << "                                    [&]() { return tab_lines_" << n
+               << "(s); });\n"
+               << "    return tab_lines_" << n << "(s);\n"
+               << "}\n";
+        }
+
+        // Table definitions
+        for(size_t i = 0; i < pt.tables.size(); i++)
+            print_table(i);
+
+        os << "\n"
+           << "bool parse_start(parse &s)\n"
+           << "{\n";
+        if(pt.start < 0)
+            os << "    return missing_table(" << cpp_string(pt.table_name(pt.start)) << ");\n";
+        else
+            os << "    return tab_" << pt.start << "(s);\n";
+        os << "}\n"
+           << "} // namespace\n"
+           << "\n"
+           << "static syntax::compiled_parser parser(" << cpp_string(name) << ", 0x"
+           << std::hex << hash << std::dec << "ull, parse_start);\n";
+    }
+};
+} // namespace
+
+bool syntax::syntax_emit_cpp(std::ostream &out, const parser_tables &pt, std::string name,
+                             uint64_t hash)
+{
+    cpp_emit(out, pt).print(name, hash);
+    return true;
+}
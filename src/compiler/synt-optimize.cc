@@ -83,6 +83,116 @@ static bool syntax_merge(sm_list &sl, bool verbose)
     return true;
 }
 
+// Set of possible first characters of a parsing code sequence
+namespace
+{
+class first_set
+{
+  public:
+    std::bitset<256> chars;
+    bool nullable = false; // Can match an empty string
+    bool unknown = false;  // Calls external code
+    bool operator!=(const first_set &b) const
+    {
+        return chars != b.chars || nullable != b.nullable || unknown != b.unknown;
+    }
+};
+} // namespace
+
+static first_set line_first(const statemachine::line &l,
+                            const std::map<std::string, first_set> &tabs)
+{
+    first_set f;
+    for(const auto &c : l.pc)
+    {
+        switch(c.type)
+        {
+        case statemachine::pcode::c_emit:
+            continue;
+        case statemachine::pcode::c_emit_return:
+        case statemachine::pcode::c_return:
+            f.nullable = true;
+            return f;
+        case statemachine::pcode::c_call_ext:
+            f.unknown = true;
+            return f;
+        case statemachine::pcode::c_literal:
+        {
+            if(c.str.empty())
+                continue;
+            unsigned char ch = c.str[0];
+            f.chars.set(ch);
+            // Literals match upper and lower case, lower case letters in the
+            // literal also match an abbreviation
+            if(ch >= 'a' && ch <= 'z')
+            {
+                f.chars.set(ch - 'a' + 'A');
+                f.chars.set('.');
+            }
+            else if(ch >= 'A' && ch <= 'Z')
+                f.chars.set(ch - 'A' + 'a');
+            return f;
+        }
+        case statemachine::pcode::c_call_table:
+        {
+            auto t = tabs.find(c.str);
+            if(t == tabs.end() || t->second.unknown)
+            {
+                f.unknown = true;
+                return f;
+            }
+            f.chars |= t->second.chars;
+            if(!t->second.nullable)
+                return f;
+            continue;
+        }
+        }
+    }
+    f.nullable = true;
+    return f;
+}
+
+static void syntax_first(sm_list &sl)
+{
+    // Calculate the FIRST set of each table, iterating until no changes
+    std::map<std::string, first_set> tabs;
+    for(const auto &sm : sl.sms)
+        tabs[sm.first] = first_set();
+    bool changed = true;
+    while(changed)
+    {
+        changed = false;
+        for(const auto &sm : sl.sms)
+        {
+            first_set f;
+            for(const auto &l : sm.second->get_code())
+            {
+                auto lf = line_first(l, tabs);
+                f.chars |= lf.chars;
+                f.nullable |= lf.nullable;
+                f.unknown |= lf.unknown;
+            }
+            if(f != tabs[sm.first])
+            {
+                tabs[sm.first] = f;
+                changed = true;
+            }
+        }
+    }
+    // Store in each line, all characters if can't be determined
+    for(auto &sm : sl.sms)
+    {
+        auto &code = sm.second->get_code();
+        for(size_t i = 0; i < code.size(); i++)
+        {
+            auto lf = line_first(code[i], tabs);
+            if(lf.nullable || lf.unknown)
+                lf.chars.set();
+            sm.second->set_first(i, lf.chars);
+        }
+    }
+}
+
 bool syntax::syntax_optimize(sm_list &sl, bool verbose, bool merge)
 {
     // Optimize parsing tables:
@@ -121,5 +231,8 @@ bool syntax::syntax_optimize(sm_list &sl, bool verbose, bool merge)
     for(auto &sm : sl.sms)
         sm.second->optimize();
 
+    // Calculate the possible first character of each table line
+    syntax_first(sl);
+
     return true;
 }
@@ -18,6 +18,7 @@
 
 // synt-sm.h: Parse and write the syntax state machine
 #pragma once
+#include <bitset>
 #include <iostream>
 #include <string>
 #include <vector>
@@ -91,6 +92,9 @@ class statemachine
       public:
         std::vector<pcode> pc;
         int lnum;
+        // Characters that can start this line, all if unknown
+        std::bitset<256> first;
+        line() { first.set(); }
     };
 
   private:
@@ -127,6 +131,7 @@ class statemachine
     bool end_call(std::string tab) const;
     bool just_call(std::string tab) const;
     const std::vector<line> &get_code() const { return code; };
+    void set_first(size_t l, const std::bitset<256> &f) { code[l].first = f; }
     int line_num() const { return lnum; }
     bool is_complete() const { return complete; }
     /* Parse a new table */
@@ -17,7 +17,10 @@
  */
 
 // syntax-processor: translates the syntax file to C++ or ASM files
+#include "parser-compiled.h"
+#include "parser-tables.h"
 #include "synt-emit-asm.h"
+#include "synt-emit-cpp.h"
 #include "synt-optimize.h"
 #include "synt-parser.h"
 #include "synt-preproc.h"
@@ -38,6 +41,7 @@ static void usage()
                  "Options:\n"
                  "  -h       Show this help.\n"
                  "  -H       specify output header file extension.\n"
+                 "  -c name  emit C++ parser for the compiler, with the given name.\n"
                  "  -D name  Define symbol 'name' to use in syntax.\n"
                  "  -o file  specify output file name 'file'.\n";
     std::exit(0);
@@ -96,6 +100,7 @@ int main(int argc, const char **argv)
 {
     std::string header_ext = ".inc";
     std::string output_name;
+    std::string cpp_name;
     std::vector<std::string> input_names;
 
     prog_name = argv[0];
@@ -137,6 +142,15 @@ int main(int argc, const char **argv)
                 else
                     error("option '-H' needs argument");
             }
+            else if(x[1] == 'c')
+            {
+                if(x.size() > 2)
+                    cpp_name = x.substr(2);
+                else if(i + 1 < argc)
+                    cpp_name = argv[++i];
+                else
+                    error("option '-c' needs argument");
+            }
             else if(x[1] == 'h')
                 usage();
             else
@@ -154,11 +168,13 @@ int main(int argc, const char **argv)
     sm_list sl;
     parse_state p;
     syntax_parser pf(p, sl);
+    syntax_hash hash;
     for(auto &name : input_names)
     {
         std::ifstream ifile;
         auto &inp = open_input(name, ifile);
         auto data = pre.read_input(inp);
+        hash.add(data);
 
         p.reset(data.c_str(), name);
         if(!pf.parse_file())
@@ -167,6 +183,17 @@ int main(int argc, const char **argv)
     // Show parsing summary
     pf.show_summary();
 
+    // The C++ parser uses the same tables as the compiler, without merging
+    if(!cpp_name.empty())
+    {
+        syntax_optimize(sl, false, false);
+        parser_tables pt;
+        pt.link(sl);
+        std::ofstream ofile;
+        auto &ostrm = open_output(output_name, ofile);
+        return syntax_emit_cpp(ostrm, pt, cpp_name, hash.get()) ? 0 : 1;
+    }
+
     // Optimize
     syntax_optimize(sl, true, true);
 
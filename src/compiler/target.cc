@@ -18,14 +18,19 @@
 
 // target.cc: read target definitions
 #include "target.h"
+#include "codew.h"
 #include "os.h"
+#include "parser-compiled.h"
 #include "synt-optimize.h"
 #include "synt-parser.h"
 #include "synt-preproc.h"
 #include "synt-pstate.h"
 #include "synt-sm-list.h"
 #include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <random>
+#include <sstream>
 #include <vector>
 
 class target_file
@@ -33,10 +38,16 @@ class target_file
   public:
     std::vector<std::string> target_path;
     std::vector<std::string> slist;
+    std::vector<std::string> plist;
+    std::vector<std::string> clist;
     std::vector<std::string> ca65_args;
     std::string lib_name;
     std::string cfg_name;
     std::string bin_ext;
+    std::string opt_level = "speed";
+    unsigned zp_vars = 0;
+    syntax::syntax_hash hash; // Hash of all the lines read
+    std::vector<std::string> files; // Paths of all the files read
     target_file(std::vector<std::string> target_path) : target_path(target_path) {}
     void read_file(std::string fname);
 };
@@ -67,11 +78,13 @@ void target_file::read_file(std::string fname)
     f.open(fname);
     if(!f.is_open())
         throw std::runtime_error("Can't open target definition file '" + fname + "'");
+    files.push_back(fname);
 
     // Read:
     std::string line;
     while(std::getline(f, line).good())
     {
+        hash.add(line);
         // Parse line:
         auto s = line.find_first_not_of(" \t\r\n");
         // Skip blank lines and comments
@@ -98,6 +111,23 @@ void target_file::read_file(std::string fname)
             {
                 bin_ext = args;
             }
+            else if(key == "optimize")
+            {
+                opt_level = args;
+            }
+            else if(key == "zpvars")
+            {
+                size_t pos = 0;
+                int n = -1;
+                try {
+                    n = std::stoi(args, &pos, 0);
+                }
+                catch(...) { }
+                if(pos != args.size() || n < 0 || n > 256)
+                    throw std::runtime_error("Bad zero page size '" + args +
+                                             "' in target file '" + fname + "'");
+                zp_vars = n;
+            }
             else if(key == "ca65")
             {
                 size_t i = 0;
@@ -118,6 +148,26 @@ void target_file::read_file(std::string fname)
                     i = args.find_first_not_of(" \t\r\n", e);
                 }
             }
+            else if(key == "peephole")
+            {
+                size_t i = 0;
+                while(i < args.size())
+                {
+                    auto e = args.find_first_of(" \t\r\n", i);
+                    plist.push_back(sub(args, i, e));
+                    i = args.find_first_not_of(" \t\r\n", e);
+                }
+            }
+            else if(key == "costs")
+            {
+                size_t i = 0;
+                while(i < args.size())
+                {
+                    auto e = args.find_first_of(" \t\r\n", i);
+                    clist.push_back(sub(args, i, e));
+                    i = args.find_first_not_of(" \t\r\n", e);
+                }
+            }
             else
                 throw std::runtime_error("Bad key '" + key + "' in target file '" +
                                          fname + "'");
@@ -125,7 +175,17 @@ void target_file::read_file(std::string fname)
     }
 }
 
-target::target() {}
+// Stores the ID of the emitted tokens in the parsing tables, so the parser
+// does not search the token names.
+static void intern_tokens(syntax::parser_tables &pt)
+{
+    for(auto &e : pt.emits)
+        for(auto &d : e)
+            if(d.type == syntax::statemachine::dcode::d_token)
+                d.num = codew::intern(d.str);
+}
+
+target::target() : opt_level_(opt_goal::o_speed), zp_vars_(0), hash_(0) {}
 
 void target::load(std::vector<std::string> target_path,
                   std::vector<std::string> syntax_path, std::string fname)
@@ -137,21 +197,104 @@ void target::load(std::vector<std::string> target_path,
     cfg_name = f.cfg_name;
     bin_extension = f.bin_ext;
     ca65_args_ = f.ca65_args;
-    // Process all syntax files:
+    opt_level_ = opt_goal::from_name(f.opt_level);
+    zp_vars_ = f.zp_vars;
+    files_ = f.files;
+    // The hash of the target includes the contents of all the files
+    syntax::syntax_hash thash = f.hash;
+    // Read the peephole optimizer rules
+    for(auto &name : f.plist)
+    {
+        std::ifstream ifile;
+        auto path = os::search_path(syntax_path, name);
+        ifile.open(path);
+        if(!ifile.is_open())
+            throw std::runtime_error("can't open peephole rules file: '" + name + "'");
+        files_.push_back(path);
+        std::stringstream data;
+        data << ifile.rdbuf();
+        thash.add(data.str());
+        peephole_.parse(data, name);
+    }
+    // Read the token cost tables
+    for(auto &name : f.clist)
+    {
+        std::ifstream ifile;
+        auto path = os::search_path(syntax_path, name);
+        ifile.open(path);
+        if(!ifile.is_open())
+            throw std::runtime_error("can't open token costs file: '" + name + "'");
+        files_.push_back(path);
+        std::stringstream data;
+        data << ifile.rdbuf();
+        thash.add(data.str());
+        costs_.parse(data, name);
+    }
+    // Read all syntax files:
     syntax::preproc pre;
-    syntax::parse_state p;
-    syntax::syntax_parser pf(p, s);
+    syntax::syntax_hash hash;
+    std::vector<std::string> sdata;
     for(auto &name : f.slist)
     {
         std::ifstream ifile;
-        ifile.open(os::search_path(syntax_path, name));
+        auto path = os::search_path(syntax_path, name);
+        ifile.open(path);
         if(!ifile.is_open())
             throw std::runtime_error("can't open syntax file: '" + name + "'");
-        auto data = pre.read_input(ifile);
-        p.reset(data.c_str(), name);
+        files_.push_back(path);
+        sdata.push_back(pre.read_input(ifile));
+        hash.add(sdata.back());
+        thash.add(sdata.back());
+    }
+    hash_ = thash.get();
+    // Use the compiled parser if the syntax files are the same
+    tables_.compiled = syntax::compiled_parser::find(hash.get());
+    if(tables_.compiled)
+        return;
+    // Try loading the tables from the cache, the key includes the compiler
+    // version as the tables depend on the compiler code.
+    hash.add(VERSION);
+    std::string cache_name;
+    auto cache_path = os::cache_dir();
+    if(!cache_path.empty())
+    {
+        std::ostringstream cname;
+        cname << "syntax-" << std::hex << std::setw(16) << std::setfill('0') << hash.get()
+           << ".bin";
+        cache_name = os::full_path(cache_path, cname.str());
+        std::ifstream cfile(cache_name, std::ios::binary);
+        if(cfile.is_open() && tables_.load(cfile, hash.get(), get_parsing_action))
+        {
+            intern_tokens(tables_);
+            return;
+        }
+    }
+    // Parse all syntax files:
+    syntax::sm_list s;
+    syntax::parse_state p;
+    syntax::syntax_parser pf(p, s);
+    for(size_t i = 0; i < f.slist.size(); i++)
+    {
+        p.reset(sdata[i].c_str(), f.slist[i]);
         if(!pf.parse_file())
-            throw std::runtime_error("error parsing syntax file: '" + name + "'");
+            throw std::runtime_error("error parsing syntax file: '" + f.slist[i] + "'");
     }
     // Optimize
     syntax_optimize(s, false, false);
+    tables_.link(s, get_parsing_action);
+    // Store into the cache, writing to a temporary file first so concurrent
+    // compilations never read a partial file.
+    if(!cache_name.empty())
+    {
+        auto tmp_name = cache_name + "." + std::to_string(std::random_device()());
+        std::ofstream cfile(tmp_name, std::ios::binary);
+        if(cfile.is_open())
+        {
+            tables_.save(cfile, hash.get());
+            cfile.close();
+            if(!cfile || !os::rename_file(tmp_name, cache_name))
+                os::remove_file(tmp_name);
+        }
+    }
+    intern_tokens(tables_);
 }
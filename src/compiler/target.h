@@ -18,32 +18,45 @@
 
 // target.h: read target definitions
 #pragma once
-#include "synt-sm-list.h"
+#include "costmodel.h"
+#include "parser-tables.h"
+#include "peephole-rules.h"
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <vector>
 
-namespace syntax
-{
-class sm_list;
-}
-
 class target
 {
   private:
-    syntax::sm_list s;
+    syntax::parser_tables tables_;
+    peephole_rules peephole_;
+    token_costs costs_;
     std::string lib_name;
     std::string cfg_name;
     std::string bin_extension;
+    opt_goal::level opt_level_;
+    unsigned zp_vars_;
     std::vector<std::string> ca65_args_;
+    uint64_t hash_;
+    std::vector<std::string> files_;
 
   public:
     target();
     void load(std::vector<std::string> target_folder,
               std::vector<std::string> syntax_folder, std::string fname);
-    const syntax::sm_list &sl() const { return s; }
+    const syntax::parser_tables &tables() const { return tables_; }
+    const peephole_rules &peephole() const { return peephole_; }
+    const token_costs &costs() const { return costs_; }
     std::string lib() const { return lib_name; }
     std::string cfg() const { return cfg_name; }
     std::string bin_ext() const { return bin_extension; }
+    opt_goal::level opt_level() const { return opt_level_; }
+    // Size in bytes of the zero page area for the program variables
+    unsigned zp_vars() const { return zp_vars_; }
     const std::vector<std::string> &ca65_args() const { return ca65_args_; }
+    // Hash of the contents of the target, syntax, peephole and costs files
+    uint64_t hash() const { return hash_; }
+    // Paths of all the files read to load the target
+    const std::vector<std::string> &files() const { return files_; }
 };
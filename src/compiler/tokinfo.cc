@@ -0,0 +1,180 @@
+/*
+ * FastBasic - Fast basic interpreter for the Atari 8-bit computers
+ * Copyright (C) 2017-2025 Daniel Serpell
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+// tokinfo.cc: Properties of the bytecode tokens used by the optimizer
+
+#include "tokinfo.h"
+#include "codew.h"
+#include <unordered_map>
+
+namespace
+{
+// Builds the table of known tokens
+class tokinfo_table
+{
+  public:
+    std::unordered_map<int, tokinfo> map;
+
+    tokinfo &add(const char *name)
+    {
+        auto &t = map[codew::intern(name)];
+        t.mem_read = false;
+        t.mem_write = false;
+        t.clobber = false;
+        return t;
+    }
+    void add_list(std::initializer_list<const char *> names)
+    {
+        for(auto n : names)
+            add(n);
+    }
+    void add_flow(const char *name, tokinfo::flow_type flow) { add(name).flow = flow; }
+    void add_var(const char *name, tokinfo::var_access var) { add(name).var = var; }
+    void add_expr(std::initializer_list<const char *> names, tokinfo::expr_type expr)
+    {
+        for(auto n : names)
+            map[codew::intern(n)].expr = expr;
+    }
+    void add_mem(const char *name, bool write)
+    {
+        auto &t = add(name);
+        t.mem_read = true;
+        t.mem_write = write;
+    }
+
+    tokinfo_table()
+    {
+        // Tokens that don't access variables or memory pointers. Note that
+        // some of those write to fixed locations (the zero page, the OS
+        // or the string buffer), never to the variables.
+        add_list({"TOK_NUM", "TOK_BYTE", "TOK_CSTRING", "TOK_SHL8", "TOK_0", "TOK_1",
+                  "TOK_PUSH", "TOK_PUSH_NUM", "TOK_PUSH_BYTE", "TOK_PUSH_0",
+                  "TOK_PUSH_1", "TOK_POP", "TOK_NEG", "TOK_ABS", "TOK_SGN", "TOK_ADD",
+                  "TOK_SUB", "TOK_MUL", "TOK_DIV", "TOK_MOD", "TOK_BIT_AND",
+                  "TOK_BIT_OR", "TOK_BIT_EXOR", "TOK_BYTE_PEEK", "TOK_TIME", "TOK_RAND",
+                  "TOK_L_NOT", "TOK_L_OR", "TOK_L_AND", "TOK_LT", "TOK_GT", "TOK_NEQ",
+                  "TOK_EQ", "TOK_COMP_0", "TOK_SADDR", "TOK_POSITION",
+                  "TOK_PRINT_TAB", "TOK_PRINT_RTAB", "TOK_GETKEY", "TOK_INPUT_STR",
+                  "TOK_PUT", "TOK_BYTE_PUT", "TOK_FOR_EXIT", "TOK_USHL", "TOK_INT_STR",
+                  "TOK_CHR", "TOK_PAUSE", "TOK_USR_ADDR", "TOK_USR_PARAM",
+                  // Input/Output
+                  "TOK_CLOSE", "TOK_GET", "TOK_IOCHN",
+                  // Graphics
+                  "TOK_GRAPHICS", "TOK_DRAWTO", "TOK_PLOT", "TOK_LOCATE",
+                  "TOK_PMGRAPHICS",
+                  // Floating point
+                  "TOK_INT_FP", "TOK_FP_SGN", "TOK_FP_ABS", "TOK_FP_NEG", "TOK_FLOAT",
+                  "TOK_FP_DIV", "TOK_FP_MUL", "TOK_FP_SUB", "TOK_FP_ADD", "TOK_FP_EXP",
+                  "TOK_FP_EXP10", "TOK_FP_LOG", "TOK_FP_LOG10", "TOK_FP_INT",
+                  "TOK_FP_CMP", "TOK_FP_IPOW", "TOK_FP_RND", "TOK_FP_SQRT", "TOK_FP_SIN",
+                  "TOK_FP_COS", "TOK_FP_ATN", "TOK_FP_STR", "TOK_FP_TIME", "TOK_MUL6"});
+        // Control flow
+        add_flow("TOK_END", tokinfo::f_end);
+        add_flow("TOK_JUMP", tokinfo::f_jump);
+        add_flow("TOK_CJUMP", tokinfo::f_cjump);
+        add_flow("TOK_CNJUMP", tokinfo::f_cjump);
+        add_flow("TOK_CALL", tokinfo::f_call);
+        add_flow("TOK_RET", tokinfo::f_ret);
+        add_flow("TOK_CRET", tokinfo::f_cret);
+        add_flow("TOK_CNRET", tokinfo::f_cret);
+        // Variable access
+        add_var("TOK_VAR_LOAD", tokinfo::v_read);
+        add_var("TOK_PUSH_VAR_LOAD", tokinfo::v_read);
+        add_var("TOK_ADD_VAR", tokinfo::v_read);
+        add_var("TOK_VAR_STORE", tokinfo::v_write);
+        add_var("TOK_VAR_STORE_0", tokinfo::v_write);
+        add_var("TOK_INCVAR", tokinfo::v_modify);
+        add_var("TOK_DECVAR", tokinfo::v_modify);
+        add_var("TOK_VAR_ADDR", tokinfo::v_addr);
+        add_var("TOK_VAR_SADDR", tokinfo::v_addr);
+        // DIM allocates and clears the array memory
+        add_var("TOK_DIM", tokinfo::v_write);
+        map[codew::intern("TOK_DIM")].mem_write = true;
+        // Memory reads
+        add_mem("TOK_PEEK", false);
+        add_mem("TOK_DPEEK", false);
+        add_mem("TOK_PRINT_STR", false);
+        add_mem("TOK_VAL", false);
+        add_mem("TOK_CMP_STR", false);
+        add_mem("TOK_STR_IDX", false);
+        add_mem("TOK_FP_LOAD", false);
+        add_mem("TOK_FP_VAL", false);
+        add_mem("TOK_XIO", false);
+        add_mem("TOK_BPUT", false);
+        // Memory writes, the FOR tokens update the loop variable by the
+        // address stored in the stack.
+        add_mem("TOK_POKE", true);
+        add_mem("TOK_DPOKE", true);
+        add_mem("TOK_NUM_POKE", true);
+        add_mem("TOK_BYTE_POKE", true);
+        add_mem("TOK_INC", true);
+        add_mem("TOK_DEC", true);
+        add_mem("TOK_MSET", true);
+        add_mem("TOK_MOVE", true);
+        add_mem("TOK_NMOVE", true);
+        add_mem("TOK_COPY_STR", true);
+        add_mem("TOK_CAT_STR", true);
+        add_mem("TOK_FOR", true);
+        add_mem("TOK_FOR_NEXT", true);
+        add_mem("TOK_FP_STORE", true);
+        add_mem("TOK_BGET", true);
+        // TOK_USR_CALL calls machine code and can do anything, so it is
+        // not in the table.
+
+        // Pure expressions. Tokens reading memory, the clock, the random
+        // number generator or the I/O are not included.
+        add_expr({"TOK_NUM", "TOK_BYTE", "TOK_0", "TOK_1", "TOK_VAR_LOAD", "TOK_VAR_ADDR"},
+                 tokinfo::e_load);
+        add_expr({"TOK_PUSH_NUM", "TOK_PUSH_BYTE", "TOK_PUSH_0", "TOK_PUSH_1",
+                  "TOK_PUSH_VAR_LOAD"},
+                 tokinfo::e_push_load);
+        add_expr({"TOK_PUSH"}, tokinfo::e_push);
+        add_expr({"TOK_NEG", "TOK_ABS", "TOK_SGN", "TOK_USHL", "TOK_SHL8", "TOK_L_NOT",
+                  "TOK_COMP_0", "TOK_ADD_VAR"},
+                 tokinfo::e_unary);
+        add_expr({"TOK_ADD", "TOK_SUB", "TOK_MUL", "TOK_DIV", "TOK_MOD", "TOK_BIT_AND",
+                  "TOK_BIT_OR", "TOK_BIT_EXOR", "TOK_L_AND", "TOK_L_OR", "TOK_LT",
+                  "TOK_GT", "TOK_NEQ", "TOK_EQ"},
+                 tokinfo::e_binary);
+    }
+};
+} // namespace
+
+const tokinfo &tokinfo::get(int tok)
+{
+    static const tokinfo_table table;
+    static const tokinfo unknown;
+    auto it = table.map.find(tok);
+    if(it == table.map.end())
+        return unknown;
+    return it->second;
+}
+
+int tokinfo::load_token(int tok)
+{
+    static const std::unordered_map<int, int> map = {
+        {codew::intern("TOK_PUSH_NUM"), codew::intern("TOK_NUM")},
+        {codew::intern("TOK_PUSH_BYTE"), codew::intern("TOK_BYTE")},
+        {codew::intern("TOK_PUSH_0"), codew::intern("TOK_0")},
+        {codew::intern("TOK_PUSH_1"), codew::intern("TOK_1")},
+        {codew::intern("TOK_PUSH_VAR_LOAD"), codew::intern("TOK_VAR_LOAD")}};
+    auto it = map.find(tok);
+    if(it == map.end())
+        return tok;
+    return it->second;
+}
@@ -0,0 +1,71 @@
+/*
+ * FastBasic - Fast basic interpreter for the Atari 8-bit computers
+ * Copyright (C) 2017-2025 Daniel Serpell
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+// tokinfo.h: Properties of the bytecode tokens used by the optimizer
+
+#pragma once
+
+#include <cstdint>
+
+class tokinfo
+{
+  public:
+    // Effect of the token on the control flow
+    enum flow_type : uint8_t
+    {
+        f_none,  // Continues to the next token
+        f_jump,  // Jumps to the label in the argument
+        f_cjump, // Jumps to the label or continues to the next token
+        f_call,  // Calls the procedure in the argument
+        f_ret,   // Returns from a procedure
+        f_cret,  // Returns from a procedure or continues to the next token
+        f_end    // Ends the program
+    };
+    // Access to the variable in the arguments
+    enum var_access : uint8_t
+    {
+        v_read,   // Reads the value
+        v_write,  // Writes the value
+        v_modify, // Reads and writes the value
+        v_addr    // Uses the address, so the variable can be accessed by pointers
+    };
+    // Use of the token in pure expressions, the result only depends on AX,
+    // the stack, the arguments and the variables read.
+    enum expr_type : uint8_t
+    {
+        e_none,      // Not a pure expression token
+        e_load,      // Loads AX from the arguments
+        e_push_load, // Pushes AX and loads AX from the arguments
+        e_push,      // Pushes AX
+        e_unary,     // Operates on AX
+        e_binary     // Operates on the value popped from the stack and AX
+    };
+    flow_type flow = f_none;
+    var_access var = v_addr;
+    bool mem_read = true;  // Reads memory pointed by the stack or SADDR
+    bool mem_write = true; // Writes memory pointed by the stack or SADDR
+    bool clobber = true;   // Unknown effects, could read or write any variable
+    expr_type expr = e_none;
+
+    // Returns the information of the given token ID, unknown tokens
+    // are assumed to have any effect.
+    static const tokinfo &get(int tok);
+    // Returns the token that loads the same value as a "push and load"
+    // token, or the same token for other ones.
+    static int load_token(int tok);
+};
@@ -104,6 +104,22 @@ bool var_type_is_array(enum VarType t)
     return false;
 }
 
+int add_temp_var(std::map<std::string, int> &vars)
+{
+    // Variable numbers are limited to one byte
+    int num = vars.size();
+    if(num > 255)
+        return -1;
+    // Use a lower-case name, as those are not valid variable names in the
+    // source, so there are no conflicts.
+    vars[temp_var_name(num)] = VT_WORD + 256 * num;
+    return num;
+}
+
+std::string temp_var_name(int num) { return "tmp" + std::to_string(num); }
+
+bool is_temp_var(const std::string &name) { return name.compare(0, 3, "tmp") == 0; }
+
 labelType::labelType() : type(0) {}
 
 labelType::labelType(std::string str)
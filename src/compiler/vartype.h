@@ -19,6 +19,7 @@
 // vartype.h: Defines types of variables
 
 #pragma once
+#include <map>
 #include <string>
 
 // Variable types
@@ -42,6 +43,13 @@ std::string get_vt_name(enum VarType t);
 int get_vt_size(enum VarType t);
 // Returns true if VarType is an array type
 bool var_type_is_array(enum VarType t);
+// Adds a new word variable for use by the optimizer to the variable list,
+// returns the variable number or -1 if there are too many variables.
+int add_temp_var(std::map<std::string, int> &vars);
+// Returns the name of the variable added by add_temp_var
+std::string temp_var_name(int num);
+// Returns true if the name is of a variable added by add_temp_var
+bool is_temp_var(const std::string &name);
 
 // Label types
 class labelType
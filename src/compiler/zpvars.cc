@@ -0,0 +1,172 @@
+/*
+ * FastBasic - Fast basic interpreter for the Atari 8-bit computers
+ * Copyright (C) 2017-2025 Daniel Serpell
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+// zpvars.cc: Placement of the most used variables in the zero page
+
+#include "zpvars.h"
+#include "costmodel.h"
+#include "vartype.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <set>
+#include <unordered_map>
+
+// Token IDs used by the optimizer
+static const int TOK_0 = codew::intern("TOK_0");
+static const int TOK_ADD_VAR = codew::intern("TOK_ADD_VAR");
+static const int TOK_BYTE = codew::intern("TOK_BYTE");
+static const int TOK_BYTE_POKE = codew::intern("TOK_BYTE_POKE");
+static const int TOK_DEC = codew::intern("TOK_DEC");
+static const int TOK_DECVAR = codew::intern("TOK_DECVAR");
+static const int TOK_INCVAR = codew::intern("TOK_INCVAR");
+static const int TOK_NUM_POKE = codew::intern("TOK_NUM_POKE");
+static const int TOK_PUSH_VAR_LOAD = codew::intern("TOK_PUSH_VAR_LOAD");
+static const int TOK_PUSH_ZP_LOAD = codew::intern("TOK_PUSH_ZP_LOAD");
+static const int TOK_VAR_ADDR = codew::intern("TOK_VAR_ADDR");
+static const int TOK_VAR_LOAD = codew::intern("TOK_VAR_LOAD");
+static const int TOK_VAR_SADDR = codew::intern("TOK_VAR_SADDR");
+static const int TOK_VAR_STORE = codew::intern("TOK_VAR_STORE");
+static const int TOK_VAR_STORE_0 = codew::intern("TOK_VAR_STORE_0");
+static const int TOK_ZP_ADD = codew::intern("TOK_ZP_ADD");
+static const int TOK_ZP_INC = codew::intern("TOK_ZP_INC");
+static const int TOK_ZP_LOAD = codew::intern("TOK_ZP_LOAD");
+static const int TOK_ZP_SADDR = codew::intern("TOK_ZP_SADDR");
+static const int TOK_ZP_STORE = codew::intern("TOK_ZP_STORE");
+
+namespace
+{
+// Replacement of a token accessing a variable, the zero page address of
+// the variable is written after the first token.
+class zp_access
+{
+  public:
+    int first;  // Token before the address
+    int second; // Token after the address, or -1
+};
+} // namespace
+
+static const std::unordered_map<int, zp_access> &replacements()
+{
+    static const std::unordered_map<int, zp_access> map = {
+        {TOK_VAR_LOAD, {TOK_ZP_LOAD, -1}},
+        {TOK_PUSH_VAR_LOAD, {TOK_PUSH_ZP_LOAD, -1}},
+        {TOK_VAR_STORE, {TOK_ZP_STORE, -1}},
+        {TOK_INCVAR, {TOK_ZP_INC, -1}},
+        {TOK_DECVAR, {TOK_BYTE, TOK_DEC}},
+        {TOK_ADD_VAR, {TOK_ZP_ADD, -1}},
+        {TOK_VAR_ADDR, {TOK_BYTE, -1}},
+        {TOK_VAR_SADDR, {TOK_ZP_SADDR, -1}}};
+    return map;
+}
+
+std::vector<std::string> do_zpvars(std::vector<codew> &code,
+                                   const std::map<std::string, int> &vars, unsigned size,
+                                   bool report)
+{
+    // A POKE to a fixed address in the zero page can write to any of the
+    // placed variables, so keep all of them in the heap.
+    for(size_t i = 0; i + 1 < code.size(); i++)
+    {
+        if((code[i].is_tok(TOK_BYTE_POKE) && code[i + 1].is_byte()) ||
+           (code[i].is_tok(TOK_NUM_POKE) && code[i + 1].is_word() &&
+            (code[i + 1].get_val() & 0xFFFF) < 256))
+        {
+            if(report)
+                std::cerr << "zero page: no variables placed, POKE to the zero page at line "
+                          << code[i].linenum() << "\n";
+            return std::vector<std::string>();
+        }
+    }
+
+    auto &repl = replacements();
+    auto loops = loop_depth(code);
+
+    // Get the accesses to each variable, weighted by the loop depth. Only
+    // the integer variables accessed by the replaced tokens can be placed.
+    std::map<std::string, double> weight;
+    std::set<std::string> excluded;
+    for(size_t i = 0; i < code.size(); i++)
+    {
+        if(!code[i].is_varn())
+            continue;
+        auto &name = code[i].get_varname();
+        auto v = vars.find(name);
+        bool ok = v != vars.end() && VarType(v->second & 0xFF) == VT_WORD && i > 0 &&
+                  code[i - 1].is_tok() &&
+                  (code[i - 1].is_tok(TOK_VAR_STORE_0) ||
+                   repl.count(code[i - 1].get_tok_id()));
+        if(ok)
+            weight[name] += opt_goal::executions(loops[i]);
+        else
+            excluded.insert(name);
+    }
+    std::vector<std::pair<double, std::string>> rank;
+    for(auto &w : weight)
+        if(!excluded.count(w.first))
+            rank.emplace_back(-w.second, w.first);
+    std::sort(rank.begin(), rank.end());
+    if(rank.size() > size / 2)
+        rank.resize(size / 2);
+
+    std::vector<std::string> ret;
+    std::set<std::string> placed;
+    for(auto &r : rank)
+    {
+        ret.push_back(r.second);
+        placed.insert(r.second);
+        if(report)
+            std::cerr << "zero page: variable " << r.second << ", weight "
+                      << std::lround(-r.first) << "\n";
+    }
+    if(report)
+        std::cerr << "zero page: " << 2 * ret.size() << " of " << size << " bytes used\n";
+    if(ret.empty())
+        return ret;
+
+    // Replace the tokens, the variables are cleared by the runtime at start
+    // and on CLR, the same as the other variables.
+    std::vector<codew> out;
+    out.reserve(code.size());
+    for(size_t i = 0; i < code.size(); i++)
+    {
+        if(i + 1 < code.size() && code[i + 1].is_varn() &&
+           placed.count(code[i + 1].get_varname()))
+        {
+            auto tok = code[i].get_tok_id();
+            auto ln = code[i].linenum();
+            auto addr = codew::cbyte("fb_var_" + code[i + 1].get_varname(), ln);
+            if(tok == TOK_VAR_STORE_0)
+            {
+                // Store a zero loaded in AX
+                out.push_back(codew::ctok(TOK_0, ln));
+                tok = TOK_VAR_STORE;
+            }
+            auto &r = repl.at(tok);
+            out.push_back(codew::ctok(r.first, ln));
+            out.push_back(addr);
+            if(r.second >= 0)
+                out.push_back(codew::ctok(r.second, ln));
+            i++;
+        }
+        else
+            out.push_back(code[i]);
+    }
+    code.swap(out);
+    return ret;
+}
@@ -0,0 +1,36 @@
+/*
+ * FastBasic - Fast basic interpreter for the Atari 8-bit computers
+ * Copyright (C) 2017-2025 Daniel Serpell
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+// zpvars.h: Placement of the most used variables in the zero page
+
+#pragma once
+
+#include "codew.h"
+#include <map>
+#include <string>
+#include <vector>
+
+// Places the most used integer variables in a zero page area of "size"
+// bytes, replacing the tokens that access them with the zero page tokens.
+// The runtime clears the area with the other variables. The variables are
+// ranked by the number of accesses in the code, weighted by the loop depth.
+// If "report" is true, shows the placement. Returns the names of the placed
+// variables.
+std::vector<std::string> do_zpvars(std::vector<codew> &code,
+                                   const std::map<std::string, int> &vars, unsigned size,
+                                   bool report);
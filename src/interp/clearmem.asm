@@ -32,6 +32,7 @@
         .exportzp       saved_cpu_stack
 
         .import         putc, var_page, __HEAP_RUN__, __HEAP_SIZE__
+        .import         __ZPVARS_RUN__, __ZPVARS_SIZE__
         .importzp       tmp1, array_ptr, move_dest
 
         .include        "target.inc"
@@ -50,14 +51,28 @@ CLEAR_DATA = clear_data
 saved_cpu_stack:
         .res    1
 
+        ; Variables placed in zero page by the compiler, the segment is
+        ; always included so that the size is defined even if empty.
+        .segment        "ZPVARS": zeropage
+
 ;----------------------------------------------------------
 ; Following routines are part of the runtime
         .segment        "RUNTIME"
 
         ; Clears data pointers before starting the interpreter
 .proc   clear_data
+        ; Clear the variables in zero page
+        .assert __ZPVARS_SIZE__ < 256, error, "error, zero page variables must be < 256 bytes"
+        lda     #0
+        ldx     #<__ZPVARS_SIZE__
+        beq     zp_done
+zp_clear:
+        sta     __ZPVARS_RUN__ - 1, x
+        dex
+        bne     zp_clear
+zp_done:
         ; Init all pointers to end of program data
-        ldx     #0
+        ; ldx #0        ;  X already 0
         lda     #>__HEAP_RUN__
         ;
         ; Note: this is only necessary so that the IDE and command line
@@ -0,0 +1,52 @@
+;
+; FastBasic - Fast basic interpreter for the Atari 8-bit computers
+; Copyright (C) 2017-2025 Daniel Serpell
+;
+; This program is free software; you can redistribute it and/or modify
+; it under the terms of the GNU General Public License as published by
+; the Free Software Foundation, either version 2 of the License, or
+; (at your option) any later version.
+;
+; This program is distributed in the hope that it will be useful,
+; but WITHOUT ANY WARRANTY; without even the implied warranty of
+; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+; GNU General Public License for more details.
+;
+; You should have received a copy of the GNU General Public License along
+; with this program.  If not, see <http://www.gnu.org/licenses/>
+;
+; In addition to the permissions in the GNU General Public License, the
+; authors give you unlimited permission to link the compiled version of
+; this file into combinations with other programs, and to distribute those
+; combinations without any restriction coming from the use of this file.
+; (The General Public License restrictions do apply in other respects; for
+; example, they cover modification of the file, and distribution when not
+; linked into a combine executable.)
+
+
+; Reads a variable in the zero page
+; ---------------------------------
+
+        .import         pushAX, inc_cptr_1
+        .importzp       cptr
+
+        .segment        "RUNTIME"
+
+.proc   EXE_PUSH_ZP_LOAD; push AX, load variable in zero page
+        jsr     pushAX
+.endproc        ; Fall through
+
+.proc   EXE_ZP_LOAD  ; AX = value of variable in zero page
+        ldy     #0
+        lda     (cptr), y
+        tay
+        ldx     1, y
+        lda     a:0, y
+        jmp     inc_cptr_1
+.endproc
+
+        .include "deftok.inc"
+        deftoken "ZP_LOAD"
+        deftoken "PUSH_ZP_LOAD"
+
+; vi:syntax=asm_ca65
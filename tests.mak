@@ -34,6 +34,8 @@ MINI65_SRC=\
 
 # All the tests
 TESTS := $(sort $(wildcard testsuite/tests/*.chk))
+# Assembly files linked with the tests
+TESTS_LINK := $(sort $(wildcard testsuite/tests/*.asm))
 
 # The tests need to be rerun if any of this files change:
 TESTS_DEPS=\
@@ -46,7 +48,7 @@ TESTS_DEPS=\
 TESTS_XEX=$(TESTS:testsuite/%.chk=build/%.xex) $(TESTS:testsuite/%.chk=build/%.com)
 TESTS_ROM=$(TESTS:testsuite/%.chk=build/%.rom)
 TESTS_ASM=$(TESTS:testsuite/%.chk=build/%.asm)
-TESTS_OBJ=$(TESTS:testsuite/%.chk=build/%.o)
+TESTS_OBJ=$(TESTS:testsuite/%.chk=build/%.o) $(TESTS_LINK:testsuite/%.asm=build/%.link.o)
 TESTS_ATB=$(TESTS:testsuite/%.chk=build/%.atb)
 TESTS_LBL=$(TESTS:testsuite/%.chk=build/%.lbl)
 TESTS_STAMP=$(TESTS:testsuite/%.chk=build/%.stamp)
@@ -61,6 +63,13 @@ build/tests/%.stamp: testsuite/tests/%.chk testsuite/tests/%.bas $(RUNTEST) $(TE
 	$(Q)$(RUNTEST) $<
 	@touch $@
 
+$(TESTS_LINK:testsuite/%.asm=build/%.stamp): build/%.stamp: testsuite/%.asm
+
+# Measures the compiler speed versus the program size
+.PHONY: bench
+bench: $(FASTBASIC_HOST)
+	$(Q)testsuite/bench/compile-time.sh $(FASTBASIC_HOST) -target-path:compiler -syntax-path:src/syntax
+
 $(RUNTEST): $(RUNTEST_OBJS) | build/bin
 	$(ECHO) "Linking $@"
 	$(Q)$(CC) $(TEST_CFLAGS) -o $@ $^ $(TEST_LDLIBS)
@@ -0,0 +1,69 @@
+#!/bin/sh
+#
+#  FastBasic - Fast basic interpreter for the Atari 8-bit computers
+#  Copyright (C) 2017-2025 Daniel Serpell
+#
+#  This program is free software; you can redistribute it and/or modify
+#  it under the terms of the GNU General Public License as published by
+#  the Free Software Foundation, either version 2 of the License, or
+#  (at your option) any later version.
+#
+#  This program is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#  GNU General Public License for more details.
+#
+#  You should have received a copy of the GNU General Public License along
+#  with this program.  If not, see <http://www.gnu.org/licenses/>
+#
+
+# Measures the compiler time versus the program size.
+#
+# Usage: compile-time.sh [compiler [options...]]
+#
+# Generates programs of increasing size and compiles each one to assembly,
+# showing the number of lines and the elapsed time. Set SIZES to change the
+# number of generated blocks, of 12 lines each.
+
+FB=${1:-build/bin/fastbasic}
+[ $# -gt 0 ] && shift
+SIZES=${SIZES:-"125 250 500 1000 2000"}
+TMP=${TMPDIR:-/tmp}/fb-bench.$$
+
+mkdir -p "$TMP" || exit 1
+trap 'rm -rf "$TMP"' EXIT
+
+# Current time in milliseconds
+now() {
+    echo $(($(date +%s%N) / 1000000))
+}
+
+printf "%8s %10s\n" "lines" "time (ms)"
+for n in $SIZES; do
+    awk -v n="$n" 'BEGIN {
+        print "DIM A(100)"
+        print "X=0 : Y=1 : Z=2 : S$=\"HELLO\""
+        for(i = 0; i < n; i++) {
+            print "PROC P" i
+            print "  X = (Y * 3 + " i ") - A(X & 63) / 2"
+            print "  IF X > 100 AND Y <> 0 THEN X = X - 100"
+            print "  FOR J = 0 TO 10 STEP 2 : Z = Z + J * 4 : NEXT J"
+            print "  WHILE Z > 1000 : Z = Z / 2 : WEND"
+            print "  POKE 710, (X + 1) & 255 : A(Z & 63) = PEEK(710) + 1"
+            print "  ? \"VALUE \"; X; \" \"; Z; : ? CHR$(65 + " i % 26 ")"
+            print "  B$ = STR$(X) : S$ = \"A\" : IF LEN(B$) > 2 THEN S$ = B$"
+            print "  REPEAT : Y = Y + 1 : UNTIL Y > " (i % 7 + 3)
+            print "ENDPROC"
+            print "EXEC P" i
+            print "IF X = " i " : ? \"X=\"; X : ELSE : ? \"Z=\"; Z : ENDIF"
+        }
+    }' > "$TMP/bench.bas"
+    lines=$(wc -l < "$TMP/bench.bas")
+    t0=$(now)
+    if ! "$FB" "$@" -c -o "$TMP/bench.asm" "$TMP/bench.bas" > "$TMP/bench.log" 2>&1; then
+        cat "$TMP/bench.log"
+        exit 1
+    fi
+    t1=$(now)
+    printf "%8d %10d\n" "$lines" $((t1 - t0))
+done
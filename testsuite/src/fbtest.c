@@ -299,7 +299,7 @@ static int run_prog(const char *prog, char *out, size_t *len)
 static int compile_cross(const char *basname, const char *asmname,
                          const char *objname, const char *outname, int fp,
                          int comp_ok, int error_pos_line, int error_pos_column,
-                         int compile_rom)
+                         int compile_rom, const char *linkname, const char *linkobj)
 {
     const char *fb_target = fp ? FB_FP_TARGET : FB_INT_TARGET;
     const char *libs = compile_rom ? (fp ? FB_LIB_ROM_FP : FB_LIB_ROM_INT)
@@ -364,10 +364,31 @@ static int compile_cross(const char *basname, const char *asmname,
             goto xit;
         }
 
+        // Assemble the extra module to link
+        if (linkname)
+        {
+            free(cmd);
+            if (asprintf(&cmd, "%s %s -o %s -I %s/asminc %s", ca65_path,
+                         CA65_OPTS, linkobj, fb_lib_path, linkname) < 0)
+            {
+                fprintf(stderr, "%s: memory error.\n", linkname);
+                goto xit;
+            }
+            len = 8191;
+            e = run_prog(cmd, out, &len);
+            if (e)
+            {
+                fprintf(stderr, "%s: assembly error: '%s'\n", linkname, out);
+                e = -1;
+                goto xit;
+            }
+        }
+
         // Now, link to XEX / ROM
         free(cmd);
-        if (asprintf(&cmd, "%s -C %s/%s -o %s %s %s/%s", ld65_path, fb_lib_path,
-                     cfg, outname, objname, fb_lib_path, libs) < 0)
+        if (asprintf(&cmd, "%s -C %s/%s -o %s %s %s %s/%s", ld65_path, fb_lib_path,
+                     cfg, outname, objname, linkname ? linkobj : "", fb_lib_path,
+                     libs) < 0)
         {
             fprintf(stderr, "%s: memory error.\n", asmname);
             goto xit;
@@ -446,6 +467,8 @@ int fbtest(const char *fname)
      *   NAME: The name of the test
      *   TEST: The test to do
      *   ERROR: The expected error from compiler (optional)
+     *   LINK: An assembly file to link with the program, only for cross
+     *         compiler tests (optional)
      *   MAX-CYCLES: The maximum number of cycles to wait for program termination.
      *               (if not given, use 20_000_000.
      *   INPUT:
@@ -453,7 +476,7 @@ int fbtest(const char *fname)
      *   OUTPUT:
      *   The expected output, up to the end of the file.
      */
-    char *name = 0, *expected_out = 0, *input_buf = 0, *error_data = 0;
+    char *name = 0, *expected_out = 0, *input_buf = 0, *error_data = 0, *link_file = 0;
     int error_pos_line = 0, error_pos_column = 0;
     int test = 0, n = 0, line = 0;
     uint64_t max_cycles = 20000000;
@@ -501,6 +524,8 @@ int fbtest(const char *fname)
         }
         else if (!strcasecmp(key, "error"))
             error_data = strdup(buf);
+        else if (!strcasecmp(key, "link"))
+            link_file = strdup(buf);
         else if (!strcasecmp(key, "error-pos"))
         {
             if( 2 != sscanf(buf, "%i : %i", &error_pos_line, &error_pos_column) )
@@ -617,6 +642,11 @@ int fbtest(const char *fname)
     }
     if ((test & test_compile_error) && !error_data)
         error_data = strdup("");
+    if (link_file && (test & test_native))
+    {
+        fprintf(stderr, "%s: link file only supported in cross compiler tests\n", fname);
+        return -1;
+    }
 
     // Get file names from test file
     const char *ext = strrchr(fname, '.');
@@ -647,6 +677,16 @@ int fbtest(const char *fname)
     char *asmname = build_fname(tag_name, "asm");
     // objname: Object file name
     char *objname = build_fname(tag_name, "o");
+    // linkname: Assembly file to link, in the same folder as the test
+    char *linkname = 0;
+    if (link_file && asprintf(&linkname, "%.*s%s", (int)(tag_name - base_name), base_name,
+                              link_file) < 0)
+    {
+        fprintf(stderr, "%s: memory error.\n", fname);
+        return -1;
+    }
+    // linkobj: Object file of the assembly file to link
+    char *linkobj = build_fname(tag_name, "link.o");
 
     // Generate ATASCII file
     atascii_convert(basname, atbname);
@@ -699,7 +739,8 @@ int fbtest(const char *fname)
             // Floating Point: cross
             if (compile_cross(basname, asmname, objname, xexname, 1,
                               !(test & test_compile_error),
-                              error_pos_line, error_pos_column, 0))
+                              error_pos_line, error_pos_column, 0,
+                              linkname, linkobj))
                 break;
 
             if (test & test_run)
@@ -717,7 +758,8 @@ int fbtest(const char *fname)
             // Floating Point: cross
             if (compile_cross(basname, asmname, objname, romname, 1,
                               !(test & test_compile_error),
-                              error_pos_line, error_pos_column, 1))
+                              error_pos_line, error_pos_column, 1,
+                              linkname, linkobj))
                 break;
 
             if (test & test_run)
@@ -737,7 +779,8 @@ int fbtest(const char *fname)
             // Integer: cross
             if (compile_cross(basname, asmname, objname, xexname, 0,
                               !(test & test_compile_error),
-                              error_pos_line, error_pos_column, 0))
+                              error_pos_line, error_pos_column, 0,
+                              linkname, linkobj))
                 break;
 
             if (test & test_run)
@@ -755,7 +798,8 @@ int fbtest(const char *fname)
             // Integer: cross
             if (compile_cross(basname, asmname, objname, romname, 0,
                               !(test & test_compile_error),
-                              error_pos_line, error_pos_column, 1))
+                              error_pos_line, error_pos_column, 1,
+                              linkname, linkobj))
                 break;
 
             if (test & test_run)
@@ -785,6 +829,9 @@ int fbtest(const char *fname)
     free(xexname);
     free(asmname);
     free(objname);
+    free(linkname);
+    free(linkobj);
+    free(link_file);
     free(base_name);
     return !test_ok;
 }
@@ -0,0 +1,35 @@
+; Assembly module for the "data-asm" test, sums the values of DATA arrays
+; not referenced from the BASIC code.
+
+        .export SUM_TBL, SUM_WTBL
+        .import fb_lbl_TBL, fb_lbl_WTBL
+
+        ; Sum of the 5 bytes in TBL
+.proc   SUM_TBL
+        lda     #0
+        tax
+        ldy     #4
+loop:   clc
+        adc     fb_lbl_TBL, y
+        dey
+        bpl     loop
+        rts
+.endproc
+
+        ; Sum of the 3 words in WTBL
+.proc   SUM_WTBL
+        lda     #0
+        tax
+        ldy     #4
+loop:   clc
+        adc     fb_lbl_WTBL, y
+        pha
+        txa
+        adc     fb_lbl_WTBL + 1, y
+        tax
+        pla
+        dey
+        dey
+        bpl     loop
+        rts
+.endproc
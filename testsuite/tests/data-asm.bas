@@ -0,0 +1,9 @@
+' Test DATA used only from an assembly module
+? "Start"
+
+DATA tbl() BYTE = 1, 2, 3, 4, 5
+DATA wtbl() = 1000, 2000, 3000
+
+' The arrays are only referenced from the assembly code
+? USR(@Sum_Tbl)
+? USR(@Sum_Wtbl)
@@ -0,0 +1,11 @@
+; Assembly module for the "var-asm" test, reads a variable only written
+; from the BASIC code.
+
+        .export GET_SPEED
+        .import fb_var_SPEED
+
+.proc   GET_SPEED
+        lda     fb_var_SPEED
+        ldx     fb_var_SPEED + 1
+        rts
+.endproc
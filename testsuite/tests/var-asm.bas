@@ -0,0 +1,6 @@
+' Test variables only read from an assembly module
+? "Start"
+? USR(@Get_Speed)
+
+' The variable is not read in the BASIC code after the store
+Speed = 7